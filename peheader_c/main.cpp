@@ -0,0 +1,1479 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     peheader - Prints information about PE/COFF and archive files
+//  File:       main.cpp
+//  Author:     Mark Coppa
+//
+//  Command line front end for libpeheader: argument parsing and dispatch.
+//  Formatting lives in peoutput.cpp.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "pebatch.h"
+#include "pecache.h"
+#include "pecarve.h"
+#include "peheader.h"
+#include "peoutput.h"
+#include "pepdbindex.h"
+#include "pepool.h"
+#include "pequery.h"
+#include "pesimindex.h"
+#include "pestats.h"
+
+#define PRINT_BANNER(out) AppendString(out, "PE/COFF header dump\n\n");
+#define PRINT_LOGO(out, filename) AppendString(out, "Dump of "); \
+                                  AppendString(out, filename); \
+                                  AppendString(out, "\n\n");
+
+#define STDOUT_FD 1
+
+/* What DumpFile did with a file, also kept with scan cache records */
+#define DUMP_CHECKSUMMED            0x01
+#define DUMP_CHECKSUM_MISMATCH      0x02
+#define DUMP_FILTERED_OUT           0x04    /* nothing in the file matched --where; its record is empty */
+
+typedef struct
+{
+    OutputOptions output;
+    ParseOptions parse;
+    ScanCache *cache;           // batch scans: reuse output of unchanged files, NULL for none
+    bool verifyCache;           // also require the file's content hash to match
+    const PeFilter *filter;     // --where conditions, NULL for none
+    bool carve;                 // report the images embedded in each file rather than the file
+} DumpOptions;
+
+/* Names are shared by every file of a batch scan */
+static StringInterner interner;
+
+/* External symbols of every object seen by --link-check */
+static SymbolLedger ledger;
+
+/* PDB identities collected by --pdb-index */
+static PdbIndexBuilder pdbIndex;
+
+/* Toolchains of every image seen by --rich-clusters */
+static RichClusterIndex richClusters;
+
+/* Similarity digests collected by --similar-index */
+static SimilarityIndexBuilder similarityIndex;
+
+/* --verify-checksum totals */
+static std::atomic<uint64_t> checksumFiles(0);
+static std::atomic<uint64_t> checksumBytes(0);
+static std::atomic<uint64_t> checksumMismatches(0);
+
+/* --cache */
+static ScanCache scanCache;
+
+/* --carve totals */
+static std::atomic<uint64_t> carvedImages(0);
+static std::atomic<uint64_t> carvedBytes(0);
+
+/* --progress: the live line printed during batch scans */
+static StatsProgress progress;
+
+
+static void Usage()
+{
+    printf("Usage: peheader <file> [-q]\n"
+           "       peheader [options] <file|directory|@listfile>...\n"
+           "    [-q] print summary only\n"
+           "    [-i] decode the import table\n"
+           "    [-e] decode the export table\n"
+           "    [-s] decode the COFF symbol table\n"
+           "    [-r] decode the base relocation table\n"
+           "    [--rebase <base>] apply the relocations to a copy of the image for a new base (a multiple of\n"
+           "        0x10000) and hash it\n"
+           "    [--version-info] decode the VS_VERSIONINFO resource\n"
+           "    [--clr] decode the CLR header, metadata streams and assembly references of managed images\n"
+           "    [--debug] decode the debug directory and the CodeView record naming the PDB\n"
+           "    [--functions] decode the x64 or ARM64 exception table into sorted function ranges\n"
+           "    [--unwind] with the functions, decode their unwind data\n"
+           "    [--function-at <rva>] print the function of the exception table that contains an address\n"
+           "    [--rich] decode the Rich header the linker left in the DOS stub\n"
+           "    [--similarity] compute similarity digests of the whole file and of each section\n"
+           "    [--where <condition>] only print files that meet the condition; may be repeated:\n"
+           "        managed, native, pe32, pe32+, machine=<x64|arm64|...|hex>, imports=<dll>,\n"
+           "        exports=<name>, defines=<symbol>\n"
+           "    [--verify-checksum] compute the image checksum and compare it with the stored one\n"
+           "    [--entropy] measure the entropy of each section and of the overlay\n"
+           "    [--entropy-sample <bytes>] with --entropy, read at most this much of each section or overlay\n"
+           "    [--link-check] report duplicate and undefined symbols across all objects scanned\n"
+           "    [--pdb-index <file>] write a sorted index from PDB GUID and age to the binaries scanned\n"
+           "    [--pdb-lookup <file> <key>] print the binaries in an index built with the PDB whose\n"
+           "        symbol server key (GUID digits and age in hex) is given\n"
+           "    [--rich-clusters] group the images scanned by the toolchain in their Rich headers\n"
+           "    [--similar-index <file>] write an index of the similarity digests of the binaries scanned\n"
+           "    [--similar <file>] print the binaries in an index similar to each file given, nearest first\n"
+           "    [--max-distance <n>] with --similar, greatest digest distance that counts as similar\n"
+           "        (default: 40)\n"
+           "    [-f text|ndjson|binary] output format (default: text)\n"
+           "    [-j <threads>] worker threads for batch scans and archive members (default: one per core)\n"
+           "    [--ordered] print batch results in input order\n"
+           "    [--io auto|uring|pread|map] how batch scans that print only headers read files: io_uring,\n"
+           "        pread on the workers, or mapping each file (default: auto, which is pread; io_uring\n"
+           "        only pays off when the files aren't in the page cache)\n"
+           "    [-o <prefix>] unordered batch scans: worker n writes to <prefix>.<n>\n"
+           "    [--cache <file>] batch scans: reuse the output of files unchanged since the last run\n"
+           "    [--cache-verify] with --cache, also compare file contents before reusing output\n"
+           "    [--carve] find and dump the PE images embedded anywhere in each file\n"
+           "    [--stats] print what was read and where the time went to stderr at the end\n"
+           "    [--progress] print running totals to stderr every second while scanning\n"
+           "    directories are scanned recursively; @listfile names one path per line (@- for stdin)\n");
+}
+
+
+/* ParseNumber    Read a numeric option value: decimal, or hex with 0x
+ * Parameters     Option name and its value for the error, smallest and
+ *                largest value that make sense
+ * Returns        The value; anything else is a usage error and exits
+ */
+static uint64_t ParseNumber(const char *option, const char *text, uint64_t least, uint64_t most)
+{
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 0);
+    if (*text < '0' || *text > '9' || *end != '\0' || errno == ERANGE || value < least || value > most)
+    {
+        fprintf(stderr, most > 0xFFFFFFFF ? "Error: %s takes a number from 0x%llx to 0x%llx, not \"%s\"\n" :
+                                            "Error: %s takes a number from %llu to %llu, not \"%s\"\n",
+                option, (unsigned long long)least, (unsigned long long)most, text);
+        Usage();
+        exit(1);
+    }
+    return value;
+}
+
+
+/* CountKind    Count a file for --stats by what it turned out to be
+ */
+static void CountKind(const PeImage *image)
+{
+    if (image->isArchive)
+    {
+        CountStat(STAT_ARCHIVES);
+    }
+    else if (image->isCOFF)
+    {
+        CountStat(STAT_COFF);
+    }
+    else if (image->isPE)
+    {
+        CountStat(STAT_PE);
+        CountStat(STAT_MANAGED, image->isManaged ? 1 : 0);
+    }
+}
+
+
+typedef struct
+{
+    const DumpOptions *options;
+    const char *path;               // of the archive or carved blob
+} ContainerContext;
+
+
+/* DumpMember    Archive handler: one record per object, import and linker
+ *               member, named "archive(member)"
+ */
+static bool DumpMember(void *context, const ArMember *member, unsigned worker, OutBuf *record)
+{
+    const ContainerContext *archive = (const ContainerContext *)context;
+    const OutputOptions *output = &archive->options->output;
+    (void)worker;
+
+    std::string path = archive->path;
+    path += '(';
+    path.append(member->name, member->nameLength);
+    path += ')';
+
+    ShortImport import;
+    ArLinkerMember linker;
+    bool ok = true;
+
+    /* Filters select objects; the archive's bookkeeping members never match */
+    const PeFilter *filter = archive->options->filter;
+    if (filter != NULL && member->kind != AR_OBJECT)
+    {
+        return true;
+    }
+
+    size_t start = record->len;
+    if (output->format == FORMAT_TEXT && member->kind != AR_LONGNAMES && member->kind != AR_OTHER)
+    {
+        PRINT_LOGO(record, path.c_str());
+    }
+
+    uint64_t mark = StatMark();
+    switch (member->kind)
+    {
+    case AR_FIRST_LINKER:
+    case AR_SECOND_LINKER:
+        ok = ParseLinkerMember(member, &linker);
+        TimeStat(TIMER_DECODE, &mark);
+        FormatLinkerMember(record, output, path.c_str(), member, &linker);
+        break;
+    case AR_OBJECT:
+    {
+        PeImage image = ParseCoffObject(member->data, &archive->options->parse);
+        TimeStat(TIMER_DECODE, &mark);
+        if (filter != NULL && !MatchesFilter(&image, member->data, filter))
+        {
+            record->len = start;
+            return true;
+        }
+        FormatImage(record, output, path.c_str(), &image);
+        break;
+    }
+    case AR_IMPORT:
+        ok = ParseShortImport(member->data, &import);
+        TimeStat(TIMER_DECODE, &mark);
+        if (ok)
+        {
+            FormatShortImport(record, output, path.c_str(), &import);
+        }
+        break;
+    default:
+        return true;
+    }
+    TimeStat(TIMER_FORMAT, &mark);
+    CountStat(STAT_MEMBERS);
+
+    if (output->format == FORMAT_TEXT)
+    {
+        AppendChar(record, '\n');
+    }
+    return ok;
+}
+
+
+/* DumpArchive    Format every member of an archive after the archive itself
+ * Parameters     Archive path and bytes, options, output holding the
+ *                archive's own record, batch options to fan members out
+ *                to a thread pool with (NULL to walk them on this thread),
+ *                and where to count the members that printed anything
+ * Returns        false if any member could not be read. An archive cut
+ *                short is reported, but the members before the cut are
+ *                all there is to read, so it doesn't fail on its own.
+ */
+static bool DumpArchive(const char *filename, PeBuffer buffer, const DumpOptions *options,
+                        OutBuf *out, const BatchOptions *fanOut, uint64_t *printed)
+{
+    ContainerContext context = { options, filename };
+
+    if (options->output.format == FORMAT_TEXT)
+    {
+        AppendChar(out, '\n');
+    }
+
+    if (fanOut != NULL)
+    {
+        WriteOutBuf(out, fanOut->fd);
+        BatchTotals totals = RunArchive(buffer, fanOut, DumpMember, &context);
+        if (totals.failed > 0)
+        {
+            fprintf(stderr, "%llu of %llu archive members could not be read\n",
+                    (unsigned long long)totals.failed, (unsigned long long)totals.files);
+        }
+        if (totals.truncated)
+        {
+            fprintf(stderr, "Warning: %s: archive truncated after %llu members\n", filename,
+                    (unsigned long long)totals.files);
+        }
+        *printed = totals.files;
+        return totals.failed == 0;
+    }
+
+    ArIterator it;
+    ArMember member;
+    bool ok = InitArIterator(&it, buffer);
+    uint64_t members = 0;
+
+    *printed = 0;
+    while (NextArMember(&it, &member))
+    {
+        size_t before = out->len;
+        ok = DumpMember(&context, &member, 0, out) && ok;
+        *printed += out->len > before ? 1 : 0;
+        ++members;
+    }
+
+    if (it.truncated)
+    {
+        fprintf(stderr, "Warning: %s: archive truncated after %llu members\n", filename, (unsigned long long)members);
+    }
+    return ok;
+}
+
+
+/* DumpCarvedImage    Carve handler: one record per embedded image, named
+ *                    "blob@offset"
+ */
+static bool DumpCarvedImage(void *context, PeBuffer blob, size_t offset, unsigned worker, OutBuf *record)
+{
+    const ContainerContext *container = (const ContainerContext *)context;
+    const OutputOptions *output = &container->options->output;
+    const PeFilter *filter = container->options->filter;
+    (void)worker;
+
+    char at[24];
+    snprintf(at, sizeof(at), "@0x%llx", (unsigned long long)offset);
+    std::string path = container->path;
+    path += at;
+
+    /* The image's bytes run on to the end of the blob, so its checksum
+     * can't be verified, the rest of the blob would pass for overlay and
+     * a rebased hash or similarity digest would cover it too */
+    PeBuffer bytes = ImageAt(blob, offset);
+    ParseOptions parse = container->options->parse;
+    parse.flags &= ~(PARSE_CHECKSUM | PARSE_ENTROPY | PARSE_REBASE | PARSE_SIMILARITY);
+
+    uint64_t mark = StatMark();
+    PeImage image = ParsePeImage(bytes, &parse);
+    TimeStat(TIMER_DECODE, &mark);
+    if (filter != NULL && !MatchesFilter(&image, bytes, filter))
+    {
+        return true;
+    }
+
+    if (output->format == FORMAT_TEXT)
+    {
+        PRINT_LOGO(record, path.c_str());
+    }
+    FormatImage(record, output, path.c_str(), &image);
+    TimeStat(TIMER_FORMAT, &mark);
+    if (output->format == FORMAT_TEXT)
+    {
+        AppendChar(record, '\n');
+    }
+    return true;
+}
+
+
+/* DumpCarved    Format every image embedded in a blob
+ * Parameters    Blob path and bytes, options, output to append to, batch
+ *               options to scan chunks of the blob on a thread pool with
+ *               (NULL to scan on this thread), and where to count the
+ *               images that printed anything
+ * Returns       false if any image could not be formatted
+ */
+static bool DumpCarved(const char *filename, PeBuffer buffer, const DumpOptions *options,
+                       OutBuf *out, const BatchOptions *fanOut, uint64_t *printed)
+{
+    ContainerContext context = { options, filename };
+    bool ok = true;
+
+    carvedBytes.fetch_add(buffer.size, std::memory_order_relaxed);
+
+    if (options->output.format == FORMAT_TEXT)
+    {
+        AppendChar(out, '\n');
+    }
+
+    if (fanOut != NULL)
+    {
+        WriteOutBuf(out, fanOut->fd);
+        BatchTotals totals = RunCarve(buffer, fanOut, DumpCarvedImage, &context);
+        carvedImages.fetch_add(totals.files, std::memory_order_relaxed);
+        *printed = totals.files;
+        return totals.failed == 0;
+    }
+
+    std::vector<size_t> hits;
+    ScanForImages(buffer, 0, buffer.size, &hits);
+    carvedImages.fetch_add(hits.size(), std::memory_order_relaxed);
+
+    *printed = 0;
+    for (size_t i = 0; i < hits.size(); ++i)
+    {
+        size_t before = out->len;
+        ok = DumpCarvedImage(&context, buffer, hits[i], 0, out) && ok;
+        *printed += out->len > before ? 1 : 0;
+    }
+
+    return ok;
+}
+
+
+/* CountChecksum    Add one verified file to the --verify-checksum totals
+ */
+static void CountChecksum(uint64_t bytes, bool mismatched)
+{
+    checksumFiles.fetch_add(1, std::memory_order_relaxed);
+    checksumBytes.fetch_add(bytes, std::memory_order_relaxed);
+    if (mismatched)
+    {
+        checksumMismatches.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+
+/* DumpOpened    Parse one opened file and format everything printed for it
+ * Parameters    File name, its view (closed on return), options, output
+ *               to append to, batch options when archive members may be
+ *               spread over threads, and where to return DUMP_* flags
+ * Returns       false if an archive member could not be read
+ */
+static bool DumpOpened(const char *filename, PeFile *file, const DumpOptions *options, OutBuf *out,
+                       const BatchOptions *fanOut, uint8_t *dumpFlags)
+{
+    uint8_t flags = 0;
+    const PeFilter *filter = options->filter;
+
+    if (options->carve)
+    {
+        uint64_t printed;
+        bool ok = DumpCarved(filename, file->buffer, options, out, fanOut, &printed);
+        ClosePeFile(file);
+        if (dumpFlags != NULL)
+        {
+            *dumpFlags = filter != NULL && printed == 0 ? DUMP_FILTERED_OUT : 0;
+        }
+        return ok;
+    }
+
+    /* Settle the --where conditions on just the facts they need, so most
+     * files are turned away after a few header reads */
+    if (filter != NULL)
+    {
+        ParseOptions probe = { 0, NULL, FilterFacts(filter), 0, 0 };
+        uint64_t mark = StatMark();
+        PeImage candidate = ParsePeImage(file->buffer, &probe);
+        TimeStat(TIMER_DECODE, &mark);
+        if (!candidate.isArchive && !MatchesFilter(&candidate, file->buffer, filter))
+        {
+            CountKind(&candidate);
+            ClosePeFile(file);
+            if (dumpFlags != NULL)
+            {
+                *dumpFlags = DUMP_FILTERED_OUT;
+            }
+            return true;
+        }
+    }
+
+    /* A header window alone can't be checksummed, measured, rebased or
+     * digested */
+    ParseOptions parse = options->parse;
+    if (!file->complete)
+    {
+        parse.flags &= ~(PARSE_CHECKSUM | PARSE_ENTROPY | PARSE_REBASE | PARSE_SIMILARITY);
+    }
+
+    /* With a filter an archive is only a container for the objects that
+     * match; it prints nothing of its own */
+    uint64_t mark = StatMark();
+    PeImage image = ParsePeImage(file->buffer, &parse);
+    TimeStat(TIMER_DECODE, &mark);
+    CountKind(&image);
+    if (!(image.isArchive && filter != NULL))
+    {
+        FormatImage(out, &options->output, filename, &image);
+        TimeStat(TIMER_FORMAT, &mark);
+    }
+
+    if (image.decoded & PARSE_CHECKSUM)
+    {
+        bool mismatched = image.owh.CheckSum != 0 && image.computedCheckSum != image.owh.CheckSum;
+        CountChecksum(file->buffer.size, mismatched);
+        flags |= DUMP_CHECKSUMMED | (mismatched ? DUMP_CHECKSUM_MISMATCH : 0);
+    }
+
+    /* Members are views into the mapping, so it stays open until they
+     * have been formatted */
+    bool ok = true;
+    if (image.isArchive)
+    {
+        uint64_t printed;
+        ok = DumpArchive(filename, file->buffer, options, out, fanOut, &printed);
+        if (filter != NULL && printed == 0)
+        {
+            flags |= DUMP_FILTERED_OUT;
+        }
+    }
+
+    ClosePeFile(file);
+    if (dumpFlags != NULL)
+    {
+        *dumpFlags = flags;
+    }
+    return ok;
+}
+
+
+/* DumpFile      Open, parse and format one file
+ * Parameters    As DumpOpened, but a file name to open
+ * Returns       false if the file (or an archive member) could not be read
+ */
+static bool DumpFile(const char *filename, const DumpOptions *options, OutBuf *out,
+                     const BatchOptions *fanOut = NULL, uint8_t *dumpFlags = NULL)
+{
+    PeFile pe;
+    if (!OpenPeFile(filename, &pe))
+    {
+        FormatOpenError(out, &options->output, filename);
+        return false;
+    }
+    return DumpOpened(filename, &pe, options, out, fanOut, dumpFlags);
+}
+
+
+/* DumpBatchFile    Batch handler: one record per file; text records are
+ *                  headed by the file name. With a scan cache, files whose
+ *                  identity is unchanged get their previous record back
+ *                  without being opened.
+ */
+static bool DumpBatchFile(void *context, const char *path, unsigned worker, OutBuf *record)
+{
+    const DumpOptions *options = (const DumpOptions *)context;
+    (void)worker;
+
+    FileIdentity id;
+    uint64_t contentHash = 0;
+    bool cacheable = options->cache != NULL && GetFileIdentity(path, &id) &&
+                     (!options->verifyCache || HashFileContents(path, &contentHash));
+
+    CachedRecord cached;
+    if (cacheable && options->cache->Lookup(&id, contentHash, &cached))
+    {
+        AppendBytes(record, cached.record.data, cached.record.size);
+        if (cached.flags & DUMP_CHECKSUMMED)
+        {
+            CountChecksum(id.size, (cached.flags & DUMP_CHECKSUM_MISMATCH) != 0);
+        }
+        return true;
+    }
+
+    size_t start = record->len;
+    uint8_t flags = 0;
+    bool ok;
+
+    if (options->output.format != FORMAT_TEXT)
+    {
+        ok = DumpFile(path, options, record, NULL, &flags);
+    }
+    else
+    {
+        PRINT_LOGO(record, path);
+        ok = DumpFile(path, options, record, NULL, &flags);
+        AppendChar(record, '\n');
+    }
+
+    if (flags & DUMP_FILTERED_OUT)
+    {
+        record->len = start;
+    }
+
+    /* Only complete, successful records are worth replaying */
+    if (ok && cacheable)
+    {
+        options->cache->Store(&id, contentHash, flags, record->data + start, record->len - start);
+    }
+
+    return ok;
+}
+
+
+/* DumpHeaderFile    Header batch handler: the same record as DumpBatchFile
+ *                   from the headers alone. Files the headers weren't
+ *                   enough for (archives, unreadable or far-flung headers)
+ *                   are opened again and dumped the usual way.
+ */
+static bool DumpHeaderFile(void *context, const char *path, PeFile *headers, unsigned worker, OutBuf *record)
+{
+    if (headers == NULL)
+    {
+        return DumpBatchFile(context, path, worker, record);
+    }
+    if (!headers->complete && HeaderExtent(headers->buffer) > headers->buffer.size)
+    {
+        ClosePeFile(headers);
+        return DumpBatchFile(context, path, worker, record);
+    }
+
+    const DumpOptions *options = (const DumpOptions *)context;
+    if (options->output.format != FORMAT_TEXT)
+    {
+        return DumpOpened(path, headers, options, record, NULL, NULL);
+    }
+
+    PRINT_LOGO(record, path);
+    bool ok = DumpOpened(path, headers, options, record, NULL, NULL);
+    AppendChar(record, '\n');
+    return ok;
+}
+
+
+/* ReportChecksums    Print --verify-checksum totals and throughput to
+ *                    stderr; mismatches leave out images with no checksum
+ * Parameters         Seconds the run took
+ */
+static void ReportChecksums(double seconds)
+{
+    uint64_t bytes = checksumBytes.load();
+    double rate = seconds > 0 ? bytes / seconds / 1e6 : 0;
+
+    fprintf(stderr, "Checksummed %llu files, %llu bytes in %.3f s (%.1f MB/s, %s); %llu mismatched\n",
+            (unsigned long long)checksumFiles.load(), (unsigned long long)bytes, seconds, rate,
+            ChecksumKernelName(), (unsigned long long)checksumMismatches.load());
+}
+
+
+/* ReportCarving    Print --carve totals and scan rate to stderr
+ * Parameters       Seconds the run took
+ */
+static void ReportCarving(double seconds)
+{
+    uint64_t bytes = carvedBytes.load();
+    double rate = seconds > 0 ? bytes / seconds / 1e6 : 0;
+
+    fprintf(stderr, "Carved %llu images from %llu bytes in %.3f s (%.1f MB/s, %s)\n",
+            (unsigned long long)carvedImages.load(), (unsigned long long)bytes, seconds, rate,
+            CarveKernelName());
+}
+
+
+/* ReportStats    Print the --stats totals to stderr. Run at exit, since
+ *                each mode leaves main by its own path.
+ */
+static void ReportStats()
+{
+    progress.Stop();
+
+    StatTotals totals;
+    SnapshotStats(&totals);
+    char report[1024];
+    FormatStatsReport(report, sizeof(report), &totals);
+    fputs(report, stderr);
+}
+
+
+/* SaveCache    Write the scan cache for the next run and print the hit
+ *              rate to stderr
+ * Parameters   Cache file name, files the batch scanned
+ * Returns      false if the cache could not be written
+ */
+static bool SaveCache(const char *cachePath, uint64_t files)
+{
+    uint64_t hits = scanCache.Hits();
+    uint64_t entries = 0;
+    bool ok = scanCache.Save(&entries);
+
+    fprintf(stderr, "Cache: reused %llu of %llu files (%.1f%%), %llu entries saved\n",
+            (unsigned long long)hits, (unsigned long long)files, files > 0 ? 100.0 * hits / files : 0.0,
+            (unsigned long long)entries);
+    if (!ok)
+    {
+        fprintf(stderr, "Error: could not write scan cache \"%s\"\n", cachePath);
+    }
+    return ok;
+}
+
+
+/* LinkCheckFile    Batch handler for --link-check: add the symbols of an
+ *                  object, or of every object in an archive, to the ledger
+ *                  and print nothing
+ */
+static bool LinkCheckFile(void *context, const char *path, unsigned worker, OutBuf *record)
+{
+    const DumpOptions *options = (const DumpOptions *)context;
+    (void)worker;
+    (void)record;
+
+    PeFile pe;
+    if (!OpenPeFile(path, &pe))
+    {
+        return false;
+    }
+
+    ArIterator it;
+    ArMember member;
+    if (InitArIterator(&it, pe.buffer))
+    {
+        while (NextArMember(&it, &member))
+        {
+            if (member.kind == AR_OBJECT)
+            {
+                std::string name = path;
+                name += '(';
+                name.append(member.name, member.nameLength);
+                name += ')';
+
+                PeImage image = ParseCoffObject(member.data, &options->parse);
+                ledger.Add(&image, name.c_str());
+            }
+        }
+    }
+    else
+    {
+        PeImage image = ParsePeImage(pe.buffer, &options->parse);
+        if (image.isCOFF && !image.isPE)
+        {
+            ledger.Add(&image, path);
+        }
+    }
+
+    ClosePeFile(&pe);
+    return true;
+}
+
+
+/* PdbIndexFile    Batch handler for --pdb-index: add the PDB identity of
+ *                 an image to the index and print nothing
+ */
+static bool PdbIndexFile(void *context, const char *path, unsigned worker, OutBuf *record)
+{
+    (void)context;
+    (void)worker;
+    (void)record;
+
+    PeFile pe;
+    if (!OpenPeFile(path, &pe))
+    {
+        return false;
+    }
+
+    ParseOptions parse = { PARSE_DEBUG, NULL, 0, 0, 0 };
+    PeImage image = ParsePeImage(pe.buffer, &parse);
+    if (image.debug.hasCodeView)
+    {
+        pdbIndex.Add(image.debug.pdbGuid, image.debug.pdbAge, path);
+    }
+
+    ClosePeFile(&pe);
+    return true;
+}
+
+
+/* BuildPdbIndex    Scan the inputs for --pdb-index and write the index
+ * Parameters       Inputs, batch options, index file name
+ * Returns          false if any input could not be read or the index
+ *                  could not be written
+ */
+static bool BuildPdbIndex(const std::vector<std::string> &inputs, const BatchOptions *batch, const char *indexPath)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    BatchTotals totals = RunBatch(inputs, batch, PdbIndexFile, NULL);
+
+    uint64_t entries = 0;
+    if (!pdbIndex.Write(indexPath, &entries))
+    {
+        fprintf(stderr, "Error: could not write PDB index \"%s\"\n", indexPath);
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "Indexed %llu of %llu files by PDB in %.3f s\n",
+            (unsigned long long)entries, (unsigned long long)totals.files, seconds);
+    return totals.failed == 0;
+}
+
+
+/* LookUpPdb     Print the binaries an index holds for a PDB, for
+ *               --pdb-lookup
+ * Parameters    Index file name, symbol server key
+ * Returns       Exit status: 0 if any binary matched, else 1
+ */
+static int LookUpPdb(const char *indexPath, const char *key)
+{
+    uint8_t guid[16];
+    uint32_t age;
+    if (!ParsePdbKey(key, guid, &age))
+    {
+        fprintf(stderr, "Error: \"%s\" is not a PDB GUID and age\n", key);
+        return 1;
+    }
+
+    PdbIndex index;
+    if (!index.Open(indexPath))
+    {
+        fprintf(stderr, "Error: \"%s\" is not a usable PDB index\n", indexPath);
+        return 1;
+    }
+
+    OutBuf out;
+    InitOutBuf(&out, OUTBUF_INITIAL_SIZE);
+
+    uint64_t first;
+    uint64_t count = index.Find(guid, age, &first);
+    for (uint64_t i = first; i < first + count; ++i)
+    {
+        PeBuffer path = index.Path(i);
+        AppendBytes(&out, path.data, path.size);
+        AppendChar(&out, '\n');
+    }
+
+    WriteOutBuf(&out, STDOUT_FD);
+    FreeOutBuf(&out);
+    return count > 0 ? 0 : 1;
+}
+
+
+/* RichClusterFile    Batch handler for --rich-clusters: file an image
+ *                    under its toolchain and print nothing
+ */
+static bool RichClusterFile(void *context, const char *path, unsigned worker, OutBuf *record)
+{
+    (void)context;
+    (void)worker;
+    (void)record;
+
+    PeFile pe;
+    if (!OpenPeFile(path, &pe))
+    {
+        return false;
+    }
+
+    ParseOptions parse = { PARSE_RICH, NULL, 0, 0, 0 };
+    PeImage image = ParsePeImage(pe.buffer, &parse);
+    if (image.decoded & PARSE_RICH)
+    {
+        richClusters.Add(&image.rich, path);
+    }
+
+    ClosePeFile(&pe);
+    return true;
+}
+
+
+/* SimilarityIndexFile    Batch handler for --similar-index: add the
+ *                        digests of a binary to the index and print
+ *                        nothing
+ */
+static bool SimilarityIndexFile(void *context, const char *path, unsigned worker, OutBuf *record)
+{
+    (void)context;
+    (void)worker;
+    (void)record;
+
+    PeFile pe;
+    if (!OpenPeFile(path, &pe))
+    {
+        return false;
+    }
+
+    ParseOptions parse = { PARSE_SIMILARITY, NULL, 0, 0, 0 };
+    PeImage image = ParsePeImage(pe.buffer, &parse);
+    if (pe.complete && !image.isArchive && (image.isPE || image.isCOFF))
+    {
+        similarityIndex.Add(&image, path);
+    }
+
+    ClosePeFile(&pe);
+    return true;
+}
+
+
+/* BuildSimilarityIndex    Scan the inputs for --similar-index and write
+ *                         the index
+ * Parameters              Inputs, batch options, index file name
+ * Returns                 false if any input could not be read or the
+ *                         index could not be written
+ */
+static bool BuildSimilarityIndex(const std::vector<std::string> &inputs, const BatchOptions *batch, const char *indexPath)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    BatchTotals totals = RunBatch(inputs, batch, SimilarityIndexFile, NULL);
+
+    uint64_t binaries = 0;
+    if (!similarityIndex.Write(indexPath, &binaries))
+    {
+        fprintf(stderr, "Error: could not write similarity index \"%s\"\n", indexPath);
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "Indexed %llu of %llu files by similarity in %.3f s\n",
+            (unsigned long long)binaries, (unsigned long long)totals.files, seconds);
+    return totals.failed == 0;
+}
+
+
+/* FindSimilar    Print the binaries an index holds that are similar to
+ *                each query file, for --similar
+ * Parameters     Index file name, query files, output options, greatest
+ *                distance that counts as similar
+ * Returns        Exit status: 0 if any binary matched, else 1
+ */
+static int FindSimilar(const char *indexPath, const std::vector<std::string> &queries, const OutputOptions *output,
+                       uint32_t maxDistance)
+{
+    SimilarityIndex index;
+    if (!index.Open(indexPath))
+    {
+        fprintf(stderr, "Error: \"%s\" is not a usable similarity index\n", indexPath);
+        return 1;
+    }
+
+    OutBuf out;
+    InitOutBuf(&out, OUTBUF_INITIAL_SIZE);
+
+    bool found = false;
+    std::vector<SimilarMatch> matches;
+    for (size_t q = 0; q < queries.size(); ++q)
+    {
+        const char *query = queries[q].c_str();
+        PeFile pe;
+        if (!OpenPeFile(query, &pe))
+        {
+            FormatOpenError(&out, output, query);
+            continue;
+        }
+
+        ParseOptions parse = { PARSE_SIMILARITY, NULL, 0, 0, 0 };
+        PeImage image = ParsePeImage(pe.buffer, &parse);
+        bool digested = pe.complete && (image.decoded & PARSE_SIMILARITY);
+        ClosePeFile(&pe);
+        if (!digested)
+        {
+            fprintf(stderr, "Error: \"%s\" could not be digested\n", query);
+            continue;
+        }
+
+        uint32_t querySections = 0;
+        for (size_t i = 0; i < image.similarity.sections.size(); ++i)
+        {
+            querySections += image.similarity.sections[i].valid;
+        }
+
+        index.Find(&image.similarity, maxDistance, &matches);
+        if (output->format == FORMAT_TEXT)
+        {
+            AppendString(&out, "Similar to ");
+            AppendString(&out, query);
+            AppendString(&out, ":\n");
+        }
+        for (size_t m = 0; m < matches.size(); ++m)
+        {
+            FormatSimilarMatch(&out, output, query, index.Path(matches[m].image), matches[m].distance,
+                               matches[m].sections, querySections);
+        }
+        found = found || !matches.empty();
+    }
+
+    WriteOutBuf(&out, STDOUT_FD);
+    FreeOutBuf(&out);
+    return found ? 0 : 1;
+}
+
+
+/* FindFunctionAt    Print the function of each image's exception table
+ *                   that contains an address, for --function-at
+ * Parameters        Images, output options, RVA
+ * Returns           Exit status: 0 if a function was found in every
+ *                   image, else 1
+ */
+static int FindFunctionAt(const std::vector<std::string> &paths, const OutputOptions *output, uint32_t rva)
+{
+    OutBuf out;
+    InitOutBuf(&out, OUTBUF_INITIAL_SIZE);
+
+    bool found = !paths.empty();
+    for (size_t p = 0; p < paths.size(); ++p)
+    {
+        const char *path = paths[p].c_str();
+        PeFile pe;
+        if (!OpenPeFile(path, &pe))
+        {
+            FormatOpenError(&out, output, path);
+            found = false;
+            continue;
+        }
+
+        ParseOptions parse = { PARSE_FUNCTIONS | PARSE_UNWIND, NULL, 0, 0, 0 };
+        PeImage image = ParsePeImage(pe.buffer, &parse);
+        ClosePeFile(&pe);
+        if (!(image.decoded & PARSE_FUNCTIONS))
+        {
+            fprintf(stderr, "Error: \"%s\" has no x64 or ARM64 exception table\n", path);
+            found = false;
+            continue;
+        }
+
+        FormatFunctionAt(&out, output, path, &image, rva);
+        found = found && FindFunction(&image.functions, rva) != NO_FUNCTION;
+    }
+
+    WriteOutBuf(&out, STDOUT_FD);
+    FreeOutBuf(&out);
+    return found ? 0 : 1;
+}
+
+
+typedef struct
+{
+    OutBuf *out;
+    const OutputOptions *options;
+} ReportContext;
+
+
+/* ReportDuplicate, ReportUndefined    Ledger callbacks printing the
+ *                                     findings of --link-check
+ */
+static void ReportDuplicate(void *context, const char *name, const char *first, const char *second, uint32_t definitions)
+{
+    const ReportContext *report = (const ReportContext *)context;
+    FormatDuplicateSymbol(report->out, report->options, name, first, second, definitions);
+}
+
+static void ReportUndefined(void *context, const char *name, const char *referencedBy)
+{
+    const ReportContext *report = (const ReportContext *)context;
+    FormatUndefinedSymbol(report->out, report->options, name, referencedBy);
+}
+
+
+/* ReportCluster    Callback printing the clusters of --rich-clusters
+ */
+static void ReportCluster(void *context, uint32_t cluster, const char *const *paths, const uint64_t *fingerprints,
+                          size_t count)
+{
+    const ReportContext *report = (const ReportContext *)context;
+    FormatRichCluster(report->out, report->options, cluster, paths, fingerprints, count);
+}
+
+
+int main(int argc, char *argv[])
+{
+    DumpOptions options = { { FORMAT_TEXT, false }, { 0, &interner, 0, 0, 0 }, NULL, false, NULL, false };
+    BatchOptions batch = { 0, false, STDOUT_FD, NULL, BATCH_IO_AUTO };
+    PeFilter filter;
+    std::vector<std::string> inputs;
+    bool batchMode = false;
+    bool linkCheck = false;
+    bool clusterRich = false;
+    const char *similarIndexPath = NULL;
+    const char *similarQueryPath = NULL;
+    const char *functionAt = NULL;
+    uint32_t maxDistance = SIMILARITY_MAX_DISTANCE;
+    const char *pdbIndexPath = NULL;
+    const char *cachePath = NULL;
+    bool readHeaders = true;
+    bool showStats = false;
+    bool showProgress = false;
+
+    InitFilter(&filter);
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+
+        if (strcmp(arg, "-?") == 0 || strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0)
+        {
+            Usage();
+            exit(0);
+        }
+        else if (strcmp(arg, "-q") == 0)
+        {
+            options.output.quiet = true;
+        }
+        else if (strcmp(arg, "-i") == 0)
+        {
+            options.parse.flags |= PARSE_IMPORTS;
+        }
+        else if (strcmp(arg, "-e") == 0)
+        {
+            options.parse.flags |= PARSE_EXPORTS;
+        }
+        else if (strcmp(arg, "-s") == 0)
+        {
+            options.parse.flags |= PARSE_SYMBOLS;
+        }
+        else if (strcmp(arg, "-r") == 0)
+        {
+            options.parse.flags |= PARSE_RELOCS;
+        }
+        else if (strcmp(arg, "--rebase") == 0 && i + 1 < argc)
+        {
+            options.parse.flags |= PARSE_RELOCS | PARSE_REBASE;
+            options.parse.rebaseTo = ParseNumber(arg, argv[++i], 0x10000, 0xFFFFFFFFFFFF0000ull);
+            if (options.parse.rebaseTo & 0xFFFF)
+            {
+                fprintf(stderr, "Error: --rebase takes a multiple of 0x10000, not \"%s\"\n", argv[i]);
+                Usage();
+                exit(1);
+            }
+        }
+        else if (strcmp(arg, "--version-info") == 0)
+        {
+            options.parse.flags |= PARSE_VERSION;
+        }
+        else if (strcmp(arg, "--clr") == 0)
+        {
+            options.parse.flags |= PARSE_CLR;
+        }
+        else if (strcmp(arg, "--debug") == 0)
+        {
+            options.parse.flags |= PARSE_DEBUG;
+        }
+        else if (strcmp(arg, "--functions") == 0)
+        {
+            options.parse.flags |= PARSE_FUNCTIONS;
+        }
+        else if (strcmp(arg, "--unwind") == 0)
+        {
+            options.parse.flags |= PARSE_FUNCTIONS | PARSE_UNWIND;
+        }
+        else if (strcmp(arg, "--function-at") == 0 && i + 1 < argc)
+        {
+            functionAt = argv[++i];
+        }
+        else if (strcmp(arg, "--rich") == 0)
+        {
+            options.parse.flags |= PARSE_RICH;
+        }
+        else if (strcmp(arg, "--similarity") == 0)
+        {
+            options.parse.flags |= PARSE_SIMILARITY;
+        }
+        else if (strcmp(arg, "--where") == 0 && i + 1 < argc)
+        {
+            const char *term = argv[++i];
+            FilterTermResult result = AddFilterTerm(&filter, term);
+            if (result == FILTER_TOO_MANY)
+            {
+                int limit = term[0] == 'i' ? MAX_FILTER_IMPORTS : term[0] == 'e' ? MAX_FILTER_EXPORTS : MAX_FILTER_DEFINES;
+                fprintf(stderr, "Error: \"%s\": --where takes at most %d %.8s conditions\n", term, limit, term);
+                exit(1);
+            }
+            if (result != FILTER_ADDED)
+            {
+                fprintf(stderr, "Error: unknown condition \"%s\"\n", term);
+                exit(1);
+            }
+        }
+        else if (strcmp(arg, "--carve") == 0)
+        {
+            options.carve = true;
+        }
+        else if (strcmp(arg, "--verify-checksum") == 0)
+        {
+            options.parse.flags |= PARSE_CHECKSUM;
+        }
+        else if (strcmp(arg, "--entropy") == 0)
+        {
+            options.parse.flags |= PARSE_ENTROPY;
+        }
+        else if (strcmp(arg, "--entropy-sample") == 0 && i + 1 < argc)
+        {
+            options.parse.entropySample = ParseNumber(arg, argv[++i], 1, 0xFFFFFFFF);
+        }
+        else if (strcmp(arg, "--link-check") == 0)
+        {
+            options.parse.flags |= PARSE_SYMBOLS;
+            linkCheck = true;
+        }
+        else if (strcmp(arg, "--pdb-index") == 0 && i + 1 < argc)
+        {
+            pdbIndexPath = argv[++i];
+        }
+        else if (strcmp(arg, "--pdb-lookup") == 0 && i + 2 < argc)
+        {
+            const char *indexPath = argv[++i];
+            return LookUpPdb(indexPath, argv[++i]);
+        }
+        else if (strcmp(arg, "--rich-clusters") == 0)
+        {
+            clusterRich = true;
+        }
+        else if (strcmp(arg, "--similar-index") == 0 && i + 1 < argc)
+        {
+            similarIndexPath = argv[++i];
+        }
+        else if (strcmp(arg, "--similar") == 0 && i + 1 < argc)
+        {
+            similarQueryPath = argv[++i];
+        }
+        else if (strcmp(arg, "--max-distance") == 0 && i + 1 < argc)
+        {
+            maxDistance = (uint32_t)ParseNumber(arg, argv[++i], 0, SIMILARITY_DISTANCE_LIMIT);
+        }
+        else if (strcmp(arg, "-f") == 0 && i + 1 < argc)
+        {
+            const char *format = argv[++i];
+            if (strcmp(format, "text") == 0)
+            {
+                options.output.format = FORMAT_TEXT;
+            }
+            else if (strcmp(format, "ndjson") == 0)
+            {
+                options.output.format = FORMAT_NDJSON;
+            }
+            else if (strcmp(format, "binary") == 0)
+            {
+                options.output.format = FORMAT_BINARY;
+            }
+            else
+            {
+                fprintf(stderr, "Error: unknown format \"%s\"\n", format);
+                exit(1);
+            }
+        }
+        else if (strcmp(arg, "-j") == 0 && i + 1 < argc)
+        {
+            batch.threads = (unsigned)ParseNumber(arg, argv[++i], 1, POOL_MAX_THREADS);
+        }
+        else if (strcmp(arg, "--ordered") == 0)
+        {
+            batch.ordered = true;
+            batchMode = true;
+        }
+        else if (strcmp(arg, "-o") == 0 && i + 1 < argc)
+        {
+            batch.outputPrefix = argv[++i];
+            batchMode = true;
+        }
+        else if (strcmp(arg, "--io") == 0 && i + 1 < argc)
+        {
+            const char *io = argv[++i];
+            readHeaders = strcmp(io, "map") != 0;
+            if (strcmp(io, "auto") == 0)
+            {
+                batch.io = BATCH_IO_AUTO;
+            }
+            else if (strcmp(io, "uring") == 0)
+            {
+                batch.io = BATCH_IO_URING;
+            }
+            else if (strcmp(io, "pread") == 0)
+            {
+                batch.io = BATCH_IO_PREAD;
+            }
+            else if (readHeaders)
+            {
+                fprintf(stderr, "Error: unknown io backend \"%s\"\n", io);
+                exit(1);
+            }
+        }
+        else if (strcmp(arg, "--cache") == 0 && i + 1 < argc)
+        {
+            cachePath = argv[++i];
+            batchMode = true;
+        }
+        else if (strcmp(arg, "--cache-verify") == 0)
+        {
+            options.verifyCache = true;
+        }
+        else if (strcmp(arg, "--stats") == 0)
+        {
+            showStats = true;
+        }
+        else if (strcmp(arg, "--progress") == 0)
+        {
+            showProgress = true;
+        }
+        else if (arg[0] == '-' && arg[1] != '\0')
+        {
+            fprintf(stderr, "Error: unknown option \"%s\"\n", arg);
+            Usage();
+            exit(1);
+        }
+        else
+        {
+            inputs.push_back(arg);
+            batchMode = batchMode || IsBatchInput(arg);
+        }
+    }
+
+    if (inputs.empty())
+    {
+        Usage();
+        exit(0);
+    }
+
+    /* Counting starts before any thread that counts */
+    if (showStats || showProgress)
+    {
+        EnableStats();
+    }
+    if (showStats)
+    {
+        atexit(ReportStats);
+    }
+    if (showProgress)
+    {
+        progress.Start();
+    }
+
+    if (similarQueryPath != NULL)
+    {
+        return FindSimilar(similarQueryPath, inputs, &options.output, maxDistance);
+    }
+    if (functionAt != NULL)
+    {
+        char *end;
+        unsigned long long rva = strtoull(functionAt, &end, 0);
+        if (*functionAt == '\0' || *end != '\0' || rva > 0xFFFFFFFF)
+        {
+            fprintf(stderr, "Error: \"%s\" is not an RVA\n", functionAt);
+            return 1;
+        }
+        return FindFunctionAt(inputs, &options.output, (uint32_t)rva);
+    }
+
+    /* Parse no further than the output needs */
+    if (options.output.format == FORMAT_TEXT && options.output.quiet)
+    {
+        options.parse.facts = FACT_KIND | FACT_MANAGED;
+    }
+    else if (options.output.format == FORMAT_BINARY)
+    {
+        options.parse.facts = FACT_HEADERS;
+    }
+
+    /* Files that don't match print nothing, which only batch records can
+     * express; cached records don't know which conditions produced them */
+    if (IsFilterSet(&filter))
+    {
+        options.filter = &filter;
+        batchMode = true;
+        if (cachePath != NULL)
+        {
+            fprintf(stderr, "Warning: --cache is ignored with --where\n");
+            cachePath = NULL;
+        }
+    }
+
+    /* The sample size and rebase address don't fit the cache's options key */
+    if ((options.parse.entropySample != 0 || (options.parse.flags & PARSE_REBASE)) && cachePath != NULL)
+    {
+        fprintf(stderr, "Warning: --cache is ignored with --entropy-sample and --rebase\n");
+        cachePath = NULL;
+    }
+
+    OutBuf out;
+    InitOutBuf(&out, OUTBUF_INITIAL_SIZE);
+
+    if (linkCheck)
+    {
+        BatchTotals totals = RunBatch(inputs, &batch, LinkCheckFile, &options);
+
+        ReportContext report = { &out, &options.output };
+        ledger.Report(ReportDuplicate, ReportUndefined, &report);
+        WriteOutBuf(&out, STDOUT_FD);
+        FreeOutBuf(&out);
+
+        return totals.failed > 0 ? 1 : 0;
+    }
+
+    if (clusterRich)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        BatchTotals totals = RunBatch(inputs, &batch, RichClusterFile, NULL);
+
+        ReportContext report = { &out, &options.output };
+        uint32_t clusters = richClusters.Report(ReportCluster, &report);
+        WriteOutBuf(&out, STDOUT_FD);
+        FreeOutBuf(&out);
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fprintf(stderr, "Clustered %llu files into %u toolchains in %.3f s\n",
+                (unsigned long long)totals.files, clusters, seconds);
+        return totals.failed > 0 ? 1 : 0;
+    }
+
+    if (similarIndexPath != NULL)
+    {
+        FreeOutBuf(&out);
+        return BuildSimilarityIndex(inputs, &batch, similarIndexPath) ? 0 : 1;
+    }
+
+    if (pdbIndexPath != NULL)
+    {
+        FreeOutBuf(&out);
+        return BuildPdbIndex(inputs, &batch, pdbIndexPath) ? 0 : 1;
+    }
+
+    bool textHeader = options.output.format == FORMAT_TEXT && !options.output.quiet;
+    bool verifyChecksums = (options.parse.flags & PARSE_CHECKSUM) != 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if (!batchMode && inputs.size() == 1)
+    {
+        const char *filename = inputs[0].c_str();
+        if (textHeader)
+        {
+            PRINT_BANNER(&out);
+            PRINT_LOGO(&out, filename);
+        }
+
+        bool ok = DumpFile(filename, &options, &out, &batch);
+        CountStat(STAT_FILES);
+        CountStat(STAT_FAILED, ok ? 0 : 1);
+        WriteOutBuf(&out, STDOUT_FD);
+        FreeOutBuf(&out);
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (verifyChecksums)
+        {
+            ReportChecksums(seconds);
+        }
+        if (options.carve)
+        {
+            ReportCarving(seconds);
+        }
+
+        return ok ? 0 : 1;
+    }
+
+    if (textHeader)
+    {
+        PRINT_BANNER(&out);
+        WriteOutBuf(&out, STDOUT_FD);
+    }
+    FreeOutBuf(&out);
+
+    /* Cached records are only valid for the options that produced them */
+    if (cachePath != NULL)
+    {
+        uint32_t key = options.output.format | (options.output.quiet ? 4 : 0) | (options.carve ? 8 : 0) |
+                       options.parse.flags << 4;
+        if (!scanCache.Load(cachePath, key))
+        {
+            fprintf(stderr, "Warning: \"%s\" is not a usable scan cache; it will be rebuilt\n", cachePath);
+        }
+        options.cache = &scanCache;
+    }
+
+    /* Scans that print only the headers read the pages they are in
+     * rather than mapping every file */
+    BatchTotals totals;
+    if (readHeaders && options.parse.flags == 0 && !options.carve && options.filter == NULL && options.cache == NULL)
+    {
+        totals = RunHeaderBatch(inputs, &batch, DumpHeaderFile, &options);
+    }
+    else
+    {
+        totals = RunBatch(inputs, &batch, DumpBatchFile, &options);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (verifyChecksums)
+    {
+        ReportChecksums(seconds);
+    }
+    if (options.carve)
+    {
+        ReportCarving(seconds);
+    }
+    if (cachePath != NULL && !SaveCache(cachePath, totals.files))
+    {
+        return 1;
+    }
+    if (totals.failed > 0)
+    {
+        fprintf(stderr, "%llu of %llu files could not be read\n",
+                (unsigned long long)totals.failed, (unsigned long long)totals.files);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,307 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pearchive.cpp
+//  Author:     Mark Coppa
+//
+//  Archive (.lib) member iteration. Members are returned as views into
+//  the mapped archive, one header at a time, so arbitrarily large
+//  libraries are walked without copying or indexing them first.
+//
+//  Reference:  PE and COFF specification, "Archive (Library) File Format"
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pearchive.h"
+#include "pestats.h"
+
+#include <string.h>
+
+static const char arMagic[] = "!<arch>\n";
+
+
+/* ReadDecimal    Read a space padded decimal field of a member header
+ * Returns        false if the field holds anything but digits and padding
+ */
+static bool ReadDecimal(const uint8_t *field, size_t width, uint64_t *value)
+{
+    size_t i = 0;
+    *value = 0;
+
+    while (i < width && field[i] >= '0' && field[i] <= '9')
+    {
+        *value = *value * 10 + (field[i] - '0');
+        ++i;
+    }
+    if (i == 0)
+    {
+        return false;
+    }
+    while (i < width && field[i] == ' ')
+    {
+        ++i;
+    }
+
+    return i == width;
+}
+
+
+/* MemberName    Resolve the name field of a member header
+ * Parameters    Iterator (for the long name table), the 16 byte field,
+ *               name and length to fill
+ */
+static void MemberName(const ArIterator *it, const uint8_t *field, const char **name, size_t *length)
+{
+    const char *s = (const char *)field;
+
+    /* "/123" refers to offset 123 of the long name table. Entries end with
+     * a NUL (Microsoft) or "/\n" (GNU) */
+    if (s[0] == '/' && s[1] >= '0' && s[1] <= '9' && it->longNames != NULL)
+    {
+        uint64_t offset;
+        size_t width = 1;
+        while (width < 16 && s[width] >= '0' && s[width] <= '9')
+        {
+            ++width;
+        }
+        if (ReadDecimal(field + 1, width - 1, &offset) && offset < it->longNamesSize)
+        {
+            const char *start = it->longNames + offset;
+            const char *end = start;
+            const char *limit = it->longNames + it->longNamesSize;
+            while (end < limit && *end != '\0' && *end != '\n')
+            {
+                ++end;
+            }
+            if (end > start && end[-1] == '/')
+            {
+                --end;
+            }
+            *name = start;
+            *length = (size_t)(end - start);
+            return;
+        }
+    }
+
+    /* Short names end with '/' then padding; the special members "/" and
+     * "//" keep their slashes */
+    size_t len = 16;
+    while (len > 0 && s[len - 1] == ' ')
+    {
+        --len;
+    }
+    if (len > 1 && s[len - 1] == '/' && !(len == 2 && s[0] == '/'))
+    {
+        --len;
+    }
+
+    *name = s;
+    *length = len;
+}
+
+
+/* ClassifyMember    Work out what kind of member a header describes
+ * Parameters        Iterator, raw name field of the header, member data
+ */
+static ArMemberKind ClassifyMember(const ArIterator *it, const uint8_t *field, PeBuffer data)
+{
+    /* Names starting with '/' are reserved unless they index the long
+     * name table */
+    if (field[0] == '/' && (field[1] < '0' || field[1] > '9'))
+    {
+        if (field[1] == ' ')
+        {
+            return it->count == 0 ? AR_FIRST_LINKER : AR_SECOND_LINKER;
+        }
+        if (field[1] == '/' && field[2] == ' ')
+        {
+            return AR_LONGNAMES;
+        }
+        return AR_OTHER;   // "/<HYBRIDMAP>/", "/<ECSYMBOLS>/" and the like
+    }
+
+    if (data.size < 4)
+    {
+        return AR_OTHER;
+    }
+
+    /* Import and anonymous object headers start with machine 0 and 0xFFFF */
+    uint16_t sig1 = ReadWord(data.data);
+    uint16_t sig2 = ReadWord(data.data + 2);
+    if (sig1 == 0 && sig2 == 0xFFFF)
+    {
+        uint16_t version = data.size >= 6 ? ReadWord(data.data + 4) : 0xFFFF;
+        return version == 0 ? AR_IMPORT : AR_OTHER;
+    }
+
+    return AR_OBJECT;
+}
+
+
+/* IsArchive    Check for the archive signature
+ */
+bool IsArchive(PeBuffer buffer)
+{
+    return buffer.size >= AR_MAGIC_SIZE && memcmp(buffer.data, arMagic, AR_MAGIC_SIZE) == 0;
+}
+
+
+/* InitArIterator    Start walking an archive
+ * Parameters        Iterator to set up, bytes of the whole archive
+ * Returns           false if the buffer is not an archive
+ */
+bool InitArIterator(ArIterator *it, PeBuffer buffer)
+{
+    memset(it, 0, sizeof(*it));
+    it->buffer = buffer;
+    it->offset = AR_MAGIC_SIZE;
+    return IsArchive(buffer);
+}
+
+
+/* NextArMember    Step to the next member
+ * Parameters      Iterator, member to fill
+ * Returns         false at the end of the archive, or at the first member
+ *                 header that is malformed or runs past the buffer
+ */
+bool NextArMember(ArIterator *it, ArMember *member)
+{
+    const PeBuffer &buffer = it->buffer;
+
+    if (it->offset >= buffer.size || buffer.size - it->offset < AR_MEMBER_HEADER_SIZE)
+    {
+        it->truncated = it->offset < buffer.size && buffer.data[it->offset] != '\n';
+        CountStat(STAT_MALFORMED, it->truncated ? 1 : 0);
+        return false;
+    }
+
+    const uint8_t *header = buffer.data + it->offset;
+    uint64_t size;
+    if (header[58] != '`' || header[59] != '\n' || !ReadDecimal(header + 48, 10, &size))
+    {
+        it->truncated = true;
+        CountStat(STAT_MALFORMED);
+        return false;
+    }
+
+    size_t dataOffset = it->offset + AR_MEMBER_HEADER_SIZE;
+    if (size > buffer.size - dataOffset)
+    {
+        it->truncated = true;
+        CountStat(STAT_MALFORMED);
+        return false;
+    }
+
+    member->offset = it->offset;
+    member->index = it->count;
+    member->data.data = buffer.data + dataOffset;
+    member->data.size = (size_t)size;
+    MemberName(it, header, &member->name, &member->nameLength);
+    member->kind = ClassifyMember(it, header, member->data);
+
+    if (member->kind == AR_LONGNAMES)
+    {
+        it->longNames = (const char *)member->data.data;
+        it->longNamesSize = member->data.size;
+    }
+
+    /* Members start on even offsets */
+    it->offset = dataOffset + (size_t)size + (size & 1);
+    ++it->count;
+    return true;
+}
+
+
+/* ParseShortImport    Decode a short import library member
+ * Parameters          Member data, import to fill
+ * Returns             false if the header or names are incomplete
+ */
+bool ParseShortImport(PeBuffer data, ShortImport *import)
+{
+    ByteCursor cur;
+    InitCursor(&cur, data);
+
+    uint16_t sig1 = SumBytes(&cur, 2);
+    uint16_t sig2 = SumBytes(&cur, 2);
+    SumBytes(&cur, 2);   // version
+    import->Machine = SumBytes(&cur, 2);
+    import->TimeDateStamp = SumBytes(&cur, 4);
+    import->SizeOfData = SumBytes(&cur, 4);
+    import->OrdinalOrHint = SumBytes(&cur, 2);
+    uint16_t type = SumBytes(&cur, 2);
+    import->Type = type & 0x3;
+    import->NameType = (type >> 2) & 0x7;
+
+    if (cur.overrun || sig1 != 0 || sig2 != 0xFFFF)
+    {
+        return false;
+    }
+
+    /* Symbol name then DLL name, both NUL terminated */
+    const char *names = (const char *)data.data + IMPORT_OBJECT_HEADER_SIZE;
+    size_t available = data.size - IMPORT_OBJECT_HEADER_SIZE;
+    if (import->SizeOfData < available)
+    {
+        available = import->SizeOfData;
+    }
+
+    const char *nul = (const char *)memchr(names, '\0', available);
+    if (nul == NULL)
+    {
+        return false;
+    }
+    const char *dll = nul + 1;
+    if (memchr(dll, '\0', available - (size_t)(dll - names)) == NULL)
+    {
+        return false;
+    }
+
+    import->symbol = names;
+    import->dll = dll;
+    return true;
+}
+
+
+/* ParseLinkerMember    Read the counts of a first or second linker member
+ * Parameters           The member, counts to fill
+ * Returns              false if the member is too short for its counts
+ */
+bool ParseLinkerMember(const ArMember *member, ArLinkerMember *linker)
+{
+    const uint8_t *p = member->data.data;
+    size_t size = member->data.size;
+
+    linker->symbols = 0;
+    linker->members = 0;
+
+    if (member->kind == AR_FIRST_LINKER)
+    {
+        /* The only big endian structure in the format */
+        if (size < 4)
+        {
+            return false;
+        }
+        linker->symbols = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+        return (uint64_t)linker->symbols * 4 <= size - 4;
+    }
+
+    if (member->kind == AR_SECOND_LINKER)
+    {
+        if (size < 4)
+        {
+            return false;
+        }
+        linker->members = ReadDword(p);
+
+        uint64_t symbolsAt = 4 + (uint64_t)linker->members * 4;
+        if (symbolsAt + 4 > size)
+        {
+            return false;
+        }
+        p += symbolsAt;
+        linker->symbols = ReadDword(p);
+        return symbolsAt + 4 + (uint64_t)linker->symbols * 2 <= size;
+    }
+
+    return false;
+}
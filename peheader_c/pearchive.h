@@ -0,0 +1,71 @@
+#ifndef _PEARCHIVE
+#define _PEARCHIVE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pefile.h"
+
+#define AR_MAGIC_SIZE              8     /* "!<arch>\n" */
+#define AR_MEMBER_HEADER_SIZE      60
+#define IMPORT_OBJECT_HEADER_SIZE  20
+
+typedef enum
+{
+    AR_FIRST_LINKER,        // "/": big endian symbol offsets, kept for compatibility
+    AR_SECOND_LINKER,       // "/" again: member offsets and sorted symbol indices
+    AR_LONGNAMES,           // "//": names too long for the header
+    AR_OBJECT,              // COFF object
+    AR_IMPORT,              // short import library entry
+    AR_OTHER                // anything else (anonymous objects, hybrid maps, ...)
+} ArMemberKind;
+
+/* One member of an archive. name and data point into the archive buffer;
+ * nothing is copied, so a member is only valid while the archive is.
+ */
+typedef struct
+{
+    const char *name;       // not terminated
+    size_t nameLength;
+    uint64_t offset;        // of the member header in the archive
+    uint64_t index;         // position among all members, from 0
+    PeBuffer data;
+    ArMemberKind kind;
+} ArMember;
+
+/* Walks the members of an archive front to back */
+typedef struct
+{
+    PeBuffer buffer;
+    size_t offset;              // of the next member header
+    uint64_t count;             // members returned so far
+    const char *longNames;      // contents of the "//" member once seen
+    size_t longNamesSize;
+    bool truncated;             // stopped at a member running past the end of the buffer
+} ArIterator;
+
+typedef struct
+{
+    uint16_t Machine;
+    uint32_t TimeDateStamp;
+    uint32_t SizeOfData;
+    uint16_t OrdinalOrHint;
+    uint8_t Type;           // 0 code, 1 data, 2 const
+    uint8_t NameType;       // 0 ordinal, 1 name, 2 no prefix, 3 undecorate, 4 export as
+    const char *symbol;     // both point into the archive, NUL terminated
+    const char *dll;
+} ShortImport;
+
+typedef struct
+{
+    uint32_t symbols;
+    uint32_t members;       // second linker member only
+} ArLinkerMember;
+
+bool IsArchive(PeBuffer buffer);
+bool InitArIterator(ArIterator *it, PeBuffer buffer);
+bool NextArMember(ArIterator *it, ArMember *member);
+bool ParseShortImport(PeBuffer data, ShortImport *import);
+bool ParseLinkerMember(const ArMember *member, ArLinkerMember *linker);
+
+#endif // _PEARCHIVE
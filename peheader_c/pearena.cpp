@@ -0,0 +1,206 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pearena.cpp
+//  Author:     Mark Coppa
+//
+//  Per-parse bump allocation and the shared string interning table that
+//  decoders use for names, so a batch scan doesn't allocate per symbol.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pearena.h"
+#include "pedigest.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERNER_SHARD_SLOTS 256  /* Initial slots per shard */
+
+
+Arena::~Arena()
+{
+    Release();
+}
+
+
+Arena::Arena(Arena &&other)
+    : head(other.head), cur(other.cur), end(other.end), nextSize(other.nextSize)
+{
+    other.head = NULL;
+    other.cur = NULL;
+    other.end = NULL;
+    other.nextSize = ARENA_BLOCK_SIZE;
+}
+
+
+Arena &Arena::operator=(Arena &&other)
+{
+    if (this != &other)
+    {
+        Release();
+        head = other.head;
+        cur = other.cur;
+        end = other.end;
+        nextSize = other.nextSize;
+        other.head = NULL;
+        other.cur = NULL;
+        other.end = NULL;
+        other.nextSize = ARENA_BLOCK_SIZE;
+    }
+    return *this;
+}
+
+
+/* Release    Free every block
+ */
+void Arena::Release()
+{
+    while (head != NULL)
+    {
+        Block *next = head->next;
+        free(head);
+        head = next;
+    }
+    cur = NULL;
+    end = NULL;
+}
+
+
+/* Alloc         Carve memory out of the current block, starting a new
+ *               block when it is full
+ * Parameters    Bytes needed, alignment (a power of two)
+ * Returns       Uninitialized memory that lives as long as the arena
+ */
+void *Arena::Alloc(size_t size, size_t align)
+{
+    uintptr_t p = ((uintptr_t)cur + (align - 1)) & ~(uintptr_t)(align - 1);
+    if (cur != NULL && p + size <= (uintptr_t)end)
+    {
+        cur = (char *)(p + size);
+        return (void *)p;
+    }
+
+    size_t need = sizeof(Block) + size + align;
+    while (nextSize < need)
+    {
+        nextSize *= 2;
+    }
+
+    Block *block = (Block *)malloc(nextSize);
+    if (block == NULL)
+    {
+        abort();
+    }
+    block->next = head;
+    head = block;
+    end = (char *)block + nextSize;
+    nextSize *= 2;
+
+    p = ((uintptr_t)(block + 1) + (align - 1)) & ~(uintptr_t)(align - 1);
+    cur = (char *)(p + size);
+    return (void *)p;
+}
+
+
+/* CopyString    Copy bytes into the arena as a NUL terminated string
+ * Parameters    Bytes, their length
+ * Returns       The copy
+ */
+const char *Arena::CopyString(const char *s, size_t len)
+{
+    char *copy = (char *)Alloc(len + 1, 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+
+StringInterner::StringInterner()
+{
+    for (int i = 0; i < SHARD_COUNT; ++i)
+    {
+        Slot empty = { 0, NULL, 0 };
+        shards[i].slots.assign(INTERNER_SHARD_SLOTS, empty);
+        shards[i].count = 0;
+    }
+}
+
+
+/* Grow    Double a shard's table and reinsert its strings
+ */
+void StringInterner::Grow(Shard *shard)
+{
+    Slot empty = { 0, NULL, 0 };
+    std::vector<Slot> slots(shard->slots.size() * 2, empty);
+    size_t mask = slots.size() - 1;
+
+    for (size_t i = 0; i < shard->slots.size(); ++i)
+    {
+        const Slot &slot = shard->slots[i];
+        if (slot.str == NULL)
+        {
+            continue;
+        }
+
+        size_t j = (size_t)(slot.hash >> 6) & mask;
+        while (slots[j].str != NULL)
+        {
+            j = (j + 1) & mask;
+        }
+        slots[j] = slot;
+    }
+
+    shard->slots.swap(slots);
+}
+
+
+/* Intern        Find or add a string
+ * Parameters    Bytes of the string, their length
+ * Returns       The single shared NUL terminated copy of those bytes
+ */
+const char *StringInterner::Intern(const char *s, size_t len)
+{
+    uint64_t hash = HashBytes(s, len);
+    Shard *shard = &shards[hash & (SHARD_COUNT - 1)];
+
+    std::lock_guard<std::mutex> guard(shard->lock);
+
+    size_t mask = shard->slots.size() - 1;
+    size_t i = (size_t)(hash >> 6) & mask;
+
+    while (shard->slots[i].str != NULL)
+    {
+        const Slot &slot = shard->slots[i];
+        if (slot.hash == hash && slot.len == len && memcmp(slot.str, s, len) == 0)
+        {
+            return slot.str;
+        }
+        i = (i + 1) & mask;
+    }
+
+    const char *copy = shard->storage.CopyString(s, len);
+    Slot slot = { hash, copy, len };
+    shard->slots[i] = slot;
+
+    if (++shard->count * 2 > shard->slots.size())
+    {
+        Grow(shard);
+    }
+
+    return copy;
+}
+
+
+/* Count      Number of distinct strings interned so far
+ */
+size_t StringInterner::Count()
+{
+    size_t total = 0;
+    for (int i = 0; i < SHARD_COUNT; ++i)
+    {
+        std::lock_guard<std::mutex> guard(shards[i].lock);
+        total += shards[i].count;
+    }
+    return total;
+}
@@ -0,0 +1,82 @@
+#ifndef _PEARENA
+#define _PEARENA
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+#define ARENA_BLOCK_SIZE 0x4000   /* Size of the first block; later blocks double */
+
+/* Bump allocator owned by one parse result. Everything allocated from an
+ * arena is released at once when the arena goes away, and moving an arena
+ * leaves pointers into it valid.
+ */
+class Arena
+{
+public:
+    Arena() : head(NULL), cur(NULL), end(NULL), nextSize(ARENA_BLOCK_SIZE) {}
+    ~Arena();
+
+    Arena(Arena &&other);
+    Arena &operator=(Arena &&other);
+
+    void *Alloc(size_t size, size_t align = 8);
+    const char *CopyString(const char *s, size_t len);
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+private:
+    void Release();
+
+    struct Block
+    {
+        Block *next;
+    };
+
+    Block *head;
+    char *cur;
+    char *end;
+    size_t nextSize;
+};
+
+/* Process wide set of unique strings. Interning the same bytes always
+ * returns the same pointer, which stays valid for the interner's lifetime,
+ * so names seen in thousands of files are stored once and compare by
+ * pointer. The table is split into shards with their own locks so batch
+ * workers rarely contend.
+ */
+class StringInterner
+{
+public:
+    StringInterner();
+
+    const char *Intern(const char *s, size_t len);
+    size_t Count();
+
+private:
+    enum { SHARD_COUNT = 64 };
+
+    typedef struct
+    {
+        uint64_t hash;
+        const char *str;
+        size_t len;
+    } Slot;
+
+    struct Shard
+    {
+        std::mutex lock;
+        std::vector<Slot> slots;    // open addressing, power of two size
+        size_t count;
+        Arena storage;
+    };
+
+    static void Grow(Shard *shard);
+
+    Shard shards[SHARD_COUNT];
+};
+
+#endif // _PEARENA
@@ -0,0 +1,818 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       peasync.cpp
+//  Author:     Mark Coppa
+//
+//  Header-only reads for batch scans that need nothing past the section
+//  table. Mapping a file costs an mmap, page faults and an munmap for the
+//  few kilobytes a header parse looks at; reading them costs an open, one
+//  or two reads and a close. On Linux those are queued through io_uring
+//  so thousands are in flight at once; elsewhere, and when io_uring is
+//  unavailable, ReadPeHeaders does the same reads with pread.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "peasync.h"
+#include "peheader.h"
+#include "pestats.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+/* IORING_REGISTER_PROBE is an enum; IORING_FEAT_FAST_POLL came with it */
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_FAST_POLL)
+#define PE_HAVE_IO_URING
+#endif
+#endif
+#endif
+
+/* The bytes read from the start of one file so far */
+typedef struct
+{
+    uint8_t *data;
+    size_t size;            // bytes read
+    size_t capacity;        // bytes allocated at data
+    bool complete;          // a read came up short, so size is the file size
+} HeaderRead;
+
+
+/* NextRead      Decide what to read next from a file
+ * Parameters    What has been read; where to return the offset and length
+ *               of the next read
+ * Returns       false once the headers have been read, or can't be
+ *
+ * The first read is page 0; after that HeaderExtent says how far the
+ * headers reach, and the read runs to the end of the page they end in.
+ * Headers reaching past HEADER_READ_LIMIT (and archives, which need the
+ * whole file) are left short, for the caller to map instead.
+ */
+static bool NextRead(HeaderRead *read, size_t *offset, size_t *length)
+{
+    if (read->complete)
+    {
+        return false;
+    }
+
+    size_t want = HEADER_READ_SIZE;
+    if (read->size > 0)
+    {
+        PeBuffer buffer = { read->data, read->size };
+        size_t extent = HeaderExtent(buffer);
+        if (extent <= read->size || extent > HEADER_READ_LIMIT)
+        {
+            return false;
+        }
+        want = (extent + HEADER_READ_SIZE - 1) & ~(size_t)(HEADER_READ_SIZE - 1);
+    }
+
+    if (want > read->capacity)
+    {
+        uint8_t *grown = (uint8_t *)realloc(read->data, want);
+        if (grown == NULL)
+        {
+            return false;
+        }
+        read->data = grown;
+        read->capacity = want;
+    }
+
+    *offset = read->size;
+    *length = want - read->size;
+    return true;
+}
+
+
+/* ReadDone      Account for a finished read
+ * Parameters    What has been read, bytes asked for, bytes read
+ *
+ * A short read of a regular file only happens at its end.
+ */
+static void ReadDone(HeaderRead *read, size_t requested, size_t got)
+{
+    CountStat(STAT_READ_CALLS);
+    CountStat(STAT_BYTES_READ, got);
+    read->size += got;
+    read->complete = got < requested;
+}
+
+
+/* TakeRead      Turn what has been read into a heap backed view
+ */
+static void TakeRead(HeaderRead *read, PeFile *file)
+{
+    file->buffer.data = read->data;
+    file->buffer.size = read->size;
+    file->mapped = false;
+    file->complete = read->complete;
+    read->data = NULL;
+    read->size = 0;
+    read->capacity = 0;
+}
+
+
+/* ReadPeHeaders    Read the headers of a file with plain reads
+ * Parameters       File name, view to fill; release it with ClosePeFile
+ * Returns          false if the file could not be opened or read
+ *
+ * The view holds at least the headers and section table unless they lie
+ * past HEADER_READ_LIMIT, and is complete if the file is that small.
+ * Platforms without pread map the file instead.
+ */
+bool ReadPeHeaders(const char *filename, PeFile *file)
+{
+#ifdef _WIN32
+    return OpenPeFile(filename, file);
+#else
+    file->buffer.data = NULL;
+    file->buffer.size = 0;
+    file->mapped = false;
+    file->complete = false;
+
+    uint64_t mark = StatMark();
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        TimeStat(TIMER_OPEN, &mark);
+        return false;
+    }
+
+    HeaderRead read = { NULL, 0, 0, false };
+    size_t offset;
+    size_t length;
+    bool ok = true;
+    while (ok && NextRead(&read, &offset, &length))
+    {
+        ssize_t got = pread(fd, read.data + offset, length, (off_t)offset);
+        if (got >= 0)
+        {
+            ReadDone(&read, length, (size_t)got);
+        }
+        else if (errno != EINTR)
+        {
+            ok = false;
+        }
+    }
+    close(fd);
+    TimeStat(TIMER_OPEN, &mark);
+
+    if (!ok)
+    {
+        free(read.data);
+        return false;
+    }
+
+    TakeRead(&read, file);
+    return true;
+#endif
+}
+
+
+#ifdef PE_HAVE_IO_URING
+
+enum SlotState
+{
+    SLOT_FREE,
+    SLOT_OPENING,
+    SLOT_READING,
+    SLOT_CLOSING
+};
+
+/* One file in flight */
+typedef struct
+{
+    SlotState state;
+    std::string path;           // kept until the open has completed
+    void *cookie;
+    int fd;
+    HeaderRead read;
+    size_t requested;           // length of the read in flight
+} QueueSlot;
+
+struct HeaderReadQueue::State
+{
+    int ringFd;
+    bool broken;                // io_uring_enter failed; nothing more completes
+
+    /* Submission ring */
+    void *sqMap;
+    size_t sqMapSize;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned sqLocalTail;       // tail as of the last io_uring_enter
+    unsigned unsubmitted;       // entries filled in after it
+
+    /* Completion ring; shares sqMap with IORING_FEAT_SINGLE_MMAP */
+    void *cqMap;
+    size_t cqMapSize;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    io_uring_cqe *cqes;
+
+    std::vector<QueueSlot> slots;
+    std::vector<unsigned> freeSlots;
+    std::deque<HeaderReadResult> ready;
+    unsigned files;             // started and not yet handed back by Next
+    unsigned busy;              // slots not free, including those closing
+
+    io_uring_sqe *Queue(uint8_t opcode, unsigned slot);
+    bool Reap();
+    void Complete(unsigned slot, int res);
+    void Continue(unsigned slot);
+    void QueueRead(unsigned slot);
+    void Finish(unsigned slot, bool opened);
+    void Release(unsigned slot);
+};
+
+
+/* Queue    Fill in the next submission entry; it is submitted by the
+ *          next io_uring_enter
+ */
+io_uring_sqe *HeaderReadQueue::State::Queue(uint8_t opcode, unsigned slot)
+{
+    /* Every slot has at most one operation in flight, and there are no
+     * more slots than ring entries, so the ring is never full. The tail
+     * is published by Reap, once the entry has been filled in. */
+    unsigned index = (sqLocalTail + unsubmitted) & sqMask;
+
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = slot;
+    sqArray[index] = index;
+
+    ++unsubmitted;
+    return sqe;
+}
+
+
+/* Continue    Queue a file's next read, or finish it once the headers
+ *             have been read
+ */
+void HeaderReadQueue::State::Continue(unsigned slot)
+{
+    QueueSlot *s = &slots[slot];
+    size_t offset;
+    size_t length;
+    if (!NextRead(&s->read, &offset, &length))
+    {
+        Finish(slot, true);
+        return;
+    }
+
+    s->state = SLOT_READING;
+    s->requested = length;
+    QueueRead(slot);
+}
+
+
+/* QueueRead    Queue the read of the next s->requested bytes of a file
+ */
+void HeaderReadQueue::State::QueueRead(unsigned slot)
+{
+    QueueSlot *s = &slots[slot];
+    io_uring_sqe *sqe = Queue(IORING_OP_READ, slot);
+    sqe->fd = s->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(s->read.data + s->read.size);
+    sqe->len = (uint32_t)s->requested;
+    sqe->off = s->read.size;
+}
+
+
+/* Finish    Hand a file back and close it in the background
+ */
+void HeaderReadQueue::State::Finish(unsigned slot, bool opened)
+{
+    QueueSlot *s = &slots[slot];
+    HeaderReadResult result;
+    result.cookie = s->cookie;
+    result.opened = opened;
+    result.file.buffer.data = NULL;
+    result.file.buffer.size = 0;
+    result.file.mapped = false;
+    result.file.complete = false;
+    if (opened)
+    {
+        TakeRead(&s->read, &result.file);
+    }
+    else
+    {
+        free(s->read.data);
+        s->read.data = NULL;
+        s->read.size = 0;
+        s->read.capacity = 0;
+    }
+    ready.push_back(result);
+
+    if (s->fd < 0)
+    {
+        Release(slot);
+        return;
+    }
+
+    s->state = SLOT_CLOSING;
+    io_uring_sqe *sqe = Queue(IORING_OP_CLOSE, slot);
+    sqe->fd = s->fd;
+}
+
+
+/* Release    Return a slot to the free list
+ */
+void HeaderReadQueue::State::Release(unsigned slot)
+{
+    QueueSlot *s = &slots[slot];
+    s->state = SLOT_FREE;
+    s->path.clear();
+    s->cookie = NULL;
+    s->fd = -1;
+    freeSlots.push_back(slot);
+    --busy;
+}
+
+
+/* Complete    Advance a file's state machine by one completion
+ */
+void HeaderReadQueue::State::Complete(unsigned slot, int res)
+{
+    if (slot >= slots.size())
+    {
+        return;
+    }
+
+    QueueSlot *s = &slots[slot];
+    switch (s->state)
+    {
+    case SLOT_OPENING:
+        if (res < 0)
+        {
+            Finish(slot, false);
+            break;
+        }
+        s->fd = res;
+        Continue(slot);
+        break;
+
+    case SLOT_READING:
+        if (res == -EINTR || res == -EAGAIN)
+        {
+            QueueRead(slot);
+            break;
+        }
+        if (res < 0)
+        {
+            Finish(slot, false);
+            break;
+        }
+        ReadDone(&s->read, s->requested, (size_t)res);
+        Continue(slot);
+        break;
+
+    case SLOT_CLOSING:
+        Release(slot);
+        break;
+
+    case SLOT_FREE:
+        break;
+    }
+}
+
+
+/* Reap       Submit what has been queued, wait for at least one
+ *            completion and run every completion that has arrived
+ * Returns    false if the ring has stopped working
+ */
+bool HeaderReadQueue::State::Reap()
+{
+    __atomic_store_n(sqTail, sqLocalTail + unsubmitted, __ATOMIC_RELEASE);
+    int submitted = (int)syscall(__NR_io_uring_enter, ringFd, unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (submitted >= 0)
+    {
+        sqLocalTail += (unsigned)submitted;
+        unsubmitted -= (unsigned)submitted;
+    }
+    else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+    {
+        return false;
+    }
+
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+        const io_uring_cqe *cqe = &cqes[head & cqMask];
+        unsigned slot = (unsigned)cqe->user_data;
+        int res = cqe->res;
+
+        /* Free the entry first: completing it may queue more work */
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        Complete(slot, res);
+    }
+    return true;
+}
+
+
+HeaderReadQueue::HeaderReadQueue()
+    : state(NULL)
+{
+}
+
+
+HeaderReadQueue::~HeaderReadQueue()
+{
+    if (state == NULL)
+    {
+        return;
+    }
+
+    /* Reads land in slot buffers, so the ring outlives every operation */
+    while (state->busy > 0 && !state->broken)
+    {
+        state->broken = !state->Reap();
+    }
+    while (!state->ready.empty())
+    {
+        ClosePeFile(&state->ready.front().file);
+        state->ready.pop_front();
+    }
+
+    munmap(state->sqes, state->sqesSize);
+    if (state->cqMap != state->sqMap)
+    {
+        munmap(state->cqMap, state->cqMapSize);
+    }
+    munmap(state->sqMap, state->sqMapSize);
+    close(state->ringFd);
+
+    /* A broken ring may still have had reads in flight; closing it
+     * cancels them, so only now can their buffers go */
+    for (size_t i = 0; i < state->slots.size(); ++i)
+    {
+        free(state->slots[i].read.data);
+    }
+    delete state;
+}
+
+
+/* ProbeOps    Check that the kernel knows the operations the queue uses
+ */
+static bool ProbeOps(int ringFd)
+{
+    const unsigned opCount = 256;
+    size_t size = sizeof(io_uring_probe) + opCount * sizeof(io_uring_probe_op);
+    io_uring_probe *probe = (io_uring_probe *)calloc(1, size);
+    if (probe == NULL)
+    {
+        return false;
+    }
+
+    bool ok = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, opCount) == 0;
+    const uint8_t needed[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+    for (size_t i = 0; ok && i < sizeof(needed); ++i)
+    {
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    free(probe);
+    return ok;
+}
+
+
+/* FitDepth      Bound the queue by the descriptors the process may open,
+ *               raising the soft limit as far as the hard one allows
+ * Parameters    Depth wanted
+ * Returns       Depth that leaves ASYNC_FD_RESERVE descriptors, 0 if none
+ */
+static unsigned FitDepth(unsigned depth)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+    {
+        return 0;
+    }
+
+    rlim_t wanted = (rlim_t)depth + ASYNC_FD_RESERVE;
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < wanted)
+    {
+        limit.rlim_cur = limit.rlim_max == RLIM_INFINITY ? wanted : std::min(limit.rlim_max, wanted);
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    if (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur >= wanted)
+    {
+        return depth;
+    }
+    return limit.rlim_cur > 2 * ASYNC_FD_RESERVE ? (unsigned)(limit.rlim_cur - ASYNC_FD_RESERVE) : 0;
+}
+
+
+/* Init          Set up the ring
+ * Parameters    Files to keep in flight at most
+ * Returns       false if io_uring, or an operation it needs, is
+ *               unavailable; the caller reads some other way
+ */
+bool HeaderReadQueue::Init(unsigned depth)
+{
+    if (state != NULL)
+    {
+        return true;
+    }
+
+    depth = FitDepth(depth);
+    if (depth == 0)
+    {
+        return false;
+    }
+
+    /* Only this thread submits and reaps, so completions can wait until
+     * it asks for them rather than interrupting it; kernels before 6.1
+     * don't know these flags and get a plain ring */
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+#ifdef IORING_SETUP_DEFER_TASKRUN
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER |
+                   IORING_SETUP_DEFER_TASKRUN;
+#endif
+    int ringFd = (int)syscall(__NR_io_uring_setup, depth, &params);
+    if (ringFd < 0 && params.flags != 0)
+    {
+        memset(&params, 0, sizeof(params));
+        ringFd = (int)syscall(__NR_io_uring_setup, depth, &params);
+    }
+    if (ringFd < 0)
+    {
+        return false;
+    }
+    if (!ProbeOps(ringFd))
+    {
+        close(ringFd);
+        return false;
+    }
+
+    size_t sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+    {
+        sqMapSize = cqMapSize = std::max(sqMapSize, cqMapSize);
+    }
+
+    void *sqMap = mmap(NULL, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    void *cqMap = sqMap;
+    if (sqMap != MAP_FAILED && !single)
+    {
+        cqMap = mmap(NULL, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    }
+    size_t sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = MAP_FAILED;
+    if (sqMap != MAP_FAILED && cqMap != MAP_FAILED)
+    {
+        sqes = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    }
+
+    if (sqes == MAP_FAILED)
+    {
+        if (cqMap != MAP_FAILED && cqMap != sqMap)
+        {
+            munmap(cqMap, cqMapSize);
+        }
+        if (sqMap != MAP_FAILED)
+        {
+            munmap(sqMap, sqMapSize);
+        }
+        close(ringFd);
+        return false;
+    }
+
+    State *s = new State;
+    uint8_t *sq = (uint8_t *)sqMap;
+    uint8_t *cq = (uint8_t *)cqMap;
+    s->ringFd = ringFd;
+    s->broken = false;
+    s->sqMap = sqMap;
+    s->sqMapSize = sqMapSize;
+    s->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    s->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    s->sqArray = (unsigned *)(sq + params.sq_off.array);
+    s->sqes = (io_uring_sqe *)sqes;
+    s->sqesSize = sqesSize;
+    s->sqLocalTail = *s->sqTail;
+    s->unsubmitted = 0;
+    s->cqMap = cqMap;
+    s->cqMapSize = cqMapSize;
+    s->cqHead = (unsigned *)(cq + params.cq_off.head);
+    s->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    s->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    s->cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    s->files = 0;
+    s->busy = 0;
+
+    unsigned slotCount = std::min(depth, params.sq_entries);
+    s->slots.resize(slotCount);
+    for (unsigned i = slotCount; i-- > 0; )
+    {
+        QueueSlot *slot = &s->slots[i];
+        slot->state = SLOT_FREE;
+        slot->cookie = NULL;
+        slot->fd = -1;
+        slot->read.data = NULL;
+        slot->read.size = 0;
+        slot->read.capacity = 0;
+        slot->read.complete = false;
+        slot->requested = 0;
+        s->freeSlots.push_back(i);
+    }
+
+    state = s;
+    return true;
+}
+
+
+/* Depth    Files the queue keeps in flight at most
+ */
+unsigned HeaderReadQueue::Depth() const
+{
+    return state != NULL ? (unsigned)state->slots.size() : 0;
+}
+
+
+/* HasRoom    Check whether Start may be called
+ */
+bool HeaderReadQueue::HasRoom() const
+{
+    return state != NULL && !state->broken && !state->freeSlots.empty();
+}
+
+
+/* InFlight    Files started and not yet handed back by Next
+ */
+unsigned HeaderReadQueue::InFlight() const
+{
+    return state != NULL ? state->files : 0;
+}
+
+
+/* HasResult    Check whether Next would return without waiting
+ */
+bool HeaderReadQueue::HasResult() const
+{
+    return state != NULL && !state->ready.empty();
+}
+
+
+/* Start         Queue the open of a file; HasRoom must be true
+ * Parameters    File name, value handed back with its result
+ */
+void HeaderReadQueue::Start(const char *path, void *cookie)
+{
+    unsigned slot = state->freeSlots.back();
+    state->freeSlots.pop_back();
+    ++state->busy;
+    ++state->files;
+
+    QueueSlot *s = &state->slots[slot];
+    s->state = SLOT_OPENING;
+    s->path = path;
+    s->cookie = cookie;
+    s->fd = -1;
+    s->read.size = 0;
+    s->read.complete = false;
+
+    io_uring_sqe *sqe = state->Queue(IORING_OP_OPENAT, slot);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)s->path.c_str();
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+}
+
+
+/* Next          Wait for a file to finish
+ * Parameters    Where to return it; release its view with ClosePeFile
+ * Returns       false once every file started has been handed back
+ *
+ * Should the ring itself fail, files still in flight come back unopened
+ * and their descriptors are abandoned to the kernel. Their buffers stay
+ * with their slots until the ring is closed.
+ */
+bool HeaderReadQueue::Next(HeaderReadResult *result)
+{
+    State *s = state;
+    if (s == NULL)
+    {
+        return false;
+    }
+
+    while (s->ready.empty() && s->files > 0 && !s->broken)
+    {
+        s->broken = !s->Reap();
+    }
+
+    if (s->ready.empty() && s->broken)
+    {
+        for (size_t i = 0; i < s->slots.size(); ++i)
+        {
+            QueueSlot *slot = &s->slots[i];
+            if (slot->state == SLOT_OPENING || slot->state == SLOT_READING)
+            {
+                HeaderReadResult lost = { slot->cookie, false, { { NULL, 0 }, false, false } };
+                s->ready.push_back(lost);
+                slot->state = SLOT_CLOSING;
+            }
+        }
+    }
+
+    if (s->ready.empty())
+    {
+        return false;
+    }
+
+    *result = s->ready.front();
+    s->ready.pop_front();
+    --s->files;
+    return true;
+}
+
+#else
+
+struct HeaderReadQueue::State
+{
+};
+
+
+HeaderReadQueue::HeaderReadQueue()
+    : state(NULL)
+{
+}
+
+
+HeaderReadQueue::~HeaderReadQueue()
+{
+}
+
+
+/* Init       io_uring is Linux only
+ * Returns    false; the caller reads some other way
+ */
+bool HeaderReadQueue::Init(unsigned depth)
+{
+    (void)depth;
+    return false;
+}
+
+
+unsigned HeaderReadQueue::Depth() const
+{
+    return 0;
+}
+
+
+bool HeaderReadQueue::HasRoom() const
+{
+    return false;
+}
+
+
+unsigned HeaderReadQueue::InFlight() const
+{
+    return 0;
+}
+
+
+bool HeaderReadQueue::HasResult() const
+{
+    return false;
+}
+
+
+void HeaderReadQueue::Start(const char *path, void *cookie)
+{
+    (void)path;
+    (void)cookie;
+}
+
+
+bool HeaderReadQueue::Next(HeaderReadResult *result)
+{
+    (void)result;
+    return false;
+}
+
+#endif
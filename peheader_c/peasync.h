@@ -0,0 +1,56 @@
+#ifndef _PEASYNC
+#define _PEASYNC
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pefile.h"
+
+#define HEADER_READ_SIZE    0x1000              /* First read of every file, and the unit later reads are rounded to */
+#define HEADER_READ_LIMIT   PE_HEADER_WINDOW    /* Headers further into a file than this are left to OpenPeFile */
+#define ASYNC_QUEUE_DEPTH   4096                /* Files an io_uring queue keeps in flight at once */
+#define ASYNC_FD_RESERVE    256                 /* Descriptors left for everything else when sizing the queue */
+
+/* A file whose headers HeaderReadQueue has finished with */
+typedef struct
+{
+    void *cookie;           // as passed to Start
+    bool opened;            // false if the file could not be opened or read; file is then empty
+    PeFile file;            // heap buffer from offset 0; complete if it holds the whole file
+} HeaderReadResult;
+
+/* Reads just the headers of many files at once through io_uring, so a
+ * scan of a cold tree keeps thousands of opens and reads in flight
+ * instead of one per worker thread.
+ *
+ * Every file is a small state machine driven by its completions: open,
+ * read page 0, read up to the page the section table ends in (through
+ * whatever e_lfanew points to), then close. A file is handed back as soon
+ * as its last read completes; its close finishes in the background. All
+ * calls come from one thread.
+ */
+class HeaderReadQueue
+{
+public:
+    HeaderReadQueue();
+    ~HeaderReadQueue();
+
+    bool Init(unsigned depth = ASYNC_QUEUE_DEPTH);
+    unsigned Depth() const;
+    bool HasRoom() const;
+    unsigned InFlight() const;
+    bool HasResult() const;
+    void Start(const char *path, void *cookie);
+    bool Next(HeaderReadResult *result);
+
+    HeaderReadQueue(const HeaderReadQueue &) = delete;
+    HeaderReadQueue &operator=(const HeaderReadQueue &) = delete;
+
+private:
+    struct State;
+    State *state;           // NULL until Init succeeds
+};
+
+bool ReadPeHeaders(const char *filename, PeFile *file);
+
+#endif // _PEASYNC
@@ -0,0 +1,946 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pebatch.cpp
+//  Author:     Mark Coppa
+//
+//  Batch scanning: expands directories and @listfiles into files and runs
+//  a handler for each one on the work-stealing pool.
+//
+//  Unordered scans walk directory trees concurrently, one pool task per
+//  directory, and write each record as soon as it is done. Ordered scans
+//  walk on the calling thread in sorted depth-first order so the sequence
+//  is deterministic, parse on the pool, and hold finished records back
+//  until everything before them has been written.
+//
+//  Header-only scans can instead read just the start of each file, either
+//  through an io_uring queue driven from the calling thread or with pread
+//  on the pool.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pebatch.h"
+#include "peasync.h"
+#include "pecarve.h"
+#include "peoutput.h"
+#include "pepool.h"
+#include "pestats.h"
+
+#include <algorithm>
+#include <map>
+
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#define O_BINARY 0
+#endif
+
+#define ORDERED_WINDOW_PER_THREAD 64  /* Records an ordered scan may hold back per worker */
+#define ARCHIVE_MEMBERS_PER_TASK  32  /* Archive members handed to a worker at once */
+#define HEADER_FILES_PER_TASK     32  /* Files whose headers are in handed to a worker at once */
+
+typedef struct
+{
+    std::string path;
+    bool isDirectory;
+} DirEntry;
+
+/* Where finished records go.
+ *
+ * Unordered: every worker formats straight into its own buffer and writes
+ * it out with one write() per OUTBUF_FLUSH_SIZE bytes, always on a record
+ * boundary. Writes to a per-worker shard take no lock; writes to the
+ * shared descriptor hold the lock for the whole record run, since
+ * WriteOutBuf may need several calls to get it out and another worker's
+ * bytes must not land in between.
+ *
+ * Ordered: records that arrive early are copied aside until every record
+ * with a lower sequence number has been written.
+ */
+class OutputSink
+{
+public:
+    OutputSink(const BatchOptions *options, unsigned workers);
+    ~OutputSink();
+
+    OutBuf *Buffer(unsigned worker) { return &scratch[worker]; }
+    void Commit(uint64_t sequence, unsigned worker);
+    void WaitForWindow(uint64_t sequence, uint64_t window);
+    bool Finish();
+
+private:
+    void WriteShared(OutBuf *buf);
+
+    bool ordered;
+    std::atomic<bool> failed;
+    int sharedFd;
+    std::vector<int> fds;           // per worker; sharedFd unless sharding
+    std::vector<OutBuf> scratch;    // per worker
+
+    std::mutex lock;
+    std::condition_variable drained;
+    uint64_t nextSequence;
+    OutBuf pending;                 // ordered output not yet written
+    std::map<uint64_t, std::string> held;
+};
+
+typedef struct
+{
+    ThreadPool *pool;
+    OutputSink *sink;
+    BatchFileHandler handler;
+    void *context;
+    std::atomic<uint64_t> files;
+    std::atomic<uint64_t> failed;
+} BatchState;
+
+
+OutputSink::OutputSink(const BatchOptions *options, unsigned workers)
+    : ordered(options->ordered),
+      failed(false),
+      sharedFd(options->fd),
+      fds(workers, options->fd),
+      scratch(workers),
+      nextSequence(0)
+{
+    for (unsigned i = 0; i < workers; ++i)
+    {
+        InitOutBuf(&scratch[i], OUTBUF_INITIAL_SIZE);
+    }
+    InitOutBuf(&pending, OUTBUF_INITIAL_SIZE);
+
+    if (!ordered && options->outputPrefix != NULL)
+    {
+        for (unsigned i = 0; i < workers; ++i)
+        {
+            char name[4096];
+            snprintf(name, sizeof(name), "%s.%u", options->outputPrefix, i);
+            fds[i] = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+            if (fds[i] < 0)
+            {
+                fprintf(stderr, "Error: Could not create \"%s\"\n", name);
+                fds[i] = sharedFd;
+            }
+        }
+    }
+}
+
+
+OutputSink::~OutputSink()
+{
+    for (size_t i = 0; i < scratch.size(); ++i)
+    {
+        FreeOutBuf(&scratch[i]);
+        if (fds[i] != sharedFd)
+        {
+            close(fds[i]);
+        }
+    }
+    FreeOutBuf(&pending);
+}
+
+
+/* WriteShared    Write a buffer to the shared descriptor
+ */
+void OutputSink::WriteShared(OutBuf *buf)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (!WriteOutBuf(buf, sharedFd))
+    {
+        failed = true;
+    }
+}
+
+
+/* Commit        Hand over the record a worker just finished in its buffer
+ * Parameters    Sequence number of the file (ignored when unordered), worker
+ */
+void OutputSink::Commit(uint64_t sequence, unsigned worker)
+{
+    OutBuf *buf = &scratch[worker];
+
+    if (!ordered)
+    {
+        if (buf->len >= OUTBUF_FLUSH_SIZE)
+        {
+            if (fds[worker] != sharedFd)
+            {
+                if (!WriteOutBuf(buf, fds[worker]))
+                {
+                    failed = true;
+                }
+            }
+            else
+            {
+                WriteShared(buf);
+            }
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (sequence != nextSequence)
+    {
+        held[sequence].assign(buf->data, buf->len);
+        buf->len = 0;
+        return;
+    }
+
+    AppendBytes(&pending, buf->data, buf->len);
+    buf->len = 0;
+    ++nextSequence;
+
+    std::map<uint64_t, std::string>::iterator it = held.begin();
+    while (it != held.end() && it->first == nextSequence)
+    {
+        AppendBytes(&pending, it->second.data(), it->second.size());
+        held.erase(it++);
+        ++nextSequence;
+    }
+
+    if (pending.len >= OUTBUF_FLUSH_SIZE)
+    {
+        if (!WriteOutBuf(&pending, sharedFd))
+        {
+            failed = true;
+        }
+    }
+
+    drained.notify_all();
+}
+
+
+/* WaitForWindow    Keep an ordered scan from running too far ahead of the
+ *                  oldest unfinished file
+ * Parameters       Sequence number about to be submitted, records allowed in flight
+ */
+void OutputSink::WaitForWindow(uint64_t sequence, uint64_t window)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    drained.wait(guard, [&] { return sequence - nextSequence < window; });
+}
+
+
+/* Finish     Write out whatever is still buffered once all workers are idle
+ * Returns    false if any write failed
+ */
+bool OutputSink::Finish()
+{
+    for (size_t i = 0; i < scratch.size(); ++i)
+    {
+        if (scratch[i].len > 0)
+        {
+            if (!WriteOutBuf(&scratch[i], fds[i]))
+            {
+                failed = true;
+            }
+        }
+    }
+    if (pending.len > 0)
+    {
+        if (!WriteOutBuf(&pending, sharedFd))
+        {
+            failed = true;
+        }
+    }
+
+    return !failed;
+}
+
+
+/* ListDirectory    Read the entries of one directory
+ * Parameters       Directory path, entries to fill
+ * Returns          false if the directory could not be read
+ *
+ * Symbolic links to directories are not followed, so trees with cycles
+ * terminate. Devices, pipes and sockets are skipped.
+ */
+static bool ListDirectory(const std::string &dir, std::vector<DirEntry> *entries)
+{
+    std::string prefix = dir;
+    if (!prefix.empty() && prefix[prefix.size() - 1] != '/' && prefix[prefix.size() - 1] != '\\')
+    {
+        prefix += '/';
+    }
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA find;
+    HANDLE hFind = FindFirstFileA((prefix + "*").c_str(), &find);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    do
+    {
+        const char *name = find.cFileName;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            (find.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+        {
+            continue;
+        }
+
+        DirEntry entry;
+        entry.path = prefix + name;
+        entry.isDirectory = (find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        entries->push_back(entry);
+    } while (FindNextFileA(hFind, &find));
+
+    FindClose(hFind);
+#else
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL)
+    {
+        return false;
+    }
+
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL)
+    {
+        const char *name = de->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            continue;
+        }
+
+        DirEntry entry;
+        entry.path = prefix + name;
+
+        unsigned char type = de->d_type;
+        if (type == DT_UNKNOWN || type == DT_LNK)
+        {
+            struct stat st;
+            if (stat(entry.path.c_str(), &st) != 0)
+            {
+                continue;
+            }
+            if (S_ISDIR(st.st_mode))
+            {
+                type = (de->d_type == DT_LNK) ? DT_LNK : DT_DIR;
+            }
+            else if (S_ISREG(st.st_mode))
+            {
+                type = DT_REG;
+            }
+        }
+
+        if (type != DT_DIR && type != DT_REG)
+        {
+            continue;
+        }
+
+        entry.isDirectory = (type == DT_DIR);
+        entries->push_back(entry);
+    }
+
+    closedir(d);
+#endif
+
+    return true;
+}
+
+
+/* IsDirectory    Check whether a path names a directory
+ */
+static bool IsDirectory(const char *path)
+{
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(path);
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+
+/* IsBatchInput    Check whether a command line path needs batch mode
+ * Parameters      The path as given
+ * Returns         true for directories and @listfiles
+ */
+bool IsBatchInput(const char *path)
+{
+    return path[0] == '@' || IsDirectory(path);
+}
+
+
+/* ReadListFile    Read one path per line from a list file
+ * Parameters      List file name ("-" for stdin), paths to append to
+ * Returns         false if the list could not be opened
+ */
+static bool ReadListFile(const char *listfile, std::vector<std::string> *paths)
+{
+    FILE *list = strcmp(listfile, "-") == 0 ? stdin : fopen(listfile, "r");
+    if (list == NULL)
+    {
+        return false;
+    }
+
+    /* Lines longer than the buffer arrive in pieces; a line is only
+     * complete once its newline (or the end of the list) is seen */
+    char chunk[4096];
+    std::string line;
+    bool more = true;
+    while (more)
+    {
+        more = fgets(chunk, sizeof(chunk), list) != NULL;
+        if (more)
+        {
+            line += chunk;
+            if (line.empty() || line[line.size() - 1] != '\n')
+            {
+                continue;
+            }
+        }
+
+        size_t len = line.size();
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        {
+            --len;
+        }
+        if (len > 0)
+        {
+            paths->push_back(line.substr(0, len));
+        }
+        line.clear();
+    }
+
+    if (list != stdin)
+    {
+        fclose(list);
+    }
+    return true;
+}
+
+
+/* ProcessFile    Run the handler on one file and pass its record on
+ */
+static void ProcessFile(BatchState *state, const std::string &path, uint64_t sequence, unsigned worker)
+{
+    if (!state->handler(state->context, path.c_str(), worker, state->sink->Buffer(worker)))
+    {
+        state->failed.fetch_add(1, std::memory_order_relaxed);
+        CountStat(STAT_FAILED);
+    }
+    state->files.fetch_add(1, std::memory_order_relaxed);
+    CountStat(STAT_FILES);
+    state->sink->Commit(sequence, worker);
+}
+
+
+/* WalkConcurrent    Scan a directory tree with one pool task per directory
+ */
+static void WalkConcurrent(BatchState *state, const std::string &dir)
+{
+    std::vector<DirEntry> entries;
+    if (!ListDirectory(dir, &entries))
+    {
+        fprintf(stderr, "Error: Could not read directory \"%s\"\n", dir.c_str());
+        state->failed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        std::string path = entries[i].path;
+        if (entries[i].isDirectory)
+        {
+            state->pool->Submit([state, path](unsigned) { WalkConcurrent(state, path); });
+        }
+        else
+        {
+            state->pool->Submit([state, path](unsigned worker) { ProcessFile(state, path, 0, worker); });
+        }
+    }
+}
+
+
+/* SubmitOrdered    Number a file and queue it, waiting if the sink is
+ *                  holding back too many records
+ */
+static void SubmitOrdered(BatchState *state, const std::string &path, uint64_t *sequence)
+{
+    uint64_t n = (*sequence)++;
+    state->sink->WaitForWindow(n, (uint64_t)state->pool->Size() * ORDERED_WINDOW_PER_THREAD);
+    state->pool->Submit([state, path, n](unsigned worker) { ProcessFile(state, path, n, worker); });
+}
+
+
+/* Yields the files under a list of paths one at a time, depth first with
+ * each directory in name order, so the sequence is deterministic and a
+ * directory is only listed once the files before it have been taken.
+ */
+class PathWalker
+{
+public:
+    explicit PathWalker(const std::vector<std::string> &paths);
+
+    bool Next(std::string *path);
+    uint64_t Failed() const { return failed; }
+
+private:
+    struct Level
+    {
+        std::vector<DirEntry> entries;
+        size_t next;
+    };
+
+    std::vector<Level> stack;
+    uint64_t failed;            // directories that could not be read
+};
+
+
+PathWalker::PathWalker(const std::vector<std::string> &paths)
+    : stack(1), failed(0)
+{
+    /* Whether an input is a directory is only looked up when it is
+     * reached, so a long list starts at once */
+    stack[0].next = 0;
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        DirEntry entry;
+        entry.path = paths[i];
+        entry.isDirectory = false;
+        stack[0].entries.push_back(entry);
+    }
+}
+
+
+/* Next          Take the next file
+ * Parameters    Where to return its path
+ * Returns       false once every file has been taken
+ */
+bool PathWalker::Next(std::string *path)
+{
+    while (!stack.empty())
+    {
+        Level *top = &stack.back();
+        if (top->next == top->entries.size())
+        {
+            stack.pop_back();
+            continue;
+        }
+
+        DirEntry entry = top->entries[top->next++];
+        if (stack.size() == 1)
+        {
+            entry.isDirectory = IsDirectory(entry.path.c_str());
+        }
+        if (!entry.isDirectory)
+        {
+            *path = entry.path;
+            return true;
+        }
+
+        Level level;
+        level.next = 0;
+        if (!ListDirectory(entry.path, &level.entries))
+        {
+            fprintf(stderr, "Error: Could not read directory \"%s\"\n", entry.path.c_str());
+            ++failed;
+            continue;
+        }
+
+        std::sort(level.entries.begin(), level.entries.end(),
+                  [](const DirEntry &a, const DirEntry &b) { return a.path < b.path; });
+        stack.push_back(std::move(level));
+    }
+    return false;
+}
+
+
+/* ExpandLists    Replace the @listfiles among the inputs by the paths
+ *                they name
+ * Parameters     Inputs as given, paths to fill, totals to count
+ *                unreadable lists in
+ */
+static void ExpandLists(const std::vector<std::string> &inputs, std::vector<std::string> *paths, BatchTotals *totals)
+{
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        if (inputs[i][0] != '@')
+        {
+            paths->push_back(inputs[i]);
+        }
+        else if (!ReadListFile(inputs[i].c_str() + 1, paths))
+        {
+            fprintf(stderr, "Error: Could not open list \"%s\"\n", inputs[i].c_str() + 1);
+            ++totals->failed;
+        }
+    }
+}
+
+
+/* RunBatch      Scan every file named by the inputs
+ * Parameters    Files, directories and @listfiles; options; handler to run
+ *               for each file and its context
+ * Returns       Counts of files scanned and files that could not be read
+ */
+BatchTotals RunBatch(const std::vector<std::string> &inputs,
+                     const BatchOptions *options,
+                     BatchFileHandler handler,
+                     void *context
+                    )
+{
+    std::vector<std::string> paths;
+    BatchTotals totals = { 0, 0, false };
+    ExpandLists(inputs, &paths, &totals);
+
+    ThreadPool pool(options->threads);
+    OutputSink sink(options, pool.Size());
+
+    BatchState state;
+    state.pool = &pool;
+    state.sink = &sink;
+    state.handler = handler;
+    state.context = context;
+    state.files = 0;
+    state.failed = 0;
+
+    if (options->ordered)
+    {
+        PathWalker walker(paths);
+        std::string path;
+        uint64_t sequence = 0;
+        while (walker.Next(&path))
+        {
+            SubmitOrdered(&state, path, &sequence);
+        }
+        state.failed += walker.Failed();
+    }
+    else
+    {
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            std::string path = paths[i];
+            if (IsDirectory(path.c_str()))
+            {
+                pool.Submit([&state, path](unsigned) { WalkConcurrent(&state, path); });
+            }
+            else
+            {
+                pool.Submit([&state, path](unsigned worker) { ProcessFile(&state, path, 0, worker); });
+            }
+        }
+    }
+
+    pool.Wait();
+    if (!sink.Finish())
+    {
+        fprintf(stderr, "Error: Could not write output\n");
+        ++totals.failed;
+    }
+
+    totals.files += state.files.load();
+    totals.failed += state.failed.load();
+    return totals;
+}
+
+
+typedef struct
+{
+    HeaderFileHandler handler;
+    void *context;
+} HeaderBatchContext;
+
+
+/* ReadHeadersFile    Batch handler for the pread backend: read the
+ *                    headers on the worker and pass them on
+ */
+static bool ReadHeadersFile(void *context, const char *path, unsigned worker, OutBuf *record)
+{
+    const HeaderBatchContext *batch = (const HeaderBatchContext *)context;
+    PeFile headers;
+    if (!ReadPeHeaders(path, &headers))
+    {
+        return batch->handler(batch->context, path, NULL, worker, record);
+    }
+    return batch->handler(batch->context, path, &headers, worker, record);
+}
+
+
+/* RunHeaderBatch    Scan every file named by the inputs, reading only the
+ *                   start of each
+ * Parameters        Files, directories and @listfiles; options, io picking
+ *                   the backend; handler to run for each file and its
+ *                   context
+ * Returns           Counts of files scanned and files the handler failed on
+ *
+ * With io_uring the calling thread walks the inputs in sorted depth-first
+ * order, keeping up to ASYNC_QUEUE_DEPTH files in flight, and hands each
+ * file to the pool as its last read completes. Files handed over but not
+ * yet finished are bounded too, so slow handlers hold the walk back rather
+ * than piling up header buffers.
+ */
+BatchTotals RunHeaderBatch(const std::vector<std::string> &inputs,
+                           const BatchOptions *options,
+                           HeaderFileHandler handler,
+                           void *context
+                          )
+{
+    HeaderReadQueue queue;
+    if (options->io != BATCH_IO_URING || !queue.Init())
+    {
+        if (options->io == BATCH_IO_URING)
+        {
+            fprintf(stderr, "Warning: io_uring is not available, reading headers with pread\n");
+        }
+        HeaderBatchContext batch = { handler, context };
+        return RunBatch(inputs, options, ReadHeadersFile, &batch);
+    }
+
+    std::vector<std::string> paths;
+    BatchTotals totals = { 0, 0, false };
+    ExpandLists(inputs, &paths, &totals);
+
+    ThreadPool pool(options->threads);
+    OutputSink sink(options, pool.Size());
+    PathWalker walker(paths);
+    std::atomic<uint64_t> failed(0);
+
+    /* Files started but not finished by a handler, at most one queue and
+     * one ordered window's worth */
+    uint64_t limit = queue.Depth() + (uint64_t)pool.Size() * ORDERED_WINDOW_PER_THREAD;
+    std::atomic<uint64_t> finished(0);
+    std::mutex lock;
+    std::condition_variable progress;
+
+    typedef struct
+    {
+        std::string path;
+        uint64_t sequence;
+    } Job;
+
+    /* Runs on a worker once a file's headers are in, or could not be read */
+    auto finish = [&](Job *job, PeFile *headers, unsigned worker) {
+        if (!handler(context, job->path.c_str(), headers, worker, sink.Buffer(worker)))
+        {
+            failed.fetch_add(1, std::memory_order_relaxed);
+            CountStat(STAT_FAILED);
+        }
+        CountStat(STAT_FILES);
+        sink.Commit(job->sequence, worker);
+        delete job;
+
+        finished.fetch_add(1);
+        std::lock_guard<std::mutex> guard(lock);
+        progress.notify_one();
+    };
+
+    uint64_t sequence = 0;
+    bool more = true;
+    while (more || queue.InFlight())
+    {
+        while (more && queue.HasRoom() && sequence - finished.load() < limit)
+        {
+            std::string path;
+            if (!walker.Next(&path))
+            {
+                more = false;
+                break;
+            }
+            Job *job = new Job;
+            job->path = path;
+            job->sequence = sequence++;
+            queue.Start(job->path.c_str(), job);
+        }
+
+        /* Hand over whatever has finished together, so a warm cache
+         * doesn't cost a pool task per file */
+        std::vector<HeaderReadResult> results;
+        HeaderReadResult result;
+        if (queue.Next(&result))
+        {
+            results.push_back(result);
+            while (results.size() < HEADER_FILES_PER_TASK && queue.HasResult() && queue.Next(&result))
+            {
+                results.push_back(result);
+            }
+
+            pool.Submit([&, results](unsigned worker) {
+                for (size_t i = 0; i < results.size(); ++i)
+                {
+                    PeFile headers = results[i].file;
+                    finish((Job *)results[i].cookie, results[i].opened ? &headers : NULL, worker);
+                }
+            });
+            continue;
+        }
+
+        /* Nothing in flight: either the handlers are behind, or the ring
+         * has failed and the rest is read on the pool */
+        std::unique_lock<std::mutex> guard(lock);
+        progress.wait(guard, [&] { return sequence - finished.load() < limit; });
+        guard.unlock();
+
+        if (more && !queue.HasRoom())
+        {
+            std::string path;
+            if (!walker.Next(&path))
+            {
+                more = false;
+                continue;
+            }
+            Job *job = new Job;
+            job->path = path;
+            job->sequence = sequence++;
+            pool.Submit([&, job](unsigned worker) {
+                PeFile headers;
+                finish(job, ReadPeHeaders(job->path.c_str(), &headers) ? &headers : NULL, worker);
+            });
+        }
+    }
+
+    pool.Wait();
+    if (!sink.Finish())
+    {
+        fprintf(stderr, "Error: Could not write output\n");
+        ++totals.failed;
+    }
+
+    totals.files = sequence;
+    totals.failed += failed.load() + walker.Failed();
+    return totals;
+}
+
+
+/* RunArchive    Run a handler for every member of an archive. Members are
+ *               found on the calling thread, a header at a time, and
+ *               handed to the pool in groups; output is always written in
+ *               archive order.
+ * Parameters    Bytes of the whole archive; options (threads and fd are
+ *               used); handler to run for each member and its context
+ * Returns       Counts of members handled and members the handler failed on
+ */
+BatchTotals RunArchive(PeBuffer archive,
+                       const BatchOptions *options,
+                       ArchiveMemberHandler handler,
+                       void *context
+                      )
+{
+    BatchTotals totals = { 0, 0, false };
+    BatchOptions ordered = *options;
+    ordered.ordered = true;
+    ordered.outputPrefix = NULL;
+
+    ArIterator it;
+    if (!InitArIterator(&it, archive))
+    {
+        return totals;
+    }
+
+    ThreadPool pool(ordered.threads);
+    OutputSink sink(&ordered, pool.Size());
+    std::atomic<uint64_t> failed(0);
+    uint64_t window = (uint64_t)pool.Size() * ORDERED_WINDOW_PER_THREAD;
+    uint64_t sequence = 0;
+    bool more = true;
+
+    while (more)
+    {
+        std::vector<ArMember> group;
+        group.reserve(ARCHIVE_MEMBERS_PER_TASK);
+
+        ArMember member;
+        while (group.size() < ARCHIVE_MEMBERS_PER_TASK && (more = NextArMember(&it, &member)))
+        {
+            group.push_back(member);
+        }
+        if (group.empty())
+        {
+            break;
+        }
+
+        totals.files += group.size();
+        uint64_t n = sequence++;
+        sink.WaitForWindow(n, window);
+        pool.Submit([&, group, n](unsigned worker) {
+            for (size_t i = 0; i < group.size(); ++i)
+            {
+                if (!handler(context, &group[i], worker, sink.Buffer(worker)))
+                {
+                    failed.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            sink.Commit(n, worker);
+        });
+    }
+
+    pool.Wait();
+    if (!sink.Finish())
+    {
+        fprintf(stderr, "Error: Could not write output\n");
+        ++totals.failed;
+    }
+    totals.truncated = it.truncated;
+    totals.failed += failed.load();
+    return totals;
+}
+
+
+/* RunCarve      Run a handler for every image embedded in a blob. The
+ *               blob is cut into CARVE_CHUNK_SIZE ranges of candidate
+ *               offsets that are scanned on the pool; output is always
+ *               written in offset order.
+ * Parameters    Bytes of the whole blob; options (threads and fd are
+ *               used); handler to run for each image and its context
+ * Returns       Counts of images found and images the handler failed on
+ */
+BatchTotals RunCarve(PeBuffer blob,
+                     const BatchOptions *options,
+                     CarveHitHandler handler,
+                     void *context
+                    )
+{
+    BatchTotals totals = { 0, 0, false };
+    BatchOptions ordered = *options;
+    ordered.ordered = true;
+    ordered.outputPrefix = NULL;
+
+    ThreadPool pool(ordered.threads);
+    OutputSink sink(&ordered, pool.Size());
+    std::atomic<uint64_t> found(0);
+    std::atomic<uint64_t> failed(0);
+    uint64_t window = (uint64_t)pool.Size() * ORDERED_WINDOW_PER_THREAD;
+    uint64_t sequence = 0;
+
+    for (size_t begin = 0, end; begin < blob.size; begin = end)
+    {
+        end = blob.size - begin > CARVE_CHUNK_SIZE ? begin + CARVE_CHUNK_SIZE : blob.size;
+        uint64_t n = sequence++;
+        sink.WaitForWindow(n, window);
+        pool.Submit([&, begin, end, n](unsigned worker) {
+            std::vector<size_t> hits;
+            ScanForImages(blob, begin, end, &hits);
+            for (size_t i = 0; i < hits.size(); ++i)
+            {
+                if (!handler(context, blob, hits[i], worker, sink.Buffer(worker)))
+                {
+                    failed.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            found.fetch_add(hits.size(), std::memory_order_relaxed);
+            sink.Commit(n, worker);
+        });
+    }
+
+    pool.Wait();
+    if (!sink.Finish())
+    {
+        fprintf(stderr, "Error: Could not write output\n");
+        ++totals.failed;
+    }
+
+    totals.files = found.load();
+    totals.failed += failed.load();
+    return totals;
+}
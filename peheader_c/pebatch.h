@@ -0,0 +1,83 @@
+#ifndef _PEBATCH
+#define _PEBATCH
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "pearchive.h"
+#include "peoutput.h"
+
+/* How RunHeaderBatch reads headers */
+enum
+{
+    BATCH_IO_AUTO,              // pread on the pool, which beats io_uring once the page cache is warm
+    BATCH_IO_URING,             // io_uring, for cold caches; warns and uses pread if it is unavailable
+    BATCH_IO_PREAD              // pread on the pool
+};
+
+typedef struct
+{
+    unsigned threads;           // worker threads, 0 for one per core
+    bool ordered;               // emit results in input order rather than completion order
+    int fd;                     // where results are written
+    const char *outputPrefix;   // unordered only: worker n writes to <prefix>.<n> instead of fd
+    int io;                     // RunHeaderBatch only: BATCH_IO_*
+} BatchOptions;
+
+/* Called on a pool worker for every file found. The handler appends the
+ * complete output for the file to record, which belongs to the worker, and
+ * returns false if the file could not be read.
+ */
+typedef bool (*BatchFileHandler)(void *context, const char *path, unsigned worker, OutBuf *record);
+
+/* Called on a pool worker for every file found by RunHeaderBatch, with
+ * the start of the file already read: at least its headers and section
+ * table, unless they lie past HEADER_READ_LIMIT. headers is NULL if the
+ * file could not be read; otherwise the handler owns it and closes it
+ * with ClosePeFile.
+ */
+typedef bool (*HeaderFileHandler)(void *context, const char *path, PeFile *headers, unsigned worker, OutBuf *record);
+
+/* Called on a pool worker for every member of an archive, in the same way
+ * as BatchFileHandler. The member points into the archive buffer.
+ */
+typedef bool (*ArchiveMemberHandler)(void *context, const ArMember *member, unsigned worker, OutBuf *record);
+
+/* Called on a pool worker for every image found in a blob by carving, in
+ * the same way as BatchFileHandler. offset is where the image's "MZ" is.
+ */
+typedef bool (*CarveHitHandler)(void *context, PeBuffer blob, size_t offset, unsigned worker, OutBuf *record);
+
+typedef struct
+{
+    uint64_t files;     // files handed to the handler
+    uint64_t failed;    // files the handler could not read
+    bool truncated;     // RunArchive: the archive ends inside a member, after the ones counted
+} BatchTotals;
+
+bool IsBatchInput(const char *path);
+BatchTotals RunBatch(const std::vector<std::string> &inputs,
+                     const BatchOptions *options,
+                     BatchFileHandler handler,
+                     void *context
+                    );
+BatchTotals RunHeaderBatch(const std::vector<std::string> &inputs,
+                           const BatchOptions *options,
+                           HeaderFileHandler handler,
+                           void *context
+                          );
+BatchTotals RunArchive(PeBuffer archive,
+                       const BatchOptions *options,
+                       ArchiveMemberHandler handler,
+                       void *context
+                      );
+BatchTotals RunCarve(PeBuffer blob,
+                     const BatchOptions *options,
+                     CarveHitHandler handler,
+                     void *context
+                    );
+
+#endif // _PEBATCH
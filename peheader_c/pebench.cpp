@@ -0,0 +1,465 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     pebench - Benchmarks libpeheader on a synthetic corpus
+//  File:       pebench.cpp
+//  Author:     Mark Coppa
+//
+//  Writes a deterministic corpus (pesynth.cpp), then times every stage
+//  of the parse over it, file by file: open, header decode, archive
+//  members, the import, export, symbol and CLR decoders, formatting and
+//  close. Prints one JSON line per invocation with throughput and
+//  latency percentiles, so runs on different commits can be appended to
+//  one file and compared.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "pearchive.h"
+#include "peclr.h"
+#include "peexports.h"
+#include "peheader.h"
+#include "peimports.h"
+#include "peoutput.h"
+#include "pesymbols.h"
+#include "pesynth.h"
+
+#define STDOUT_FD 1
+
+#define BENCH_DEFAULT_CORPUS    "bench-corpus"
+#define BENCH_DEFAULT_SEED      0x5045484541444552ull   /* "PEHEADER" */
+#define BENCH_DEFAULT_RUNS      10
+
+typedef enum
+{
+    PHASE_OPEN,
+    PHASE_HEADERS,          // ParsePeImage with no decoders, as every dump starts
+    PHASE_MEMBERS,          // archives: walk the members and parse each one's headers
+    PHASE_IMPORTS,
+    PHASE_EXPORTS,
+    PHASE_SYMBOLS,
+    PHASE_CLR,
+    PHASE_FORMAT,           // text output of everything decoded
+    PHASE_CLOSE,
+    PHASE_TOTAL,
+    PHASES
+} BenchPhase;
+
+static const char *const phaseNames[PHASES] =
+{
+    "open", "headers", "members", "imports", "exports", "symbols", "clr", "format", "close", "total"
+};
+
+/* Latencies of every file that went through a phase, in nanoseconds */
+typedef struct
+{
+    std::vector<uint64_t> samples[PHASES];
+    uint64_t kindFiles[SYNTH_KINDS];
+    uint64_t kindBytes[SYNTH_KINDS];
+    uint64_t kindNanoseconds[SYNTH_KINDS];
+    uint64_t failures;
+} BenchResults;
+
+typedef std::chrono::steady_clock BenchClock;
+
+
+static void Usage()
+{
+    printf("Usage: pebench [options]\n"
+           "    [--corpus <dir>] where to write the synthetic corpus (default: " BENCH_DEFAULT_CORPUS ")\n"
+           "    [--seed <n>] seed of the corpus; the same seed gives the same files\n"
+           "    [--scale <n>] multiply the number of files of every kind (default: 1)\n"
+           "    [--runs <n>] timed passes over the corpus after one warm-up pass (default: 10)\n"
+           "    [--label <text>] recorded with the results, e.g. the commit measured\n"
+           "    [--generate-only] write the corpus and stop\n"
+           "    results are one JSON line on stdout\n");
+}
+
+
+/* Nanoseconds    Elapsed time since a mark, which moves to now
+ */
+static uint64_t Nanoseconds(BenchClock::time_point *mark)
+{
+    BenchClock::time_point now = BenchClock::now();
+    uint64_t elapsed = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - *mark).count();
+    *mark = now;
+    return elapsed;
+}
+
+
+/* BenchMembers    Parse the headers of every member of an archive the
+ *                 way a dump does: objects fully, import and linker
+ *                 members through their own parsers
+ * Returns         Members seen
+ */
+static uint64_t BenchMembers(PeBuffer buffer)
+{
+    ArIterator it;
+    ArMember member;
+    uint64_t members = 0;
+
+    if (!InitArIterator(&it, buffer))
+    {
+        return 0;
+    }
+    while (NextArMember(&it, &member))
+    {
+        ShortImport import;
+        ArLinkerMember linker;
+        switch (member.kind)
+        {
+        case AR_OBJECT:
+        {
+            PeImage object = ParseCoffObject(member.data);
+            members += object.isCOFF ? 1 : 0;
+            break;
+        }
+        case AR_IMPORT:
+            members += ParseShortImport(member.data, &import) ? 1 : 0;
+            break;
+        case AR_FIRST_LINKER:
+        case AR_SECOND_LINKER:
+            members += ParseLinkerMember(&member, &linker) ? 1 : 0;
+            break;
+        default:
+            break;
+        }
+    }
+    return members;
+}
+
+
+/* BenchFile    Time every stage of one file
+ * Parameters   File, results to add to, output buffer reused between files
+ * Returns      false if the file could not be opened
+ */
+static bool BenchFile(const SynthFile *file, BenchResults *results, OutBuf *out)
+{
+    static const OutputOptions text = { FORMAT_TEXT, false };
+    uint64_t elapsed[PHASES];
+    bool ran[PHASES] = { false };
+    BenchClock::time_point start = BenchClock::now();
+    BenchClock::time_point mark = start;
+
+    PeFile pe;
+    if (!OpenPeFile(file->path.c_str(), &pe))
+    {
+        return false;
+    }
+    elapsed[PHASE_OPEN] = Nanoseconds(&mark);
+    ran[PHASE_OPEN] = true;
+
+    PeImage image = ParsePeImage(pe.buffer);
+    elapsed[PHASE_HEADERS] = Nanoseconds(&mark);
+    ran[PHASE_HEADERS] = true;
+
+    if (image.isArchive)
+    {
+        BenchMembers(pe.buffer);
+        elapsed[PHASE_MEMBERS] = Nanoseconds(&mark);
+        ran[PHASE_MEMBERS] = true;
+    }
+
+    /* The decoders ParsePeImage would run for -i -e -s --clr, called one
+     * at a time so each gets its own clock */
+    if (image.isPE && !image.isCOFF)
+    {
+        if (DecodeImports(pe.buffer, &image, NULL))
+        {
+            image.decoded |= PARSE_IMPORTS;
+        }
+        elapsed[PHASE_IMPORTS] = Nanoseconds(&mark);
+        ran[PHASE_IMPORTS] = true;
+
+        if (DecodeExports(pe.buffer, &image, NULL))
+        {
+            image.decoded |= PARSE_EXPORTS;
+        }
+        elapsed[PHASE_EXPORTS] = Nanoseconds(&mark);
+        ran[PHASE_EXPORTS] = true;
+    }
+    if (image.isCOFF)
+    {
+        if (DecodeSymbols(pe.buffer, &image, NULL))
+        {
+            image.decoded |= PARSE_SYMBOLS;
+        }
+        elapsed[PHASE_SYMBOLS] = Nanoseconds(&mark);
+        ran[PHASE_SYMBOLS] = true;
+    }
+    if (image.isManaged)
+    {
+        if (DecodeClr(pe.buffer, &image, NULL))
+        {
+            image.decoded |= PARSE_CLR;
+        }
+        elapsed[PHASE_CLR] = Nanoseconds(&mark);
+        ran[PHASE_CLR] = true;
+    }
+
+    out->len = 0;
+    FormatImage(out, &text, file->path.c_str(), &image);
+    elapsed[PHASE_FORMAT] = Nanoseconds(&mark);
+    ran[PHASE_FORMAT] = true;
+
+    ClosePeFile(&pe);
+    elapsed[PHASE_CLOSE] = Nanoseconds(&mark);
+    ran[PHASE_CLOSE] = true;
+
+    elapsed[PHASE_TOTAL] = Nanoseconds(&start);
+    ran[PHASE_TOTAL] = true;
+
+    for (int p = 0; p < PHASES; ++p)
+    {
+        if (ran[p])
+        {
+            results->samples[p].push_back(elapsed[p]);
+        }
+    }
+    results->kindFiles[file->kind] += 1;
+    results->kindBytes[file->kind] += file->size;
+    results->kindNanoseconds[file->kind] += elapsed[PHASE_TOTAL];
+    return true;
+}
+
+
+/* AppendNumber    Append a JSON number with a fixed number of decimals
+ */
+static void AppendNumber(OutBuf *out, double value, int decimals)
+{
+    char text[64];
+    snprintf(text, sizeof(text), "%.*f", decimals, value);
+    AppendString(out, text);
+}
+
+
+/* AppendKey    Append ,"key": or "key": for the first member of an object
+ */
+static void AppendKey(OutBuf *out, const char *key, bool first = false)
+{
+    AppendString(out, first ? "\"" : ",\"");
+    AppendString(out, key);
+    AppendString(out, "\":");
+}
+
+
+/* Percentile    Nearest rank percentile of sorted samples
+ */
+static uint64_t Percentile(const std::vector<uint64_t> &sorted, unsigned percent)
+{
+    size_t rank = (sorted.size() * percent + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+
+/* AppendThroughput    Append files, bytes and their rates over a time
+ */
+static void AppendThroughput(OutBuf *out, uint64_t files, uint64_t bytes, uint64_t nanoseconds)
+{
+    double seconds = nanoseconds / 1e9;
+    AppendKey(out, "files", true);
+    AppendDec(out, files);
+    AppendKey(out, "bytes");
+    AppendDec(out, bytes);
+    AppendKey(out, "seconds");
+    AppendNumber(out, seconds, 6);
+    AppendKey(out, "filesPerSec");
+    AppendNumber(out, seconds > 0 ? files / seconds : 0, 1);
+    AppendKey(out, "bytesPerSec");
+    AppendNumber(out, seconds > 0 ? bytes / seconds : 0, 0);
+}
+
+
+/* FormatResults    One JSON object holding everything measured
+ */
+static void FormatResults(OutBuf *out, BenchResults *results, const SynthOptions *synth, unsigned runs,
+                          const char *label, uint64_t corpusFiles, uint64_t corpusBytes)
+{
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    uint64_t nanoseconds = 0;
+    for (int k = 0; k < SYNTH_KINDS; ++k)
+    {
+        files += results->kindFiles[k];
+        bytes += results->kindBytes[k];
+        nanoseconds += results->kindNanoseconds[k];
+    }
+
+    AppendString(out, "{\"benchmark\":\"pebench\"");
+    AppendKey(out, "label");
+    AppendJsonString(out, label, strlen(label));
+    AppendKey(out, "corpusVersion");
+    AppendDec(out, SYNTH_VERSION);
+    AppendKey(out, "seed");
+    AppendDec(out, synth->seed);
+    AppendKey(out, "scale");
+    AppendDec(out, synth->scale);
+    AppendKey(out, "runs");
+    AppendDec(out, runs);
+    AppendKey(out, "corpusFiles");
+    AppendDec(out, corpusFiles);
+    AppendKey(out, "corpusBytes");
+    AppendDec(out, corpusBytes);
+    AppendKey(out, "failures");
+    AppendDec(out, results->failures);
+
+    AppendKey(out, "overall");
+    AppendChar(out, '{');
+    AppendThroughput(out, files, bytes, nanoseconds);
+    AppendChar(out, '}');
+
+    AppendKey(out, "kinds");
+    AppendChar(out, '{');
+    for (int k = 0; k < SYNTH_KINDS; ++k)
+    {
+        AppendKey(out, SynthKindName((SynthKind)k), k == 0);
+        AppendChar(out, '{');
+        AppendThroughput(out, results->kindFiles[k], results->kindBytes[k], results->kindNanoseconds[k]);
+        AppendChar(out, '}');
+    }
+    AppendChar(out, '}');
+
+    AppendKey(out, "phases");
+    AppendChar(out, '{');
+    bool first = true;
+    for (int p = 0; p < PHASES; ++p)
+    {
+        std::vector<uint64_t> &samples = results->samples[p];
+        if (samples.empty())
+        {
+            continue;
+        }
+        std::sort(samples.begin(), samples.end());
+        uint64_t sum = 0;
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            sum += samples[i];
+        }
+
+        AppendKey(out, phaseNames[p], first);
+        first = false;
+        AppendChar(out, '{');
+        AppendKey(out, "count", true);
+        AppendDec(out, samples.size());
+        AppendKey(out, "meanNs");
+        AppendDec(out, sum / samples.size());
+        AppendKey(out, "p50Ns");
+        AppendDec(out, Percentile(samples, 50));
+        AppendKey(out, "p90Ns");
+        AppendDec(out, Percentile(samples, 90));
+        AppendKey(out, "p99Ns");
+        AppendDec(out, Percentile(samples, 99));
+        AppendKey(out, "maxNs");
+        AppendDec(out, samples.back());
+        AppendChar(out, '}');
+    }
+    AppendString(out, "}}\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *corpus = BENCH_DEFAULT_CORPUS;
+    const char *label = "";
+    SynthOptions synth = { BENCH_DEFAULT_SEED, 1 };
+    unsigned runs = BENCH_DEFAULT_RUNS;
+    bool generateOnly = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+
+        if (strcmp(arg, "-?") == 0 || strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0)
+        {
+            Usage();
+            exit(0);
+        }
+        else if (strcmp(arg, "--corpus") == 0 && i + 1 < argc)
+        {
+            corpus = argv[++i];
+        }
+        else if (strcmp(arg, "--seed") == 0 && i + 1 < argc)
+        {
+            synth.seed = strtoull(argv[++i], NULL, 0);
+        }
+        else if (strcmp(arg, "--scale") == 0 && i + 1 < argc)
+        {
+            synth.scale = (uint32_t)strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(arg, "--runs") == 0 && i + 1 < argc)
+        {
+            runs = (unsigned)strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(arg, "--label") == 0 && i + 1 < argc)
+        {
+            label = argv[++i];
+        }
+        else if (strcmp(arg, "--generate-only") == 0)
+        {
+            generateOnly = true;
+        }
+        else
+        {
+            Usage();
+            exit(1);
+        }
+    }
+    if (synth.scale == 0 || runs == 0)
+    {
+        fprintf(stderr, "Error: --scale and --runs must be at least 1\n");
+        exit(1);
+    }
+
+    std::vector<SynthFile> files;
+    if (!GenerateCorpus(corpus, &synth, &files))
+    {
+        fprintf(stderr, "Error: could not write the corpus to %s\n", corpus);
+        exit(1);
+    }
+    uint64_t corpusBytes = 0;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        corpusBytes += files[i].size;
+    }
+    if (generateOnly)
+    {
+        fprintf(stderr, "%u files, %llu bytes written to %s\n", (unsigned)files.size(),
+                (unsigned long long)corpusBytes, corpus);
+        return 0;
+    }
+
+    /* The warm-up pass pulls the corpus into the page cache and the
+     * allocator up to size; only later passes are kept */
+    OutBuf out;
+    InitOutBuf(&out, 1 << 16);
+    BenchResults warmUp = BenchResults();
+    BenchResults results = BenchResults();
+    for (unsigned run = 0; run <= runs; ++run)
+    {
+        BenchResults *into = run == 0 ? &warmUp : &results;
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            if (!BenchFile(&files[i], into, &out))
+            {
+                into->failures += 1;
+            }
+        }
+    }
+
+    out.len = 0;
+    FormatResults(&out, &results, &synth, runs, label, files.size(), corpusBytes);
+    bool ok = WriteOutBuf(&out, STDOUT_FD);
+    FreeOutBuf(&out);
+    if (results.failures > 0)
+    {
+        fprintf(stderr, "Warning: %llu files could not be opened\n", (unsigned long long)results.failures);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,379 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pecache.cpp
+//  Author:     Mark Coppa
+//
+//  Incremental scan cache: remembers the output produced for each file by
+//  identity (device, inode, size, mtime and path) so unchanged files can be
+//  skipped on the next run. The cache file is one open addressing table of
+//  fixed size slots followed by the records they point at, mapped and
+//  probed in place.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pecache.h"
+#include "pedigest.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#include <sys/stat.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The scan cache file is read by mapping the structs; add byte swapping for big endian hosts"
+#endif
+
+static_assert(sizeof(CacheSlot) == 72, "CacheSlot must stay 72 bytes with no padding");
+
+#define CACHE_MIN_SLOTS 1024     /* Smallest table written */
+
+
+/* GetFileIdentity    stat a file for its cache key
+ * Parameters         File name, identity to fill
+ * Returns            false if the file can't be stat'ed or isn't a regular file
+ */
+bool GetFileIdentity(const char *path, FileIdentity *id)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG)
+    {
+        return false;
+    }
+
+    id->device = (uint64_t)st.st_dev;
+    id->inode = (uint64_t)st.st_ino;
+    id->size = (uint64_t)st.st_size;
+#if defined(_WIN32)
+    id->mtime = (uint64_t)st.st_mtime * 1000000000ull;
+#elif defined(__APPLE__)
+    id->mtime = (uint64_t)st.st_mtimespec.tv_sec * 1000000000ull + st.st_mtimespec.tv_nsec;
+#else
+    id->mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+#endif
+    id->pathHash = HashBytes(path, strlen(path));
+
+    return true;
+}
+
+
+/* HashFileContents    Hash a whole file for --cache-verify
+ * Parameters          File name, hash to fill
+ * Returns             false if the whole file could not be read
+ */
+bool HashFileContents(const char *path, uint64_t *hash)
+{
+    PeFile pe;
+    if (!OpenPeFile(path, &pe))
+    {
+        return false;
+    }
+
+    bool ok = pe.complete;
+    if (ok)
+    {
+        *hash = HashBytes(pe.buffer.data, pe.buffer.size);
+    }
+
+    ClosePeFile(&pe);
+    return ok;
+}
+
+
+ScanCache::ScanCache()
+    : options(0), runStart(0), loaded(false), slots(NULL), slotCount(0), records(NULL), recordSize(0),
+      hit(NULL), lookups(0), hits(0)
+{
+    memset(&file, 0, sizeof(file));
+}
+
+
+ScanCache::~ScanCache()
+{
+    if (loaded)
+    {
+        ClosePeFile(&file);
+    }
+    delete[] hit;
+}
+
+
+/* SlotIndex    Home slot hash of an identity under an options key
+ */
+uint64_t ScanCache::SlotIndex(const FileIdentity *id, uint32_t options)
+{
+    return HashBytes(id, sizeof(*id), options);
+}
+
+
+/* SameKey    Check whether two slots are for the same file version
+ */
+bool ScanCache::SameKey(const CacheSlot *a, const CacheSlot *b)
+{
+    return a->options == b->options && memcmp(&a->id, &b->id, sizeof(a->id)) == 0;
+}
+
+
+/* Load          Map the cache left by the previous run
+ * Parameters    Cache file name, options key of this run
+ * Returns       false if the file exists but is not a usable cache; the
+ *               run then starts with an empty cache and Save replaces it
+ */
+bool ScanCache::Load(const char *cachePath, uint32_t runOptions)
+{
+    path = cachePath;
+    options = runOptions;
+    runStart = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+
+    struct stat st;
+    if (stat(cachePath, &st) != 0)
+    {
+        return true;    // first run
+    }
+
+    if (!OpenWholeFile(cachePath, &file))
+    {
+        return false;
+    }
+
+    const FileHeader *header = (const FileHeader *)file.buffer.data;
+    size_t size = file.buffer.size;
+
+    bool valid = file.complete && size >= sizeof(FileHeader) &&
+                 header->magic == SCAN_CACHE_MAGIC && header->version == SCAN_CACHE_VERSION &&
+                 header->slotCount != 0 && (header->slotCount & (header->slotCount - 1)) == 0 &&
+                 header->slotCount <= (size - sizeof(FileHeader)) / sizeof(CacheSlot) &&
+                 header->recordSize == size - sizeof(FileHeader) - header->slotCount * sizeof(CacheSlot);
+    if (!valid)
+    {
+        ClosePeFile(&file);
+        return false;
+    }
+
+    loaded = true;
+    slots = (const CacheSlot *)(file.buffer.data + sizeof(FileHeader));
+    slotCount = header->slotCount;
+    records = (const uint8_t *)(slots + slotCount);
+    recordSize = header->recordSize;
+
+    hit = new std::atomic<uint8_t>[slotCount];
+    for (uint64_t i = 0; i < slotCount; ++i)
+    {
+        hit[i].store(0, std::memory_order_relaxed);
+    }
+
+    return true;
+}
+
+
+/* Lookup        Find the stored output for a file version
+ * Parameters    Identity of the file, its content hash (0 to not check
+ *               content), where to return the record
+ * Returns       true on a hit
+ */
+bool ScanCache::Lookup(const FileIdentity *id, uint64_t contentHash, CachedRecord *found)
+{
+    lookups.fetch_add(1, std::memory_order_relaxed);
+    if (!loaded)
+    {
+        return false;
+    }
+
+    CacheSlot key;
+    key.id = *id;
+    key.options = options;
+
+    uint64_t mask = slotCount - 1;
+    uint64_t i = SlotIndex(id, options) & mask;
+
+    for (uint64_t probes = 0; probes < slotCount; ++probes, i = (i + 1) & mask)
+    {
+        const CacheSlot *slot = &slots[i];
+        if (!(slot->flags & CACHE_SLOT_USED))
+        {
+            return false;
+        }
+        if (!SameKey(slot, &key))
+        {
+            continue;
+        }
+
+        if ((contentHash != 0 && slot->contentHash != contentHash) ||
+            slot->recordOffset > recordSize || recordSize - slot->recordOffset < slot->recordLength)
+        {
+            return false;
+        }
+
+        found->record.data = records + slot->recordOffset;
+        found->record.size = slot->recordLength;
+        found->flags = slot->flags & ~CACHE_SLOT_USED;
+
+        hit[i].store(1, std::memory_order_relaxed);
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    return false;
+}
+
+
+/* Store         Remember the output produced for a file version
+ * Parameters    Identity of the file, its content hash (0 if not
+ *               computed), caller flags (low 7 bits), the output
+ *
+ * Files modified within SCAN_CACHE_RACY_NS of the run start are not
+ * stored: a second write inside the same timestamp tick would leave the
+ * identity unchanged and the cached output stale.
+ */
+void ScanCache::Store(const FileIdentity *id, uint64_t contentHash, uint8_t flags, const char *record, size_t length)
+{
+    if (id->mtime + SCAN_CACHE_RACY_NS >= runStart || length > UINT32_MAX)
+    {
+        return;
+    }
+
+    Pending entry;
+    memset(&entry.slot, 0, sizeof(entry.slot));
+    entry.slot.id = *id;
+    entry.slot.contentHash = contentHash;
+    entry.slot.recordLength = (uint32_t)length;
+    entry.slot.options = options;
+    entry.slot.flags = (uint8_t)((flags & ~CACHE_SLOT_USED) | CACHE_SLOT_USED);
+
+    Shard *shard = &shards[(SlotIndex(id, options) >> 32) & (SHARD_COUNT - 1)];
+    std::lock_guard<std::mutex> guard(shard->lock);
+
+    char *copy = (char *)shard->storage.Alloc(length, 1);
+    memcpy(copy, record, length);
+    entry.record = copy;
+    shard->entries.push_back(entry);
+}
+
+
+/* Save          Write the new cache file and replace the old one
+ * Parameters    Where to return the number of entries written
+ * Returns       false if the file could not be written; the old cache
+ *               is left in place
+ *
+ * Entries stored this run come first, then old entries that were not
+ * replaced. Old entries age by one run unless they were hit, and are
+ * dropped past SCAN_CACHE_MAX_AGE so deleted files don't linger.
+ */
+bool ScanCache::Save(uint64_t *entries)
+{
+    uint64_t total = 0;
+    for (int s = 0; s < SHARD_COUNT; ++s)
+    {
+        total += shards[s].entries.size();
+    }
+    for (uint64_t i = 0; i < slotCount; ++i)
+    {
+        total += (slots[i].flags & CACHE_SLOT_USED) ? 1 : 0;
+    }
+
+    /* Keep the load factor at or below 3/4 */
+    uint64_t newCount = CACHE_MIN_SLOTS;
+    while (newCount * 3 < total * 4)
+    {
+        newCount *= 2;
+    }
+
+    std::vector<CacheSlot> table(newCount);     // zeroed: every slot empty
+    std::vector<const char *> sources;
+    std::vector<uint64_t> order;
+    sources.reserve(total);
+    order.reserve(total);
+    uint64_t mask = newCount - 1;
+    uint64_t offset = 0;
+
+    auto insert = [&](const CacheSlot &slot, const char *source)
+    {
+        uint64_t i = SlotIndex(&slot.id, slot.options) & mask;
+        while (table[i].flags & CACHE_SLOT_USED)
+        {
+            if (SameKey(&table[i], &slot))
+            {
+                return;
+            }
+            i = (i + 1) & mask;
+        }
+
+        table[i] = slot;
+        table[i].recordOffset = offset;
+        offset += slot.recordLength;
+        sources.push_back(source);
+        order.push_back(i);
+    };
+
+    for (int s = 0; s < SHARD_COUNT; ++s)
+    {
+        for (size_t e = 0; e < shards[s].entries.size(); ++e)
+        {
+            insert(shards[s].entries[e].slot, shards[s].entries[e].record);
+        }
+    }
+
+    for (uint64_t i = 0; i < slotCount; ++i)
+    {
+        CacheSlot slot = slots[i];
+        if (!(slot.flags & CACHE_SLOT_USED) ||
+            slot.recordOffset > recordSize || recordSize - slot.recordOffset < slot.recordLength)
+        {
+            continue;
+        }
+
+        slot.age = hit[i].load(std::memory_order_relaxed) ? 0 : slot.age + 1;
+        if (slot.age > SCAN_CACHE_MAX_AGE)
+        {
+            continue;
+        }
+        insert(slot, (const char *)records + slot.recordOffset);
+    }
+
+    std::string temp = path + ".tmp";
+    FILE *out = fopen(temp.c_str(), "wb");
+    if (out == NULL)
+    {
+        return false;
+    }
+
+    FileHeader header = { SCAN_CACHE_MAGIC, SCAN_CACHE_VERSION, newCount, offset, 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(table.data(), sizeof(CacheSlot), newCount, out) == newCount;
+
+    for (size_t n = 0; ok && n < order.size(); ++n)
+    {
+        uint32_t length = table[order[n]].recordLength;
+        ok = length == 0 || fwrite(sources[n], length, 1, out) == 1;
+    }
+
+    ok = fclose(out) == 0 && ok;
+
+    /* The old records have been copied; let go of the mapping so the file
+     * can be replaced */
+    if (loaded)
+    {
+        ClosePeFile(&file);
+        loaded = false;
+        slots = NULL;
+        slotCount = 0;
+    }
+
+#ifdef _WIN32
+    if (ok)
+    {
+        remove(path.c_str());
+    }
+#endif
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0)
+    {
+        remove(temp.c_str());
+        return false;
+    }
+
+    *entries = order.size();
+    return true;
+}
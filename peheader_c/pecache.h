@@ -0,0 +1,130 @@
+#ifndef _PECACHE
+#define _PECACHE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pearena.h"
+#include "pefile.h"
+
+#define SCAN_CACHE_MAGIC     0x43484550  /* "PEHC" */
+#define SCAN_CACHE_VERSION   3
+#define SCAN_CACHE_MAX_AGE   16          /* Runs an entry survives without being hit */
+#define SCAN_CACHE_RACY_NS   2000000000ull  /* Files modified this close to the run start aren't stored */
+
+#define CACHE_SLOT_USED      0x80        /* Slot flag kept by the cache; callers own the low 7 bits */
+
+/* What identifies one version of a file without reading it. The path is
+ * part of the identity because cached output names the file.
+ */
+typedef struct
+{
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    uint64_t mtime;         // nanoseconds since the epoch
+    uint64_t pathHash;
+} FileIdentity;
+
+/* One slot of the on-disk hash table, 72 bytes */
+typedef struct
+{
+    FileIdentity id;
+    uint64_t contentHash;       // HashBytes of the whole file, 0 if not computed
+    uint64_t recordOffset;      // from the start of the record area
+    uint32_t recordLength;
+    uint32_t options;           // the options key of the run that stored it
+    uint8_t flags;              // CACHE_SLOT_USED and caller flags
+    uint8_t age;                // runs since the entry was last hit
+    uint8_t reserved[6];
+} CacheSlot;
+
+/* A cache hit. record points into the cache mapping and stays valid until
+ * the cache is saved or destroyed.
+ */
+typedef struct
+{
+    PeBuffer record;
+    uint8_t flags;              // caller flags given to Store
+} CachedRecord;
+
+bool GetFileIdentity(const char *path, FileIdentity *id);
+bool HashFileContents(const char *path, uint64_t *hash);
+
+/* Persistent map from file identity to the output produced for that file.
+ * The previous run's cache file is mapped read-only and probed in place,
+ * so a lookup is a stat plus a few memory reads and needs no locks. Files
+ * parsed in this run are collected in sharded memory, and Save writes the
+ * surviving old entries and the new ones to a fresh file that replaces the
+ * old one. Entries belong to the options key they were stored under, so
+ * runs with different options share one cache file without mixing output.
+ */
+class ScanCache
+{
+public:
+    ScanCache();
+    ~ScanCache();
+
+    bool Load(const char *path, uint32_t options);
+    bool Lookup(const FileIdentity *id, uint64_t contentHash, CachedRecord *found);
+    void Store(const FileIdentity *id, uint64_t contentHash, uint8_t flags, const char *record, size_t length);
+    bool Save(uint64_t *entries);
+
+    uint64_t Lookups() const { return lookups.load(); }
+    uint64_t Hits() const { return hits.load(); }
+
+    ScanCache(const ScanCache &) = delete;
+    ScanCache &operator=(const ScanCache &) = delete;
+
+private:
+    enum { SHARD_COUNT = 64 };
+
+    typedef struct
+    {
+        uint32_t magic;             // SCAN_CACHE_MAGIC
+        uint32_t version;           // SCAN_CACHE_VERSION
+        uint64_t slotCount;         // a power of two
+        uint64_t recordSize;        // bytes in the record area, which follows the slots
+        uint64_t reserved;
+    } FileHeader;
+
+    struct Pending
+    {
+        CacheSlot slot;
+        const char *record;         // in the shard's arena
+    };
+
+    struct Shard
+    {
+        std::mutex lock;
+        std::vector<Pending> entries;
+        Arena storage;
+    };
+
+    static uint64_t SlotIndex(const FileIdentity *id, uint32_t options);
+    static bool SameKey(const CacheSlot *a, const CacheSlot *b);
+
+    std::string path;
+    uint32_t options;
+    uint64_t runStart;              // nanoseconds since the epoch
+
+    PeFile file;                    // previous run's cache, if any
+    bool loaded;
+    const CacheSlot *slots;
+    uint64_t slotCount;
+    const uint8_t *records;
+    uint64_t recordSize;
+    std::atomic<uint8_t> *hit;      // per old slot: looked up this run
+
+    std::atomic<uint64_t> lookups;
+    std::atomic<uint64_t> hits;
+
+    Shard shards[SHARD_COUNT];
+};
+
+#endif // _PECACHE
@@ -0,0 +1,211 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pecarve.cpp
+//  Author:     Mark Coppa
+//
+//  Finds PE images embedded anywhere in a blob: installers, overlays,
+//  firmware and memory dumps. Every "MZ" is a candidate, found with a
+//  vector compare of the blob against itself shifted by one byte; a
+//  candidate is a hit when its e_lfanew is sane and points at "PE\0\0".
+//
+//  Callers split a blob into ranges of candidate offsets, not of bytes, and
+//  scan them in parallel. A scan reads past the end of its range whenever
+//  a header does, so an image whose headers straddle a range boundary is
+//  found exactly once, by the range holding its "MZ".
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pecarve.h"
+#include "pesimd.h"
+
+#include <string.h>
+
+/* Next "MZ" at an offset in [from, end); returns end if there is none.
+ * The 'Z' may sit at end, so kernels read up to one byte past the range
+ * but never past size. */
+typedef size_t (*FindMzFn)(const uint8_t *data, size_t from, size_t end, size_t size);
+
+
+/* FindMzScalar    memchr for the 'M', then check the 'Z'
+ */
+static size_t FindMzScalar(const uint8_t *data, size_t from, size_t end, size_t size)
+{
+    size_t limit = end < size ? end : size - 1;     // an 'M' in the last byte has no 'Z'
+
+    while (from < limit)
+    {
+        const uint8_t *m = (const uint8_t *)memchr(data + from, 'M', limit - from);
+        if (m == NULL)
+        {
+            break;
+        }
+
+        size_t i = m - data;
+        if (data[i + 1] == 'Z')
+        {
+            return i;
+        }
+        from = i + 1;
+    }
+
+    return end;
+}
+
+
+#ifdef SIMD_X86
+
+/* FindMzSse2    16 candidates per step: bytes equal to 'M' and, one byte
+ *               further on, bytes equal to 'Z'
+ */
+TARGET_SSE2
+static size_t FindMzSse2(const uint8_t *data, size_t from, size_t end, size_t size)
+{
+    const __m128i m = _mm_set1_epi8('M');
+    const __m128i z = _mm_set1_epi8('Z');
+
+    while (from < end && from + 17 <= size)
+    {
+        __m128i first = _mm_loadu_si128((const __m128i *)(data + from));
+        __m128i second = _mm_loadu_si128((const __m128i *)(data + from + 1));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, m), _mm_cmpeq_epi8(second, z)));
+        if (mask != 0)
+        {
+            size_t i = from + LowestSetBit(mask);
+            return i < end ? i : end;
+        }
+        from += 16;
+    }
+
+    return from < end ? FindMzScalar(data, from, end, size) : end;
+}
+
+
+/* FindMzAvx2    FindMzSse2 with 32 candidates per step
+ */
+TARGET_AVX2
+static size_t FindMzAvx2(const uint8_t *data, size_t from, size_t end, size_t size)
+{
+    const __m256i m = _mm256_set1_epi8('M');
+    const __m256i z = _mm256_set1_epi8('Z');
+
+    while (from < end && from + 33 <= size)
+    {
+        __m256i first = _mm256_loadu_si256((const __m256i *)(data + from));
+        __m256i second = _mm256_loadu_si256((const __m256i *)(data + from + 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, m),
+                                                                        _mm256_cmpeq_epi8(second, z)));
+        if (mask != 0)
+        {
+            size_t i = from + LowestSetBit(mask);
+            return i < end ? i : end;
+        }
+        from += 32;
+    }
+
+    return from < end ? FindMzScalar(data, from, end, size) : end;
+}
+
+#endif // SIMD_X86
+
+
+typedef struct
+{
+    FindMzFn find;
+    const char *name;
+} CarveKernel;
+
+/* PickKernel    Choose the widest kernel the CPU runs, once
+ */
+static const CarveKernel &PickKernel()
+{
+    static const CarveKernel kernel = []() {
+#ifdef SIMD_X86
+        if (CpuHasAvx2())
+        {
+            return CarveKernel{ FindMzAvx2, "avx2" };
+        }
+#ifdef SIMD_SSE2
+        return CarveKernel{ FindMzSse2, "sse2" };
+#endif
+#endif
+        return CarveKernel{ FindMzScalar, "scalar" };
+    }();
+    return kernel;
+}
+
+
+/* IsImageAt     Check whether a PE image starts at an offset
+ * Parameters    Blob, offset of the candidate "MZ"
+ * Returns       true if e_lfanew is in range and points at "PE\0\0"
+ *               followed by a whole COFF file header
+ */
+bool IsImageAt(PeBuffer blob, size_t offset)
+{
+    if (offset > blob.size || blob.size - offset < 0x40)
+    {
+        return false;
+    }
+
+    const uint8_t *p = blob.data + offset;
+    if (p[0] != 'M' || p[1] != 'Z')
+    {
+        return false;
+    }
+
+    uint32_t lfanew = ReadDword(p + 0x3C);
+    if (lfanew < CARVE_MIN_LFANEW || lfanew > CARVE_MAX_LFANEW || blob.size - offset < (size_t)lfanew + 4 + 20)
+    {
+        return false;
+    }
+
+    const uint8_t *sig = p + lfanew;
+    return sig[0] == 'P' && sig[1] == 'E' && sig[2] == 0 && sig[3] == 0;
+}
+
+
+/* ScanForImages    Find every embedded image starting in a range
+ * Parameters       Blob, range of candidate offsets [begin, end), hits to
+ *                  append to in ascending order
+ */
+void ScanForImages(PeBuffer blob, size_t begin, size_t end, std::vector<size_t> *hits)
+{
+    FindMzFn find = PickKernel().find;
+
+    if (end > blob.size)
+    {
+        end = blob.size;
+    }
+    if (blob.size < 2)
+    {
+        return;
+    }
+
+    for (size_t i = find(blob.data, begin, end, blob.size); i < end; i = find(blob.data, i + 1, end, blob.size))
+    {
+        if (IsImageAt(blob, i))
+        {
+            hits->push_back(i);
+        }
+    }
+}
+
+
+/* ImageAt       The bytes of an embedded image, for ParsePeImage
+ * Parameters    Blob, offset of the image
+ * Returns       The blob from offset on; the image's own length isn't
+ *               known until its section table has been read
+ */
+PeBuffer ImageAt(PeBuffer blob, size_t offset)
+{
+    PeBuffer image = { blob.data + offset, offset < blob.size ? blob.size - offset : 0 };
+    return image;
+}
+
+
+/* CarveKernelName    Name of the kernel in use, for reports
+ */
+const char *CarveKernelName()
+{
+    return PickKernel().name;
+}
@@ -0,0 +1,20 @@
+#ifndef _PECARVE
+#define _PECARVE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "pefile.h"
+
+#define CARVE_MIN_LFANEW    4           /* Smallest e_lfanew accepted at a candidate */
+#define CARVE_MAX_LFANEW    0x10000     /* Largest e_lfanew accepted at a candidate */
+#define CARVE_CHUNK_SIZE    0x1000000   /* Candidate offsets scanned by one task */
+
+bool IsImageAt(PeBuffer blob, size_t offset);
+void ScanForImages(PeBuffer blob, size_t begin, size_t end, std::vector<size_t> *hits);
+PeBuffer ImageAt(PeBuffer blob, size_t offset);
+const char *CarveKernelName();
+
+#endif // _PECARVE
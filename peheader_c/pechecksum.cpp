@@ -0,0 +1,194 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pechecksum.cpp
+//  Author:     Mark Coppa
+//
+//  The image checksum the loader checks for drivers and boot images: a
+//  16 bit one's complement sum of the file's words, leaving out the
+//  CheckSum field, plus the file length.
+//
+//  One's complement addition doesn't care about order, so the words are
+//  added into wide accumulators with no carry folding in the loop and the
+//  total is folded once at the end. That lets SSE2 and AVX2 kernels keep
+//  up with a mapped file; the kernel is picked from the CPU at first use.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pechecksum.h"
+#include "pesimd.h"
+
+/* 32 bit lanes gain at most 2 * 0xFFFF per step, so they are widened to
+ * 64 bits before this many steps can overflow them */
+#define LANE_FLUSH_STEPS 0x8000
+
+typedef uint64_t (*SumWordsFn)(const uint8_t *data, size_t size);
+
+
+/* SumWordsScalar    Add up little endian 16 bit words
+ * Parameters        Bytes (an even count)
+ * Returns           The plain sum, not yet folded
+ */
+static uint64_t SumWordsScalar(const uint8_t *data, size_t size)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i + 1 < size; i += 2)
+    {
+        sum += data[i] | (data[i + 1] << 8);
+    }
+    return sum;
+}
+
+
+#ifdef SIMD_X86
+
+/* SumWordsSse2    SumWordsScalar, 16 bytes per step: the low and high
+ *                 word of each 32 bit lane are added separately
+ */
+TARGET_SSE2
+static uint64_t SumWordsSse2(const uint8_t *data, size_t size)
+{
+    const __m128i low = _mm_set1_epi32(0xFFFF);
+    __m128i wide = _mm_setzero_si128();
+    size_t steps = size / 16;
+    size_t i = 0;
+
+    while (i < steps)
+    {
+        size_t end = i + LANE_FLUSH_STEPS < steps ? i + LANE_FLUSH_STEPS : steps;
+        __m128i acc = _mm_setzero_si128();
+
+        for (; i < end; ++i)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(data + i * 16));
+            acc = _mm_add_epi32(acc, _mm_and_si128(v, low));
+            acc = _mm_add_epi32(acc, _mm_srli_epi32(v, 16));
+        }
+
+        __m128i zero = _mm_setzero_si128();
+        wide = _mm_add_epi64(wide, _mm_unpacklo_epi32(acc, zero));
+        wide = _mm_add_epi64(wide, _mm_unpackhi_epi32(acc, zero));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, wide);
+    return lanes[0] + lanes[1] + SumWordsScalar(data + steps * 16, size - steps * 16);
+}
+
+
+/* SumWordsAvx2    SumWordsSse2 with 32 bytes per step
+ */
+TARGET_AVX2
+static uint64_t SumWordsAvx2(const uint8_t *data, size_t size)
+{
+    const __m256i low = _mm256_set1_epi32(0xFFFF);
+    __m256i wide = _mm256_setzero_si256();
+    size_t steps = size / 32;
+    size_t i = 0;
+
+    while (i < steps)
+    {
+        size_t end = i + LANE_FLUSH_STEPS < steps ? i + LANE_FLUSH_STEPS : steps;
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+
+        for (; i < end; ++i)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(data + i * 32));
+            acc0 = _mm256_add_epi32(acc0, _mm256_and_si256(v, low));
+            acc1 = _mm256_add_epi32(acc1, _mm256_srli_epi32(v, 16));
+        }
+
+        __m256i zero = _mm256_setzero_si256();
+        wide = _mm256_add_epi64(wide, _mm256_unpacklo_epi32(acc0, zero));
+        wide = _mm256_add_epi64(wide, _mm256_unpackhi_epi32(acc0, zero));
+        wide = _mm256_add_epi64(wide, _mm256_unpacklo_epi32(acc1, zero));
+        wide = _mm256_add_epi64(wide, _mm256_unpackhi_epi32(acc1, zero));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, wide);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+           SumWordsScalar(data + steps * 32, size - steps * 32);
+}
+
+#endif // SIMD_X86
+
+
+typedef struct
+{
+    SumWordsFn sum;
+    const char *name;
+} ChecksumKernel;
+
+/* PickKernel    Choose the widest kernel the CPU runs, once
+ */
+static const ChecksumKernel &PickKernel()
+{
+    static const ChecksumKernel kernel = []() {
+#ifdef SIMD_X86
+        if (CpuHasAvx2())
+        {
+            return ChecksumKernel{ SumWordsAvx2, "avx2" };
+        }
+#ifdef SIMD_SSE2
+        return ChecksumKernel{ SumWordsSse2, "sse2" };
+#endif
+#endif
+        return ChecksumKernel{ SumWordsScalar, "scalar" };
+    }();
+    return kernel;
+}
+
+
+/* SumWords      Add up the little endian 16 bit words of a buffer; an odd
+ *               last byte counts as a word with a zero high byte
+ * Parameters    Bytes, their count
+ * Returns       The plain sum, not yet folded
+ */
+uint64_t SumWords(const uint8_t *data, size_t size)
+{
+    uint64_t sum = PickKernel().sum(data, size & ~(size_t)1);
+    if (size & 1)
+    {
+        sum += data[size - 1];
+    }
+    return sum;
+}
+
+
+/* PeChecksum    Compute the image checksum of a whole file
+ * Parameters    Bytes of the file, the CheckSum value stored in its header
+ * Returns       The checksum the loader would compute
+ *
+ * The stored value is taken back out of the sum the way imagehlp's
+ * CheckSumMappedFile does it, rather than skipping its bytes.
+ */
+uint32_t PeChecksum(PeBuffer file, uint32_t storedCheckSum)
+{
+    uint64_t wide = SumWords(file.data, file.size);
+
+    /* Fold the carries back in until the sum fits in 16 bits */
+    while (wide >> 16)
+    {
+        wide = (wide & 0xFFFF) + (wide >> 16);
+    }
+
+    uint16_t sum = (uint16_t)wide;
+    uint16_t adjust[2] = { (uint16_t)(storedCheckSum & 0xFFFF), (uint16_t)(storedCheckSum >> 16) };
+    for (int i = 0; i < 2; ++i)
+    {
+        sum = (uint16_t)(sum - (sum < adjust[i]));
+        sum = (uint16_t)(sum - adjust[i]);
+    }
+
+    return sum + (uint32_t)file.size;
+}
+
+
+/* ChecksumKernelName    Name of the kernel in use, for reports
+ */
+const char *ChecksumKernelName()
+{
+    return PickKernel().name;
+}
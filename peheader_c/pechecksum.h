@@ -0,0 +1,13 @@
+#ifndef _PECHECKSUM
+#define _PECHECKSUM
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pefile.h"
+
+uint64_t SumWords(const uint8_t *data, size_t size);
+uint32_t PeChecksum(PeBuffer file, uint32_t storedCheckSum);
+const char *ChecksumKernelName();
+
+#endif // _PECHECKSUM
@@ -0,0 +1,668 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       peclr.cpp
+//  Author:     Mark Coppa
+//
+//  Reference:  ECMA-335, Partition II, sections 22 and 24
+//
+//  CLR header and metadata decoder. The metadata tables are stored one
+//  after the other with fixed size rows, but a row's size depends on the
+//  row counts of the tables it points into and on the heap size flags.
+//  Opening the metadata works those widths out from a schema of every
+//  table; after that any row of any table is a multiply away and is only
+//  decoded when asked for.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "peheader.h"
+
+#include <string.h>
+
+#include <string>
+
+/* Column kinds of the table schemas: values below COL_CODED are simple
+ * indexes into that table */
+#define COL_CODED       0x40    /* | a CI_* coded index kind */
+#define COL_U16         0x80
+#define COL_U32         0x81
+#define COL_STRING      0x82
+#define COL_GUID        0x83
+#define COL_BLOB        0x84
+
+#define CI_TYPEDEFORREF         0
+#define CI_HASCONSTANT          1
+#define CI_HASCUSTOMATTRIBUTE   2
+#define CI_HASFIELDMARSHAL      3
+#define CI_HASDECLSECURITY      4
+#define CI_MEMBERREFPARENT      5
+#define CI_HASSEMANTICS         6
+#define CI_METHODDEFORREF       7
+#define CI_MEMBERFORWARDED      8
+#define CI_IMPLEMENTATION       9
+#define CI_CUSTOMATTRIBUTETYPE  10
+#define CI_RESOLUTIONSCOPE      11
+#define CI_TYPEORMETHODDEF      12
+
+#define NO_TABLE        0xFF    /* a coded index tag with no table */
+
+typedef struct
+{
+    uint8_t bits;               // tag bits
+    uint8_t count;
+    uint8_t tables[22];
+} CodedIndexKind;
+
+static const CodedIndexKind codedIndexes[] =
+{
+    { 2, 3, { 0x02, 0x01, 0x1B } },                                         // TypeDefOrRef
+    { 2, 3, { 0x04, 0x08, 0x17 } },                                         // HasConstant
+    { 5, 22, { 0x06, 0x04, 0x01, 0x02, 0x08, 0x09, 0x0A, 0x00, 0x0E, 0x17, 0x14,
+               0x11, 0x1A, 0x1B, 0x20, 0x23, 0x26, 0x27, 0x28, 0x2A, 0x2C, 0x2B } },  // HasCustomAttribute
+    { 1, 2, { 0x04, 0x08 } },                                               // HasFieldMarshal
+    { 2, 3, { 0x02, 0x06, 0x20 } },                                         // HasDeclSecurity
+    { 3, 5, { 0x02, 0x01, 0x1A, 0x06, 0x1B } },                             // MemberRefParent
+    { 1, 2, { 0x14, 0x17 } },                                               // HasSemantics
+    { 1, 2, { 0x06, 0x0A } },                                               // MethodDefOrRef
+    { 1, 2, { 0x04, 0x06 } },                                               // MemberForwarded
+    { 2, 3, { 0x26, 0x23, 0x27 } },                                         // Implementation
+    { 3, 5, { NO_TABLE, NO_TABLE, 0x06, 0x0A, NO_TABLE } },                 // CustomAttributeType
+    { 2, 4, { 0x00, 0x1A, 0x23, 0x01 } },                                   // ResolutionScope
+    { 1, 2, { 0x02, 0x06 } },                                               // TypeOrMethodDef
+};
+
+typedef struct
+{
+    uint8_t count;
+    uint8_t columns[CLR_MAX_COLUMNS];
+} TableSchema;
+
+#define CI(kind) (COL_CODED | CI_##kind)
+
+static const TableSchema schemas[CLR_KNOWN_TABLES] =
+{
+    { 5, { COL_U16, COL_STRING, COL_GUID, COL_GUID, COL_GUID } },                           // 0x00 Module
+    { 3, { CI(RESOLUTIONSCOPE), COL_STRING, COL_STRING } },                                 // 0x01 TypeRef
+    { 6, { COL_U32, COL_STRING, COL_STRING, CI(TYPEDEFORREF), 0x04, 0x06 } },               // 0x02 TypeDef
+    { 1, { 0x04 } },                                                                        // 0x03 FieldPtr
+    { 3, { COL_U16, COL_STRING, COL_BLOB } },                                               // 0x04 Field
+    { 1, { 0x06 } },                                                                        // 0x05 MethodPtr
+    { 6, { COL_U32, COL_U16, COL_U16, COL_STRING, COL_BLOB, 0x08 } },                       // 0x06 MethodDef
+    { 1, { 0x08 } },                                                                        // 0x07 ParamPtr
+    { 3, { COL_U16, COL_U16, COL_STRING } },                                                // 0x08 Param
+    { 2, { 0x02, CI(TYPEDEFORREF) } },                                                      // 0x09 InterfaceImpl
+    { 3, { CI(MEMBERREFPARENT), COL_STRING, COL_BLOB } },                                   // 0x0A MemberRef
+    { 3, { COL_U16, CI(HASCONSTANT), COL_BLOB } },                                          // 0x0B Constant
+    { 3, { CI(HASCUSTOMATTRIBUTE), CI(CUSTOMATTRIBUTETYPE), COL_BLOB } },                   // 0x0C CustomAttribute
+    { 2, { CI(HASFIELDMARSHAL), COL_BLOB } },                                               // 0x0D FieldMarshal
+    { 3, { COL_U16, CI(HASDECLSECURITY), COL_BLOB } },                                      // 0x0E DeclSecurity
+    { 3, { COL_U16, COL_U32, 0x02 } },                                                      // 0x0F ClassLayout
+    { 2, { COL_U32, 0x04 } },                                                               // 0x10 FieldLayout
+    { 1, { COL_BLOB } },                                                                    // 0x11 StandAloneSig
+    { 2, { 0x02, 0x14 } },                                                                  // 0x12 EventMap
+    { 1, { 0x14 } },                                                                        // 0x13 EventPtr
+    { 3, { COL_U16, COL_STRING, CI(TYPEDEFORREF) } },                                       // 0x14 Event
+    { 2, { 0x02, 0x17 } },                                                                  // 0x15 PropertyMap
+    { 1, { 0x17 } },                                                                        // 0x16 PropertyPtr
+    { 3, { COL_U16, COL_STRING, COL_BLOB } },                                               // 0x17 Property
+    { 3, { COL_U16, 0x06, CI(HASSEMANTICS) } },                                             // 0x18 MethodSemantics
+    { 3, { 0x02, CI(METHODDEFORREF), CI(METHODDEFORREF) } },                                // 0x19 MethodImpl
+    { 1, { COL_STRING } },                                                                  // 0x1A ModuleRef
+    { 1, { COL_BLOB } },                                                                    // 0x1B TypeSpec
+    { 4, { COL_U16, CI(MEMBERFORWARDED), COL_STRING, 0x1A } },                              // 0x1C ImplMap
+    { 2, { COL_U32, 0x04 } },                                                               // 0x1D FieldRVA
+    { 2, { COL_U32, COL_U32 } },                                                            // 0x1E EncLog
+    { 1, { COL_U32 } },                                                                     // 0x1F EncMap
+    { 9, { COL_U32, COL_U16, COL_U16, COL_U16, COL_U16, COL_U32, COL_BLOB, COL_STRING, COL_STRING } },  // 0x20 Assembly
+    { 1, { COL_U32 } },                                                                     // 0x21 AssemblyProcessor
+    { 3, { COL_U32, COL_U32, COL_U32 } },                                                   // 0x22 AssemblyOS
+    { 9, { COL_U16, COL_U16, COL_U16, COL_U16, COL_U32, COL_BLOB, COL_STRING, COL_STRING, COL_BLOB } },  // 0x23 AssemblyRef
+    { 2, { COL_U32, 0x23 } },                                                               // 0x24 AssemblyRefProcessor
+    { 4, { COL_U32, COL_U32, COL_U32, 0x23 } },                                             // 0x25 AssemblyRefOS
+    { 3, { COL_U32, COL_STRING, COL_BLOB } },                                               // 0x26 File
+    { 5, { COL_U32, COL_U32, COL_STRING, COL_STRING, CI(IMPLEMENTATION) } },                // 0x27 ExportedType
+    { 4, { COL_U32, COL_U32, COL_STRING, CI(IMPLEMENTATION) } },                            // 0x28 ManifestResource
+    { 2, { 0x02, 0x02 } },                                                                  // 0x29 NestedClass
+    { 4, { COL_U16, COL_U16, CI(TYPEORMETHODDEF), COL_STRING } },                           // 0x2A GenericParam
+    { 2, { CI(METHODDEFORREF), COL_BLOB } },                                                // 0x2B MethodSpec
+    { 2, { 0x2A, CI(TYPEDEFORREF) } },                                                      // 0x2C GenericParamConstraint
+};
+
+
+/* ColumnWidth    Bytes a column takes, given the row counts and heap sizes
+ */
+static uint8_t ColumnWidth(const ClrMetadata *md, uint8_t column)
+{
+    switch (column)
+    {
+    case COL_U16:
+        return 2;
+    case COL_U32:
+        return 4;
+    case COL_STRING:
+        return (md->heapSizes & 0x01) ? 4 : 2;
+    case COL_GUID:
+        return (md->heapSizes & 0x02) ? 4 : 2;
+    case COL_BLOB:
+        return (md->heapSizes & 0x04) ? 4 : 2;
+    }
+
+    if (column & COL_CODED)
+    {
+        /* Wide once the largest table can't be numbered beside the tag */
+        const CodedIndexKind *kind = &codedIndexes[column & ~COL_CODED];
+        uint32_t largest = 0;
+        for (int i = 0; i < kind->count; ++i)
+        {
+            if (kind->tables[i] != NO_TABLE && md->rows[kind->tables[i]] > largest)
+            {
+                largest = md->rows[kind->tables[i]];
+            }
+        }
+        return largest < (1u << (16 - kind->bits)) ? 2 : 4;
+    }
+
+    return md->rows[column] > 0xFFFF ? 4 : 2;
+}
+
+
+/* LayOutTables    Work out column widths, row sizes and table offsets
+ * Parameters      Metadata with rows and heapSizes read, offset of the
+ *                 first table's data in the tables stream
+ */
+static void LayOutTables(ClrMetadata *md, uint64_t offset)
+{
+    for (uint32_t t = 0; t < CLR_KNOWN_TABLES; ++t)
+    {
+        md->rowSize[t] = 0;
+        for (uint32_t c = 0; c < schemas[t].count; ++c)
+        {
+            md->columnWidth[t][c] = ColumnWidth(md, schemas[t].columns[c]);
+            md->rowSize[t] += md->columnWidth[t][c];
+        }
+    }
+
+    /* Tables are stored in table number order; past a table whose layout
+     * isn't known, nothing can be located */
+    md->knownTables = CLR_KNOWN_TABLES;
+    for (uint32_t t = 0; t < CLR_MAX_TABLES; ++t)
+    {
+        if (!(md->valid & (1ull << t)))
+        {
+            continue;
+        }
+        if (t >= CLR_KNOWN_TABLES)
+        {
+            md->knownTables = t;
+            break;
+        }
+
+        md->tableOffset[t] = offset;
+        offset += (uint64_t)md->rows[t] * md->rowSize[t];
+    }
+}
+
+
+/* ReadTablesHeader    Read the #~ stream header and the row counts
+ * Returns             false if the header is cut short
+ */
+static bool ReadTablesHeader(ClrMetadata *md)
+{
+    ByteCursor cur;
+    InitCursor(&cur, md->tables);
+
+    SumBytes(&cur, 4);      // reserved
+    SumBytes(&cur, 2);      // major and minor version
+    md->heapSizes = (uint8_t)SumBytes(&cur, 1);
+    SumBytes(&cur, 1);      // reserved
+    uint32_t validLow = SumBytes(&cur, 4);
+    uint32_t validHigh = SumBytes(&cur, 4);
+    md->valid = validLow | (uint64_t)validHigh << 32;
+    SumBytes(&cur, 4);      // sorted
+    SumBytes(&cur, 4);
+
+    for (uint32_t t = 0; t < CLR_MAX_TABLES; ++t)
+    {
+        if (md->valid & (1ull << t))
+        {
+            md->rows[t] = SumBytes(&cur, 4);
+        }
+    }
+
+    /* Uncompressed (#-) streams may carry 4 more bytes */
+    if (md->heapSizes & 0x40)
+    {
+        SumBytes(&cur, 4);
+    }
+
+    if (cur.overrun)
+    {
+        return false;
+    }
+
+    LayOutTables(md, cur.offset);
+    return true;
+}
+
+
+/* OpenClrMetadata    Locate the CLR header, the metadata root, its streams
+ *                    and every table
+ * Parameters         Parsed image, the buffer it was parsed from, view to fill
+ * Returns            false if the image has no readable CLR metadata
+ */
+bool OpenClrMetadata(const PeImage *image, PeBuffer buffer, ClrMetadata *md)
+{
+    memset(md, 0, sizeof(*md));
+
+    const DataDirectory &dir = image->odd.CLRRuntimeHeader;
+    if (dir.VirtualAddress == 0 || dir.Size == 0)
+    {
+        return false;
+    }
+
+    md->cor20 = RvaToPointer(image, buffer, dir.VirtualAddress, COR20_HEADER_SIZE);
+    if (md->cor20 == NULL)
+    {
+        return false;
+    }
+
+    uint32_t rootRva = ReadDword(md->cor20 + 8);
+    uint32_t rootSize = ReadDword(md->cor20 + 12);
+    uint32_t offset;
+    uint32_t available;
+
+    if (!RvaToOffset(image, rootRva, &offset, &available) || offset >= buffer.size)
+    {
+        return false;
+    }
+    if (available > buffer.size - offset)
+    {
+        available = (uint32_t)(buffer.size - offset);
+    }
+
+    PeBuffer root = { buffer.data + offset, rootSize < available ? rootSize : available };
+    ByteCursor cur;
+    InitCursor(&cur, root);
+
+    if (SumBytes(&cur, 4) != CLR_METADATA_SIGNATURE)
+    {
+        return false;
+    }
+    SumBytes(&cur, 4);      // major and minor version
+    SumBytes(&cur, 4);      // reserved
+    uint32_t length = SumBytes(&cur, 4);
+    md->version.data = TakeBytes(&cur, length);
+    md->version.size = length;
+    SumBytes(&cur, 2);      // flags
+    uint32_t streams = SumBytes(&cur, 2);
+
+    if (cur.overrun)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < streams && md->streamCount < CLR_MAX_STREAMS; ++i)
+    {
+        uint32_t streamOffset = SumBytes(&cur, 4);
+        uint32_t streamSize = SumBytes(&cur, 4);
+
+        /* The name is NUL terminated and padded to 4 bytes, 32 at most */
+        size_t left = cur.size - cur.offset;
+        const char *name = (const char *)cur.data + cur.offset;
+        const char *nul = cur.overrun ? NULL : (const char *)memchr(name, '\0', left < 32 ? left : 32);
+        if (nul == NULL)
+        {
+            break;
+        }
+        TakeBytes(&cur, ((nul - name) + 4) & ~(size_t)3);
+
+        if (streamOffset > root.size)
+        {
+            continue;
+        }
+        if (streamSize > root.size - streamOffset)
+        {
+            streamSize = (uint32_t)(root.size - streamOffset);
+        }
+
+        ClrStream stream = { name, streamOffset, streamSize };
+        md->streams[md->streamCount++] = stream;
+
+        PeBuffer bytes = { root.data + streamOffset, streamSize };
+        if (strcmp(name, "#~") == 0 || strcmp(name, "#-") == 0)
+        {
+            md->tables = bytes;
+        }
+        else if (strcmp(name, "#Strings") == 0)
+        {
+            md->strings = bytes;
+        }
+        else if (strcmp(name, "#US") == 0)
+        {
+            md->userStrings = bytes;
+        }
+        else if (strcmp(name, "#Blob") == 0)
+        {
+            md->blob = bytes;
+        }
+        else if (strcmp(name, "#GUID") == 0)
+        {
+            md->guid = bytes;
+        }
+    }
+
+    return md->tables.data != NULL && ReadTablesHeader(md);
+}
+
+
+/* ClrString    Find a #Strings heap entry
+ * Returns      The NUL terminated UTF-8 string in the file, else NULL if
+ *              the index is out of the heap or the entry is unterminated
+ */
+const char *ClrString(const ClrMetadata *md, uint32_t index)
+{
+    if (index >= md->strings.size)
+    {
+        return NULL;
+    }
+
+    const char *s = (const char *)md->strings.data + index;
+    return memchr(s, '\0', md->strings.size - index) != NULL ? s : NULL;
+}
+
+
+/* ClrBlob    Find a #Blob heap entry
+ * Returns    Its bytes after the compressed length, empty if unreadable
+ */
+PeBuffer ClrBlob(const ClrMetadata *md, uint32_t index)
+{
+    PeBuffer blob = { NULL, 0 };
+    if (index >= md->blob.size)
+    {
+        return blob;
+    }
+
+    const uint8_t *p = md->blob.data + index;
+    size_t left = md->blob.size - index;
+    size_t header;
+    size_t length;
+
+    if ((p[0] & 0x80) == 0)
+    {
+        header = 1;
+        length = p[0];
+    }
+    else if ((p[0] & 0xC0) == 0x80 && left >= 2)
+    {
+        header = 2;
+        length = (size_t)(p[0] & 0x3F) << 8 | p[1];
+    }
+    else if ((p[0] & 0xE0) == 0xC0 && left >= 4)
+    {
+        header = 4;
+        length = (size_t)(p[0] & 0x1F) << 24 | (size_t)p[1] << 16 | (size_t)p[2] << 8 | p[3];
+    }
+    else
+    {
+        return blob;
+    }
+
+    if (length > left - header)
+    {
+        return blob;
+    }
+
+    blob.data = p + header;
+    blob.size = length;
+    return blob;
+}
+
+
+/* RowPointer    Find a row of a table
+ * Parameters    Metadata, table, 1 based row number
+ * Returns       The row's bytes, else NULL if it doesn't exist or isn't
+ *               in the stream
+ */
+static const uint8_t *RowPointer(const ClrMetadata *md, uint32_t table, uint32_t row)
+{
+    if (table >= md->knownTables || row == 0 || row > md->rows[table])
+    {
+        return NULL;
+    }
+
+    uint64_t at = md->tableOffset[table] + (uint64_t)(row - 1) * md->rowSize[table];
+    if (at > md->tables.size || md->tables.size - at < md->rowSize[table])
+    {
+        return NULL;
+    }
+    return md->tables.data + at;
+}
+
+
+/* ReadColumn    Load one column of a row
+ */
+static uint32_t ReadColumn(const ClrMetadata *md, uint32_t table, const uint8_t *row, uint32_t column)
+{
+    for (uint32_t c = 0; c < column; ++c)
+    {
+        row += md->columnWidth[table][c];
+    }
+    return md->columnWidth[table][column] == 2 ? ReadWord(row) : ReadDword(row);
+}
+
+
+/* ReadAssemblyColumns    Decode the columns Assembly and AssemblyRef share
+ * Parameters             Metadata, table, row, first column of the version
+ */
+static bool ReadAssemblyColumns(const ClrMetadata *md, uint32_t table, const uint8_t *p, uint32_t first, ClrAssemblyRow *out)
+{
+    out->MajorVersion = (uint16_t)ReadColumn(md, table, p, first);
+    out->MinorVersion = (uint16_t)ReadColumn(md, table, p, first + 1);
+    out->BuildNumber = (uint16_t)ReadColumn(md, table, p, first + 2);
+    out->RevisionNumber = (uint16_t)ReadColumn(md, table, p, first + 3);
+    out->Flags = ReadColumn(md, table, p, first + 4);
+    out->publicKey = ClrBlob(md, ReadColumn(md, table, p, first + 5));
+    out->name = ClrString(md, ReadColumn(md, table, p, first + 6));
+    out->culture = ClrString(md, ReadColumn(md, table, p, first + 7));
+
+    if (out->culture == NULL)
+    {
+        out->culture = "";
+    }
+    return out->name != NULL;
+}
+
+
+/* ReadClrAssembly    Decode the Assembly row of an assembly's manifest
+ * Returns            false if the image is a module with no manifest
+ */
+bool ReadClrAssembly(const ClrMetadata *md, ClrAssemblyRow *row)
+{
+    const uint8_t *p = RowPointer(md, CLR_TABLE_ASSEMBLY, 1);
+    return p != NULL && ReadAssemblyColumns(md, CLR_TABLE_ASSEMBLY, p, 1, row);
+}
+
+
+/* ReadClrAssemblyRef    Decode one AssemblyRef row
+ */
+bool ReadClrAssemblyRef(const ClrMetadata *md, uint32_t row, ClrAssemblyRow *out)
+{
+    const uint8_t *p = RowPointer(md, CLR_TABLE_ASSEMBLYREF, row);
+    return p != NULL && ReadAssemblyColumns(md, CLR_TABLE_ASSEMBLYREF, p, 0, out);
+}
+
+
+/* ReadClrTypeDef    Decode one TypeDef row
+ */
+bool ReadClrTypeDef(const ClrMetadata *md, uint32_t row, ClrTypeDefRow *out)
+{
+    const uint8_t *p = RowPointer(md, CLR_TABLE_TYPEDEF, row);
+    if (p == NULL)
+    {
+        return false;
+    }
+
+    out->Flags = ReadColumn(md, CLR_TABLE_TYPEDEF, p, 0);
+    out->name = ClrString(md, ReadColumn(md, CLR_TABLE_TYPEDEF, p, 1));
+    out->typeNamespace = ClrString(md, ReadColumn(md, CLR_TABLE_TYPEDEF, p, 2));
+    out->fieldList = ReadColumn(md, CLR_TABLE_TYPEDEF, p, 4);
+    out->methodList = ReadColumn(md, CLR_TABLE_TYPEDEF, p, 5);
+    return out->name != NULL && out->typeNamespace != NULL;
+}
+
+
+/* ReadClrMethodDef    Decode one MethodDef row
+ */
+bool ReadClrMethodDef(const ClrMetadata *md, uint32_t row, ClrMethodDefRow *out)
+{
+    const uint8_t *p = RowPointer(md, CLR_TABLE_METHODDEF, row);
+    if (p == NULL)
+    {
+        return false;
+    }
+
+    out->RVA = ReadColumn(md, CLR_TABLE_METHODDEF, p, 0);
+    out->ImplFlags = (uint16_t)ReadColumn(md, CLR_TABLE_METHODDEF, p, 1);
+    out->Flags = (uint16_t)ReadColumn(md, CLR_TABLE_METHODDEF, p, 2);
+    out->name = ClrString(md, ReadColumn(md, CLR_TABLE_METHODDEF, p, 3));
+    out->signature = ClrBlob(md, ReadColumn(md, CLR_TABLE_METHODDEF, p, 4));
+    out->paramList = ReadColumn(md, CLR_TABLE_METHODDEF, p, 5);
+    return out->name != NULL;
+}
+
+
+/* FindClrMethodOwner    Find the type that defines a method
+ * Parameters            Metadata, MethodDef row
+ * Returns               TypeDef row, else 0
+ *
+ * Each type owns the methods from its MethodList up to the next type's,
+ * and MethodList never decreases, so the owner is found by binary search
+ * reading one column of O(log n) rows.
+ */
+uint32_t FindClrMethodOwner(const ClrMetadata *md, uint32_t methodRow)
+{
+    uint32_t lo = 1;
+    uint32_t hi = md->rows[CLR_TABLE_TYPEDEF];
+    uint32_t owner = 0;
+
+    while (lo <= hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const uint8_t *p = RowPointer(md, CLR_TABLE_TYPEDEF, mid);
+        if (p == NULL)
+        {
+            return 0;
+        }
+
+        if (ReadColumn(md, CLR_TABLE_TYPEDEF, p, 5) <= methodRow)
+        {
+            owner = mid;
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    return owner;
+}
+
+
+/* KeepAssemblyName    Copy an Assembly or AssemblyRef row into the image
+ */
+static void KeepAssemblyName(const ClrAssemblyRow *row, bool isReference, StringInterner *interner,
+                             PeImage *image, ClrAssemblyName *name)
+{
+    name->name = KeepName(row->name, strlen(row->name), interner, image);
+    name->culture = KeepName(row->culture, strlen(row->culture), interner, image);
+    name->MajorVersion = row->MajorVersion;
+    name->MinorVersion = row->MinorVersion;
+    name->BuildNumber = row->BuildNumber;
+    name->RevisionNumber = row->RevisionNumber;
+    name->Flags = row->Flags;
+
+    /* A reference usually holds the 8 byte token; a full key would need
+     * hashing to get it */
+    name->hasPublicKeyToken = isReference && !(row->Flags & 0x0001) && row->publicKey.size == 8;
+    if (name->hasPublicKeyToken)
+    {
+        memcpy(name->publicKeyToken, row->publicKey.data, 8);
+    }
+}
+
+
+/* DecodeClr     Decode the CLR header and a summary of the metadata into
+ *               image->clr
+ * Parameters    The buffer the image was parsed from, the image, and an
+ *               optional interner for names
+ * Returns       false if the image has no readable CLR metadata
+ *
+ * Only the Assembly and AssemblyRef rows, and the entry point's MethodDef
+ * and owning TypeDef rows, are decoded.
+ */
+bool DecodeClr(PeBuffer buffer, PeImage *image, StringInterner *interner)
+{
+    ClrMetadata md;
+    if (!OpenClrMetadata(image, buffer, &md))
+    {
+        return false;
+    }
+
+    ClrInfo *clr = &image->clr;
+    clr->MajorRuntimeVersion = ReadWord(md.cor20 + 4);
+    clr->MinorRuntimeVersion = ReadWord(md.cor20 + 6);
+    clr->Flags = ReadDword(md.cor20 + 16);
+    clr->EntryPointToken = ReadDword(md.cor20 + 20);
+    clr->version = KeepName((const char *)md.version.data, strnlen((const char *)md.version.data, md.version.size),
+                            interner, image);
+    clr->heapSizes = md.heapSizes;
+    memcpy(clr->rows, md.rows, sizeof(clr->rows));
+
+    clr->streams.resize(md.streamCount);
+    for (uint32_t i = 0; i < md.streamCount; ++i)
+    {
+        clr->streams[i] = md.streams[i];
+        clr->streams[i].name = KeepName(md.streams[i].name, strlen(md.streams[i].name), interner, image);
+    }
+
+    ClrAssemblyRow row;
+    clr->hasAssembly = ReadClrAssembly(&md, &row);
+    if (clr->hasAssembly)
+    {
+        KeepAssemblyName(&row, false, interner, image, &clr->assembly);
+    }
+
+    uint32_t count = md.rows[CLR_TABLE_ASSEMBLYREF] < MAX_CLR_REFERENCES ? md.rows[CLR_TABLE_ASSEMBLYREF] : MAX_CLR_REFERENCES;
+    clr->references.reserve(count);
+    for (uint32_t r = 1; r <= count; ++r)
+    {
+        ClrAssemblyName name;
+        if (ReadClrAssemblyRef(&md, r, &row))
+        {
+            KeepAssemblyName(&row, true, interner, image, &name);
+            clr->references.push_back(name);
+        }
+    }
+
+    /* The entry point is a MethodDef token, or a File token for a module */
+    ClrMethodDefRow method;
+    ClrTypeDefRow type;
+    clr->entryPoint = NULL;
+    if ((clr->EntryPointToken >> 24) == CLR_TABLE_METHODDEF &&
+        ReadClrMethodDef(&md, clr->EntryPointToken & 0xFFFFFF, &method) &&
+        ReadClrTypeDef(&md, FindClrMethodOwner(&md, clr->EntryPointToken & 0xFFFFFF), &type))
+    {
+        std::string name = type.typeNamespace;
+        if (!name.empty())
+        {
+            name += '.';
+        }
+        name += type.name;
+        name += "::";
+        name += method.name;
+        clr->entryPoint = KeepName(name.data(), name.size(), NULL, image);
+    }
+
+    return true;
+}
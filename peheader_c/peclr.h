@@ -0,0 +1,136 @@
+#ifndef _PECLR
+#define _PECLR
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "pearena.h"
+#include "pefile.h"
+
+#define COR20_HEADER_SIZE        72
+#define CLR_METADATA_SIGNATURE   0x424A5342  /* "BSJB" */
+#define CLR_MAX_TABLES           64          /* Bits of the Valid mask */
+#define CLR_KNOWN_TABLES         0x2D        /* Tables up to GenericParamConstraint have a known layout */
+#define CLR_MAX_COLUMNS          9
+#define CLR_MAX_STREAMS          16          /* Stop reading stream headers after this many */
+#define MAX_CLR_REFERENCES       0x1000      /* Stop collecting AssemblyRef rows after this many */
+
+/* Metadata tables used by the decoder (ECMA-335 II.22) */
+#define CLR_TABLE_TYPEREF        0x01
+#define CLR_TABLE_TYPEDEF        0x02
+#define CLR_TABLE_METHODDEF      0x06
+#define CLR_TABLE_MEMBERREF      0x0A
+#define CLR_TABLE_ASSEMBLY       0x20
+#define CLR_TABLE_ASSEMBLYREF    0x23
+
+typedef struct
+{
+    const char *name;
+    uint32_t offset;            // from the metadata root
+    uint32_t size;
+} ClrStream;
+
+/* A view of the metadata of one managed image, straight over the file.
+ * Only sizes and offsets are worked out when it is opened; rows are
+ * decoded one at a time, on request, by 1 based row number as tokens
+ * number them.
+ */
+typedef struct
+{
+    const uint8_t *cor20;       // the COR20 header, COR20_HEADER_SIZE bytes
+    PeBuffer version;           // metadata version string, NUL padded
+    uint32_t streamCount;
+    ClrStream streams[CLR_MAX_STREAMS];     // names point into the file
+    PeBuffer strings;           // #Strings heap
+    PeBuffer userStrings;       // #US heap
+    PeBuffer blob;              // #Blob heap
+    PeBuffer guid;              // #GUID heap
+    PeBuffer tables;            // #~ (or uncompressed #-) stream
+    uint8_t heapSizes;          // 0x01 wide #Strings, 0x02 wide #GUID, 0x04 wide #Blob indexes
+    uint64_t valid;             // tables present
+    uint32_t rows[CLR_MAX_TABLES];
+    uint32_t rowSize[CLR_MAX_TABLES];
+    uint64_t tableOffset[CLR_MAX_TABLES];               // from the start of the tables stream
+    uint8_t columnWidth[CLR_KNOWN_TABLES][CLR_MAX_COLUMNS];
+    uint32_t knownTables;       // tables below this whose rows can be located
+} ClrMetadata;
+
+typedef struct
+{
+    const char *name;           // views into #Strings
+    const char *culture;
+    uint16_t MajorVersion;
+    uint16_t MinorVersion;
+    uint16_t BuildNumber;
+    uint16_t RevisionNumber;
+    uint32_t Flags;
+    PeBuffer publicKey;         // public key, or token when an AssemblyRef's flags don't have 0x0001
+} ClrAssemblyRow;
+
+typedef struct
+{
+    uint32_t Flags;
+    const char *name;
+    const char *typeNamespace;
+    uint32_t fieldList;         // first Field row
+    uint32_t methodList;        // first MethodDef row
+} ClrTypeDefRow;
+
+typedef struct
+{
+    uint32_t RVA;
+    uint16_t ImplFlags;
+    uint16_t Flags;
+    const char *name;
+    PeBuffer signature;
+    uint32_t paramList;         // first Param row
+} ClrMethodDefRow;
+
+typedef struct
+{
+    const char *name;
+    const char *culture;        // empty for neutral
+    uint16_t MajorVersion;
+    uint16_t MinorVersion;
+    uint16_t BuildNumber;
+    uint16_t RevisionNumber;
+    uint32_t Flags;
+    bool hasPublicKeyToken;
+    uint8_t publicKeyToken[8];
+} ClrAssemblyName;
+
+/* The decoded CLR header and metadata summary. Name pointers refer either
+ * to the string interner passed to the decoder or to the owning image's
+ * arena.
+ */
+typedef struct
+{
+    uint16_t MajorRuntimeVersion;
+    uint16_t MinorRuntimeVersion;
+    uint32_t Flags;
+    uint32_t EntryPointToken;
+    const char *version;        // metadata version string, e.g. "v4.0.30319"
+    uint8_t heapSizes;
+    std::vector<ClrStream> streams;
+    uint32_t rows[CLR_MAX_TABLES];
+    bool hasAssembly;
+    ClrAssemblyName assembly;
+    std::vector<ClrAssemblyName> references;
+    const char *entryPoint;     // "Namespace.Type::Method" when the entry point is a MethodDef, else NULL
+} ClrInfo;
+
+struct PeImage;
+
+bool OpenClrMetadata(const PeImage *image, PeBuffer buffer, ClrMetadata *md);
+const char *ClrString(const ClrMetadata *md, uint32_t index);
+PeBuffer ClrBlob(const ClrMetadata *md, uint32_t index);
+bool ReadClrAssembly(const ClrMetadata *md, ClrAssemblyRow *row);
+bool ReadClrAssemblyRef(const ClrMetadata *md, uint32_t row, ClrAssemblyRow *out);
+bool ReadClrTypeDef(const ClrMetadata *md, uint32_t row, ClrTypeDefRow *out);
+bool ReadClrMethodDef(const ClrMetadata *md, uint32_t row, ClrMethodDefRow *out);
+uint32_t FindClrMethodOwner(const ClrMetadata *md, uint32_t methodRow);
+bool DecodeClr(PeBuffer buffer, PeImage *image, StringInterner *interner);
+
+#endif // _PECLR
@@ -0,0 +1,211 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pedebug.cpp
+//  Author:     Mark Coppa
+//
+//  Debug directory decoder. The directory is an array of fixed size
+//  entries, each pointing at a blob of debug data; the one that matters
+//  for symbolication is the CodeView RSDS record, which names the PDB the
+//  image was linked with by GUID, age and path. A symbol server files a
+//  PDB under its GUID and age written as one hex key, which is also how
+//  crash reports name it.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "peheader.h"
+
+#include <string.h>
+
+
+/* DebugData    Find the data an entry points at
+ * Returns      Its bytes, else NULL if they aren't in the buffer
+ *
+ * The file offset is what the loader doesn't need and what tools trust;
+ * the RVA is used when the data isn't stored at one.
+ */
+static const uint8_t *DebugData(const PeImage *image, PeBuffer buffer, const DebugDirectoryEntry *entry)
+{
+    if (entry->PointerToRawData != 0)
+    {
+        if (entry->PointerToRawData > buffer.size || buffer.size - entry->PointerToRawData < entry->SizeOfData)
+        {
+            return NULL;
+        }
+        return buffer.data + entry->PointerToRawData;
+    }
+    return entry->AddressOfRawData != 0 ? RvaToPointer(image, buffer, entry->AddressOfRawData, entry->SizeOfData) : NULL;
+}
+
+
+/* ReadCodeView    Decode an RSDS record into image->debug
+ * Returns         false if the record isn't RSDS or is cut short
+ */
+static bool ReadCodeView(const uint8_t *data, uint32_t size, PeImage *image, StringInterner *interner)
+{
+    if (size < CODEVIEW_RSDS_HEADER_SIZE || ReadDword(data) != CODEVIEW_RSDS_SIGNATURE)
+    {
+        return false;
+    }
+
+    DebugInfo *debug = &image->debug;
+    memcpy(debug->pdbGuid, data + 4, sizeof(debug->pdbGuid));
+    debug->pdbAge = ReadDword(data + 20);
+
+    const char *path = (const char *)data + CODEVIEW_RSDS_HEADER_SIZE;
+    size_t room = size - CODEVIEW_RSDS_HEADER_SIZE;
+    size_t len = strnlen(path, room < MAX_PDB_PATH ? room : MAX_PDB_PATH);
+    debug->pdbPath = KeepName(path, len, interner, image);
+    debug->hasCodeView = true;
+    return true;
+}
+
+
+/* DecodeDebug    Decode the debug directory into image->debug
+ * Parameters     The buffer the image was parsed from, the image, and an
+ *                optional interner for the PDB path
+ * Returns        false if the image has no readable debug directory
+ */
+bool DecodeDebug(PeBuffer buffer, PeImage *image, StringInterner *interner)
+{
+    const DataDirectory &dir = image->odd.Debug;
+    uint32_t offset;
+    uint32_t available;
+
+    if (dir.VirtualAddress == 0 || dir.Size < DEBUG_DIRECTORY_ENTRY_SIZE ||
+        !RvaToOffset(image, dir.VirtualAddress, &offset, &available) || offset >= buffer.size)
+    {
+        return false;
+    }
+    if (available > buffer.size - offset)
+    {
+        available = (uint32_t)(buffer.size - offset);
+    }
+
+    uint32_t count = (dir.Size < available ? dir.Size : available) / DEBUG_DIRECTORY_ENTRY_SIZE;
+    if (count > MAX_DEBUG_ENTRIES)
+    {
+        count = MAX_DEBUG_ENTRIES;
+    }
+
+    DebugInfo *debug = &image->debug;
+    PeBuffer entries = { buffer.data + offset, (size_t)count * DEBUG_DIRECTORY_ENTRY_SIZE };
+    ByteCursor cur;
+    InitCursor(&cur, entries);
+    debug->entries.resize(count);
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        DebugDirectoryEntry *entry = &debug->entries[i];
+        entry->Characteristics = SumBytes(&cur, 4);
+        entry->TimeDateStamp = SumBytes(&cur, 4);
+        entry->MajorVersion = (uint16_t)SumBytes(&cur, 2);
+        entry->MinorVersion = (uint16_t)SumBytes(&cur, 2);
+        entry->Type = SumBytes(&cur, 4);
+        entry->SizeOfData = SumBytes(&cur, 4);
+        entry->AddressOfRawData = SumBytes(&cur, 4);
+        entry->PointerToRawData = SumBytes(&cur, 4);
+
+        if (entry->Type == DEBUG_TYPE_CODEVIEW && !debug->hasCodeView)
+        {
+            const uint8_t *data = DebugData(image, buffer, entry);
+            if (data != NULL)
+            {
+                ReadCodeView(data, entry->SizeOfData, image, interner);
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/* FormatPdbKey    Write the symbol server key for a PDB: the GUID's 32
+ *                 hex digits in display order followed by the age in hex
+ * Parameters      GUID as stored in the RSDS record, age, where to write
+ *                 the NUL terminated key
+ * Returns         Length of the key
+ */
+size_t FormatPdbKey(const uint8_t guid[16], uint32_t age, char key[PDB_KEY_LENGTH + 1])
+{
+    static const char digits[] = "0123456789ABCDEF";
+    static const uint8_t order[16] = { 3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15 };
+    size_t len = 0;
+
+    for (int i = 0; i < 16; ++i)
+    {
+        key[len++] = digits[guid[order[i]] >> 4];
+        key[len++] = digits[guid[order[i]] & 0xF];
+    }
+
+    char ageDigits[8];
+    int ageLength = 0;
+    do
+    {
+        ageDigits[ageLength++] = digits[age & 0xF];
+        age >>= 4;
+    } while (age != 0);
+    while (ageLength > 0)
+    {
+        key[len++] = ageDigits[--ageLength];
+    }
+
+    key[len] = '\0';
+    return len;
+}
+
+
+/* ParsePdbKey    Read a symbol server key back into a GUID and age
+ * Parameters     Key, optionally with the GUID in braces and dashes as
+ *                "{8-4-4-4-12}age"; GUID to fill in stored order; age
+ * Returns        false if the key is malformed
+ */
+bool ParsePdbKey(const char *key, uint8_t guid[16], uint32_t *age)
+{
+    static const uint8_t order[16] = { 3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15 };
+    uint32_t digits = 0;
+    uint32_t ageDigits = 0;
+    uint8_t display[16] = { 0 };
+
+    *age = 0;
+    for (const char *p = key; *p != '\0'; ++p)
+    {
+        if (*p == '{' || *p == '}' || *p == '-')
+        {
+            continue;
+        }
+
+        int value = *p >= '0' && *p <= '9' ? *p - '0' :
+                    *p >= 'a' && *p <= 'f' ? *p - 'a' + 10 :
+                    *p >= 'A' && *p <= 'F' ? *p - 'A' + 10 : -1;
+        if (value < 0)
+        {
+            return false;
+        }
+
+        if (digits < 32)
+        {
+            display[digits / 2] = (uint8_t)(display[digits / 2] << 4 | value);
+            ++digits;
+        }
+        else if (ageDigits < 8)
+        {
+            *age = *age << 4 | value;
+            ++ageDigits;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (digits != 32 || ageDigits == 0)
+    {
+        return false;
+    }
+    for (int i = 0; i < 16; ++i)
+    {
+        guid[order[i]] = display[i];
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef _PEDEBUG
+#define _PEDEBUG
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "pearena.h"
+#include "pefile.h"
+
+#define DEBUG_DIRECTORY_ENTRY_SIZE  28
+#define MAX_DEBUG_ENTRIES           0x100       /* Stop decoding the directory after this many entries */
+#define MAX_PDB_PATH                0x400       /* Longest PDB path taken from a CodeView record */
+
+#define DEBUG_TYPE_CODEVIEW         2
+#define CODEVIEW_RSDS_SIGNATURE     0x53445352  /* "RSDS" */
+#define CODEVIEW_RSDS_HEADER_SIZE   24          /* signature, GUID and age before the path */
+
+#define PDB_KEY_LENGTH              40          /* 32 GUID digits and up to 8 age digits */
+
+typedef struct
+{
+    uint32_t Characteristics;
+    uint32_t TimeDateStamp;
+    uint16_t MajorVersion;
+    uint16_t MinorVersion;
+    uint32_t Type;
+    uint32_t SizeOfData;
+    uint32_t AddressOfRawData;
+    uint32_t PointerToRawData;
+} DebugDirectoryEntry;
+
+/* The decoded debug directory and the first RSDS CodeView record in it.
+ * The PDB path refers either to the string interner passed to the decoder
+ * or to the owning image's arena.
+ */
+typedef struct
+{
+    std::vector<DebugDirectoryEntry> entries;
+    bool hasCodeView;
+    uint8_t pdbGuid[16];        // as stored: Data1, Data2 and Data3 little endian
+    uint32_t pdbAge;
+    const char *pdbPath;
+} DebugInfo;
+
+struct PeImage;
+
+bool DecodeDebug(PeBuffer buffer, PeImage *image, StringInterner *interner);
+size_t FormatPdbKey(const uint8_t guid[16], uint32_t age, char key[PDB_KEY_LENGTH + 1]);
+bool ParsePdbKey(const char *key, uint8_t guid[16], uint32_t *age);
+
+#endif // _PEDEBUG
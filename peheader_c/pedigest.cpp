@@ -0,0 +1,153 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pedigest.cpp
+//  Author:     Mark Coppa
+//
+//  MD5 (RFC 1321), used for import hashes.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pedigest.h"
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static const uint32_t md5K[64] =
+{
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint8_t md5R[64] =
+{
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+
+/* Md5Block    Mix one 64 byte block into the state
+ */
+static void Md5Block(uint32_t state[4], const uint8_t *block)
+{
+    uint32_t w[16];
+    for (int i = 0; i < 16; ++i)
+    {
+        w[i] = block[i * 4] | (block[i * 4 + 1] << 8) | (block[i * 4 + 2] << 16) | ((uint32_t)block[i * 4 + 3] << 24);
+    }
+
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t f;
+        int g;
+
+        if (i < 16)
+        {
+            f = (b & c) | (~b & d);
+            g = i;
+        }
+        else if (i < 32)
+        {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) & 15;
+        }
+        else if (i < 48)
+        {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) & 15;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+            g = (7 * i) & 15;
+        }
+
+        uint32_t t = d;
+        d = c;
+        c = b;
+        b = b + ROTL(a + f + md5K[i] + w[g], md5R[i]);
+        a = t;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+
+void Md5Init(Md5Context *ctx)
+{
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xefcdab89;
+    ctx->state[2] = 0x98badcfe;
+    ctx->state[3] = 0x10325476;
+    ctx->length = 0;
+}
+
+
+void Md5Update(Md5Context *ctx, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    size_t used = (size_t)(ctx->length & 63);
+    ctx->length += len;
+
+    if (used > 0)
+    {
+        size_t take = 64 - used < len ? 64 - used : len;
+        memcpy(ctx->block + used, p, take);
+        p += take;
+        len -= take;
+        if (used + take < 64)
+        {
+            return;
+        }
+        Md5Block(ctx->state, ctx->block);
+    }
+
+    while (len >= 64)
+    {
+        Md5Block(ctx->state, p);
+        p += 64;
+        len -= 64;
+    }
+
+    memcpy(ctx->block, p, len);
+}
+
+
+void Md5Final(Md5Context *ctx, uint8_t digest[16])
+{
+    uint64_t bits = ctx->length * 8;
+    uint8_t pad[72];
+    size_t used = (size_t)(ctx->length & 63);
+    size_t padLen = used < 56 ? 56 - used : 120 - used;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (int i = 0; i < 8; ++i)
+    {
+        pad[padLen + i] = (uint8_t)(bits >> (8 * i));
+    }
+    Md5Update(ctx, pad, padLen + 8);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        digest[i * 4] = (uint8_t)ctx->state[i];
+        digest[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 8);
+        digest[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 16);
+        digest[i * 4 + 3] = (uint8_t)(ctx->state[i] >> 24);
+    }
+}
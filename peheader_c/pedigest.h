@@ -0,0 +1,53 @@
+#ifndef _PEDIGEST
+#define _PEDIGEST
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct
+{
+    uint32_t state[4];
+    uint64_t length;        // bytes hashed so far
+    uint8_t block[64];      // partial input block
+} Md5Context;
+
+void Md5Init(Md5Context *ctx);
+void Md5Update(Md5Context *ctx, const void *data, size_t len);
+void Md5Final(Md5Context *ctx, uint8_t digest[16]);
+
+
+/* HashBytes     Fast non-cryptographic 64 bit hash for hash tables
+ * Parameters    Bytes to hash, their length, seed
+ * Returns       The hash
+ */
+inline uint64_t HashBytes(const void *data, size_t len, uint64_t seed = 0)
+{
+    const uint64_t m = 0x9E3779B97F4A7C15ull;
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t h = seed ^ (len * m);
+
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        h = (h ^ (v * m)) * 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 31;
+        p += 8;
+        len -= 8;
+    }
+
+    uint64_t tail = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        tail |= (uint64_t)p[i] << (8 * i);
+    }
+    h = (h ^ (tail * m)) * 0x94D049BB133111EBull;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 32;
+
+    return h;
+}
+
+#endif // _PEDIGEST
@@ -0,0 +1,296 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       peentropy.cpp
+//  Author:     Mark Coppa
+//
+//  Shannon entropy of section data and of the overlay, for spotting packed
+//  and encrypted content. Almost all of the time goes into the byte
+//  histogram, so it counts into four interleaved tables: consecutive bytes
+//  bump different counters and a run of equal bytes doesn't serialize on
+//  one load-increment-store chain. Padding is common in images, so the
+//  vector kernels add a whole block of one repeated byte in a single step.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "peentropy.h"
+#include "peheader.h"
+#include "pesimd.h"
+
+#include <math.h>
+#include <string.h>
+
+/* Bytes counted into 32 bit tables before they are added into the caller's
+ * 64 bit counts; no counter can reach 2^32 within one chunk */
+#define HISTOGRAM_CHUNK_SIZE 0x40000000
+
+typedef uint32_t HistogramTables[4][256];
+typedef void (*HistogramFn)(const uint8_t *data, size_t size, HistogramTables tables);
+
+
+/* CountWord    Count the 8 bytes of a word, two per table
+ */
+static inline void CountWord(uint64_t w, HistogramTables t)
+{
+    ++t[0][w & 0xFF];
+    ++t[1][(w >> 8) & 0xFF];
+    ++t[2][(w >> 16) & 0xFF];
+    ++t[3][(w >> 24) & 0xFF];
+    ++t[0][(w >> 32) & 0xFF];
+    ++t[1][(w >> 40) & 0xFF];
+    ++t[2][(w >> 48) & 0xFF];
+    ++t[3][w >> 56];
+}
+
+
+/* HistogramScalar    Count bytes 8 at a time from word loads
+ */
+static void HistogramScalar(const uint8_t *data, size_t size, HistogramTables tables)
+{
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        CountWord(w, tables);
+    }
+    for (; i < size; ++i)
+    {
+        ++tables[i & 3][data[i]];
+    }
+}
+
+
+#ifdef SIMD_X86
+
+/* HistogramSse2    HistogramScalar, but a 16 byte block of one repeated
+ *                  byte is counted in one step
+ */
+TARGET_SSE2
+static void HistogramSse2(const uint8_t *data, size_t size, HistogramTables tables)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i first = _mm_set1_epi8((char)data[i]);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, first)) == 0xFFFF)
+        {
+            tables[0][data[i]] += 16;
+            continue;
+        }
+
+        uint64_t w[2];
+        memcpy(w, data + i, 16);
+        CountWord(w[0], tables);
+        CountWord(w[1], tables);
+    }
+
+    HistogramScalar(data + i, size - i, tables);
+}
+
+
+/* HistogramAvx2    HistogramSse2 with 32 byte blocks
+ */
+TARGET_AVX2
+static void HistogramAvx2(const uint8_t *data, size_t size, HistogramTables tables)
+{
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i first = _mm256_set1_epi8((char)data[i]);
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, first)) == 0xFFFFFFFF)
+        {
+            tables[0][data[i]] += 32;
+            continue;
+        }
+
+        uint64_t w[4];
+        memcpy(w, data + i, 32);
+        CountWord(w[0], tables);
+        CountWord(w[1], tables);
+        CountWord(w[2], tables);
+        CountWord(w[3], tables);
+    }
+
+    HistogramScalar(data + i, size - i, tables);
+}
+
+#endif // SIMD_X86
+
+
+typedef struct
+{
+    HistogramFn histogram;
+    const char *name;
+} EntropyKernel;
+
+/* PickKernel    Choose the widest kernel the CPU runs, once
+ */
+static const EntropyKernel &PickKernel()
+{
+    static const EntropyKernel kernel = []() {
+#ifdef SIMD_X86
+        if (CpuHasAvx2())
+        {
+            return EntropyKernel{ HistogramAvx2, "avx2" };
+        }
+#ifdef SIMD_SSE2
+        return EntropyKernel{ HistogramSse2, "sse2" };
+#endif
+#endif
+        return EntropyKernel{ HistogramScalar, "scalar" };
+    }();
+    return kernel;
+}
+
+
+/* ByteHistogram    Add the byte counts of a buffer to a histogram
+ * Parameters       Bytes, their count, counts to add to
+ */
+void ByteHistogram(const uint8_t *data, size_t size, uint64_t counts[256])
+{
+    HistogramFn histogram = PickKernel().histogram;
+
+    while (size > 0)
+    {
+        size_t chunk = size < HISTOGRAM_CHUNK_SIZE ? size : HISTOGRAM_CHUNK_SIZE;
+        HistogramTables tables;
+        memset(tables, 0, sizeof(tables));
+
+        histogram(data, chunk, tables);
+        for (int b = 0; b < 256; ++b)
+        {
+            counts[b] += (uint64_t)tables[0][b] + tables[1][b] + tables[2][b] + tables[3][b];
+        }
+
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+
+/* ShannonEntropy    Entropy of a byte histogram
+ * Returns           Bits per byte, 0 to 8; 0 for an empty histogram
+ */
+double ShannonEntropy(const uint64_t counts[256])
+{
+    uint64_t total = 0;
+    for (int b = 0; b < 256; ++b)
+    {
+        total += counts[b];
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    double entropy = 0;
+    for (int b = 0; b < 256; ++b)
+    {
+        if (counts[b] != 0)
+        {
+            double p = (double)counts[b] / total;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy;
+}
+
+
+/* RangeEntropy    Entropy of a range of a file
+ * Parameters      File bytes, range (clipped to the file), most bytes to
+ *                 read (0 for all), count of bytes read to add to
+ * Returns         Bits per byte, or NO_ENTROPY if no byte of the range is
+ *                 in the file
+ *
+ * A range longer than the limit is sampled in ENTROPY_BLOCK_SIZE blocks
+ * spread evenly across it, so the whole range is represented.
+ */
+float RangeEntropy(PeBuffer buffer, uint64_t offset, uint64_t size, uint64_t sampleLimit, uint64_t *sampled)
+{
+    if (offset >= buffer.size || size == 0)
+    {
+        return NO_ENTROPY;
+    }
+    if (size > buffer.size - offset)
+    {
+        size = buffer.size - offset;
+    }
+
+    uint64_t counts[256] = { 0 };
+    const uint8_t *data = buffer.data + offset;
+
+    if (sampleLimit == 0 || size <= sampleLimit)
+    {
+        ByteHistogram(data, (size_t)size, counts);
+        *sampled += size;
+    }
+    else
+    {
+        uint64_t blocks = sampleLimit / ENTROPY_BLOCK_SIZE;
+        blocks = blocks == 0 ? 1 : blocks;
+        uint64_t length = sampleLimit / blocks;
+        uint64_t stride = size / blocks;
+
+        for (uint64_t k = 0; k < blocks; ++k)
+        {
+            ByteHistogram(data + k * stride, (size_t)length, counts);
+        }
+        *sampled += blocks * length;
+    }
+
+    return (float)ShannonEntropy(counts);
+}
+
+
+/* DecodeEntropy    Measure the entropy of each section and of the overlay
+ * Parameters       The whole file, image with its section table parsed,
+ *                  most bytes to read per range (0 for all)
+ * Returns          true once image->entropy is filled in
+ *
+ * The overlay starts after the furthest section raw data (or the headers
+ * when there are no sections), so it includes an Authenticode signature.
+ */
+bool DecodeEntropy(PeBuffer buffer, PeImage *image, uint64_t sampleLimit)
+{
+    EntropyTable *entropy = &image->entropy;
+    entropy->sections.assign(image->sections.size(), NO_ENTROPY);
+    entropy->overlayOffset = 0;
+    entropy->overlaySize = 0;
+    entropy->overlay = NO_ENTROPY;
+    entropy->sampled = 0;
+
+    uint64_t rawEnd = image->owh.SizeOfHeaders;
+    for (size_t i = 0; i < image->sections.size(); ++i)
+    {
+        const SectionHeader *sh = &image->sections[i];
+        entropy->sections[i] = RangeEntropy(buffer, sh->PointerToRawData, sh->SizeOfRawData, sampleLimit, &entropy->sampled);
+
+        if (sh->SizeOfRawData > 0 && (uint64_t)sh->PointerToRawData + sh->SizeOfRawData > rawEnd)
+        {
+            rawEnd = (uint64_t)sh->PointerToRawData + sh->SizeOfRawData;
+        }
+    }
+
+    if (image->isPE && !image->isCOFF)
+    {
+        entropy->overlayOffset = rawEnd;
+    }
+    if (image->isPE && !image->isCOFF && rawEnd < buffer.size)
+    {
+        entropy->overlaySize = buffer.size - rawEnd;
+        entropy->overlay = RangeEntropy(buffer, rawEnd, entropy->overlaySize, sampleLimit, &entropy->sampled);
+    }
+
+    return true;
+}
+
+
+/* EntropyKernelName    Name of the kernel in use, for reports
+ */
+const char *EntropyKernelName()
+{
+    return PickKernel().name;
+}
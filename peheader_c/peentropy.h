@@ -0,0 +1,34 @@
+#ifndef _PEENTROPY
+#define _PEENTROPY
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "pefile.h"
+
+#define ENTROPY_BLOCK_SIZE   0x1000     /* Bytes histogrammed at each sample point when sampling */
+#define NO_ENTROPY           -1.0f      /* A range with no bytes in the file */
+
+/* Shannon entropy in bits per byte (0 to 8) of each section's raw data and
+ * of the overlay, the bytes after the last section's raw data.
+ */
+typedef struct
+{
+    std::vector<float> sections;    // parallel to PeImage::sections; NO_ENTROPY when a section has no raw data
+    uint64_t overlayOffset;         // PE images only; overlaySize 0 when there is no overlay
+    uint64_t overlaySize;
+    float overlay;
+    uint64_t sampled;               // bytes histogrammed across all ranges
+} EntropyTable;
+
+struct PeImage;
+
+void ByteHistogram(const uint8_t *data, size_t size, uint64_t counts[256]);
+double ShannonEntropy(const uint64_t counts[256]);
+float RangeEntropy(PeBuffer buffer, uint64_t offset, uint64_t size, uint64_t sampleLimit, uint64_t *sampled);
+bool DecodeEntropy(PeBuffer buffer, PeImage *image, uint64_t sampleLimit);
+const char *EntropyKernelName();
+
+#endif // _PEENTROPY
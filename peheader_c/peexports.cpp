@@ -0,0 +1,263 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       peexports.cpp
+//  Author:     Mark Coppa
+//
+//  Export directory decoder and name lookups. The name pointer table is
+//  sorted in the file, so a name is found by binary search either over the
+//  decoded table or directly over the mapped image.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "peheader.h"
+
+#include <string.h>
+
+typedef struct
+{
+    uint32_t nameRva;
+    uint32_t Base;
+    uint32_t numberOfFunctions;
+    uint32_t numberOfNames;
+    uint32_t functionsRva;
+    uint32_t namesRva;
+    uint32_t ordinalsRva;
+} ExportDirectory;
+
+
+/* ReadExportDirectory    Read the fixed part of the export directory
+ * Returns                false if the image has none or it is unreadable
+ */
+static bool ReadExportDirectory(const PeImage *image, PeBuffer buffer, ExportDirectory *dir, uint32_t *timeDateStamp)
+{
+    uint32_t rva = image->odd.ExportTable.VirtualAddress;
+    if (rva == 0 || image->odd.ExportTable.Size == 0)
+    {
+        return false;
+    }
+
+    const uint8_t *p = RvaToPointer(image, buffer, rva, EXPORT_DIRECTORY_SIZE);
+    if (p == NULL)
+    {
+        return false;
+    }
+
+    PeBuffer directory = { p, EXPORT_DIRECTORY_SIZE };
+    ByteCursor cur;
+    InitCursor(&cur, directory);
+    SumBytes(&cur, 4);   // characteristics
+    *timeDateStamp = SumBytes(&cur, 4);
+    SumBytes(&cur, 4);   // major and minor version
+    dir->nameRva = SumBytes(&cur, 4);
+    dir->Base = SumBytes(&cur, 4);
+    dir->numberOfFunctions = SumBytes(&cur, 4);
+    dir->numberOfNames = SumBytes(&cur, 4);
+    dir->functionsRva = SumBytes(&cur, 4);
+    dir->namesRva = SumBytes(&cur, 4);
+    dir->ordinalsRva = SumBytes(&cur, 4);
+
+    if (dir->numberOfFunctions > MAX_EXPORT_FUNCTIONS)
+    {
+        dir->numberOfFunctions = MAX_EXPORT_FUNCTIONS;
+    }
+    if (dir->numberOfNames > MAX_EXPORT_FUNCTIONS)
+    {
+        dir->numberOfNames = MAX_EXPORT_FUNCTIONS;
+    }
+
+    return true;
+}
+
+
+/* IsForwarder    An export whose address lies inside the export directory
+ *                is the RVA of a forwarder string, not of code
+ */
+static bool IsForwarder(const PeImage *image, uint32_t rva)
+{
+    const DataDirectory &dir = image->odd.ExportTable;
+    return rva >= dir.VirtualAddress && rva - dir.VirtualAddress < dir.Size;
+}
+
+
+/* DecodeExports    Decode the export directory into image->exports
+ * Parameters       The buffer the image was parsed from, the image, and an
+ *                  optional interner for names
+ * Returns          false if the image has no readable export directory
+ */
+bool DecodeExports(PeBuffer buffer, PeImage *image, StringInterner *interner)
+{
+    ExportTable *exports = &image->exports;
+    ExportDirectory dir;
+
+    if (!ReadExportDirectory(image, buffer, &dir, &exports->TimeDateStamp))
+    {
+        return false;
+    }
+
+    size_t len;
+    const char *dll = RvaToString(image, buffer, dir.nameRva, &len);
+    exports->dll = dll != NULL ? KeepName(dll, len, interner, image) : NULL;
+    exports->Base = dir.Base;
+    exports->namesSorted = true;
+
+    /* Export address table */
+    const uint8_t *p = RvaToPointer(image, buffer, dir.functionsRva, dir.numberOfFunctions * 4);
+    if (p == NULL)
+    {
+        dir.numberOfFunctions = 0;
+    }
+
+    exports->functions.resize(dir.numberOfFunctions);
+    for (uint32_t i = 0; i < dir.numberOfFunctions; ++i, p += 4)
+    {
+        ExportFunction &function = exports->functions[i];
+        function.rva = ReadDword(p);
+        function.forwarder = NULL;
+
+        if (function.rva != 0 && IsForwarder(image, function.rva))
+        {
+            const char *forwarder = RvaToString(image, buffer, function.rva, &len);
+            if (forwarder != NULL)
+            {
+                function.forwarder = KeepName(forwarder, len, interner, image);
+            }
+        }
+    }
+
+    /* Name pointer and name ordinal tables run in parallel */
+    const uint8_t *names = RvaToPointer(image, buffer, dir.namesRva, dir.numberOfNames * 4);
+    const uint8_t *ordinals = RvaToPointer(image, buffer, dir.ordinalsRva, dir.numberOfNames * 2);
+    if (names == NULL || ordinals == NULL)
+    {
+        dir.numberOfNames = 0;
+    }
+
+    exports->names.reserve(dir.numberOfNames);
+    const char *previous = NULL;
+
+    for (uint32_t i = 0; i < dir.numberOfNames; ++i, names += 4, ordinals += 2)
+    {
+        uint32_t nameRva = ReadDword(names);
+        uint32_t index = ReadWord(ordinals);
+
+        const char *name = RvaToString(image, buffer, nameRva, &len);
+        if (name == NULL || index >= dir.numberOfFunctions)
+        {
+            continue;
+        }
+
+        if (previous != NULL && strcmp(previous, name) > 0)
+        {
+            exports->namesSorted = false;
+        }
+        previous = name;
+
+        ExportName entry = { KeepName(name, len, interner, image), index };
+        exports->names.push_back(entry);
+    }
+
+    return true;
+}
+
+
+/* FindExport    Look a name up in a decoded export table
+ * Parameters    Image decoded with PARSE_EXPORTS, exported name
+ * Returns       Index into exports.functions (ordinal - Base), else NO_EXPORT
+ */
+uint32_t FindExport(const PeImage *image, const char *name)
+{
+    const std::vector<ExportName> &names = image->exports.names;
+
+    if (!image->exports.namesSorted)
+    {
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            if (strcmp(names[i].name, name) == 0)
+            {
+                return names[i].function;
+            }
+        }
+        return NO_EXPORT;
+    }
+
+    size_t lo = 0;
+    size_t hi = names.size();
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(names[mid].name, name);
+        if (cmp == 0)
+        {
+            return names[mid].function;
+        }
+        if (cmp < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return NO_EXPORT;
+}
+
+
+/* FindExport    Look a name up straight from the file, without decoding the
+ *               export table: a binary search over the name pointer table
+ * Parameters    Parsed image, the buffer it was parsed from, exported name
+ * Returns       Index into the export address table (ordinal - Base), else
+ *               NO_EXPORT. A file whose names are not sorted may give a
+ *               false miss, just as it would with the loader.
+ */
+uint32_t FindExport(const PeImage *image, PeBuffer buffer, const char *name)
+{
+    ExportDirectory dir;
+    uint32_t timeDateStamp;
+
+    if (!ReadExportDirectory(image, buffer, &dir, &timeDateStamp))
+    {
+        return NO_EXPORT;
+    }
+
+    const uint8_t *names = RvaToPointer(image, buffer, dir.namesRva, dir.numberOfNames * 4);
+    const uint8_t *ordinals = RvaToPointer(image, buffer, dir.ordinalsRva, dir.numberOfNames * 2);
+    if (names == NULL || ordinals == NULL)
+    {
+        return NO_EXPORT;
+    }
+
+    uint32_t lo = 0;
+    uint32_t hi = dir.numberOfNames;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t nameRva = ReadDword(names + mid * 4);
+
+        size_t len;
+        const char *candidate = RvaToString(image, buffer, nameRva, &len);
+        if (candidate == NULL)
+        {
+            return NO_EXPORT;
+        }
+
+        int cmp = strcmp(candidate, name);
+        if (cmp == 0)
+        {
+            uint32_t index = ReadWord(ordinals + mid * 2);
+            return index < dir.numberOfFunctions ? index : NO_EXPORT;
+        }
+        if (cmp < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return NO_EXPORT;
+}
@@ -0,0 +1,49 @@
+#ifndef _PEEXPORTS
+#define _PEEXPORTS
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "pearena.h"
+#include "pefile.h"
+
+#define EXPORT_DIRECTORY_SIZE 40
+#define MAX_EXPORT_FUNCTIONS  0x10000    /* Name ordinals are 16 bits, so no more are reachable by name */
+#define NO_EXPORT             0xFFFFFFFF
+
+typedef struct
+{
+    uint32_t rva;               // address of the function, 0 for an unused slot
+    const char *forwarder;      // "DLL.Function" when the export is forwarded, else NULL
+} ExportFunction;
+
+typedef struct
+{
+    const char *name;
+    uint32_t function;          // index into ExportTable::functions
+} ExportName;
+
+/* The decoded export directory. functions is indexed by ordinal - Base;
+ * names keeps the order of the file's name pointer table, which the format
+ * requires to be sorted so the loader can binary search it. Name pointers
+ * refer either to the string interner passed to the decoder or to the
+ * owning image's arena.
+ */
+typedef struct
+{
+    const char *dll;
+    uint32_t TimeDateStamp;
+    uint32_t Base;              // ordinal of functions[0]
+    bool namesSorted;           // false if the file broke the ordering; lookups then scan
+    std::vector<ExportFunction> functions;
+    std::vector<ExportName> names;
+} ExportTable;
+
+struct PeImage;
+
+bool DecodeExports(PeBuffer buffer, PeImage *image, StringInterner *interner);
+uint32_t FindExport(const PeImage *image, const char *name);
+uint32_t FindExport(const PeImage *image, PeBuffer buffer, const char *name);
+
+#endif // _PEEXPORTS
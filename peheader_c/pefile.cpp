@@ -0,0 +1,299 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pefile.cpp
+//  Author:     Mark Coppa
+//
+//  Maps an input file read-only so the headers can be decoded straight
+//  from memory. Files that can't be mapped (empty files, devices, pipes)
+//  fall back to a single stdio read of the header window, or to reading
+//  the whole file for callers that need all of it.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pefile.h"
+#include "pestats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* ReadHeaderWindow    Fallback for files that can't be mapped
+ * Parameters          File name, view to fill
+ * Returns             true if the file could be opened
+ */
+static bool ReadHeaderWindow(const char *filename, PeFile *file)
+{
+    FILE *pPE = fopen(filename, "rb");
+    if (pPE == NULL)
+    {
+        return false;
+    }
+
+    uint8_t *buf = (uint8_t *)malloc(PE_HEADER_WINDOW);
+    if (buf == NULL)
+    {
+        fclose(pPE);
+        return false;
+    }
+
+    file->buffer.data = buf;
+    file->buffer.size = fread(buf, 1, PE_HEADER_WINDOW, pPE);
+    CountStat(STAT_READ_CALLS);
+    CountStat(STAT_BYTES_READ, file->buffer.size);
+    file->mapped = false;
+    file->complete = file->buffer.size < PE_HEADER_WINDOW && !ferror(pPE);
+    fclose(pPE);
+
+    return true;
+}
+
+
+/* ReadWholeFile    Fallback for callers that need all of a file that
+ *                  can't be mapped
+ * Parameters       File name, view to fill
+ * Returns          true if the whole file was read
+ */
+static bool ReadWholeFile(const char *filename, PeFile *file)
+{
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        return false;
+    }
+
+    size_t capacity = PE_HEADER_WINDOW;
+    size_t size = 0;
+    uint8_t *buf = (uint8_t *)malloc(capacity);
+    while (buf != NULL)
+    {
+        size_t got = fread(buf + size, 1, capacity - size, f);
+        CountStat(STAT_READ_CALLS);
+        CountStat(STAT_BYTES_READ, got);
+        size += got;
+        if (size < capacity)
+        {
+            break;
+        }
+
+        uint8_t *grown = (uint8_t *)realloc(buf, capacity * 2);
+        if (grown == NULL)
+        {
+            free(buf);
+        }
+        buf = grown;
+        capacity *= 2;
+    }
+
+    bool ok = buf != NULL && !ferror(f);
+    fclose(f);
+    if (!ok)
+    {
+        free(buf);
+        return false;
+    }
+
+    file->buffer.data = buf;
+    file->buffer.size = size;
+    file->mapped = false;
+    file->complete = true;
+    return true;
+}
+
+
+#ifdef _WIN32
+
+/* MapPeFile    Open a file and map it for reading
+ * Parameters   File name, view to fill, whether to read all of a file
+ *              that can't be mapped rather than its header window
+ * Returns      true if the file is available through file->buffer
+ */
+static bool MapPeFile(const char *filename, PeFile *file, bool whole)
+{
+    file->buffer.data = NULL;
+    file->buffer.size = 0;
+    file->mapped = false;
+    file->complete = false;
+    file->hFile = INVALID_HANDLE_VALUE;
+    file->hMapping = NULL;
+
+    HANDLE hFile = CreateFileA(filename,
+                               GENERIC_READ,
+                               FILE_SHARE_READ,
+                               NULL,
+                               OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL,
+                               NULL
+                              );
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return whole ? ReadWholeFile(filename, file) : ReadHeaderWindow(filename, file);
+    }
+
+    LARGE_INTEGER size;
+    HANDLE hMapping = NULL;
+    const void *view = NULL;
+
+    /* Zero length files can't be mapped */
+    if (GetFileSizeEx(hFile, &size) && size.QuadPart > 0)
+    {
+        hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+
+    if (hMapping != NULL)
+    {
+        view = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    }
+
+    if (view == NULL)
+    {
+        if (hMapping != NULL)
+        {
+            CloseHandle(hMapping);
+        }
+        CloseHandle(hFile);
+        return whole ? ReadWholeFile(filename, file) : ReadHeaderWindow(filename, file);
+    }
+
+    file->buffer.data = (const uint8_t *)view;
+    file->buffer.size = (size_t)size.QuadPart;
+    file->mapped = true;
+    file->complete = true;
+    file->hFile = hFile;
+    file->hMapping = hMapping;
+
+    return true;
+}
+
+
+/* ClosePeFile    Release the view and any handles behind it
+ * Parameters     View returned by OpenPeFile
+ */
+void ClosePeFile(PeFile *file)
+{
+    uint64_t mark = StatMark();
+    if (file->mapped)
+    {
+        UnmapViewOfFile(file->buffer.data);
+        CloseHandle(file->hMapping);
+        CloseHandle(file->hFile);
+    }
+    else
+    {
+        free((void *)file->buffer.data);
+    }
+
+    file->buffer.data = NULL;
+    file->buffer.size = 0;
+    TimeStat(TIMER_CLOSE, &mark);
+}
+
+#else
+
+/* MapPeFile    Open a file and map it for reading
+ * Parameters   File name, view to fill, whether to read all of a file
+ *              that can't be mapped rather than its header window
+ * Returns      true if the file is available through file->buffer
+ */
+static bool MapPeFile(const char *filename, PeFile *file, bool whole)
+{
+    file->buffer.data = NULL;
+    file->buffer.size = 0;
+    file->mapped = false;
+    file->complete = false;
+
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    /* Zero length files and anything that isn't a regular file can't be mapped */
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        close(fd);
+        return whole ? ReadWholeFile(filename, file) : ReadHeaderWindow(filename, file);
+    }
+
+    void *view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+    {
+        return whole ? ReadWholeFile(filename, file) : ReadHeaderWindow(filename, file);
+    }
+
+    file->buffer.data = (const uint8_t *)view;
+    file->buffer.size = (size_t)st.st_size;
+    file->mapped = true;
+    file->complete = true;
+
+    return true;
+}
+
+
+/* ClosePeFile    Release the view
+ * Parameters     View returned by OpenPeFile
+ */
+void ClosePeFile(PeFile *file)
+{
+    uint64_t mark = StatMark();
+    if (file->mapped)
+    {
+        munmap((void *)file->buffer.data, file->buffer.size);
+    }
+    else
+    {
+        free((void *)file->buffer.data);
+    }
+
+    file->buffer.data = NULL;
+    file->buffer.size = 0;
+    TimeStat(TIMER_CLOSE, &mark);
+}
+
+#endif
+
+
+/* OpenPeFile    Open a file and map it for reading, or read its header
+ *               window where it can't be mapped
+ * Parameters    File name, view to fill
+ * Returns       true if the file is available through file->buffer
+ */
+bool OpenPeFile(const char *filename, PeFile *file)
+{
+    uint64_t mark = StatMark();
+    bool ok = MapPeFile(filename, file, false);
+    if (ok && file->mapped)
+    {
+        CountStat(STAT_MAPS);
+        CountStat(STAT_BYTES_MAPPED, file->buffer.size);
+    }
+    TimeStat(TIMER_OPEN, &mark);
+    return ok;
+}
+
+
+/* OpenWholeFile    Open a file the way OpenPeFile does, but read all of it
+ *                  where it can't be mapped, for indexes and caches that
+ *                  are only usable whole
+ * Parameters       File name, view to fill
+ * Returns          true if the whole file is available through file->buffer
+ */
+bool OpenWholeFile(const char *filename, PeFile *file)
+{
+    uint64_t mark = StatMark();
+    bool ok = MapPeFile(filename, file, true);
+    if (ok && file->mapped)
+    {
+        CountStat(STAT_MAPS);
+        CountStat(STAT_BYTES_MAPPED, file->buffer.size);
+    }
+    TimeStat(TIMER_OPEN, &mark);
+    return ok;
+}
@@ -0,0 +1,146 @@
+#ifndef _PEFILE
+#define _PEFILE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PE_HEADER_WINDOW 0x10000  /* Bytes read in one call when the file can't be mapped */
+
+/* A borrowed, read-only range of bytes. The parser only ever sees one of
+ * these, so it doesn't care whether the bytes came from a mapping, a read
+ * or a caller's own buffer.
+ */
+typedef struct
+{
+    const uint8_t *data;   // first byte of the range
+    size_t size;           // number of valid bytes at data
+} PeBuffer;
+
+/* A read-only view of a file: either a mapping of the whole file or, for
+ * files that can't be mapped, one header window read through stdio.
+ */
+typedef struct
+{
+    PeBuffer buffer;
+    bool mapped;           // true if buffer is a mapped view, false if it was read into the heap
+    bool complete;         // buffer holds the whole file, not just its header window
+#ifdef _WIN32
+    void *hFile;
+    void *hMapping;
+#endif
+} PeFile;
+
+/* Sequential little endian reader over a buffer. Loads past the end of the
+ * buffer return 0 and latch overrun, so a header block can be decoded
+ * unconditionally and checked once at the end.
+ */
+typedef struct
+{
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+    bool overrun;
+    uint32_t seeks;         // moves to an offset other than the current one, for the stats
+} ByteCursor;
+
+bool OpenPeFile(const char *filename, PeFile *file);
+bool OpenWholeFile(const char *filename, PeFile *file);
+void ClosePeFile(PeFile *file);
+
+
+/* InitCursor    Start a cursor at the beginning of a buffer
+ * Parameters    Cursor to initialize, buffer to read
+ */
+inline void InitCursor(ByteCursor *cursor, PeBuffer buffer)
+{
+    cursor->data = buffer.data;
+    cursor->size = buffer.size;
+    cursor->offset = 0;
+    cursor->overrun = false;
+    cursor->seeks = 0;
+}
+
+
+/* SeekBytes     Move the cursor to an absolute offset in the buffer
+ * Parameters    Cursor, offset from the start of the buffer
+ */
+inline void SeekBytes(ByteCursor *cursor, size_t offset)
+{
+    cursor->seeks += cursor->offset != offset;
+    cursor->offset = offset;
+}
+
+
+/* ReadWord, ReadDword, ReadQword    Little endian loads from bytes the
+ *                                   caller has already bounds checked
+ */
+inline uint16_t ReadWord(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+inline uint32_t ReadDword(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline uint64_t ReadQword(const uint8_t *p)
+{
+    return ReadDword(p) | (uint64_t)ReadDword(p + 4) << 32;
+}
+
+
+/* SumBytes      Load contiguous little endian bytes at the cursor and advance
+ *               assumes input bytes are little endian and positive (unsigned)
+ * Parameters    Cursor to read, number of bytes to load (1, 2 or 4)
+ * Returns       Value of the bytes, else 0 if they run past the end of the buffer
+ */
+inline uint32_t SumBytes(ByteCursor *cursor, int count)
+{
+    if (cursor->offset > cursor->size || cursor->size - cursor->offset < (size_t)count)
+    {
+        cursor->overrun = true;
+        cursor->offset = cursor->size;
+        return 0;
+    }
+
+    const uint8_t *p = cursor->data + cursor->offset;
+    cursor->offset += count;
+
+    switch (count)
+    {
+    case 1:
+        return p[0];
+    case 2:
+        return ReadWord(p);
+    case 4:
+        return ReadDword(p);
+    default:
+        cursor->overrun = true;
+        return 0;
+    }
+}
+
+
+/* TakeBytes     Borrow a run of bytes at the cursor and advance past it
+ * Parameters    Cursor to read, number of bytes
+ * Returns       Pointer into the buffer, else NULL if the run doesn't fit
+ */
+inline const uint8_t *TakeBytes(ByteCursor *cursor, size_t count)
+{
+    if (cursor->offset > cursor->size || cursor->size - cursor->offset < count)
+    {
+        cursor->overrun = true;
+        cursor->offset = cursor->size;
+        return NULL;
+    }
+
+    const uint8_t *p = cursor->data + cursor->offset;
+    cursor->offset += count;
+    return p;
+}
+
+#endif // _PEFILE
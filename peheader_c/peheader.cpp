@@ -1,6 +1,6 @@
 //////////////////////////////////////////////////////////////////////////////
 //
-//  Module:     peheader.exe - Prints information about PE/COFF and archive files
+//  Module:     libpeheader - Parses PE/COFF and archive files
 //  File:       peheader.cpp
 //  Author:     Mark Coppa
 //
@@ -10,718 +10,569 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #include "peheader.h"
+#include "pelayout.h"
+#include "pestats.h"
 
-BOOL isPE32Plus = FALSE;
-BOOL isPE = FALSE;
-BOOL isCOFF = FALSE;
-BOOL isManaged = FALSE;
-BOOL isArchive = FALSE;
-
-int
-__cdecl
-wmain(
-    int argc,
-    __in_ecount(argc) WCHAR *argv[]
-     )
+#include <algorithm>
+
+/* ParseSections    Decode the section table into image->sections
+ * Parameters       Cursor over the file, offset of the table, image to fill
+ */
+static void ParseSections(ByteCursor *cur, size_t offset, PeImage *image)
 {
-    if (argc == 1 || argv[1][1] == '?')
+    uint32_t count = image->cfh.NumberOfSections;
+
+    SeekBytes(cur, offset);
+    if (TakeBytes(cur, (size_t)count * SECTION_HEADER_SIZE) == NULL)
     {
-        printf("Usage: peheader.exe <file> [-q]\n    [-q] print summary only\n");
-        exit(0);
+        /* Keep whatever part of a truncated table is present */
+        CountStat(STAT_MALFORMED);
+        count = (uint32_t)((cur->size - std::min(offset, cur->size)) / SECTION_HEADER_SIZE);
     }
 
-    BOOL quiet = FALSE;
+    image->sections.resize(count);
+    SeekBytes(cur, offset);
 
-    CoffFileHeader cfh;
-    OptionalStdHeader osh;
-    OptionalWinHeader owh;
-    OptionalDataDirs odd;
-
-    if (argc > 2 && argv[2][1] == 'q')
+    for (uint32_t i = 0; i < count; ++i)
     {
-        quiet = TRUE;
+        SectionHeader &sh = image->sections[i];
+        memcpy(sh.Name, TakeBytes(cur, 8), 8);
+        sh.VirtualSize = SumBytes(cur, 4);
+        sh.VirtualAddress = SumBytes(cur, 4);
+        sh.SizeOfRawData = SumBytes(cur, 4);
+        sh.PointerToRawData = SumBytes(cur, 4);
+        sh.PointerToRelocations = SumBytes(cur, 4);
+        sh.PointerToLinenumbers = SumBytes(cur, 4);
+        sh.NumberOfRelocations = SumBytes(cur, 2);
+        sh.NumberOfLinenumbers = SumBytes(cur, 2);
+        sh.Characteristics = SumBytes(cur, 4);
     }
+}
+
 
-    WCHAR *filename = argv[1];
-    if (!quiet)
+/* ReadCoffFileHeader    Decode the COFF file header at the cursor
+ */
+static void ReadCoffFileHeader(ByteCursor *cur, CoffFileHeader *cfh)
+{
+    const uint8_t *p = TakeBytes(cur, CoffFileHeaderLayout::size);
+    if (p != NULL)
     {
-        PRINT_LOGO(filename);
+        CoffFileHeaderLayout::Load(p, cfh);
     }
+}
 
-    FILE *pPE;
-    pPE = _wfopen(filename, L"rb");
-    if (pPE == NULL)
+
+/* BuildRvaIndex    Build the sorted RVA to file offset index from the
+ *                  section table, the way the loader maps sections
+ * Parameters       Image whose sections are already parsed
+ */
+static void BuildRvaIndex(PeImage *image)
+{
+    std::vector<RvaRange> &index = image->rvaIndex;
+    index.clear();
+    index.reserve(image->sections.size() + 1);
+
+    /* Headers are mapped at RVA 0 exactly as they appear in the file */
+    if (image->owh.SizeOfHeaders > 0)
     {
-        printf("Error: Could not open \"%s\" for reading\n", filename);
-        exit(1);
+        RvaRange headers = { 0, image->owh.SizeOfHeaders, 0, NO_SECTION };
+        index.push_back(headers);
     }
 
-    /* Check if file is an archive (uses ar format) */
-    char magicAr[7];
-    fread(magicAr, 1, 7, pPE);
-    if (strncmp(magicAr, "!<arch>", 7) == 0)
+    /* The loader rounds raw data pointers down to a 512 byte boundary */
+    uint32_t rawMask = image->owh.FileAlignment >= 0x200 ? ~(uint32_t)0x1FF : ~(uint32_t)0;
+
+    for (uint32_t i = 0; i < image->sections.size(); ++i)
     {
-        isArchive = TRUE;
-        goto finish;
+        const SectionHeader &sh = image->sections[i];
+        uint32_t size = sh.SizeOfRawData;
+        if (sh.VirtualSize != 0 && sh.VirtualSize < size)
+        {
+            size = sh.VirtualSize;
+        }
+
+        if (size == 0 || (uint64_t)sh.VirtualAddress + size > 0xFFFFFFFF)
+        {
+            continue;
+        }
+
+        RvaRange range = { sh.VirtualAddress, sh.VirtualAddress + size, sh.PointerToRawData & rawMask, i };
+        index.push_back(range);
     }
 
-    /* Determine section offsets */
-    fseek(pPE, PE_OFFSET_LOCATION, SEEK_SET);
-    int offsetSig  = SumBytes(pPE, 2);
-    int offsetCoff = offsetSig + 4;
-    int offsetStd  = offsetSig + 4 + 20;
-    int offsetWin  = offsetSig + 4 + 20 + 28;
-    int offsetData = offsetSig + 4 + 20 + 96;
+    std::stable_sort(index.begin(), index.end(),
+                     [](const RvaRange &a, const RvaRange &b) { return a.start < b.start; });
 
-    /* Check that signature exists */
-    fseek(pPE, offsetSig, SEEK_SET);
-    char buf[4];
-    fread(buf, 1, 2, pPE);
-    if (buf[0] != 'P' || buf[1] != 'E')
+    /* Sections take precedence over the headers where they overlap */
+    if (index.size() > 1 && index[0].section == NO_SECTION && index[0].end > index[1].start)
     {
-        goto finish;
+        index[0].end = index[1].start;
     }
-    else
+}
+
+
+/* RvaToOffset    Translate an RVA to a file offset in O(log n)
+ * Parameters     Parsed image, RVA, offset to fill, and optionally the
+ *                number of file-backed bytes available from that offset
+ * Returns        false if the RVA is not backed by file data
+ */
+bool RvaToOffset(const PeImage *image, uint32_t rva, uint32_t *offset, uint32_t *available)
+{
+    const std::vector<RvaRange> &index = image->rvaIndex;
+
+    /* Last range starting at or before rva */
+    std::vector<RvaRange>::const_iterator it =
+        std::upper_bound(index.begin(), index.end(), rva,
+                         [](uint32_t value, const RvaRange &range) { return value < range.start; });
+    if (it == index.begin())
     {
-        isPE = TRUE;
+        return false;
     }
+    --it;
 
-    /* Get COFF file header fields */
-    fseek(pPE, offsetCoff, SEEK_SET);
-    cfh.Machine = SumBytes(pPE, 2);
-    cfh.NumberOfSections = SumBytes(pPE, 2);
-    cfh.TimeDateStamp = SumBytes(pPE, 4);
-    cfh.PointerToSymbolTable = SumBytes(pPE, 4);
-    cfh.NumberOfSymbols = SumBytes(pPE, 4);
-    cfh.SizeOfOptionalHeader = SumBytes(pPE, 2);
-    cfh.Characteristics = SumBytes(pPE, 2);
-
-    if (cfh.SizeOfOptionalHeader == 0)
+    if (rva >= it->end)
     {
-        isCOFF = TRUE;
-        goto finish;
-    }
-
-    /* Get optional header standard fields */
-    fseek(pPE, offsetStd, SEEK_SET);
-    osh.Magic = SumBytes(pPE, 2);
-    osh.MajorLinkerVersion = SumBytes(pPE,1);
-    osh.MinorLinkerVersion = SumBytes(pPE, 1);
-    osh.SizeOfCode = SumBytes(pPE, 4);
-    osh.SizeOfInitializedData = SumBytes(pPE, 4);
-    osh.SizeOfUninitializedData = SumBytes(pPE, 4);
-    osh.AddressOfEntryPoint = SumBytes(pPE, 4);
-    osh.BaseOfCode = SumBytes(pPE, 4);
-    if (osh.Magic == 0x10b)
-    {
-        osh.BaseOfData = SumBytes(pPE, 4);
-    }
-
-    /* update offsets for PE32+ file */
-    if (osh.Magic == 0x20b)
-    {
-        isPE32Plus = TRUE;
-        offsetWin -= 4;
-        offsetData += 16;
-    }
-
-    /* Get optional windows header fields */
-    fseek(pPE, offsetWin, SEEK_SET);
-
-    /* BUG ImageBase is 8 bytes for PE32+, this is a truncation */
-    owh.ImageBase = SumBytes(pPE, 4);
-    if (isPE32Plus)
-    {
-        SumBytes(pPE, 4);   
-    }
-
-    owh.SectionAlignment = SumBytes(pPE, 4);
-    owh.FileAlignment = SumBytes(pPE, 4);
-    owh.MajorOperatingSystemVersion = SumBytes(pPE, 2);
-    owh.MinorOperatingSystemVersion = SumBytes(pPE, 2);
-    owh.MajorImageVersion = SumBytes(pPE, 2);
-    owh.MinorImageVersion = SumBytes(pPE, 2);
-    owh.MajorSubsystemVersion = SumBytes(pPE, 2);
-    owh.MinorSubsystemVersion = SumBytes(pPE, 2);
-    owh.Win32VersionValue = SumBytes(pPE, 4);
-    owh.SizeOfImage = SumBytes(pPE, 4);
-    owh.SizeOfHeaders = SumBytes(pPE, 4);
-    owh.CheckSum = SumBytes(pPE, 4);
-    owh.Subsystem = SumBytes(pPE, 2);
-    owh.DllCharacteristics = SumBytes(pPE, 2);
-
-    /* BUG these Size items are 8 bytes for PE32+, these are truncations */
-    owh.SizeOfStackReserve = SumBytes(pPE, 4);
-    if (isPE32Plus)
-    {
-        SumBytes(pPE, 4);   
-    }
-    owh.SizeOfStackCommit = SumBytes(pPE, 4);
-    if (isPE32Plus)
-    {
-        SumBytes(pPE, 4);   
-    }
-    owh.SizeOfHeapReserve = SumBytes(pPE, 4);
-    if (isPE32Plus)
-    {
-        SumBytes(pPE, 4);   
-    }
-    owh.SizeOfHeapCommit = SumBytes(pPE, 4);
-    if (isPE32Plus)
-    {
-        SumBytes(pPE, 4);   
-    }
-
-    owh.LoaderFlags = SumBytes(pPE, 4);
-    owh.NumberOfRvaAndSizes = SumBytes(pPE, 4);
-
-    /* Get optional data directories */
-    fseek(pPE, offsetData, SEEK_SET);
-    odd.ExportTable.VirtualAddress = SumBytes(pPE, 4);
-    odd.ExportTable.Size = SumBytes(pPE, 4);
-    odd.ImportTable.VirtualAddress = SumBytes(pPE, 4);
-    odd.ImportTable.Size = SumBytes(pPE, 4);
-    odd.ResourceTable.VirtualAddress = SumBytes(pPE, 4);
-    odd.ResourceTable.Size = SumBytes(pPE, 4);
-    odd.ExceptionTable.VirtualAddress = SumBytes(pPE, 4);
-    odd.ExceptionTable.Size = SumBytes(pPE, 4);
-    odd.CertificateTable.VirtualAddress = SumBytes(pPE, 4);
-    odd.CertificateTable.Size = SumBytes(pPE, 4);
-    odd.BaseRelocationTable.VirtualAddress = SumBytes(pPE, 4);
-    odd.BaseRelocationTable.Size = SumBytes(pPE, 4);
-    odd.Debug.VirtualAddress = SumBytes(pPE, 4);
-    odd.Debug.Size = SumBytes(pPE, 4);
-    odd.Architecture.VirtualAddress = SumBytes(pPE, 4);
-    odd.Architecture.Size = SumBytes(pPE, 4);
-    odd.GlobalPtr.VirtualAddress = SumBytes(pPE, 4);
-    odd.GlobalPtr.Size = SumBytes(pPE, 4);
-    odd.TLSTable.VirtualAddress = SumBytes(pPE, 4);
-    odd.TLSTable.Size = SumBytes(pPE, 4);
-    odd.LoadConfigTable.VirtualAddress = SumBytes(pPE, 4);
-    odd.LoadConfigTable.Size = SumBytes(pPE, 4);
-    odd.BoundImport.VirtualAddress = SumBytes(pPE, 4);
-    odd.BoundImport.Size = SumBytes(pPE, 4);
-    odd.IAT.VirtualAddress = SumBytes(pPE, 4);
-    odd.IAT.Size = SumBytes(pPE, 4);
-    odd.DelayImportDescriptor.VirtualAddress = SumBytes(pPE, 4);
-    odd.DelayImportDescriptor.Size = SumBytes(pPE, 4);
-    odd.CLRRuntimeHeader.VirtualAddress = SumBytes(pPE, 4);
-    odd.CLRRuntimeHeader.Size = SumBytes(pPE, 4);
-    odd.Reserved.VirtualAddress = SumBytes(pPE, 4);
-    odd.Reserved.Size = SumBytes(pPE, 4);
+        return false;
+    }
 
-    if (odd.CLRRuntimeHeader.Size > 0)
+    *offset = it->fileOffset + (rva - it->start);
+    if (available != NULL)
     {
-        isManaged = TRUE;
+        *available = it->end - rva;
     }
+    return true;
+}
 
-finish:
 
-    if (!quiet)
+/* RvaToPointer    Find the bytes of an RVA range in the file
+ * Parameters      Parsed image, the buffer it was parsed from, RVA, size
+ * Returns         Pointer to size bytes, else NULL if any of the range is
+ *                 not backed by file data or lies outside the buffer
+ */
+const uint8_t *RvaToPointer(const PeImage *image, PeBuffer buffer, uint32_t rva, uint32_t size)
+{
+    uint32_t offset;
+    uint32_t available;
+
+    if (!RvaToOffset(image, rva, &offset, &available) || available < size)
+    {
+        return NULL;
+    }
+    if (offset > buffer.size || buffer.size - offset < size)
     {
-        PrintAll(&cfh,
-                 &osh,
-                 &owh,
-                 &odd
-                );
+        return NULL;
     }
-    PrintSummary();
-    fclose(pPE);
 
-    return 0;
+    return buffer.data + offset;
 }
 
-/* SumBytes      Convert continguous little endian bytes into their value
- *               assumes input bytes are little endian and positive (unsigned)
- * Parameters    File to read, number of bytes to sum (up to 8)
- * Returns       Sum of bytes, else 0 if count is too big
+
+/* RvaToString    Find a NUL terminated string at an RVA
+ * Parameters     Parsed image, the buffer it was parsed from, RVA, length to fill
+ * Returns        Pointer to the string in the buffer, else NULL if it is not
+ *                terminated within file-backed data
  */
-UINT SumBytes(FILE *pFile, int count)
+const char *RvaToString(const PeImage *image, PeBuffer buffer, uint32_t rva, size_t *len)
 {
-    if (count > 8)
+    uint32_t offset;
+    uint32_t available;
+
+    if (!RvaToOffset(image, rva, &offset, &available) || offset >= buffer.size)
     {
-        return 0;
+        return NULL;
+    }
+    if (available > buffer.size - offset)
+    {
+        available = (uint32_t)(buffer.size - offset);
     }
 
-    UINT sum = 0;
-    UINT multiplier = 1;
-    UCHAR buf[1];
-
-    for (int i = 0; i < count; ++i)
+    const char *s = (const char *)buffer.data + offset;
+    const char *nul = (const char *)memchr(s, '\0', available);
+    if (nul == NULL)
     {
-        fread(buf, 1, 1, pFile);
-        sum += buf[0] * multiplier;
-        multiplier = multiplier<<8;
+        return NULL;
     }
 
-    return sum;
+    *len = (size_t)(nul - s);
+    return s;
 }
 
 
-/* PrintMachineType    Print the machine type (that image can run on)
- * Parameters          The type number
+/* KeepName      Store a name found in the file
+ * Parameters    Bytes of the name, length, interner (or NULL), owning image
+ * Returns       A NUL terminated copy that lives as long as the result
  */
-void PrintMachineType(int type)
+const char *KeepName(const char *s, size_t len, StringInterner *interner, PeImage *image)
 {
-    printf("machine (");
-
-    switch(type)
+    if (interner != NULL)
     {
-    case 0x0:
-        printf("UNKNOWN");
-        break;
-    case 0x1d3:
-        printf("AM33");
-        break;
-    case 0x8664:
-        printf("AMD64");
-        break;
-    case 0x1c0:
-        printf("ARM");
-        break;
-    case 0x1c4:
-        printf("ARMNT");
-        break;
-    case 0xaa64:
-        printf("ARM64");
-        break;
-    case 0xebc:  // heh
-        printf("EBC");
-        break;
-    case 0x14c:
-        printf("I386");
-        break;
-    case 0x200:
-        printf("IA64");
-        break;
-    case 0x9041:
-        printf("M32R");
-        break;
-    case 0x266:
-        printf("MIPS16");
-        break;
-    case 0x366:
-        printf("MIPSFPU");
-        break;
-    case 0x466:
-        printf("MIPSFPU16");
-        break;
-    case 0x1f0:
-        printf("POWERPC");
-        break;
-    case 0x1f1:
-        printf("POWERPCFP");
-        break;
-    case 0x166:
-        printf("R4000");
-        break;
-    case 0x1a2:
-        printf("SH3");
-        break;
-    case 0x1a3:
-        printf("SH3DSP");
-        break;
-    case 0x1a6:
-        printf("SH4");
-        break;
-    case 0x1a8:
-        printf("SH5");
-        break;
-    case 0x1c2:
-        printf("THUMB");
-        break;
-    case 0x169:
-        printf("WCEMIPSV2");
-        break;
-    default:
-        printf("No matching entry");
-        break;
+        return interner->Intern(s, len);
     }
-
-    printf(")\n");
+    return image->arena.CopyString(s, len);
 }
 
 
-/* PrintCharacteristics    Print the characteristics given by bit field
- * Parameters              The bit field of characteristics
+/* RunDecoders    Run the decoders asked for beyond the headers
+ * Parameters     The buffer the image was parsed from, the image, options
+ *                (NULL for none)
  */
-void PrintCharacteristics(int characteristics)
+static void RunDecoders(PeBuffer buffer, PeImage *image, const ParseOptions *options)
 {
-    if (characteristics & 0x0001)
+    if (options == NULL)
     {
-        PRINT_CHAR("Relocations stripped");
+        return;
     }
 
-    if (characteristics & 0x0002)
+    if ((options->flags & PARSE_IMPORTS) && DecodeImports(buffer, image, options->interner))
     {
-        PRINT_CHAR("Executable");
+        image->decoded |= PARSE_IMPORTS;
     }
-
-    if (characteristics & 0x0004)
+    if ((options->flags & PARSE_EXPORTS) && DecodeExports(buffer, image, options->interner))
     {
-        PRINT_CHAR("Line numbers stripped");
+        image->decoded |= PARSE_EXPORTS;
     }
-
-    if (characteristics & 0x0008)
+    if ((options->flags & PARSE_SYMBOLS) && DecodeSymbols(buffer, image, options->interner))
     {
-        PRINT_CHAR("Symbols stripped");
+        image->decoded |= PARSE_SYMBOLS;
     }
-
-    if (characteristics & 0x0010)
+    if ((options->flags & PARSE_CHECKSUM) && image->isPE && !image->isCOFF)
     {
-        PRINT_CHAR("AGGRESSIVE_WS_TRIM");
+        image->computedCheckSum = PeChecksum(buffer, image->owh.CheckSum);
+        image->decoded |= PARSE_CHECKSUM;
     }
-
-    if (characteristics & 0x0020)
+    if ((options->flags & PARSE_ENTROPY) && DecodeEntropy(buffer, image, options->entropySample))
     {
-        PRINT_CHAR("LARGE_ADDRESS_AWARE");
+        image->decoded |= PARSE_ENTROPY;
     }
-
-    if (characteristics & 0x0040)
+    if ((options->flags & PARSE_VERSION) && image->isPE && !image->isCOFF && DecodeVersionInfo(buffer, image))
     {
-        PRINT_CHAR("Reserved for future use");
+        image->decoded |= PARSE_VERSION;
     }
-
-    if (characteristics & 0x0080)
+    if ((options->flags & PARSE_RELOCS) && image->isPE && !image->isCOFF && DecodeRelocations(buffer, image))
     {
-        PRINT_CHAR("BYTES_REVERSED_LO");
+        image->decoded |= PARSE_RELOCS;
     }
-
-    if (characteristics & 0x0100)
+    if ((options->flags & PARSE_REBASE) && image->isPE && !image->isCOFF && DecodeRebase(buffer, image, options->rebaseTo))
     {
-        PRINT_CHAR("32 bit word machine");
+        image->decoded |= PARSE_REBASE;
     }
-
-    if (characteristics & 0x0200)
+    if ((options->flags & PARSE_CLR) && image->isPE && !image->isCOFF && image->isManaged &&
+        DecodeClr(buffer, image, options->interner))
     {
-        PRINT_CHAR("DEBUG_STRIPPED");
+        image->decoded |= PARSE_CLR;
     }
-
-    if (characteristics & 0x0400)
+    if ((options->flags & PARSE_DEBUG) && image->isPE && !image->isCOFF && DecodeDebug(buffer, image, options->interner))
     {
-        PRINT_CHAR("REMOVABLE_RUN_FROM_SWAP");
+        image->decoded |= PARSE_DEBUG;
     }
-
-    if (characteristics & 0x0800)
+    if ((options->flags & (PARSE_FUNCTIONS | PARSE_UNWIND)) && image->isPE && !image->isCOFF &&
+        DecodeFunctions(buffer, image, (options->flags & PARSE_UNWIND) != 0))
     {
-        PRINT_CHAR("NET_RUN_FROM_SWAP");
+        image->decoded |= options->flags & (PARSE_FUNCTIONS | PARSE_UNWIND);
     }
-
-    if (characteristics & 0x1000)
+    if ((options->flags & PARSE_RICH) && image->isPE && !image->isCOFF && DecodeRich(buffer, image))
     {
-        PRINT_CHAR("SYSTEM");
+        image->decoded |= PARSE_RICH;
     }
-
-    if (characteristics & 0x2000)
+    if ((options->flags & PARSE_SIMILARITY) && DecodeSimilarity(buffer, image))
     {
-        PRINT_CHAR("DLL");
+        image->decoded |= PARSE_SIMILARITY;
     }
+}
+
 
-    if (characteristics & 0x4000)
+/* NeededFacts    Normalize the facts a parse was asked for: each fact
+ *                brings the ones it is decoded with, and decoders need
+ *                everything
+ */
+static uint32_t NeededFacts(const ParseOptions *options)
+{
+    if (options == NULL || options->facts == 0 || options->flags != 0)
     {
-        PRINT_CHAR("UP_SYSTEM_ONLY");
+        return FACT_ALL;
     }
 
-    if (characteristics & 0x8000)
+    uint32_t facts = options->facts | FACT_KIND;
+    if (facts & FACT_SECTIONS)
+    {
+        facts |= FACT_HEADERS;
+    }
+    if (facts & FACT_HEADERS)
     {
-        PRINT_CHAR("BYTES_REVERSED_HI");
+        facts |= FACT_MACHINE | FACT_MANAGED;
     }
+    return facts;
 }
 
 
-/* PrintOSSubsystem    Print the windows subsystem string
- * Parameters          The subsystem value
+/* LooksLikeCoffObject    Check whether a file without a PE signature is
+ *                        plausibly a bare COFF object
  */
-void PrintOSSubsystem(int subsystem)
+static bool LooksLikeCoffObject(PeBuffer buffer)
 {
-    switch (subsystem)
+    if (buffer.size < COFF_FILE_HEADER_SIZE)
     {
-    case 0:
-        printf("An unknown subsystem\n");
-        break;
-    case 1:
-        printf("Device drivers and native Windows processs\n");
-        break;
-    case 2:
-        printf("The Windows graphical user interface (GUI) subsystem\n");
-        break;
-    case 3:
-        printf("Windows CUI\n");
-        break;
-    /* No cases listed for 4-6 */
-    case 7:
-        printf("The Posix character subsystem\n");
-        break;
-    /* No case for 8 */
-    case 9:
-        printf("Windows CE\n");
-        break;
-    case 10:
-        printf("An Extensible Firmware interface (EFI) application\n");
-        break;
-    case 11:
-        printf("An EFI driver with boot services\n");
-        break;
-    case 12:
-        printf("An EFI driver with run-time services\n");
-        break;
-    case 13:
-        printf("An EFI ROM image\n");
-        break;
-    case 14:
-        printf("XBOX\n");
+        return false;
+    }
+
+    const uint8_t *p = buffer.data;
+    uint16_t machine = ReadWord(p);
+    uint16_t sections = ReadWord(p + 2);
+    uint32_t symbols = ReadDword(p + 8);
+    uint16_t sizeOfOptionalHeader = ReadWord(p + 16);
+
+    switch (machine)
+    {
+    case 0x14c: case 0x166: case 0x169: case 0x184: case 0x1a2: case 0x1a3: case 0x1a6:
+    case 0x1a8: case 0x1c0: case 0x1c2: case 0x1c4: case 0x1d3: case 0x1f0: case 0x1f1:
+    case 0x200: case 0x266: case 0x366: case 0x466: case 0x5032: case 0x5064: case 0x5128:
+    case 0x6232: case 0x8664: case 0x9041: case 0xa641: case 0xa64e: case 0xaa64: case 0xebc:
         break;
     default:
-        printf("Error: unregistered value\n");
-        break;
+        return false;
     }
+
+    return sizeOfOptionalHeader == 0 && (sections > 0 || symbols > 0) &&
+           COFF_FILE_HEADER_SIZE + (size_t)sections * SECTION_HEADER_SIZE <= buffer.size;
 }
 
 
-/* PrintDLLCharacteristics    Print the characteristics given by bit field
- * Parameters                 The bit field of characteristics
+/* ParseHeaders    ParsePeImage, over a cursor the caller can look at
+ *                 afterwards
  */
-void PrintDLLCharacteristics(int characteristics)
+static PeImage ParseHeaders(PeBuffer buffer, const ParseOptions *options, ByteCursor *cursor)
 {
-    if (characteristics & 0x0001)
-    {
-        PRINT_CHAR("Reserved, must be zero (0x01)");
-    }
+    ByteCursor &cur = *cursor;
+    PeImage image = {};
+    CoffFileHeader &cfh = image.cfh;
+    OptionalDataDirs &odd = image.odd;
 
-    if (characteristics & 0x0002)
-    {
-        PRINT_CHAR("Reserved, must be zero (0x02)");
-    }
+    image.facts = NeededFacts(options);
 
-    if (characteristics & 0x0004)
-    {
-        PRINT_CHAR("Reserved, must be zero (0x04)");
-    }
+    InitCursor(&cur, buffer);
 
-    if (characteristics & 0x0008)
+    /* Check if file is an archive (uses ar format) */
+    if (IsArchive(buffer))
     {
-        PRINT_CHAR("Reserved, must be zero (0x08)");
+        image.isArchive = true;
+        return image;
     }
 
-    if (characteristics & 0x0040)
-    {
-        PRINT_CHAR("Dynamic base");
-    }
+    /* Determine section offsets */
+    SeekBytes(&cur, PE_OFFSET_LOCATION);
+    size_t offsetSig  = SumBytes(&cur, 4);
+    size_t offsetCoff = offsetSig + 4;
+    size_t offsetStd  = offsetSig + 4 + 20;
 
-    if (characteristics & 0x0080)
+    /* Check that signature exists */
+    SeekBytes(&cur, offsetSig);
+    if (cur.overrun || SumBytes(&cur, 2) != ('P' | 'E' << 8))
     {
-        PRINT_CHAR("Code integrity checks are enforced");
+        if (LooksLikeCoffObject(buffer))
+        {
+            return ParseCoffObject(buffer, options);
+        }
+        return image;
     }
-
-    if (characteristics & 0x0100)
+    else
     {
-        PRINT_CHAR("NX compatible");
+        image.isPE = true;
     }
 
-    if (characteristics & 0x0200)
-    {
-        PRINT_CHAR("Isolation aware, but do not isolate the image");
-    }
+    /* Get COFF file header fields */
+    SeekBytes(&cur, offsetCoff);
+    ReadCoffFileHeader(&cur, &cfh);
 
-    if (characteristics & 0x0400)
+    if (cur.overrun)
     {
-        PRINT_CHAR("No structured exception handler");
+        CountStat(STAT_MALFORMED);
+        image.isPE = false;
+        return image;
     }
 
-    if (characteristics & 0x0800)
+    if (cfh.SizeOfOptionalHeader == 0)
     {
-        PRINT_CHAR("Do not bind the image");
+        image.isCOFF = true;
+        if (image.facts & FACT_SECTIONS)
+        {
+            ParseSections(&cur, offsetStd, &image);
+            RunDecoders(buffer, &image, options);
+        }
+        return image;
+    }
+
+    /* Get the optional header: the magic picks the layout, and the rest
+     * is fixed offset loads once the header is known to be present. It is
+     * SizeOfOptionalHeader bytes long, which may leave out some of the
+     * data directories but not the fields before them. */
+    SeekBytes(&cur, offsetStd);
+    uint16_t magic = SumBytes(&cur, 2);
+    image.isPE32Plus = magic == 0x20b;
+
+    size_t fixedSize = image.isPE32Plus ? (size_t)OptionalHeader64Layout::dirOffset
+                                        : (size_t)OptionalHeader32Layout::dirOffset;
+    size_t optionalSize = std::min((size_t)cfh.SizeOfOptionalHeader,
+                                   image.isPE32Plus ? (size_t)OptionalHeader64Layout::size
+                                                    : (size_t)OptionalHeader32Layout::size);
+    SeekBytes(&cur, offsetStd);
+    const uint8_t *optional = optionalSize >= fixedSize ? TakeBytes(&cur, optionalSize) : NULL;
+
+    /* Optional header runs past the end of the file, or is too short to
+     * be one */
+    if (optional == NULL)
+    {
+        CountStat(STAT_MALFORMED);
+        image.isPE = false;
+        image.isPE32Plus = false;
+        return image;
+    }
+
+    /* Knowing that the header is there answers FACT_KIND; FACT_MANAGED
+     * needs one more directory entry */
+    if (image.facts & FACT_HEADERS)
+    {
+        if (image.isPE32Plus)
+        {
+            OptionalHeader64Layout::Load(optional, optionalSize, &image);
+        }
+        else
+        {
+            OptionalHeader32Layout::Load(optional, optionalSize, &image);
+        }
+    }
+    else if (image.facts & FACT_MANAGED)
+    {
+        image.osh.Magic = magic;
+        if (image.isPE32Plus)
+        {
+            OptionalHeader64Layout::LoadClrDirectory(optional, optionalSize, &image);
+        }
+        else
+        {
+            OptionalHeader32Layout::LoadClrDirectory(optional, optionalSize, &image);
+        }
     }
 
-    if (characteristics & 0x1000)
+    if (odd.CLRRuntimeHeader.Size > 0)
     {
-        PRINT_CHAR("Reserved, must be zero (0x1000)");
+        image.isManaged = true;
     }
 
-    if (characteristics & 0x2000)
+    if (!(image.facts & FACT_SECTIONS))
     {
-        PRINT_CHAR("A WDM driver");
+        return image;
     }
 
-    if (characteristics & 0x8000)
-    {
-        PRINT_CHAR("Terminal Server Aware");
-    }
+    /* The section table follows the optional header */
+    ParseSections(&cur, offsetStd + cfh.SizeOfOptionalHeader, &image);
+    BuildRvaIndex(&image);
+
+    RunDecoders(buffer, &image, options);
+    return image;
 }
 
 
-/* PrintAll     Print all available sections
+/* ParsePeImage    Decode the headers of a PE/COFF or archive file
+ * Parameters      Bytes of the file, starting at offset 0; which decoders
+ *                 to run beyond the headers and which facts are needed
+ *                 (NULL for no decoders and every header)
+ * Returns         The decoded image; fields of headers that are not
+ *                 present, or not needed, are left zero
  */
-void PrintAll(CoffFileHeader *cfh,
-              OptionalStdHeader *osh,
-              OptionalWinHeader *owh,
-              OptionalDataDirs *odd
-             )
+PeImage ParsePeImage(PeBuffer buffer, const ParseOptions *options)
 {
-    if (!isPE)
-    {
-        printf("Error: not a PE file\n");
-        return;
-    }
-
-    /* For forming version strings */
-    char buf[16];
-
-    /* Always print coff header */
-    printf("COFF FILE HEADER\n");
-
-    PRINT_HEX(cfh->Machine);
-    PrintMachineType(cfh->Machine);
-
-    PRINT_HEX(cfh->NumberOfSections);
-    printf("number of sections\n");
-
-    PRINT_HEX(cfh->TimeDateStamp);
-    time_t stamp = cfh->TimeDateStamp;
-    printf("time date stamp: %s", ctime(&stamp));
-
-    PRINT_HEX(cfh->PointerToSymbolTable);
-    printf("file pointer to symbol table\n");
-
-    PRINT_HEX(cfh->NumberOfSymbols);
-    printf("number of symbols\n");
-
-    PRINT_HEX(cfh->SizeOfOptionalHeader);
-    printf("size of optional header\n");
+    ByteCursor cur;
+    PeImage image = ParseHeaders(buffer, options, &cur);
+    CountStat(STAT_SEEKS, cur.seeks);
+    return image;
+}
 
-    PRINT_HEX(cfh->Characteristics);
-    printf("characteristics\n");
-    PrintCharacteristics(cfh->Characteristics);
 
-    /* Is a COFF file, no other headers to print */
-    if (isCOFF)
+/* HeaderExtent    How much of the start of a file ParsePeImage reads when
+ *                 it runs no decoders: the headers and the section table
+ * Parameters      The first bytes of the file, as many as have been read
+ * Returns         Bytes needed from offset 0. The answer can grow once
+ *                 that much has been read and the headers in it are
+ *                 known; SIZE_MAX for archives, which need the whole file
+ */
+size_t HeaderExtent(PeBuffer buffer)
+{
+    const size_t dosHeader = PE_OFFSET_LOCATION + 4;
+    if (buffer.size < dosHeader)
     {
-        printf("COFF file\n");
-        return;
+        return dosHeader;
     }
-
-    /* Print optional standard header */
-    printf("\nOPTIONAL STANDARD HEADER\n");
-
-    PRINT_HEX(osh->Magic);
-    printf("magic # %s\n", osh->Magic == 0x10B ? "(PE32)" : "(PE32+)");
-
-    sprintf(buf, "%d.%02d", osh->MajorLinkerVersion, osh->MinorLinkerVersion);
-    PRINT_STR(buf);
-    printf("linker version\n");
-
-    PRINT_HEX(osh->SizeOfCode);
-    printf("size of code\n");
-
-    PRINT_HEX(osh->SizeOfInitializedData);
-    printf("size of initialized data\n");
-
-    PRINT_HEX(osh->SizeOfUninitializedData);
-    printf("size of uninitialized data\n");
-
-    PRINT_HEX(osh->AddressOfEntryPoint);
-    printf("entry point (%08X)\n", owh->ImageBase + osh->AddressOfEntryPoint);
-
-    PRINT_HEX(osh->BaseOfCode);
-    printf("base of code\n");
-
-    if (!isPE32Plus)
+    if (IsArchive(buffer))
     {
-        PRINT_HEX(osh->BaseOfData);
-        printf("base of data\n");
+        return SIZE_MAX;
     }
 
-    /* Print optional windows header */
-    printf("\nOPTIONAL WINDOWS HEADER\n");
-    PRINT_HEX(owh->ImageBase);
-    printf("image base\n");    /* TODO print range */
-
-    PRINT_HEX(owh->SectionAlignment);
-    printf("section alignment\n");
-
-    PRINT_HEX(owh->FileAlignment);
-    printf("file alignment\n");
-
-    sprintf(buf, "%d.%02d", owh->MajorOperatingSystemVersion, owh->MinorOperatingSystemVersion);
-    PRINT_STR(buf);
-    printf("operating system version\n");
-
-    sprintf(buf, "%d.%02d", owh->MajorImageVersion, owh->MinorImageVersion);
-    PRINT_STR(buf);
-    printf("image version\n");
-
-    sprintf(buf, "%d.%02d", owh->MajorSubsystemVersion, owh->MinorSubsystemVersion);
-    PRINT_STR(buf);
-    printf("subsystem version\n");
-
-    PRINT_HEX(owh->Win32VersionValue);
-    printf("Win32 version\n");
-
-    PRINT_HEX(owh->SizeOfImage);
-    printf("size of image\n");
-
-    PRINT_HEX(owh->SizeOfHeaders);
-    printf("size of headers\n");
+    ByteCursor cur;
+    InitCursor(&cur, buffer);
 
-    PRINT_HEX(owh->CheckSum);
-    printf("checksum\n");
+    /* A bare COFF object's section table follows its file header */
+    SeekBytes(&cur, 2);
+    size_t coffObject = COFF_FILE_HEADER_SIZE + (size_t)SumBytes(&cur, 2) * SECTION_HEADER_SIZE;
 
-    PRINT_HEX(owh->Subsystem);
-    PrintOSSubsystem(owh->Subsystem);
-
-    PRINT_HEX(owh->DllCharacteristics);
-    printf("DLL characteristics\n");
-    PrintDLLCharacteristics(owh->DllCharacteristics);
-
-    PRINT_HEX(owh->SizeOfStackReserve);
-    printf("size of stack reserve\n");
-
-    PRINT_HEX(owh->SizeOfStackCommit);
-    printf("size of stack commit\n");
-
-    PRINT_HEX(owh->SizeOfHeapReserve);
-    printf("size of heap reserve\n");
-
-    PRINT_HEX(owh->SizeOfHeapCommit);
-    printf("size of heap commit\n");
-
-    PRINT_HEX(owh->LoaderFlags);
-    printf("loader flags\n");
+    SeekBytes(&cur, PE_OFFSET_LOCATION);
+    size_t offsetSig = SumBytes(&cur, 4);
+    size_t offsetStd = offsetSig + 4 + COFF_FILE_HEADER_SIZE;
+    if (buffer.size < offsetSig + 2)
+    {
+        return std::max(offsetSig + 2, coffObject);
+    }
 
-    PRINT_HEX(owh->NumberOfRvaAndSizes);
-    printf("number of directories\n");
+    SeekBytes(&cur, offsetSig);
+    if (SumBytes(&cur, 2) != ('P' | 'E' << 8))
+    {
+        return std::max(dosHeader, coffObject);
+    }
+    if (buffer.size < offsetStd)
+    {
+        return offsetStd;
+    }
 
-    /* Print optional data directories */
-    printf("\nOPTIONAL DATA DIRECTORIES\n");
-    PRINT_DIR(odd->ExportTable.VirtualAddress, odd->ExportTable.Size, "Export Directory");
-    PRINT_DIR(odd->ImportTable.VirtualAddress, odd->ImportTable.Size, "Import Directory");
-    PRINT_DIR(odd->ResourceTable.VirtualAddress, odd->ResourceTable.Size, "Resource Directory");
-    PRINT_DIR(odd->ExceptionTable.VirtualAddress, odd->ExceptionTable.Size, "Exception Directory");
-    PRINT_DIR(odd->CertificateTable.VirtualAddress, odd->CertificateTable.Size, "Certificates Directory");
-    PRINT_DIR(odd->BaseRelocationTable.VirtualAddress, odd->BaseRelocationTable.Size, "Base Relocation Directory");
-    PRINT_DIR(odd->Debug.VirtualAddress, odd->Debug.Size, "Debug Directory");
-    PRINT_DIR(odd->Architecture.VirtualAddress, odd->Architecture.Size, "Architecture Directory");
-    PRINT_DIR(odd->GlobalPtr.VirtualAddress, odd->GlobalPtr.Size, "Global Pointer Directory");
-    PRINT_DIR(odd->TLSTable.VirtualAddress, odd->TLSTable.Size, "Thread Storage Directory");
-    PRINT_DIR(odd->LoadConfigTable.VirtualAddress, odd->LoadConfigTable.Size, "Load Configuration Directory");
-    PRINT_DIR(odd->BoundImport.VirtualAddress, odd->BoundImport.Size, "Bound Import Directory");
-    PRINT_DIR(odd->IAT.VirtualAddress, odd->IAT.Size, "Import Address Table Directory");
-    PRINT_DIR(odd->DelayImportDescriptor.VirtualAddress, odd->DelayImportDescriptor.Size, "Delay Import Directory");
-    PRINT_DIR(odd->CLRRuntimeHeader.VirtualAddress, odd->CLRRuntimeHeader.Size, "COM Description Directory");
-    PRINT_DIR(odd->Reserved.VirtualAddress, odd->Reserved.Size, "Reserved Directory");
+    SeekBytes(&cur, offsetSig + 4 + 2);
+    size_t sections = (size_t)SumBytes(&cur, 2) * SECTION_HEADER_SIZE;
+    SeekBytes(&cur, offsetSig + 4 + 16);
+    size_t sizeOfOptionalHeader = SumBytes(&cur, 2);
+    if (sizeOfOptionalHeader == 0)
+    {
+        return offsetStd + sections;
+    }
 
-    printf("\n");
+    /* The optional header is read no further than it claims to go, but
+     * its magic is read whatever it claims */
+    return offsetStd + std::max((size_t)2, sizeOfOptionalHeader + sections);
 }
 
-
-/* PrintSummary    Print basic characteristics of the file
- * Parameters      Uses global characteristics
+/* ParseCoffObject    Decode a COFF object file, which starts directly with
+ *                    the file header (archive members, .obj files)
+ * Parameters         Bytes of the object, starting at its file header;
+ *                    which decoders to run (NULL for none)
+ * Returns            The decoded image, with isCOFF false if the bytes do
+ *                    not hold a complete file header
  */
-void PrintSummary()
+PeImage ParseCoffObject(PeBuffer buffer, const ParseOptions *options)
 {
-    printf("SUMMARY\n");
-    printf("Archive: %s\n", isArchive ? "TRUE" : "FALSE");
-    printf("PE: %s\n", isPE ? "TRUE" : "FALSE");
-    printf("COFF: %s\n", isCOFF ? "TRUE" : "FALSE");
-    printf("Managed: %s\n", isManaged ? "TRUE" : "FALSE");
+    PeImage image = {};
+    image.facts = NeededFacts(options);
+
+    ByteCursor cur;
+    InitCursor(&cur, buffer);
+    ReadCoffFileHeader(&cur, &image.cfh);
+
+    /* Objects have no optional header */
+    if (cur.overrun || image.cfh.SizeOfOptionalHeader != 0)
+    {
+        return image;
+    }
+
+    image.isCOFF = true;
+    if (image.facts & FACT_SECTIONS)
+    {
+        ParseSections(&cur, COFF_FILE_HEADER_SIZE, &image);
+        RunDecoders(buffer, &image, options);
+    }
+    return image;
 }
@@ -1,71 +1,84 @@
 #ifndef _PEHEADER
 #define _PEHEADER
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <time.h>
-#include <windows.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "pearchive.h"
+#include "pearena.h"
+#include "pechecksum.h"
+#include "peclr.h"
+#include "pedebug.h"
+#include "peentropy.h"
+#include "peexports.h"
+#include "pefile.h"
+#include "peimports.h"
+#include "perelocs.h"
+#include "peresource.h"
+#include "perich.h"
+#include "pesimilarity.h"
+#include "pesymbols.h"
+#include "peunwind.h"
 
 #define PE_OFFSET_LOCATION 60  /* The address of the PE header is given at 60 bytes into the image */
-#define PRINT_LOGO(filename) printf("PE/COFF header dump\n\nDump of %S\n\n", filename);
-#define PRINT_CHAR(value) printf("             %s\n", value);
-#define PRINT_HEX(value) printf("%10X ", value)
-#define PRINT_STR(value) printf("%10s ", value)
-#define PRINT_DIR(address, size, item) printf("%10X [%8X] RVA [size] of %s\n", address, size, item);
+#define COFF_FILE_HEADER_SIZE 20
+#define SECTION_HEADER_SIZE 40
 
 typedef struct
 {
-    UINT Machine;                // 2 bytes
-    UINT NumberOfSections;       // 2 bytes
-    UINT TimeDateStamp;          // 4 bytes
-    UINT PointerToSymbolTable;   // 4 bytes
-    UINT NumberOfSymbols;        // 4 bytes
-    UINT SizeOfOptionalHeader;   // 2 bytes
-    UINT Characteristics;        // 2 bytes
+    uint16_t Machine;
+    uint16_t NumberOfSections;
+    uint32_t TimeDateStamp;
+    uint32_t PointerToSymbolTable;
+    uint32_t NumberOfSymbols;
+    uint16_t SizeOfOptionalHeader;
+    uint16_t Characteristics;
 } CoffFileHeader;
 
 typedef struct
 {
-    UINT Magic;                     // 2 bytes
-    UINT MajorLinkerVersion;        // 1 byte
-    UINT MinorLinkerVersion;        // 1 bytes
-    UINT SizeOfCode;                // 4 bytes
-    UINT SizeOfInitializedData;     // 4 bytes
-    UINT SizeOfUninitializedData;   // 4 bytes
-    UINT AddressOfEntryPoint;       // 4 bytes
-    UINT BaseOfCode;                // 4 bytes
-    UINT BaseOfData;                // 4 bytes (PE32 only)
+    uint16_t Magic;
+    uint8_t MajorLinkerVersion;
+    uint8_t MinorLinkerVersion;
+    uint32_t SizeOfCode;
+    uint32_t SizeOfInitializedData;
+    uint32_t SizeOfUninitializedData;
+    uint32_t AddressOfEntryPoint;
+    uint32_t BaseOfCode;
+    uint32_t BaseOfData;                // PE32 only
 } OptionalStdHeader;
 
 typedef struct
 {
-    UINT ImageBase;                     // 4 bytes (8 for PE32+)
-    UINT SectionAlignment;              // 4 bytes
-    UINT FileAlignment;                 // 4 bytes
-    UINT MajorOperatingSystemVersion;   // 2 bytes
-    UINT MinorOperatingSystemVersion;   // 2 bytes
-    UINT MajorImageVersion;             // 2 bytes
-    UINT MinorImageVersion;             // 2 bytes
-    UINT MajorSubsystemVersion;         // 2 bytes
-    UINT MinorSubsystemVersion;         // 2 bytes
-    UINT Win32VersionValue;             // 4 bytes
-    UINT SizeOfImage;                   // 4 bytes
-    UINT SizeOfHeaders;                 // 4 bytes
-    UINT CheckSum;                      // 4 bytes
-    UINT Subsystem;                     // 2 bytes
-    UINT DllCharacteristics;            // 2 bytes
-    UINT SizeOfStackReserve;            // 4 bytes (8 for PE32+)
-    UINT SizeOfStackCommit;             // 4 bytes (8 for PE32+)
-    UINT SizeOfHeapReserve;             // 4 bytes (8 for PE32+)
-    UINT SizeOfHeapCommit;              // 4 bytes (8 for PE32+)
-    UINT LoaderFlags;                   // 4 bytes
-    UINT NumberOfRvaAndSizes;           // 4 bytes
+    uint64_t ImageBase;                 // 4 bytes on disk (8 for PE32+)
+    uint32_t SectionAlignment;
+    uint32_t FileAlignment;
+    uint16_t MajorOperatingSystemVersion;
+    uint16_t MinorOperatingSystemVersion;
+    uint16_t MajorImageVersion;
+    uint16_t MinorImageVersion;
+    uint16_t MajorSubsystemVersion;
+    uint16_t MinorSubsystemVersion;
+    uint32_t Win32VersionValue;
+    uint32_t SizeOfImage;
+    uint32_t SizeOfHeaders;
+    uint32_t CheckSum;
+    uint16_t Subsystem;
+    uint16_t DllCharacteristics;
+    uint64_t SizeOfStackReserve;        // 4 bytes on disk (8 for PE32+)
+    uint64_t SizeOfStackCommit;         // 4 bytes on disk (8 for PE32+)
+    uint64_t SizeOfHeapReserve;         // 4 bytes on disk (8 for PE32+)
+    uint64_t SizeOfHeapCommit;          // 4 bytes on disk (8 for PE32+)
+    uint32_t LoaderFlags;
+    uint32_t NumberOfRvaAndSizes;
 } OptionalWinHeader;
 
 typedef struct
 {
-    UINT VirtualAddress;    // 4 bytes
-    UINT Size;              // 4 bytes
+    uint32_t VirtualAddress;
+    uint32_t Size;
 } DataDirectory;
 
 typedef struct
@@ -88,16 +101,115 @@ typedef struct
     DataDirectory Reserved;
 } OptionalDataDirs;
 
+typedef struct
+{
+    char Name[8];                       // NUL padded, not terminated when all 8 bytes are used
+    uint32_t VirtualSize;
+    uint32_t VirtualAddress;
+    uint32_t SizeOfRawData;
+    uint32_t PointerToRawData;
+    uint32_t PointerToRelocations;
+    uint32_t PointerToLinenumbers;
+    uint16_t NumberOfRelocations;
+    uint16_t NumberOfLinenumbers;
+    uint32_t Characteristics;
+} SectionHeader;
+
+/* One entry of the RVA index: a run of RVAs that is backed by file data.
+ * The index is sorted by start so a lookup is a binary search.
+ */
+typedef struct
+{
+    uint32_t start;         // first RVA of the run
+    uint32_t end;           // one past the last RVA backed by raw data
+    uint32_t fileOffset;    // file offset of start
+    uint32_t section;       // index into sections, or NO_SECTION for the headers
+} RvaRange;
+
+#define NO_SECTION 0xFFFFFFFF
+
+/* Decoders that run beyond the headers and section table */
+#define PARSE_IMPORTS       0x0001
+#define PARSE_EXPORTS       0x0002
+#define PARSE_SYMBOLS       0x0004
+#define PARSE_CHECKSUM      0x0008   /* needs the whole file in the buffer, not a header window */
+#define PARSE_ENTROPY       0x0010   /* likewise */
+#define PARSE_VERSION       0x0020
+#define PARSE_RELOCS        0x0040
+#define PARSE_REBASE        0x0080   /* needs the whole file */
+#define PARSE_CLR           0x0100
+#define PARSE_DEBUG         0x0200
+#define PARSE_FUNCTIONS     0x0400
+#define PARSE_UNWIND        0x0800   /* implies PARSE_FUNCTIONS */
+#define PARSE_RICH          0x1000
+#define PARSE_SIMILARITY    0x2000   /* needs the whole file */
+
+/* Facts a parse can be limited to. ParsePeImage touches only the bytes
+ * the requested facts depend on and returns once they are known; any
+ * PARSE_* decoder needs them all.
+ */
+#define FACT_KIND           0x0001   /* isArchive, isPE, isCOFF; always answered */
+#define FACT_MACHINE        0x0002   /* the COFF file header */
+#define FACT_MANAGED        0x0004   /* isPE32Plus and isManaged: the magic and the CLR directory entry */
+#define FACT_HEADERS        0x0008   /* every optional header field */
+#define FACT_SECTIONS       0x0010   /* the section table and RVA index */
+#define FACT_ALL            0x001F
+
+typedef struct
+{
+    uint32_t flags;                 // PARSE_* decoders to run
+    StringInterner *interner;       // shared home for names, NULL to keep them in the image's arena
+    uint32_t facts;                 // FACT_* the caller needs, 0 for all
+    uint64_t entropySample;         // PARSE_ENTROPY: most bytes read per range, 0 for all
+    uint64_t rebaseTo;              // PARSE_REBASE: the image base to rebase a copy to
+} ParseOptions;
+
+/* Everything learned about one file. A PeImage owns all of its data (or
+ * shares immutable names with a StringInterner) and holds no reference to
+ * the buffer it was parsed from, so results can be kept, moved and handed
+ * between threads freely.
+ */
+typedef struct PeImage
+{
+    bool isArchive;
+    bool isPE;
+    bool isCOFF;
+    bool isManaged;
+    bool isPE32Plus;
+
+    CoffFileHeader cfh;
+    OptionalStdHeader osh;
+    OptionalWinHeader owh;
+    OptionalDataDirs odd;
+
+    std::vector<SectionHeader> sections;
+    std::vector<RvaRange> rvaIndex;
+
+    uint32_t facts;                 // FACT_* that were decoded; other fields are left zero
+    uint32_t decoded;               // PARSE_* decoders that ran
+    Arena arena;                    // storage for variable sized results
+    ImportTable imports;
+    ExportTable exports;
+    SymbolTable symbols;
+    uint32_t computedCheckSum;      // PARSE_CHECKSUM: what the loader would compute
+    EntropyTable entropy;           // PARSE_ENTROPY
+    VersionInfo version;            // PARSE_VERSION
+    RelocationTable relocations;    // PARSE_RELOCS, PARSE_REBASE
+    ClrInfo clr;                    // PARSE_CLR
+    DebugInfo debug;                // PARSE_DEBUG
+    FunctionTable functions;        // PARSE_FUNCTIONS, PARSE_UNWIND
+    RichHeader rich;                // PARSE_RICH
+    SimilarityTable similarity;     // PARSE_SIMILARITY
+} PeImage;
+
+
+PeImage ParsePeImage(PeBuffer buffer, const ParseOptions *options = NULL);
+PeImage ParseCoffObject(PeBuffer buffer, const ParseOptions *options = NULL);
+size_t HeaderExtent(PeBuffer buffer);
 
-UINT SumBytes(FILE *pFile, int count);
-void PrintMachineType(int type);
-void PrintCharacteristics(int characteristics);
-void PrintOSSubsystem(int subsystem);
-void PrintAll(CoffFileHeader *cfh,
-              OptionalStdHeader *osh,
-              OptionalWinHeader *owh,
-              OptionalDataDirs *odd
-             );
-void PrintSummary();
+bool RvaToOffset(const PeImage *image, uint32_t rva, uint32_t *offset, uint32_t *available = NULL);
+const uint8_t *RvaToPointer(const PeImage *image, PeBuffer buffer, uint32_t rva, uint32_t size);
+const char *RvaToString(const PeImage *image, PeBuffer buffer, uint32_t rva, size_t *len);
+const char *KeepName(const char *s, size_t len, StringInterner *interner, PeImage *image);
 
-#endif _PEHEADER
+#endif // _PEHEADER
@@ -0,0 +1,291 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       peimports.cpp
+//  Author:     Mark Coppa
+//
+//  Import directory decoder. Walks the import descriptors, their lookup
+//  (or address) thunks and hint/name entries for PE32 and PE32+, and
+//  computes the import hash in the same pass.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "peheader.h"
+#include "pedigest.h"
+
+#include <ctype.h>
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#endif
+
+/* HashLower     Feed bytes to the import hash lower cased
+ */
+static void HashLower(Md5Context *ctx, const char *s, size_t len)
+{
+    char buf[64];
+
+    while (len > 0)
+    {
+        size_t n = len < sizeof(buf) ? len : sizeof(buf);
+        for (size_t i = 0; i < n; ++i)
+        {
+            buf[i] = (char)tolower((unsigned char)s[i]);
+        }
+        Md5Update(ctx, buf, n);
+        s += n;
+        len -= n;
+    }
+}
+
+
+/* HashLibraryName    Feed a DLL name to the import hash: lower cased, with
+ *                    a .dll, .ocx or .sys extension removed
+ */
+static void HashLibraryName(Md5Context *ctx, const char *dll, size_t len)
+{
+    if (len > 4 && dll[len - 4] == '.')
+    {
+        char ext[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            ext[i] = (char)tolower((unsigned char)dll[len - 3 + i]);
+        }
+
+        if (memcmp(ext, "dll", 3) == 0 || memcmp(ext, "ocx", 3) == 0 || memcmp(ext, "sys", 3) == 0)
+        {
+            len -= 4;
+        }
+    }
+
+    HashLower(ctx, dll, len);
+}
+
+
+/* DecodeImports    Decode the import directory into image->imports
+ * Parameters       The buffer the image was parsed from, the image, and an
+ *                  optional interner for DLL and function names
+ * Returns          false if the image has no readable import directory
+ */
+bool DecodeImports(PeBuffer buffer, PeImage *image, StringInterner *interner)
+{
+    ImportTable *imports = &image->imports;
+    uint32_t descriptorRva = image->odd.ImportTable.VirtualAddress;
+
+    if (descriptorRva == 0 || image->odd.ImportTable.Size == 0)
+    {
+        return false;
+    }
+
+    uint32_t thunkSize = image->isPE32Plus ? 8 : 4;
+    uint64_t ordinalFlag = image->isPE32Plus ? 0x8000000000000000ull : 0x80000000ull;
+
+    /* Every descriptor can point at the same thunk array, so the per
+     * module limits alone still allow ~1e9 entries from a small file. A
+     * real image can't import more functions than it has room for
+     * thunks. */
+    size_t maxFunctions = buffer.size / thunkSize;
+    if (maxFunctions > MAX_IMPORT_FUNCTIONS)
+    {
+        maxFunctions = MAX_IMPORT_FUNCTIONS;
+    }
+    imports->truncated = false;
+
+    Md5Context hash;
+    Md5Init(&hash);
+    bool firstHashed = true;
+
+    for (uint32_t n = 0; n < MAX_IMPORT_MODULES && !imports->truncated; ++n, descriptorRva += IMPORT_DESCRIPTOR_SIZE)
+    {
+        const uint8_t *d = RvaToPointer(image, buffer, descriptorRva, IMPORT_DESCRIPTOR_SIZE);
+        if (d == NULL)
+        {
+            break;
+        }
+
+        PeBuffer descriptor = { d, IMPORT_DESCRIPTOR_SIZE };
+        ByteCursor cur;
+        InitCursor(&cur, descriptor);
+        uint32_t lookupRva = SumBytes(&cur, 4);
+        uint32_t timeDateStamp = SumBytes(&cur, 4);
+        SumBytes(&cur, 4);   // forwarder chain
+        uint32_t nameRva = SumBytes(&cur, 4);
+        uint32_t addressRva = SumBytes(&cur, 4);
+
+        /* The table ends with an all zero descriptor */
+        if (lookupRva == 0 && nameRva == 0 && addressRva == 0)
+        {
+            break;
+        }
+
+        size_t dllLen;
+        const char *dll = RvaToString(image, buffer, nameRva, &dllLen);
+        if (dll == NULL)
+        {
+            continue;
+        }
+
+        ImportModule module;
+        module.dll = KeepName(dll, dllLen, interner, image);
+        module.TimeDateStamp = timeDateStamp;
+        module.firstFunction = (uint32_t)imports->functions.size();
+        module.functionCount = 0;
+
+        /* Bound images may have no lookup table; the address table then
+         * still holds the original thunks on disk */
+        uint32_t thunkRva = lookupRva != 0 ? lookupRva : addressRva;
+
+        for (uint32_t t = 0; t < MAX_IMPORT_THUNKS; ++t, thunkRva += thunkSize)
+        {
+            const uint8_t *p = RvaToPointer(image, buffer, thunkRva, thunkSize);
+            if (p == NULL)
+            {
+                break;
+            }
+
+            uint64_t thunk = thunkSize == 8 ? ReadQword(p) : ReadDword(p);
+
+            if (thunk == 0)
+            {
+                break;
+            }
+            if (imports->functions.size() >= maxFunctions)
+            {
+                imports->truncated = true;
+                break;
+            }
+
+            ImportFunction function = { NULL, 0, 0 };
+            const char *name = NULL;
+            size_t nameLen = 0;
+
+            if (thunk & ordinalFlag)
+            {
+                function.ordinal = (uint16_t)thunk;
+            }
+            else
+            {
+                const uint8_t *hint = RvaToPointer(image, buffer, (uint32_t)thunk, 2);
+                name = hint != NULL ? RvaToString(image, buffer, (uint32_t)thunk + 2, &nameLen) : NULL;
+                if (name == NULL)
+                {
+                    continue;
+                }
+                function.hint = ReadWord(hint);
+                function.name = KeepName(name, nameLen, interner, image);
+            }
+
+            imports->functions.push_back(function);
+            ++module.functionCount;
+
+            /* imphash: "library.function" lower cased, comma separated */
+            if (!firstHashed)
+            {
+                Md5Update(&hash, ",", 1);
+            }
+            firstHashed = false;
+
+            HashLibraryName(&hash, dll, dllLen);
+            Md5Update(&hash, ".", 1);
+            if (name != NULL)
+            {
+                HashLower(&hash, name, nameLen);
+            }
+            else
+            {
+                char ord[16];
+                int len = snprintf(ord, sizeof(ord), "ord%u", (unsigned)function.ordinal);
+                Md5Update(&hash, ord, len);
+            }
+        }
+
+        imports->modules.push_back(module);
+    }
+
+    Md5Final(&hash, imports->imphash);
+    return !imports->modules.empty();
+}
+
+
+/* ImportsFunction    Check whether an image imports a function
+ * Parameters         Decoded image, DLL name (case insensitive, NULL for
+ *                    any), function name (NULL for any function of the DLL)
+ * Returns            true if a matching import exists
+ */
+bool ImportsFunction(const PeImage *image, const char *dll, const char *function)
+{
+    const ImportTable *imports = &image->imports;
+
+    for (size_t m = 0; m < imports->modules.size(); ++m)
+    {
+        const ImportModule &module = imports->modules[m];
+        if (dll != NULL && strcasecmp(module.dll, dll) != 0)
+        {
+            continue;
+        }
+
+        if (function == NULL && module.functionCount > 0)
+        {
+            return true;
+        }
+
+        for (uint32_t i = 0; function != NULL && i < module.functionCount; ++i)
+        {
+            const char *name = imports->functions[module.firstFunction + i].name;
+            if (name != NULL && strcmp(name, function) == 0)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+
+/* ImportsModule    Check whether an image imports from a DLL without
+ *                  decoding the import table: walks the descriptors only
+ *                  and stops at the first match
+ * Parameters       Image parsed through its sections, the buffer it was
+ *                  parsed from, DLL name (case insensitive)
+ * Returns          true if a descriptor names the DLL
+ */
+bool ImportsModule(const PeImage *image, PeBuffer buffer, const char *dll)
+{
+    uint32_t descriptorRva = image->odd.ImportTable.VirtualAddress;
+    size_t wantedLen = strlen(dll);
+
+    if (descriptorRva == 0 || image->odd.ImportTable.Size == 0)
+    {
+        return false;
+    }
+
+    for (uint32_t n = 0; n < MAX_IMPORT_MODULES; ++n, descriptorRva += IMPORT_DESCRIPTOR_SIZE)
+    {
+        const uint8_t *d = RvaToPointer(image, buffer, descriptorRva, IMPORT_DESCRIPTOR_SIZE);
+        if (d == NULL)
+        {
+            return false;
+        }
+
+        uint32_t lookupRva = ReadDword(d);
+        uint32_t nameRva = ReadDword(d + 12);
+        uint32_t addressRva = ReadDword(d + 16);
+        if (lookupRva == 0 && nameRva == 0 && addressRva == 0)
+        {
+            return false;
+        }
+
+        size_t len;
+        const char *name = RvaToString(image, buffer, nameRva, &len);
+        if (name != NULL && len == wantedLen && strncasecmp(name, dll, len) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,48 @@
+#ifndef _PEIMPORTS
+#define _PEIMPORTS
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "pearena.h"
+#include "pefile.h"
+
+#define IMPORT_DESCRIPTOR_SIZE 20
+#define MAX_IMPORT_MODULES     0x4000     /* Stop walking descriptors after this many */
+#define MAX_IMPORT_THUNKS      0x10000    /* Stop walking one module's thunks after this many */
+#define MAX_IMPORT_FUNCTIONS   0x100000   /* Stop decoding an image's imports after this many in all */
+
+typedef struct
+{
+    const char *name;       // function name, NULL when imported by ordinal
+    uint16_t hint;          // index hint into the exporter's name table
+    uint16_t ordinal;       // ordinal, when imported by ordinal
+} ImportFunction;
+
+typedef struct
+{
+    const char *dll;
+    uint32_t TimeDateStamp;
+    uint32_t firstFunction;     // index of the module's first entry in ImportTable::functions
+    uint32_t functionCount;
+} ImportModule;
+
+/* The decoded import directory. Name pointers refer either to the string
+ * interner passed to the decoder or to the owning image's arena.
+ */
+typedef struct
+{
+    std::vector<ImportModule> modules;
+    std::vector<ImportFunction> functions;
+    uint8_t imphash[16];        // MD5 of "dll.function,..." lower cased, as imphash tools compute it
+    bool truncated;             // stopped at the limit on functions; the rest was not decoded
+} ImportTable;
+
+struct PeImage;
+
+bool DecodeImports(PeBuffer buffer, PeImage *image, StringInterner *interner);
+bool ImportsFunction(const PeImage *image, const char *dll, const char *function);
+bool ImportsModule(const PeImage *image, PeBuffer buffer, const char *dll);
+
+#endif // _PEIMPORTS
@@ -0,0 +1,251 @@
+#ifndef _PELAYOUT
+#define _PELAYOUT
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pefile.h"
+#include "peheader.h"
+
+/* On-disk layouts of the PE headers, each described once as a list of
+ * fields: where the field sits in the file, how wide it is there, and
+ * which struct member receives it. Layout<...>::Load expands at compile
+ * time into one fixed-offset little endian load per field, so decoding a
+ * header is straight-line code with no per-field bounds checks or
+ * branches; the caller checks once that Layout::size bytes are present.
+ * LoadWithin is the slow path for a header cut short: it loads only the
+ * fields that end within a limit and zeroes the rest.
+ */
+
+/* LoadLE    Little endian load of 1, 2, 4 or 8 bytes */
+template <size_t Width> struct LoadLE;
+
+template <> struct LoadLE<1>
+{
+    static uint64_t Load(const uint8_t *p) { return p[0]; }
+};
+
+template <> struct LoadLE<2>
+{
+    static uint64_t Load(const uint8_t *p) { return ReadWord(p); }
+};
+
+template <> struct LoadLE<4>
+{
+    static uint64_t Load(const uint8_t *p) { return ReadDword(p); }
+};
+
+template <> struct LoadLE<8>
+{
+    static uint64_t Load(const uint8_t *p) { return ReadQword(p); }
+};
+
+/* Field    One header field: Width bytes at Offset into Member */
+template <size_t Offset, size_t Width, typename S, typename T, T S::*Member>
+struct Field
+{
+    static_assert(Width <= sizeof(T), "field is wider than the member that receives it");
+    enum { end = Offset + Width };
+
+    static void Load(const uint8_t *p, S *s) { s->*Member = (T)LoadLE<Width>::Load(p + Offset); }
+
+    static void LoadWithin(const uint8_t *p, S *s, size_t limit)
+    {
+        s->*Member = (size_t)end <= limit ? (T)LoadLE<Width>::Load(p + Offset) : T();
+    }
+};
+
+/* DirectoryField    One data directory: address and size at Offset */
+template <size_t Offset, DataDirectory OptionalDataDirs::*Member>
+struct DirectoryField
+{
+    enum { end = Offset + 8 };
+
+    static void Load(const uint8_t *p, OptionalDataDirs *s)
+    {
+        (s->*Member).VirtualAddress = (uint32_t)LoadLE<4>::Load(p + Offset);
+        (s->*Member).Size = (uint32_t)LoadLE<4>::Load(p + Offset + 4);
+    }
+
+    static void LoadWithin(const uint8_t *p, OptionalDataDirs *s, size_t limit)
+    {
+        if ((size_t)end <= limit)
+        {
+            Load(p, s);
+        }
+        else
+        {
+            (s->*Member).VirtualAddress = 0;
+            (s->*Member).Size = 0;
+        }
+    }
+};
+
+/* MaxEnd    Largest end offset of a field list, the layout's size */
+template <typename... Fields> struct MaxEnd;
+
+template <> struct MaxEnd<>
+{
+    enum { value = 0 };
+};
+
+template <typename F, typename... Rest> struct MaxEnd<F, Rest...>
+{
+    enum { value = (size_t)F::end > (size_t)MaxEnd<Rest...>::value ? (size_t)F::end : (size_t)MaxEnd<Rest...>::value };
+};
+
+template <typename S, typename... Fields>
+struct Layout
+{
+    enum { size = MaxEnd<Fields...>::value };
+
+    static void Load(const uint8_t *p, S *s)
+    {
+        int expand[] = { (Fields::Load(p, s), 0)... };
+        (void)expand;
+    }
+
+    static void LoadWithin(const uint8_t *p, S *s, size_t limit)
+    {
+        if (limit >= (size_t)size)
+        {
+            Load(p, s);
+            return;
+        }
+        int expand[] = { (Fields::LoadWithin(p, s, limit), 0)... };
+        (void)expand;
+    }
+};
+
+#define PE_FIELD(S, name, offset, width) Field<offset, width, S, decltype(S::name), &S::name>
+#define PE_DIR(name, offset) DirectoryField<offset, &OptionalDataDirs::name>
+
+
+typedef Layout<CoffFileHeader,
+               PE_FIELD(CoffFileHeader, Machine, 0, 2),
+               PE_FIELD(CoffFileHeader, NumberOfSections, 2, 2),
+               PE_FIELD(CoffFileHeader, TimeDateStamp, 4, 4),
+               PE_FIELD(CoffFileHeader, PointerToSymbolTable, 8, 4),
+               PE_FIELD(CoffFileHeader, NumberOfSymbols, 12, 4),
+               PE_FIELD(CoffFileHeader, SizeOfOptionalHeader, 16, 2),
+               PE_FIELD(CoffFileHeader, Characteristics, 18, 2)
+              > CoffFileHeaderLayout;
+
+/* The standard fields; PE32+ drops BaseOfData */
+#define OPTIONAL_STD_FIELDS \
+               PE_FIELD(OptionalStdHeader, Magic, 0, 2), \
+               PE_FIELD(OptionalStdHeader, MajorLinkerVersion, 2, 1), \
+               PE_FIELD(OptionalStdHeader, MinorLinkerVersion, 3, 1), \
+               PE_FIELD(OptionalStdHeader, SizeOfCode, 4, 4), \
+               PE_FIELD(OptionalStdHeader, SizeOfInitializedData, 8, 4), \
+               PE_FIELD(OptionalStdHeader, SizeOfUninitializedData, 12, 4), \
+               PE_FIELD(OptionalStdHeader, AddressOfEntryPoint, 16, 4), \
+               PE_FIELD(OptionalStdHeader, BaseOfCode, 20, 4)
+
+typedef Layout<OptionalStdHeader,
+               OPTIONAL_STD_FIELDS,
+               PE_FIELD(OptionalStdHeader, BaseOfData, 24, 4)
+              > OptionalStdHeader32Layout;
+
+typedef Layout<OptionalStdHeader,
+               OPTIONAL_STD_FIELDS
+              > OptionalStdHeader64Layout;
+
+/* The Windows fields. ImageBase and the stack and heap sizes are 4 bytes
+ * in PE32 and 8 in PE32+, which moves everything after them. */
+#define OPTIONAL_WIN_FIELDS(w) \
+               PE_FIELD(OptionalWinHeader, ImageBase, 0, w), \
+               PE_FIELD(OptionalWinHeader, SectionAlignment, w, 4), \
+               PE_FIELD(OptionalWinHeader, FileAlignment, w + 4, 4), \
+               PE_FIELD(OptionalWinHeader, MajorOperatingSystemVersion, w + 8, 2), \
+               PE_FIELD(OptionalWinHeader, MinorOperatingSystemVersion, w + 10, 2), \
+               PE_FIELD(OptionalWinHeader, MajorImageVersion, w + 12, 2), \
+               PE_FIELD(OptionalWinHeader, MinorImageVersion, w + 14, 2), \
+               PE_FIELD(OptionalWinHeader, MajorSubsystemVersion, w + 16, 2), \
+               PE_FIELD(OptionalWinHeader, MinorSubsystemVersion, w + 18, 2), \
+               PE_FIELD(OptionalWinHeader, Win32VersionValue, w + 20, 4), \
+               PE_FIELD(OptionalWinHeader, SizeOfImage, w + 24, 4), \
+               PE_FIELD(OptionalWinHeader, SizeOfHeaders, w + 28, 4), \
+               PE_FIELD(OptionalWinHeader, CheckSum, w + 32, 4), \
+               PE_FIELD(OptionalWinHeader, Subsystem, w + 36, 2), \
+               PE_FIELD(OptionalWinHeader, DllCharacteristics, w + 38, 2), \
+               PE_FIELD(OptionalWinHeader, SizeOfStackReserve, w + 40, w), \
+               PE_FIELD(OptionalWinHeader, SizeOfStackCommit, 2 * w + 40, w), \
+               PE_FIELD(OptionalWinHeader, SizeOfHeapReserve, 3 * w + 40, w), \
+               PE_FIELD(OptionalWinHeader, SizeOfHeapCommit, 4 * w + 40, w), \
+               PE_FIELD(OptionalWinHeader, LoaderFlags, 5 * w + 40, 4), \
+               PE_FIELD(OptionalWinHeader, NumberOfRvaAndSizes, 5 * w + 44, 4)
+
+typedef Layout<OptionalWinHeader, OPTIONAL_WIN_FIELDS(4)> OptionalWinHeader32Layout;
+typedef Layout<OptionalWinHeader, OPTIONAL_WIN_FIELDS(8)> OptionalWinHeader64Layout;
+
+typedef Layout<OptionalDataDirs,
+               PE_DIR(ExportTable, 0),
+               PE_DIR(ImportTable, 8),
+               PE_DIR(ResourceTable, 16),
+               PE_DIR(ExceptionTable, 24),
+               PE_DIR(CertificateTable, 32),
+               PE_DIR(BaseRelocationTable, 40),
+               PE_DIR(Debug, 48),
+               PE_DIR(Architecture, 56),
+               PE_DIR(GlobalPtr, 64),
+               PE_DIR(TLSTable, 72),
+               PE_DIR(LoadConfigTable, 80),
+               PE_DIR(BoundImport, 88),
+               PE_DIR(IAT, 96),
+               PE_DIR(DelayImportDescriptor, 104),
+               PE_DIR(CLRRuntimeHeader, 112),
+               PE_DIR(Reserved, 120)
+              > OptionalDataDirsLayout;
+
+/* The CLR directory entry alone, for telling managed images apart */
+typedef Layout<OptionalDataDirs, PE_DIR(CLRRuntimeHeader, 112)> ClrDirectoryLayout;
+
+/* A whole optional header: the three parts back to back. The fixed
+ * fields up to dirOffset must all be there; of the data directories only
+ * the first NumberOfRvaAndSizes count, and only those that fit in the
+ * SizeOfOptionalHeader bytes given as available, since the section table
+ * follows right after.
+ */
+template <typename Std, typename Win>
+struct OptionalHeaderLayout
+{
+    enum
+    {
+        winOffset = Std::size,
+        dirOffset = Std::size + Win::size,
+        countOffset = dirOffset - 4,        // NumberOfRvaAndSizes, the last Windows field
+        size = Std::size + Win::size + OptionalDataDirsLayout::size
+    };
+
+    /* DirectoryBytes    Bytes of data directories the header really has */
+    static size_t DirectoryBytes(const uint8_t *p, size_t available)
+    {
+        uint64_t count = LoadLE<4>::Load(p + countOffset);
+        size_t present = available - dirOffset;
+        return count * 8 < present ? (size_t)count * 8 : present;
+    }
+
+    static void Load(const uint8_t *p, size_t available, PeImage *image)
+    {
+        Std::Load(p, &image->osh);
+        Win::Load(p + winOffset, &image->owh);
+        OptionalDataDirsLayout::LoadWithin(p + dirOffset, &image->odd, DirectoryBytes(p, available));
+    }
+
+    static void LoadClrDirectory(const uint8_t *p, size_t available, PeImage *image)
+    {
+        ClrDirectoryLayout::LoadWithin(p + dirOffset, &image->odd, DirectoryBytes(p, available));
+    }
+};
+
+typedef OptionalHeaderLayout<OptionalStdHeader32Layout, OptionalWinHeader32Layout> OptionalHeader32Layout;
+typedef OptionalHeaderLayout<OptionalStdHeader64Layout, OptionalWinHeader64Layout> OptionalHeader64Layout;
+
+static_assert(CoffFileHeaderLayout::size == 20, "COFF file header is 20 bytes");
+static_assert(OptionalHeader32Layout::winOffset == 28 && OptionalHeader32Layout::size == 224, "PE32 optional header is 224 bytes");
+static_assert(OptionalHeader64Layout::winOffset == 24 && OptionalHeader64Layout::size == 240, "PE32+ optional header is 240 bytes");
+static_assert(OptionalHeader32Layout::countOffset == 92 && OptionalHeader64Layout::countOffset == 108,
+              "NumberOfRvaAndSizes ends the Windows fields");
+
+#endif // _PELAYOUT
@@ -0,0 +1,2919 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       peoutput.cpp
+//  Author:     Mark Coppa
+//
+//  Output formatters: the classic text dump, NDJSON and fixed layout
+//  binary records. Everything is written into an OutBuf with hand-rolled
+//  number formatting; nothing here calls printf or touches a FILE, so
+//  batch workers can each format into their own buffer.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "peoutput.h"
+#include "pestats.h"
+
+#include <errno.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "PeRecord is written by copying the struct; add byte swapping for big endian hosts"
+#endif
+
+static_assert(sizeof(PeRecord) == 16 + 20 + 28 + 88 + 128, "PeRecord layout must not contain padding");
+
+#define PRINT_CHAR(out, value) AppendString(out, "             " value "\n");
+#define PRINT_HEX(out, value) AppendHex(out, value, 10); AppendChar(out, ' ')
+#define PRINT_VERSION(out, major, minor) AppendVersion(out, major, minor); AppendChar(out, ' ')
+#define PRINT_DIR(out, address, size, item) AppendHex(out, address, 10); \
+                                            AppendString(out, " ["); \
+                                            AppendHex(out, size, 8); \
+                                            AppendString(out, "] RVA [size] of " item "\n");
+
+static const char hexDigits[] = "0123456789ABCDEF";
+static const char *dayNames[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char *monthNames[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+
+/* InitOutBuf    Allocate an empty buffer
+ * Parameters    Buffer, initial capacity
+ */
+void InitOutBuf(OutBuf *out, size_t capacity)
+{
+    out->data = (char *)malloc(capacity);
+    out->len = 0;
+    out->cap = out->data != NULL ? capacity : 0;
+}
+
+
+/* FreeOutBuf    Release a buffer's memory
+ */
+void FreeOutBuf(OutBuf *out)
+{
+    free(out->data);
+    out->data = NULL;
+    out->len = 0;
+    out->cap = 0;
+}
+
+
+/* GrowOutBuf    Make room for at least extra more bytes
+ * Parameters    Buffer, bytes about to be appended
+ */
+void GrowOutBuf(OutBuf *out, size_t extra)
+{
+    size_t cap = out->cap < OUTBUF_INITIAL_SIZE ? OUTBUF_INITIAL_SIZE : out->cap;
+    while (cap - out->len < extra)
+    {
+        cap *= 2;
+    }
+
+    char *data = (char *)realloc(out->data, cap);
+    if (data == NULL)
+    {
+        abort();
+    }
+
+    out->data = data;
+    out->cap = cap;
+}
+
+
+/* WriteOutBuf    Write a buffer's contents to a file descriptor and empty it
+ * Parameters     Buffer, descriptor
+ * Returns        false if the write failed
+ */
+bool WriteOutBuf(OutBuf *out, int fd)
+{
+    const char *p = out->data;
+    size_t left = out->len;
+    uint64_t mark = StatMark();
+
+    while (left > 0)
+    {
+        long n = (long)write(fd, p, (unsigned)(left > 0x40000000 ? 0x40000000 : left));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            out->len = 0;
+            TimeStat(TIMER_WRITE, &mark);
+            return false;
+        }
+
+        p += n;
+        left -= (size_t)n;
+    }
+
+    CountStat(STAT_BYTES_WRITTEN, out->len);
+    TimeStat(TIMER_WRITE, &mark);
+    out->len = 0;
+    return true;
+}
+
+
+/* AppendHex     Append a number in upper case hex
+ * Parameters    Buffer, value, minimum width, pad character for the width
+ */
+void AppendHex(OutBuf *out, uint64_t value, int width, char pad)
+{
+    char digits[16];
+    int n = 0;
+
+    do
+    {
+        digits[n++] = hexDigits[value & 0xF];
+        value >>= 4;
+    } while (value != 0);
+
+    if (width > n)
+    {
+        AppendChar(out, pad, width - n);
+    }
+
+    if (out->cap - out->len < (size_t)n)
+    {
+        GrowOutBuf(out, n);
+    }
+    while (n > 0)
+    {
+        out->data[out->len++] = digits[--n];
+    }
+}
+
+
+/* AppendDec     Append a number in decimal
+ * Parameters    Buffer, value, minimum width, pad character for the width
+ */
+void AppendDec(OutBuf *out, uint64_t value, int width, char pad)
+{
+    char digits[20];
+    int n = 0;
+
+    do
+    {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    if (width > n)
+    {
+        AppendChar(out, pad, width - n);
+    }
+
+    if (out->cap - out->len < (size_t)n)
+    {
+        GrowOutBuf(out, n);
+    }
+    while (n > 0)
+    {
+        out->data[out->len++] = digits[--n];
+    }
+}
+
+
+/* AppendHexBytes    Append bytes as lower case hex digits, as digests are
+ *                   usually written
+ * Parameters        Buffer, bytes, count
+ */
+void AppendHexBytes(OutBuf *out, const uint8_t *bytes, size_t count)
+{
+    static const char lowerDigits[] = "0123456789abcdef";
+
+    if (out->cap - out->len < count * 2)
+    {
+        GrowOutBuf(out, count * 2);
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        out->data[out->len++] = lowerDigits[bytes[i] >> 4];
+        out->data[out->len++] = lowerDigits[bytes[i] & 0xF];
+    }
+}
+
+
+/* AppendVersion    Append major.minor right aligned in a ten character field
+ */
+static void AppendVersion(OutBuf *out, unsigned major, unsigned minor)
+{
+    OutBuf text = { NULL, 0, 0 };
+    char buf[16];
+    text.data = buf;
+    text.cap = sizeof(buf);
+
+    AppendDec(&text, major);
+    AppendChar(&text, '.');
+    AppendDec(&text, minor, 2, '0');
+
+    if (text.len < 10)
+    {
+        AppendChar(out, ' ', 10 - text.len);
+    }
+    AppendBytes(out, buf, text.len);
+}
+
+
+/* AppendEntropy    Append bits per byte with three decimals, right aligned
+ *                  in a field of the given width
+ */
+static void AppendEntropy(OutBuf *out, float entropy, int width = 0)
+{
+    uint32_t milli = (uint32_t)(entropy * 1000 + 0.5f);
+    AppendDec(out, milli / 1000, width > 4 ? width - 4 : 0);
+    AppendChar(out, '.');
+    AppendDec(out, milli % 1000, 3, '0');
+}
+
+
+/* AppendTimeStamp    Append a time stamp in local time, laid out the way
+ *                    ctime does ("Thu Jan  1 00:00:00 1970")
+ * Parameters         Buffer, seconds since 1970
+ */
+void AppendTimeStamp(OutBuf *out, uint32_t stamp)
+{
+    time_t t = stamp;
+    struct tm local;
+#ifdef _WIN32
+    bool ok = localtime_s(&local, &t) == 0;
+#else
+    bool ok = localtime_r(&t, &local) != NULL;
+#endif
+    if (!ok)
+    {
+        AppendString(out, "(invalid)");
+        return;
+    }
+
+    AppendString(out, dayNames[local.tm_wday]);
+    AppendChar(out, ' ');
+    AppendString(out, monthNames[local.tm_mon]);
+    AppendChar(out, ' ');
+    AppendDec(out, local.tm_mday, 2);
+    AppendChar(out, ' ');
+    AppendDec(out, local.tm_hour, 2, '0');
+    AppendChar(out, ':');
+    AppendDec(out, local.tm_min, 2, '0');
+    AppendChar(out, ':');
+    AppendDec(out, local.tm_sec, 2, '0');
+    AppendChar(out, ' ');
+    AppendDec(out, (uint32_t)(local.tm_year + 1900));
+}
+
+
+/* Utf8Length    Length of the well formed UTF-8 sequence a string starts
+ *               with: no overlong forms, surrogates or code points past
+ *               U+10FFFF
+ * Parameters    Bytes, how many there are (at least one)
+ * Returns       1 to 4, else 0 if the first byte does not start one
+ */
+static size_t Utf8Length(const unsigned char *s, size_t len)
+{
+    unsigned char c = s[0];
+    if (c < 0x80)
+    {
+        return 1;
+    }
+
+    size_t count;
+    unsigned char low = 0x80;
+    unsigned char high = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF)
+    {
+        count = 2;
+    }
+    else if (c >= 0xE0 && c <= 0xEF)
+    {
+        count = 3;
+        low = c == 0xE0 ? 0xA0 : 0x80;
+        high = c == 0xED ? 0x9F : 0xBF;
+    }
+    else if (c >= 0xF0 && c <= 0xF4)
+    {
+        count = 4;
+        low = c == 0xF0 ? 0x90 : 0x80;
+        high = c == 0xF4 ? 0x8F : 0xBF;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (len < count || s[1] < low || s[1] > high)
+    {
+        return 0;
+    }
+    for (size_t i = 2; i < count; ++i)
+    {
+        if ((s[i] & 0xC0) != 0x80)
+        {
+            return 0;
+        }
+    }
+    return count;
+}
+
+
+/* AppendJsonString    Append a quoted, escaped JSON string. Names and paths
+ *                     come straight from files and directories, so bytes
+ *                     that are not well formed UTF-8 are each written as
+ *                     U+FFFD to keep the line valid JSON.
+ * Parameters          Buffer, bytes of the string, their length
+ */
+void AppendJsonString(OutBuf *out, const char *s, size_t len)
+{
+    const unsigned char *bytes = (const unsigned char *)s;
+    AppendChar(out, '"');
+
+    size_t start = 0;
+    size_t i = 0;
+    while (i < len)
+    {
+        unsigned char c = bytes[i];
+        if (c >= 0x80)
+        {
+            size_t count = Utf8Length(bytes + i, len - i);
+            if (count != 0)
+            {
+                i += count;
+                continue;
+            }
+        }
+        else if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            ++i;
+            continue;
+        }
+
+        AppendBytes(out, s + start, i - start);
+        start = ++i;
+
+        switch (c)
+        {
+        case '"':
+            AppendString(out, "\\\"");
+            break;
+        case '\\':
+            AppendString(out, "\\\\");
+            break;
+        case '\n':
+            AppendString(out, "\\n");
+            break;
+        case '\t':
+            AppendString(out, "\\t");
+            break;
+        default:
+            if (c >= 0x80)
+            {
+                AppendString(out, "\\ufffd");
+                break;
+            }
+            AppendString(out, "\\u00");
+            AppendHex(out, c, 2, '0');
+            break;
+        }
+    }
+
+    AppendBytes(out, s + start, len - start);
+    AppendChar(out, '"');
+}
+
+
+/* AppendUtf16    Append UTF-16LE text as UTF-8; unpaired surrogates
+ *                become U+FFFD
+ * Parameters     Buffer, text, whether to escape it for a JSON string
+ *                (the quotes are the caller's)
+ */
+static void AppendUtf16(OutBuf *out, Utf16Span text, bool json)
+{
+    for (uint32_t i = 0; i < text.length; ++i)
+    {
+        uint32_t c = text.data[i * 2] | (text.data[i * 2 + 1] << 8);
+
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < text.length)
+        {
+            uint32_t low = text.data[i * 2 + 2] | (text.data[i * 2 + 3] << 8);
+            if (low >= 0xDC00 && low < 0xE000)
+            {
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                ++i;
+            }
+        }
+        if (c >= 0xD800 && c < 0xE000)
+        {
+            c = 0xFFFD;
+        }
+
+        if (c < 0x80)
+        {
+            if (json && (c == '"' || c == '\\'))
+            {
+                AppendChar(out, '\\');
+                AppendChar(out, (char)c);
+            }
+            else if (json && c < 0x20)
+            {
+                AppendString(out, "\\u00");
+                AppendHex(out, c, 2, '0');
+            }
+            else
+            {
+                AppendChar(out, (char)c);
+            }
+        }
+        else if (c < 0x800)
+        {
+            AppendChar(out, (char)(0xC0 | (c >> 6)));
+            AppendChar(out, (char)(0x80 | (c & 0x3F)));
+        }
+        else if (c < 0x10000)
+        {
+            AppendChar(out, (char)(0xE0 | (c >> 12)));
+            AppendChar(out, (char)(0x80 | ((c >> 6) & 0x3F)));
+            AppendChar(out, (char)(0x80 | (c & 0x3F)));
+        }
+        else
+        {
+            AppendChar(out, (char)(0xF0 | (c >> 18)));
+            AppendChar(out, (char)(0x80 | ((c >> 12) & 0x3F)));
+            AppendChar(out, (char)(0x80 | ((c >> 6) & 0x3F)));
+            AppendChar(out, (char)(0x80 | (c & 0x3F)));
+        }
+    }
+}
+
+
+/* AppendFileVersion    Append a VS_FIXEDFILEINFO version as a.b.c.d
+ */
+static void AppendFileVersion(OutBuf *out, uint32_t ms, uint32_t ls)
+{
+    AppendDec(out, ms >> 16);
+    AppendChar(out, '.');
+    AppendDec(out, ms & 0xFFFF);
+    AppendChar(out, '.');
+    AppendDec(out, ls >> 16);
+    AppendChar(out, '.');
+    AppendDec(out, ls & 0xFFFF);
+}
+
+
+/* PrintMachineType    Print the machine type (that image can run on)
+ * Parameters          The type number
+ */
+static void PrintMachineType(OutBuf *out, int type)
+{
+    AppendString(out, "machine (");
+
+    switch(type)
+    {
+    case 0x0:
+        AppendString(out, "UNKNOWN");
+        break;
+    case 0x1d3:
+        AppendString(out, "AM33");
+        break;
+    case 0x8664:
+        AppendString(out, "AMD64");
+        break;
+    case 0x1c0:
+        AppendString(out, "ARM");
+        break;
+    case 0x1c4:
+        AppendString(out, "ARMNT");
+        break;
+    case 0xaa64:
+        AppendString(out, "ARM64");
+        break;
+    case 0xebc:  // heh
+        AppendString(out, "EBC");
+        break;
+    case 0x14c:
+        AppendString(out, "I386");
+        break;
+    case 0x200:
+        AppendString(out, "IA64");
+        break;
+    case 0x9041:
+        AppendString(out, "M32R");
+        break;
+    case 0x266:
+        AppendString(out, "MIPS16");
+        break;
+    case 0x366:
+        AppendString(out, "MIPSFPU");
+        break;
+    case 0x466:
+        AppendString(out, "MIPSFPU16");
+        break;
+    case 0x1f0:
+        AppendString(out, "POWERPC");
+        break;
+    case 0x1f1:
+        AppendString(out, "POWERPCFP");
+        break;
+    case 0x166:
+        AppendString(out, "R4000");
+        break;
+    case 0x1a2:
+        AppendString(out, "SH3");
+        break;
+    case 0x1a3:
+        AppendString(out, "SH3DSP");
+        break;
+    case 0x1a6:
+        AppendString(out, "SH4");
+        break;
+    case 0x1a8:
+        AppendString(out, "SH5");
+        break;
+    case 0x1c2:
+        AppendString(out, "THUMB");
+        break;
+    case 0x169:
+        AppendString(out, "WCEMIPSV2");
+        break;
+    default:
+        AppendString(out, "No matching entry");
+        break;
+    }
+
+    AppendString(out, ")\n");
+}
+
+
+/* PrintCharacteristics    Print the characteristics given by bit field
+ * Parameters              The bit field of characteristics
+ */
+static void PrintCharacteristics(OutBuf *out, int characteristics)
+{
+    if (characteristics & 0x0001)
+    {
+        PRINT_CHAR(out, "Relocations stripped");
+    }
+
+    if (characteristics & 0x0002)
+    {
+        PRINT_CHAR(out, "Executable");
+    }
+
+    if (characteristics & 0x0004)
+    {
+        PRINT_CHAR(out, "Line numbers stripped");
+    }
+
+    if (characteristics & 0x0008)
+    {
+        PRINT_CHAR(out, "Symbols stripped");
+    }
+
+    if (characteristics & 0x0010)
+    {
+        PRINT_CHAR(out, "AGGRESSIVE_WS_TRIM");
+    }
+
+    if (characteristics & 0x0020)
+    {
+        PRINT_CHAR(out, "LARGE_ADDRESS_AWARE");
+    }
+
+    if (characteristics & 0x0040)
+    {
+        PRINT_CHAR(out, "Reserved for future use");
+    }
+
+    if (characteristics & 0x0080)
+    {
+        PRINT_CHAR(out, "BYTES_REVERSED_LO");
+    }
+
+    if (characteristics & 0x0100)
+    {
+        PRINT_CHAR(out, "32 bit word machine");
+    }
+
+    if (characteristics & 0x0200)
+    {
+        PRINT_CHAR(out, "DEBUG_STRIPPED");
+    }
+
+    if (characteristics & 0x0400)
+    {
+        PRINT_CHAR(out, "REMOVABLE_RUN_FROM_SWAP");
+    }
+
+    if (characteristics & 0x0800)
+    {
+        PRINT_CHAR(out, "NET_RUN_FROM_SWAP");
+    }
+
+    if (characteristics & 0x1000)
+    {
+        PRINT_CHAR(out, "SYSTEM");
+    }
+
+    if (characteristics & 0x2000)
+    {
+        PRINT_CHAR(out, "DLL");
+    }
+
+    if (characteristics & 0x4000)
+    {
+        PRINT_CHAR(out, "UP_SYSTEM_ONLY");
+    }
+
+    if (characteristics & 0x8000)
+    {
+        PRINT_CHAR(out, "BYTES_REVERSED_HI");
+    }
+}
+
+
+/* PrintOSSubsystem    Print the windows subsystem string
+ * Parameters          The subsystem value
+ */
+static void PrintOSSubsystem(OutBuf *out, int subsystem)
+{
+    switch (subsystem)
+    {
+    case 0:
+        AppendString(out, "An unknown subsystem\n");
+        break;
+    case 1:
+        AppendString(out, "Device drivers and native Windows processs\n");
+        break;
+    case 2:
+        AppendString(out, "The Windows graphical user interface (GUI) subsystem\n");
+        break;
+    case 3:
+        AppendString(out, "Windows CUI\n");
+        break;
+    /* No cases listed for 4-6 */
+    case 7:
+        AppendString(out, "The Posix character subsystem\n");
+        break;
+    /* No case for 8 */
+    case 9:
+        AppendString(out, "Windows CE\n");
+        break;
+    case 10:
+        AppendString(out, "An Extensible Firmware interface (EFI) application\n");
+        break;
+    case 11:
+        AppendString(out, "An EFI driver with boot services\n");
+        break;
+    case 12:
+        AppendString(out, "An EFI driver with run-time services\n");
+        break;
+    case 13:
+        AppendString(out, "An EFI ROM image\n");
+        break;
+    case 14:
+        AppendString(out, "XBOX\n");
+        break;
+    default:
+        AppendString(out, "Error: unregistered value\n");
+        break;
+    }
+}
+
+
+/* PrintDLLCharacteristics    Print the characteristics given by bit field
+ * Parameters                 The bit field of characteristics
+ */
+static void PrintDLLCharacteristics(OutBuf *out, int characteristics)
+{
+    if (characteristics & 0x0001)
+    {
+        PRINT_CHAR(out, "Reserved, must be zero (0x01)");
+    }
+
+    if (characteristics & 0x0002)
+    {
+        PRINT_CHAR(out, "Reserved, must be zero (0x02)");
+    }
+
+    if (characteristics & 0x0004)
+    {
+        PRINT_CHAR(out, "Reserved, must be zero (0x04)");
+    }
+
+    if (characteristics & 0x0008)
+    {
+        PRINT_CHAR(out, "Reserved, must be zero (0x08)");
+    }
+
+    if (characteristics & 0x0040)
+    {
+        PRINT_CHAR(out, "Dynamic base");
+    }
+
+    if (characteristics & 0x0080)
+    {
+        PRINT_CHAR(out, "Code integrity checks are enforced");
+    }
+
+    if (characteristics & 0x0100)
+    {
+        PRINT_CHAR(out, "NX compatible");
+    }
+
+    if (characteristics & 0x0200)
+    {
+        PRINT_CHAR(out, "Isolation aware, but do not isolate the image");
+    }
+
+    if (characteristics & 0x0400)
+    {
+        PRINT_CHAR(out, "No structured exception handler");
+    }
+
+    if (characteristics & 0x0800)
+    {
+        PRINT_CHAR(out, "Do not bind the image");
+    }
+
+    if (characteristics & 0x1000)
+    {
+        PRINT_CHAR(out, "Reserved, must be zero (0x1000)");
+    }
+
+    if (characteristics & 0x2000)
+    {
+        PRINT_CHAR(out, "A WDM driver");
+    }
+
+    if (characteristics & 0x8000)
+    {
+        PRINT_CHAR(out, "Terminal Server Aware");
+    }
+}
+
+
+/* PrintSections    Print the section table
+ * Parameters       The parsed image
+ */
+static void PrintSections(OutBuf *out, const PeImage *image)
+{
+    for (size_t i = 0; i < image->sections.size(); ++i)
+    {
+        const SectionHeader *sh = &image->sections[i];
+
+        AppendString(out, "\nSECTION HEADER #");
+        AppendDec(out, i + 1);
+        AppendChar(out, '\n');
+
+        size_t len = strnlen(sh->Name, sizeof(sh->Name));
+        AppendChar(out, ' ', 10 - len);
+        AppendBytes(out, sh->Name, len);
+        AppendString(out, " name\n");
+
+        PRINT_HEX(out, sh->VirtualSize);
+        AppendString(out, "virtual size\n");
+
+        PRINT_HEX(out, sh->VirtualAddress);
+        AppendString(out, "virtual address\n");
+
+        PRINT_HEX(out, sh->SizeOfRawData);
+        AppendString(out, "size of raw data\n");
+
+        PRINT_HEX(out, sh->PointerToRawData);
+        AppendString(out, "file pointer to raw data\n");
+
+        PRINT_HEX(out, sh->PointerToRelocations);
+        AppendString(out, "file pointer to relocation table\n");
+
+        PRINT_HEX(out, sh->PointerToLinenumbers);
+        AppendString(out, "file pointer to line numbers\n");
+
+        PRINT_HEX(out, sh->NumberOfRelocations);
+        AppendString(out, "number of relocations\n");
+
+        PRINT_HEX(out, sh->NumberOfLinenumbers);
+        AppendString(out, "number of line numbers\n");
+
+        PRINT_HEX(out, sh->Characteristics);
+        AppendString(out, "flags\n");
+    }
+}
+
+
+/* PrintImports    Print the decoded import table
+ * Parameters      The parsed image
+ */
+static void PrintImports(OutBuf *out, const PeImage *image)
+{
+    const ImportTable *imports = &image->imports;
+
+    AppendString(out, "\nIMPORTS\n");
+
+    for (size_t m = 0; m < imports->modules.size(); ++m)
+    {
+        const ImportModule &module = imports->modules[m];
+
+        AppendString(out, "    ");
+        AppendString(out, module.dll);
+        AppendChar(out, '\n');
+
+        for (uint32_t i = 0; i < module.functionCount; ++i)
+        {
+            const ImportFunction &function = imports->functions[module.firstFunction + i];
+            if (function.name != NULL)
+            {
+                PRINT_HEX(out, function.hint);
+                AppendString(out, function.name);
+            }
+            else
+            {
+                AppendString(out, "           ordinal ");
+                AppendDec(out, function.ordinal);
+            }
+            AppendChar(out, '\n');
+        }
+    }
+
+    if (imports->truncated)
+    {
+        AppendString(out, "           truncated\n");
+    }
+
+    AppendString(out, "\n");
+    AppendHexBytes(out, imports->imphash, sizeof(imports->imphash));
+    AppendString(out, " imphash\n");
+}
+
+
+/* PrintExport     Print one export line: ordinal, RVA, name and forwarder
+ */
+static void PrintExport(OutBuf *out, const ExportTable *exports, uint32_t index, const char *name)
+{
+    const ExportFunction &function = exports->functions[index];
+
+    AppendDec(out, (uint64_t)exports->Base + index, 10);
+    AppendChar(out, ' ');
+    PRINT_HEX(out, function.rva);
+    AppendString(out, name != NULL ? name : "[NONAME]");
+    if (function.forwarder != NULL)
+    {
+        AppendString(out, " (forwarded to ");
+        AppendString(out, function.forwarder);
+        AppendChar(out, ')');
+    }
+    AppendChar(out, '\n');
+}
+
+
+/* PrintExports    Print the decoded export table: named exports in name
+ *                 order, then those exported by ordinal only
+ * Parameters      The parsed image
+ */
+static void PrintExports(OutBuf *out, const PeImage *image)
+{
+    const ExportTable *exports = &image->exports;
+    std::vector<bool> named(exports->functions.size(), false);
+
+    AppendString(out, "\nEXPORTS\n");
+    if (exports->dll != NULL)
+    {
+        AppendString(out, "    ");
+        AppendString(out, exports->dll);
+        AppendChar(out, '\n');
+    }
+
+    for (size_t i = 0; i < exports->names.size(); ++i)
+    {
+        const ExportName &entry = exports->names[i];
+        named[entry.function] = true;
+        PrintExport(out, exports, entry.function, entry.name);
+    }
+
+    for (uint32_t i = 0; i < exports->functions.size(); ++i)
+    {
+        if (!named[i] && exports->functions[i].rva != 0)
+        {
+            PrintExport(out, exports, i, NULL);
+        }
+    }
+}
+
+
+/* SymbolClassName    Name of a symbol's storage class, as dumpbin shows it
+ */
+static const char *SymbolClassName(uint8_t storageClass)
+{
+    switch (storageClass)
+    {
+    case 0xFF: return "End of function";
+    case 0:    return "Null";
+    case 1:    return "Automatic";
+    case 2:    return "External";
+    case 3:    return "Static";
+    case 4:    return "Register";
+    case 5:    return "External def";
+    case 6:    return "Label";
+    case 7:    return "Undefined label";
+    case 8:    return "Member of struct";
+    case 9:    return "Argument";
+    case 10:   return "Struct tag";
+    case 11:   return "Member of union";
+    case 12:   return "Union tag";
+    case 13:   return "Type definition";
+    case 14:   return "Undefined static";
+    case 15:   return "Enum tag";
+    case 16:   return "Member of enum";
+    case 17:   return "Register param";
+    case 18:   return "Bit field";
+    case 100:  return "Block";
+    case 101:  return "Function";
+    case 102:  return "End of struct";
+    case 103:  return "Filename";
+    case 104:  return "Section";
+    case 105:  return "WeakExternal";
+    case 107:  return "CLR token";
+    default:   return "Unknown";
+    }
+}
+
+
+/* PrintSymbols    Print the decoded COFF symbol table
+ * Parameters      The parsed image
+ */
+static void PrintSymbols(OutBuf *out, const PeImage *image)
+{
+    const SymbolTable *symbols = &image->symbols;
+
+    AppendString(out, "\nSYMBOL TABLE\n");
+    if (symbols->sourceFile != NULL)
+    {
+        AppendString(out, "    ");
+        AppendString(out, symbols->sourceFile);
+        AppendChar(out, '\n');
+    }
+
+    for (size_t i = 0; i < symbols->names.size(); ++i)
+    {
+        int16_t section = symbols->sections[i];
+
+        AppendHex(out, symbols->recordIndex[i], 3, '0');
+        AppendChar(out, ' ');
+        AppendHex(out, symbols->values[i], 8, '0');
+        AppendChar(out, ' ');
+
+        switch (section)
+        {
+        case SYMBOL_UNDEFINED:
+            AppendString(out, "UNDEF ");
+            break;
+        case SYMBOL_ABSOLUTE:
+            AppendString(out, "ABS   ");
+            break;
+        case SYMBOL_DEBUG:
+            AppendString(out, "DEBUG ");
+            break;
+        default:
+            AppendString(out, "SECT");
+            AppendHex(out, (uint16_t)section, 2, ' ');
+            break;
+        }
+
+        /* Complex type 2 marks a function */
+        AppendString(out, (symbols->types[i] >> 4) == 2 ? " () " : "    ");
+        AppendString(out, SymbolClassName(symbols->storageClasses[i]));
+        AppendString(out, " | ");
+        AppendString(out, symbols->names[i]);
+        AppendChar(out, '\n');
+    }
+}
+
+
+/* PrintChecksum    Print the stored and computed image checksums
+ * Parameters       The parsed image
+ */
+static void PrintChecksum(OutBuf *out, const PeImage *image)
+{
+    AppendString(out, "\nCHECKSUM\n");
+    PRINT_HEX(out, image->owh.CheckSum);
+    AppendString(out, "stored\n");
+    PRINT_HEX(out, image->computedCheckSum);
+    AppendString(out, "computed\n");
+
+    if (image->owh.CheckSum == 0)
+    {
+        AppendString(out, "           not set\n");
+    }
+    else
+    {
+        AppendString(out, image->owh.CheckSum == image->computedCheckSum ? "           valid\n" : "           MISMATCH\n");
+    }
+}
+
+
+/* PrintEntropy    Print the entropy of each section and of the overlay
+ * Parameters      The parsed image
+ */
+static void PrintEntropy(OutBuf *out, const PeImage *image)
+{
+    const EntropyTable *entropy = &image->entropy;
+
+    AppendString(out, "\nENTROPY\n");
+    for (size_t i = 0; i < entropy->sections.size(); ++i)
+    {
+        const SectionHeader *sh = &image->sections[i];
+
+        if (entropy->sections[i] == NO_ENTROPY)
+        {
+            AppendString(out, "         - ");
+        }
+        else
+        {
+            AppendEntropy(out, entropy->sections[i], 10);
+            AppendChar(out, ' ');
+        }
+        AppendBytes(out, sh->Name, strnlen(sh->Name, sizeof(sh->Name)));
+        AppendChar(out, '\n');
+    }
+
+    if (image->isPE && !image->isCOFF)
+    {
+        PRINT_HEX(out, entropy->overlayOffset);
+        AppendString(out, "overlay offset\n");
+        PRINT_HEX(out, entropy->overlaySize);
+        AppendString(out, "overlay size\n");
+        if (entropy->overlaySize > 0)
+        {
+            AppendEntropy(out, entropy->overlay, 10);
+            AppendString(out, " overlay\n");
+        }
+    }
+
+    PRINT_HEX(out, entropy->sampled);
+    AppendString(out, "bytes sampled\n");
+}
+
+
+/* PrintVersionInfo    Print the fixed and string file info
+ * Parameters          The parsed image
+ */
+static void PrintVersionInfo(OutBuf *out, const PeImage *image)
+{
+    const VersionInfo *version = &image->version;
+
+    AppendString(out, "\nVERSION INFO\n");
+    if (version->hasFixed)
+    {
+        AppendString(out, "    file version ");
+        AppendFileVersion(out, version->FileVersionMS, version->FileVersionLS);
+        AppendString(out, "\n    product version ");
+        AppendFileVersion(out, version->ProductVersionMS, version->ProductVersionLS);
+        AppendChar(out, '\n');
+        PRINT_HEX(out, version->FileFlags);
+        AppendString(out, "file flags\n");
+        PRINT_HEX(out, version->FileOS);
+        AppendString(out, "file OS\n");
+        PRINT_HEX(out, version->FileType);
+        AppendString(out, "file type\n");
+        PRINT_HEX(out, version->FileSubtype);
+        AppendString(out, "file subtype\n");
+    }
+
+    if (version->language.length > 0)
+    {
+        AppendString(out, "    strings (");
+        AppendUtf16(out, version->language, false);
+        AppendString(out, ")\n");
+    }
+    for (size_t i = 0; i < version->strings.size(); ++i)
+    {
+        AppendString(out, "        ");
+        AppendUtf16(out, version->strings[i].key, false);
+        AppendString(out, ": ");
+        AppendUtf16(out, version->strings[i].value, false);
+        AppendChar(out, '\n');
+    }
+}
+
+
+/* RelocationTypeName    Name of an IMAGE_REL_BASED_* type, NULL if unknown
+ */
+static const char *RelocationTypeName(uint32_t type)
+{
+    static const char *names[] = { "ABSOLUTE", "HIGH", "LOW", "HIGHLOW", "HIGHADJ", "MACHINE_SPECIFIC_5",
+                                   "RESERVED", "THUMB_MOV32", "RISCV_LOW12S", "MACHINE_SPECIFIC_9", "DIR64" };
+    return type < sizeof(names) / sizeof(names[0]) ? names[type] : NULL;
+}
+
+
+/* CountRelocationTypes    Tally decoded relocations by type
+ */
+static void CountRelocationTypes(const RelocationTable *relocs, uint32_t counts[16])
+{
+    memset(counts, 0, 16 * sizeof(counts[0]));
+    for (size_t i = 0; i < relocs->entries.size(); ++i)
+    {
+        ++counts[relocs->entries[i].type & 0xF];
+    }
+}
+
+
+/* PrintRelocations    Print base relocation totals by type, and the
+ *                     outcome of a rebase
+ * Parameters          The parsed image
+ */
+static void PrintRelocations(OutBuf *out, const PeImage *image)
+{
+    const RelocationTable *relocs = &image->relocations;
+
+    if (image->decoded & PARSE_RELOCS)
+    {
+        uint32_t counts[16];
+        CountRelocationTypes(relocs, counts);
+
+        AppendString(out, "\nBASE RELOCATIONS\n");
+        PRINT_HEX(out, relocs->blockCount);
+        AppendString(out, "blocks\n");
+        PRINT_HEX(out, relocs->entries.size());
+        AppendString(out, "relocations\n");
+
+        for (uint32_t type = 0; type < 16; ++type)
+        {
+            if (counts[type] == 0)
+            {
+                continue;
+            }
+
+            PRINT_HEX(out, counts[type]);
+            const char *name = RelocationTypeName(type);
+            if (name != NULL)
+            {
+                AppendString(out, name);
+            }
+            else
+            {
+                AppendString(out, "type ");
+                AppendDec(out, type);
+            }
+            AppendChar(out, '\n');
+        }
+
+        if (relocs->truncated)
+        {
+            AppendString(out, "           truncated\n");
+        }
+    }
+
+    if (image->decoded & PARSE_REBASE)
+    {
+        AppendString(out, "\nREBASE\n");
+        PRINT_HEX(out, relocs->rebasedTo);
+        AppendString(out, "new image base\n");
+        PRINT_HEX(out, relocs->rebasedCount);
+        AppendString(out, "relocations applied\n");
+        PRINT_HEX(out, relocs->unsupported);
+        AppendString(out, "relocations not applied\n");
+        AppendString(out, "    md5 ");
+        AppendHexBytes(out, relocs->rebasedMd5, sizeof(relocs->rebasedMd5));
+        AppendChar(out, '\n');
+    }
+}
+
+
+/* ClrTableName    Name of a metadata table, NULL past the known ones
+ */
+static const char *ClrTableName(uint32_t table)
+{
+    static const char *names[CLR_KNOWN_TABLES] =
+    {
+        "Module", "TypeRef", "TypeDef", "FieldPtr", "Field", "MethodPtr", "MethodDef", "ParamPtr",
+        "Param", "InterfaceImpl", "MemberRef", "Constant", "CustomAttribute", "FieldMarshal",
+        "DeclSecurity", "ClassLayout", "FieldLayout", "StandAloneSig", "EventMap", "EventPtr", "Event",
+        "PropertyMap", "PropertyPtr", "Property", "MethodSemantics", "MethodImpl", "ModuleRef",
+        "TypeSpec", "ImplMap", "FieldRVA", "EncLog", "EncMap", "Assembly", "AssemblyProcessor",
+        "AssemblyOS", "AssemblyRef", "AssemblyRefProcessor", "AssemblyRefOS", "File", "ExportedType",
+        "ManifestResource", "NestedClass", "GenericParam", "MethodSpec", "GenericParamConstraint"
+    };
+    return table < CLR_KNOWN_TABLES ? names[table] : NULL;
+}
+
+
+/* AppendAssemblyName    Append a display name: "Name, Version=1.2.3.4,
+ *                       Culture=neutral, PublicKeyToken=..."
+ */
+static void AppendAssemblyName(OutBuf *out, const ClrAssemblyName *name)
+{
+    AppendString(out, name->name);
+    AppendString(out, ", Version=");
+    AppendDec(out, name->MajorVersion);
+    AppendChar(out, '.');
+    AppendDec(out, name->MinorVersion);
+    AppendChar(out, '.');
+    AppendDec(out, name->BuildNumber);
+    AppendChar(out, '.');
+    AppendDec(out, name->RevisionNumber);
+    AppendString(out, ", Culture=");
+    AppendString(out, name->culture[0] != '\0' ? name->culture : "neutral");
+    AppendString(out, ", PublicKeyToken=");
+    if (name->hasPublicKeyToken)
+    {
+        AppendHexBytes(out, name->publicKeyToken, sizeof(name->publicKeyToken));
+    }
+    else
+    {
+        AppendString(out, "null");
+    }
+}
+
+
+/* PrintClr      Print the CLR header, metadata streams and tables, and
+ *               the assembly's identity and references
+ * Parameters    The parsed image
+ */
+static void PrintClr(OutBuf *out, const PeImage *image)
+{
+    const ClrInfo *clr = &image->clr;
+
+    AppendString(out, "\nCLR HEADER\n");
+    PRINT_VERSION(out, clr->MajorRuntimeVersion, clr->MinorRuntimeVersion);
+    AppendString(out, "runtime version\n");
+    AppendString(out, "    metadata ");
+    AppendString(out, clr->version);
+    AppendChar(out, '\n');
+    PRINT_HEX(out, clr->Flags);
+    AppendString(out, "flags\n");
+    PRINT_HEX(out, clr->EntryPointToken);
+    AppendString(out, "entry point token");
+    if (clr->entryPoint != NULL)
+    {
+        AppendString(out, " (");
+        AppendString(out, clr->entryPoint);
+        AppendChar(out, ')');
+    }
+    AppendChar(out, '\n');
+
+    AppendString(out, "    streams\n");
+    for (size_t i = 0; i < clr->streams.size(); ++i)
+    {
+        AppendString(out, "        ");
+        PRINT_HEX(out, clr->streams[i].offset);
+        PRINT_HEX(out, clr->streams[i].size);
+        AppendString(out, clr->streams[i].name);
+        AppendChar(out, '\n');
+    }
+
+    AppendString(out, "    tables\n");
+    for (uint32_t t = 0; t < CLR_MAX_TABLES; ++t)
+    {
+        if (clr->rows[t] == 0)
+        {
+            continue;
+        }
+        AppendString(out, "        ");
+        PRINT_HEX(out, clr->rows[t]);
+        const char *name = ClrTableName(t);
+        if (name != NULL)
+        {
+            AppendString(out, name);
+        }
+        else
+        {
+            AppendString(out, "table ");
+            AppendHex(out, t, 2, '0');
+        }
+        AppendChar(out, '\n');
+    }
+
+    if (clr->hasAssembly)
+    {
+        AppendString(out, "    assembly ");
+        AppendAssemblyName(out, &clr->assembly);
+        AppendChar(out, '\n');
+    }
+    for (size_t i = 0; i < clr->references.size(); ++i)
+    {
+        AppendString(out, "        ");
+        AppendAssemblyName(out, &clr->references[i]);
+        AppendChar(out, '\n');
+    }
+}
+
+
+/* DebugTypeName    Name of an IMAGE_DEBUG_TYPE_*, NULL if unknown
+ */
+static const char *DebugTypeName(uint32_t type)
+{
+    static const char *names[] = { "UNKNOWN", "COFF", "CODEVIEW", "FPO", "MISC", "EXCEPTION", "FIXUP",
+                                   "OMAP_TO_SRC", "OMAP_FROM_SRC", "BORLAND", "RESERVED10", "CLSID",
+                                   "VC_FEATURE", "POGO", "ILTCG", "MPX", "REPRO", "EMBEDDED_PDB", "SPGO",
+                                   "PDBCHECKSUM", "EX_DLLCHARACTERISTICS" };
+    return type < sizeof(names) / sizeof(names[0]) ? names[type] : NULL;
+}
+
+
+/* AppendPdbGuid    Append a GUID stored as in an RSDS record in registry
+ *                  form, {8-4-4-4-12}
+ */
+static void AppendPdbGuid(OutBuf *out, const uint8_t guid[16])
+{
+    char key[PDB_KEY_LENGTH + 1];
+    FormatPdbKey(guid, 0, key);
+
+    AppendChar(out, '{');
+    AppendBytes(out, key, 8);
+    AppendChar(out, '-');
+    AppendBytes(out, key + 8, 4);
+    AppendChar(out, '-');
+    AppendBytes(out, key + 12, 4);
+    AppendChar(out, '-');
+    AppendBytes(out, key + 16, 4);
+    AppendChar(out, '-');
+    AppendBytes(out, key + 20, 12);
+    AppendChar(out, '}');
+}
+
+
+/* PrintDebug    Print the debug directory and the PDB it names
+ * Parameters    The parsed image
+ */
+static void PrintDebug(OutBuf *out, const PeImage *image)
+{
+    const DebugInfo *debug = &image->debug;
+
+    AppendString(out, "\nDEBUG DIRECTORY\n");
+    AppendString(out, "      size        RVA    pointer type\n");
+    for (size_t i = 0; i < debug->entries.size(); ++i)
+    {
+        const DebugDirectoryEntry *entry = &debug->entries[i];
+        PRINT_HEX(out, entry->SizeOfData);
+        PRINT_HEX(out, entry->AddressOfRawData);
+        PRINT_HEX(out, entry->PointerToRawData);
+        const char *name = DebugTypeName(entry->Type);
+        if (name != NULL)
+        {
+            AppendString(out, name);
+        }
+        else
+        {
+            AppendString(out, "type ");
+            AppendDec(out, entry->Type);
+        }
+        AppendChar(out, '\n');
+    }
+
+    if (debug->hasCodeView)
+    {
+        char key[PDB_KEY_LENGTH + 1];
+        size_t len = FormatPdbKey(debug->pdbGuid, debug->pdbAge, key);
+
+        AppendString(out, "    pdb ");
+        AppendString(out, debug->pdbPath);
+        AppendString(out, "\n    guid ");
+        AppendPdbGuid(out, debug->pdbGuid);
+        AppendString(out, ", age ");
+        AppendDec(out, debug->pdbAge);
+        AppendString(out, "\n    symbol server key ");
+        AppendBytes(out, key, len);
+        AppendChar(out, '\n');
+    }
+}
+
+
+/* PrintFunctions    Print the function ranges of the exception table and,
+ *                   when decoded, each function's unwind data
+ * Parameters        The parsed image
+ */
+static void PrintFunctions(OutBuf *out, const PeImage *image)
+{
+    const FunctionTable *functions = &image->functions;
+    bool unwind = (image->decoded & PARSE_UNWIND) != 0;
+
+    AppendString(out, "\nEXCEPTION TABLE\n");
+    PRINT_HEX(out, functions->begins.size());
+    AppendString(out, "functions\n");
+    if (functions->resorted)
+    {
+        AppendString(out, "           not stored in order\n");
+    }
+    if (functions->truncated)
+    {
+        AppendString(out, "           truncated\n");
+    }
+
+    AppendString(out, unwind ? "   begin      end      unwind    stack handler\n" : "   begin      end      unwind\n");
+    for (size_t i = 0; i < functions->begins.size(); ++i)
+    {
+        AppendHex(out, functions->begins[i], 8, '0');
+        AppendChar(out, ' ');
+        AppendHex(out, functions->ends[i], 8, '0');
+        AppendChar(out, ' ');
+        AppendHex(out, functions->unwindData[i], 8, '0');
+        if (!unwind)
+        {
+            AppendChar(out, '\n');
+            continue;
+        }
+
+        const UnwindInfo *info = &functions->unwind[i];
+        AppendChar(out, ' ');
+        AppendHex(out, info->stackSize, 8);
+        AppendChar(out, ' ');
+        AppendHex(out, info->handler, 8, '0');
+        if (info->chained != 0)
+        {
+            AppendString(out, " chained to ");
+            AppendHex(out, info->chained, 8, '0');
+        }
+        AppendChar(out, '\n');
+
+        /* x64 codes, in the order the unwinder undoes them */
+        for (uint32_t c = 0; c < info->codeCount && info->firstCode + c < functions->codes.size() &&
+                             image->cfh.Machine != 0xAA64; ++c)
+        {
+            const UnwindCode *code = &functions->codes[info->firstCode + c];
+            const char *name = UnwindOpName(code->op, info->version);
+
+            AppendString(out, "        ");
+            AppendHex(out, code->codeOffset, 2, '0');
+            AppendChar(out, ' ');
+            AppendString(out, name != NULL ? name : "UNKNOWN");
+            AppendChar(out, ' ');
+            AppendDec(out, code->info);
+            if (code->value != 0)
+            {
+                AppendString(out, " 0x");
+                AppendHex(out, code->value);
+            }
+            AppendChar(out, '\n');
+        }
+    }
+}
+
+
+/* PrintRich     Print the unmasked Rich header
+ * Parameters    The parsed image
+ */
+static void PrintRich(OutBuf *out, const PeImage *image)
+{
+    const RichHeader *rich = &image->rich;
+
+    AppendString(out, "\nRICH HEADER\n");
+    PRINT_HEX(out, rich->offset);
+    AppendString(out, "offset\n");
+    PRINT_HEX(out, rich->key);
+    AppendString(out, rich->checksumValid ? "key (checksum valid)\n" : "key (checksum invalid)\n");
+    AppendString(out, "    fingerprint ");
+    AppendHex(out, rich->fingerprint, 16, '0');
+    AppendString(out, "\n   product    build    count\n");
+
+    for (size_t i = 0; i < rich->entries.size(); ++i)
+    {
+        AppendHex(out, rich->entries[i].productId, 8);
+        AppendDec(out, rich->entries[i].build, 9);
+        AppendDec(out, rich->entries[i].count, 9);
+        AppendChar(out, '\n');
+    }
+}
+
+
+/* AppendDigest    Append a similarity digest in hex, or "-" if the range
+ *                 had none
+ */
+static void AppendDigest(OutBuf *out, const SimilarityDigest *digest)
+{
+    if (digest->valid)
+    {
+        AppendHexBytes(out, digest->bytes, sizeof(digest->bytes));
+    }
+    else
+    {
+        AppendChar(out, '-');
+    }
+}
+
+
+/* PrintSimilarity    Print the similarity digests of the image and of
+ *                    each section
+ * Parameters         The parsed image
+ */
+static void PrintSimilarity(OutBuf *out, const PeImage *image)
+{
+    const SimilarityTable *similarity = &image->similarity;
+
+    AppendString(out, "\nSIMILARITY DIGESTS\n");
+    AppendString(out, "    image    ");
+    AppendDigest(out, &similarity->image);
+    AppendChar(out, '\n');
+    for (size_t i = 0; i < similarity->sections.size(); ++i)
+    {
+        const SectionHeader *sh = &image->sections[i];
+        size_t length = strnlen(sh->Name, sizeof(sh->Name));
+
+        AppendString(out, "    ");
+        AppendBytes(out, sh->Name, length);
+        AppendChar(out, ' ', 9 - length);
+        AppendDigest(out, &similarity->sections[i]);
+        AppendChar(out, '\n');
+    }
+}
+
+
+/* PrintAll      Print all available sections
+ * Parameters    The parsed image
+ */
+static void PrintAll(OutBuf *out, const PeImage *image)
+{
+    const CoffFileHeader *cfh = &image->cfh;
+    const OptionalStdHeader *osh = &image->osh;
+    const OptionalWinHeader *owh = &image->owh;
+    const OptionalDataDirs *odd = &image->odd;
+
+    if (!image->isPE && !image->isCOFF)
+    {
+        AppendString(out, "Error: not a PE file\n");
+        return;
+    }
+
+    /* Always print coff header */
+    AppendString(out, "COFF FILE HEADER\n");
+
+    PRINT_HEX(out, cfh->Machine);
+    PrintMachineType(out, cfh->Machine);
+
+    PRINT_HEX(out, cfh->NumberOfSections);
+    AppendString(out, "number of sections\n");
+
+    PRINT_HEX(out, cfh->TimeDateStamp);
+    AppendString(out, "time date stamp: ");
+    AppendTimeStamp(out, cfh->TimeDateStamp);
+    AppendChar(out, '\n');
+
+    PRINT_HEX(out, cfh->PointerToSymbolTable);
+    AppendString(out, "file pointer to symbol table\n");
+
+    PRINT_HEX(out, cfh->NumberOfSymbols);
+    AppendString(out, "number of symbols\n");
+
+    PRINT_HEX(out, cfh->SizeOfOptionalHeader);
+    AppendString(out, "size of optional header\n");
+
+    PRINT_HEX(out, cfh->Characteristics);
+    AppendString(out, "characteristics\n");
+    PrintCharacteristics(out, cfh->Characteristics);
+
+    /* Is a COFF file, no other headers to print */
+    if (image->isCOFF)
+    {
+        AppendString(out, "COFF file\n");
+        PrintSections(out, image);
+        if (image->decoded & PARSE_SYMBOLS)
+        {
+            PrintSymbols(out, image);
+        }
+        if (image->decoded & PARSE_ENTROPY)
+        {
+            PrintEntropy(out, image);
+        }
+        AppendString(out, "\n");
+        return;
+    }
+
+    /* Print optional standard header */
+    AppendString(out, "\nOPTIONAL STANDARD HEADER\n");
+
+    PRINT_HEX(out, osh->Magic);
+    AppendString(out, osh->Magic == 0x10B ? "magic # (PE32)\n" : "magic # (PE32+)\n");
+
+    PRINT_VERSION(out, osh->MajorLinkerVersion, osh->MinorLinkerVersion);
+    AppendString(out, "linker version\n");
+
+    PRINT_HEX(out, osh->SizeOfCode);
+    AppendString(out, "size of code\n");
+
+    PRINT_HEX(out, osh->SizeOfInitializedData);
+    AppendString(out, "size of initialized data\n");
+
+    PRINT_HEX(out, osh->SizeOfUninitializedData);
+    AppendString(out, "size of uninitialized data\n");
+
+    PRINT_HEX(out, osh->AddressOfEntryPoint);
+    AppendString(out, "entry point (");
+    if (image->isPE32Plus)
+    {
+        AppendHex(out, owh->ImageBase + osh->AddressOfEntryPoint, 16, '0');
+    }
+    else
+    {
+        AppendHex(out, (uint32_t)(owh->ImageBase + osh->AddressOfEntryPoint), 8, '0');
+    }
+    AppendString(out, ")\n");
+
+    PRINT_HEX(out, osh->BaseOfCode);
+    AppendString(out, "base of code\n");
+
+    if (!image->isPE32Plus)
+    {
+        PRINT_HEX(out, osh->BaseOfData);
+        AppendString(out, "base of data\n");
+    }
+
+    /* Print optional windows header */
+    AppendString(out, "\nOPTIONAL WINDOWS HEADER\n");
+    PRINT_HEX(out, owh->ImageBase);
+    AppendString(out, "image base\n");    /* TODO print range */
+
+    PRINT_HEX(out, owh->SectionAlignment);
+    AppendString(out, "section alignment\n");
+
+    PRINT_HEX(out, owh->FileAlignment);
+    AppendString(out, "file alignment\n");
+
+    PRINT_VERSION(out, owh->MajorOperatingSystemVersion, owh->MinorOperatingSystemVersion);
+    AppendString(out, "operating system version\n");
+
+    PRINT_VERSION(out, owh->MajorImageVersion, owh->MinorImageVersion);
+    AppendString(out, "image version\n");
+
+    PRINT_VERSION(out, owh->MajorSubsystemVersion, owh->MinorSubsystemVersion);
+    AppendString(out, "subsystem version\n");
+
+    PRINT_HEX(out, owh->Win32VersionValue);
+    AppendString(out, "Win32 version\n");
+
+    PRINT_HEX(out, owh->SizeOfImage);
+    AppendString(out, "size of image\n");
+
+    PRINT_HEX(out, owh->SizeOfHeaders);
+    AppendString(out, "size of headers\n");
+
+    PRINT_HEX(out, owh->CheckSum);
+    AppendString(out, "checksum\n");
+
+    PRINT_HEX(out, owh->Subsystem);
+    PrintOSSubsystem(out, owh->Subsystem);
+
+    PRINT_HEX(out, owh->DllCharacteristics);
+    AppendString(out, "DLL characteristics\n");
+    PrintDLLCharacteristics(out, owh->DllCharacteristics);
+
+    PRINT_HEX(out, owh->SizeOfStackReserve);
+    AppendString(out, "size of stack reserve\n");
+
+    PRINT_HEX(out, owh->SizeOfStackCommit);
+    AppendString(out, "size of stack commit\n");
+
+    PRINT_HEX(out, owh->SizeOfHeapReserve);
+    AppendString(out, "size of heap reserve\n");
+
+    PRINT_HEX(out, owh->SizeOfHeapCommit);
+    AppendString(out, "size of heap commit\n");
+
+    PRINT_HEX(out, owh->LoaderFlags);
+    AppendString(out, "loader flags\n");
+
+    PRINT_HEX(out, owh->NumberOfRvaAndSizes);
+    AppendString(out, "number of directories\n");
+
+    /* Print optional data directories */
+    AppendString(out, "\nOPTIONAL DATA DIRECTORIES\n");
+    PRINT_DIR(out, odd->ExportTable.VirtualAddress, odd->ExportTable.Size, "Export Directory");
+    PRINT_DIR(out, odd->ImportTable.VirtualAddress, odd->ImportTable.Size, "Import Directory");
+    PRINT_DIR(out, odd->ResourceTable.VirtualAddress, odd->ResourceTable.Size, "Resource Directory");
+    PRINT_DIR(out, odd->ExceptionTable.VirtualAddress, odd->ExceptionTable.Size, "Exception Directory");
+    PRINT_DIR(out, odd->CertificateTable.VirtualAddress, odd->CertificateTable.Size, "Certificates Directory");
+    PRINT_DIR(out, odd->BaseRelocationTable.VirtualAddress, odd->BaseRelocationTable.Size, "Base Relocation Directory");
+    PRINT_DIR(out, odd->Debug.VirtualAddress, odd->Debug.Size, "Debug Directory");
+    PRINT_DIR(out, odd->Architecture.VirtualAddress, odd->Architecture.Size, "Architecture Directory");
+    PRINT_DIR(out, odd->GlobalPtr.VirtualAddress, odd->GlobalPtr.Size, "Global Pointer Directory");
+    PRINT_DIR(out, odd->TLSTable.VirtualAddress, odd->TLSTable.Size, "Thread Storage Directory");
+    PRINT_DIR(out, odd->LoadConfigTable.VirtualAddress, odd->LoadConfigTable.Size, "Load Configuration Directory");
+    PRINT_DIR(out, odd->BoundImport.VirtualAddress, odd->BoundImport.Size, "Bound Import Directory");
+    PRINT_DIR(out, odd->IAT.VirtualAddress, odd->IAT.Size, "Import Address Table Directory");
+    PRINT_DIR(out, odd->DelayImportDescriptor.VirtualAddress, odd->DelayImportDescriptor.Size, "Delay Import Directory");
+    PRINT_DIR(out, odd->CLRRuntimeHeader.VirtualAddress, odd->CLRRuntimeHeader.Size, "COM Description Directory");
+    PRINT_DIR(out, odd->Reserved.VirtualAddress, odd->Reserved.Size, "Reserved Directory");
+
+    PrintSections(out, image);
+
+    if (image->decoded & PARSE_IMPORTS)
+    {
+        PrintImports(out, image);
+    }
+    if (image->decoded & PARSE_EXPORTS)
+    {
+        PrintExports(out, image);
+    }
+    if (image->decoded & PARSE_SYMBOLS)
+    {
+        PrintSymbols(out, image);
+    }
+    if (image->decoded & PARSE_CHECKSUM)
+    {
+        PrintChecksum(out, image);
+    }
+    if (image->decoded & PARSE_ENTROPY)
+    {
+        PrintEntropy(out, image);
+    }
+    if (image->decoded & PARSE_VERSION)
+    {
+        PrintVersionInfo(out, image);
+    }
+    if (image->decoded & (PARSE_RELOCS | PARSE_REBASE))
+    {
+        PrintRelocations(out, image);
+    }
+    if (image->decoded & PARSE_CLR)
+    {
+        PrintClr(out, image);
+    }
+    if (image->decoded & PARSE_DEBUG)
+    {
+        PrintDebug(out, image);
+    }
+    if (image->decoded & PARSE_FUNCTIONS)
+    {
+        PrintFunctions(out, image);
+    }
+    if (image->decoded & PARSE_RICH)
+    {
+        PrintRich(out, image);
+    }
+    if (image->decoded & PARSE_SIMILARITY)
+    {
+        PrintSimilarity(out, image);
+    }
+
+    AppendString(out, "\n");
+}
+
+
+/* PrintSummary    Print basic characteristics of the file
+ * Parameters      The parsed image
+ */
+static void PrintSummary(OutBuf *out, const PeImage *image)
+{
+    AppendString(out, "SUMMARY\n");
+    AppendString(out, image->isArchive ? "Archive: TRUE\n" : "Archive: FALSE\n");
+    AppendString(out, image->isPE ? "PE: TRUE\n" : "PE: FALSE\n");
+    AppendString(out, image->isCOFF ? "COFF: TRUE\n" : "COFF: FALSE\n");
+    AppendString(out, image->isManaged ? "Managed: TRUE\n" : "Managed: FALSE\n");
+
+    if (image->decoded & PARSE_CHECKSUM)
+    {
+        AppendString(out, image->owh.CheckSum == 0 ? "Checksum: NOT SET\n" :
+                          image->owh.CheckSum == image->computedCheckSum ? "Checksum: VALID\n" : "Checksum: MISMATCH\n");
+    }
+}
+
+
+/* JSON_FIELD      Append ,"name":value for an integer field of a header
+ * JSON_DIR        Append ,"name":[rva,size] for a data directory
+ */
+#define JSON_FIELD(out, header, name) AppendString(out, ",\"" #name "\":"); AppendDec(out, (header)->name)
+#define JSON_DIR(out, dirs, name) AppendString(out, ",\"" #name "\":["); \
+                                  AppendDec(out, (dirs)->name.VirtualAddress); \
+                                  AppendChar(out, ','); \
+                                  AppendDec(out, (dirs)->name.Size); \
+                                  AppendChar(out, ']')
+
+
+/* FormatJsonSections    Append ,"sections":[...] for the section table
+ */
+static void FormatJsonSections(OutBuf *out, const PeImage *image)
+{
+    AppendString(out, ",\"sections\":[");
+
+    for (size_t i = 0; i < image->sections.size(); ++i)
+    {
+        const SectionHeader *sh = &image->sections[i];
+
+        AppendString(out, i == 0 ? "{\"Name\":" : ",{\"Name\":");
+        AppendJsonString(out, sh->Name, strnlen(sh->Name, sizeof(sh->Name)));
+        JSON_FIELD(out, sh, VirtualSize);
+        JSON_FIELD(out, sh, VirtualAddress);
+        JSON_FIELD(out, sh, SizeOfRawData);
+        JSON_FIELD(out, sh, PointerToRawData);
+        JSON_FIELD(out, sh, PointerToRelocations);
+        JSON_FIELD(out, sh, PointerToLinenumbers);
+        JSON_FIELD(out, sh, NumberOfRelocations);
+        JSON_FIELD(out, sh, NumberOfLinenumbers);
+        JSON_FIELD(out, sh, Characteristics);
+        AppendChar(out, '}');
+    }
+
+    AppendChar(out, ']');
+}
+
+
+/* FormatJsonImports    Append ,"imports":[...],"imphash":"...","importsTruncated":...
+ */
+static void FormatJsonImports(OutBuf *out, const PeImage *image)
+{
+    const ImportTable *imports = &image->imports;
+
+    AppendString(out, ",\"imports\":[");
+
+    for (size_t m = 0; m < imports->modules.size(); ++m)
+    {
+        const ImportModule &module = imports->modules[m];
+
+        AppendString(out, m == 0 ? "{\"dll\":" : ",{\"dll\":");
+        AppendJsonString(out, module.dll, strlen(module.dll));
+        AppendString(out, ",\"functions\":[");
+
+        for (uint32_t i = 0; i < module.functionCount; ++i)
+        {
+            const ImportFunction &function = imports->functions[module.firstFunction + i];
+            if (i > 0)
+            {
+                AppendChar(out, ',');
+            }
+
+            /* Imports by ordinal are written as numbers */
+            if (function.name != NULL)
+            {
+                AppendJsonString(out, function.name, strlen(function.name));
+            }
+            else
+            {
+                AppendDec(out, function.ordinal);
+            }
+        }
+
+        AppendString(out, "]}");
+    }
+
+    AppendString(out, "],\"imphash\":\"");
+    AppendHexBytes(out, imports->imphash, sizeof(imports->imphash));
+    AppendString(out, imports->truncated ? "\",\"importsTruncated\":true" : "\",\"importsTruncated\":false");
+}
+
+
+/* FormatJsonExports    Append ,"exports":{"dll":...,"base":n,"functions":[...]}
+ *                      with one entry per used export address table slot
+ */
+static void FormatJsonExports(OutBuf *out, const PeImage *image)
+{
+    const ExportTable *exports = &image->exports;
+    std::vector<const char *> names(exports->functions.size(), (const char *)NULL);
+
+    for (size_t i = 0; i < exports->names.size(); ++i)
+    {
+        names[exports->names[i].function] = exports->names[i].name;
+    }
+
+    AppendString(out, ",\"exports\":{\"dll\":");
+    if (exports->dll != NULL)
+    {
+        AppendJsonString(out, exports->dll, strlen(exports->dll));
+    }
+    else
+    {
+        AppendString(out, "null");
+    }
+    AppendString(out, ",\"base\":");
+    AppendDec(out, exports->Base);
+    AppendString(out, ",\"functions\":[");
+
+    bool first = true;
+    for (uint32_t i = 0; i < exports->functions.size(); ++i)
+    {
+        const ExportFunction &function = exports->functions[i];
+        if (function.rva == 0)
+        {
+            continue;
+        }
+
+        AppendString(out, first ? "{\"ordinal\":" : ",{\"ordinal\":");
+        first = false;
+        AppendDec(out, (uint64_t)exports->Base + i);
+        AppendString(out, ",\"rva\":");
+        AppendDec(out, function.rva);
+        if (names[i] != NULL)
+        {
+            AppendString(out, ",\"name\":");
+            AppendJsonString(out, names[i], strlen(names[i]));
+        }
+        if (function.forwarder != NULL)
+        {
+            AppendString(out, ",\"forwarder\":");
+            AppendJsonString(out, function.forwarder, strlen(function.forwarder));
+        }
+        AppendChar(out, '}');
+    }
+
+    AppendString(out, "]}");
+}
+
+
+/* FormatJsonSymbols    Append ,"symbols":[...] for the COFF symbol table
+ */
+static void FormatJsonSymbols(OutBuf *out, const PeImage *image)
+{
+    const SymbolTable *symbols = &image->symbols;
+
+    AppendString(out, ",\"symbols\":[");
+    for (size_t i = 0; i < symbols->names.size(); ++i)
+    {
+        AppendString(out, i == 0 ? "{\"name\":" : ",{\"name\":");
+        AppendJsonString(out, symbols->names[i], strlen(symbols->names[i]));
+        AppendString(out, ",\"value\":");
+        AppendDec(out, symbols->values[i]);
+        AppendString(out, ",\"section\":");
+        if (symbols->sections[i] < 0)
+        {
+            AppendChar(out, '-');
+        }
+        AppendDec(out, (uint64_t)(symbols->sections[i] < 0 ? -symbols->sections[i] : symbols->sections[i]));
+        AppendString(out, ",\"type\":");
+        AppendDec(out, symbols->types[i]);
+        AppendString(out, ",\"class\":");
+        AppendDec(out, symbols->storageClasses[i]);
+        AppendString(out, ",\"aux\":");
+        AppendDec(out, symbols->auxCounts[i]);
+        AppendChar(out, '}');
+    }
+    AppendChar(out, ']');
+}
+
+
+/* FormatJsonEntropy    Append ,"entropy":{...}; sections with no raw
+ *                      data and a missing overlay are null
+ */
+static void FormatJsonEntropy(OutBuf *out, const PeImage *image)
+{
+    const EntropyTable *entropy = &image->entropy;
+
+    AppendString(out, ",\"entropy\":{\"sections\":[");
+    for (size_t i = 0; i < entropy->sections.size(); ++i)
+    {
+        if (i > 0)
+        {
+            AppendChar(out, ',');
+        }
+        if (entropy->sections[i] == NO_ENTROPY)
+        {
+            AppendString(out, "null");
+        }
+        else
+        {
+            AppendEntropy(out, entropy->sections[i]);
+        }
+    }
+    AppendChar(out, ']');
+
+    if (image->isPE && !image->isCOFF)
+    {
+        JSON_FIELD(out, entropy, overlayOffset);
+        JSON_FIELD(out, entropy, overlaySize);
+        AppendString(out, ",\"overlay\":");
+        if (entropy->overlaySize > 0)
+        {
+            AppendEntropy(out, entropy->overlay);
+        }
+        else
+        {
+            AppendString(out, "null");
+        }
+    }
+
+    JSON_FIELD(out, entropy, sampled);
+    AppendChar(out, '}');
+}
+
+
+/* FormatJsonVersionInfo    Append ,"version":{...}
+ */
+static void FormatJsonVersionInfo(OutBuf *out, const PeImage *image)
+{
+    const VersionInfo *version = &image->version;
+
+    AppendString(out, ",\"version\":{");
+    if (version->hasFixed)
+    {
+        AppendString(out, "\"FileVersion\":\"");
+        AppendFileVersion(out, version->FileVersionMS, version->FileVersionLS);
+        AppendString(out, "\",\"ProductVersion\":\"");
+        AppendFileVersion(out, version->ProductVersionMS, version->ProductVersionLS);
+        AppendChar(out, '"');
+        JSON_FIELD(out, version, FileFlags);
+        JSON_FIELD(out, version, FileOS);
+        JSON_FIELD(out, version, FileType);
+        JSON_FIELD(out, version, FileSubtype);
+        AppendChar(out, ',');
+    }
+
+    AppendString(out, "\"language\":\"");
+    AppendUtf16(out, version->language, true);
+    AppendString(out, "\",\"strings\":{");
+    for (size_t i = 0; i < version->strings.size(); ++i)
+    {
+        AppendString(out, i == 0 ? "\"" : ",\"");
+        AppendUtf16(out, version->strings[i].key, true);
+        AppendString(out, "\":\"");
+        AppendUtf16(out, version->strings[i].value, true);
+        AppendChar(out, '"');
+    }
+    AppendString(out, "}}");
+}
+
+
+/* FormatJsonRelocations    Append ,"relocations":{...} and ,"rebase":{...}
+ */
+static void FormatJsonRelocations(OutBuf *out, const PeImage *image)
+{
+    const RelocationTable *relocs = &image->relocations;
+
+    if (image->decoded & PARSE_RELOCS)
+    {
+        uint32_t counts[16];
+        CountRelocationTypes(relocs, counts);
+
+        AppendString(out, ",\"relocations\":{\"blocks\":");
+        AppendDec(out, relocs->blockCount);
+        AppendString(out, ",\"count\":");
+        AppendDec(out, relocs->entries.size());
+        AppendString(out, relocs->truncated ? ",\"truncated\":true,\"types\":{" : ",\"truncated\":false,\"types\":{");
+
+        bool first = true;
+        for (uint32_t type = 0; type < 16; ++type)
+        {
+            if (counts[type] == 0)
+            {
+                continue;
+            }
+            AppendString(out, first ? "\"" : ",\"");
+            AppendDec(out, type);
+            AppendString(out, "\":");
+            AppendDec(out, counts[type]);
+            first = false;
+        }
+        AppendString(out, "}}");
+    }
+
+    if (image->decoded & PARSE_REBASE)
+    {
+        AppendString(out, ",\"rebase\":{\"base\":");
+        AppendDec(out, relocs->rebasedTo);
+        AppendString(out, ",\"applied\":");
+        AppendDec(out, relocs->rebasedCount);
+        AppendString(out, ",\"unsupported\":");
+        AppendDec(out, relocs->unsupported);
+        AppendString(out, ",\"md5\":\"");
+        AppendHexBytes(out, relocs->rebasedMd5, sizeof(relocs->rebasedMd5));
+        AppendString(out, "\"}");
+    }
+}
+
+
+/* FormatJsonAssemblyName    Append {"name":...,"version":...} for an
+ *                           Assembly or AssemblyRef row
+ */
+static void FormatJsonAssemblyName(OutBuf *out, const ClrAssemblyName *name)
+{
+    AppendString(out, "{\"name\":");
+    AppendJsonString(out, name->name, strlen(name->name));
+    AppendString(out, ",\"version\":\"");
+    AppendDec(out, name->MajorVersion);
+    AppendChar(out, '.');
+    AppendDec(out, name->MinorVersion);
+    AppendChar(out, '.');
+    AppendDec(out, name->BuildNumber);
+    AppendChar(out, '.');
+    AppendDec(out, name->RevisionNumber);
+    AppendString(out, "\",\"culture\":");
+    AppendJsonString(out, name->culture, strlen(name->culture));
+    JSON_FIELD(out, name, Flags);
+    if (name->hasPublicKeyToken)
+    {
+        AppendString(out, ",\"publicKeyToken\":\"");
+        AppendHexBytes(out, name->publicKeyToken, sizeof(name->publicKeyToken));
+        AppendChar(out, '"');
+    }
+    AppendChar(out, '}');
+}
+
+
+/* FormatJsonClr    Append ,"clr":{...}
+ */
+static void FormatJsonClr(OutBuf *out, const PeImage *image)
+{
+    const ClrInfo *clr = &image->clr;
+
+    AppendString(out, ",\"clr\":{\"version\":");
+    AppendJsonString(out, clr->version, strlen(clr->version));
+    JSON_FIELD(out, clr, MajorRuntimeVersion);
+    JSON_FIELD(out, clr, MinorRuntimeVersion);
+    JSON_FIELD(out, clr, Flags);
+    JSON_FIELD(out, clr, EntryPointToken);
+    if (clr->entryPoint != NULL)
+    {
+        AppendString(out, ",\"entryPoint\":");
+        AppendJsonString(out, clr->entryPoint, strlen(clr->entryPoint));
+    }
+
+    AppendString(out, ",\"streams\":[");
+    for (size_t i = 0; i < clr->streams.size(); ++i)
+    {
+        AppendString(out, i == 0 ? "{\"name\":" : ",{\"name\":");
+        AppendJsonString(out, clr->streams[i].name, strlen(clr->streams[i].name));
+        AppendString(out, ",\"offset\":");
+        AppendDec(out, clr->streams[i].offset);
+        AppendString(out, ",\"size\":");
+        AppendDec(out, clr->streams[i].size);
+        AppendChar(out, '}');
+    }
+
+    AppendString(out, "],\"tables\":{");
+    bool first = true;
+    for (uint32_t t = 0; t < CLR_MAX_TABLES; ++t)
+    {
+        if (clr->rows[t] == 0)
+        {
+            continue;
+        }
+        const char *name = ClrTableName(t);
+        AppendString(out, first ? "\"" : ",\"");
+        if (name != NULL)
+        {
+            AppendString(out, name);
+        }
+        else
+        {
+            AppendDec(out, t);
+        }
+        AppendString(out, "\":");
+        AppendDec(out, clr->rows[t]);
+        first = false;
+    }
+    AppendChar(out, '}');
+
+    if (clr->hasAssembly)
+    {
+        AppendString(out, ",\"assembly\":");
+        FormatJsonAssemblyName(out, &clr->assembly);
+    }
+    AppendString(out, ",\"references\":[");
+    for (size_t i = 0; i < clr->references.size(); ++i)
+    {
+        if (i > 0)
+        {
+            AppendChar(out, ',');
+        }
+        FormatJsonAssemblyName(out, &clr->references[i]);
+    }
+    AppendString(out, "]}");
+}
+
+
+/* FormatJsonDebug    Append ,"debug":{...}
+ */
+static void FormatJsonDebug(OutBuf *out, const PeImage *image)
+{
+    const DebugInfo *debug = &image->debug;
+
+    AppendString(out, ",\"debug\":{\"entries\":[");
+    for (size_t i = 0; i < debug->entries.size(); ++i)
+    {
+        const DebugDirectoryEntry *entry = &debug->entries[i];
+        AppendString(out, i == 0 ? "{\"Characteristics\":" : ",{\"Characteristics\":");
+        AppendDec(out, entry->Characteristics);
+        JSON_FIELD(out, entry, TimeDateStamp);
+        JSON_FIELD(out, entry, MajorVersion);
+        JSON_FIELD(out, entry, MinorVersion);
+        JSON_FIELD(out, entry, Type);
+        JSON_FIELD(out, entry, SizeOfData);
+        JSON_FIELD(out, entry, AddressOfRawData);
+        JSON_FIELD(out, entry, PointerToRawData);
+        AppendChar(out, '}');
+    }
+    AppendChar(out, ']');
+
+    if (debug->hasCodeView)
+    {
+        char key[PDB_KEY_LENGTH + 1];
+        size_t len = FormatPdbKey(debug->pdbGuid, debug->pdbAge, key);
+
+        AppendString(out, ",\"pdb\":{\"path\":");
+        AppendJsonString(out, debug->pdbPath, strlen(debug->pdbPath));
+        AppendString(out, ",\"guid\":\"");
+        AppendPdbGuid(out, debug->pdbGuid);
+        AppendString(out, "\",\"age\":");
+        AppendDec(out, debug->pdbAge);
+        AppendString(out, ",\"key\":\"");
+        AppendBytes(out, key, len);
+        AppendString(out, "\"}");
+    }
+    AppendChar(out, '}');
+}
+
+
+/* FormatJsonFunctions    Append ,"functions":{...}
+ */
+static void FormatJsonFunctions(OutBuf *out, const PeImage *image)
+{
+    const FunctionTable *functions = &image->functions;
+    bool unwind = (image->decoded & PARSE_UNWIND) != 0;
+
+    AppendString(out, functions->truncated ? ",\"functions\":{\"truncated\":true" : ",\"functions\":{\"truncated\":false");
+    AppendString(out, functions->resorted ? ",\"resorted\":true,\"entries\":[" : ",\"resorted\":false,\"entries\":[");
+    for (size_t i = 0; i < functions->begins.size(); ++i)
+    {
+        AppendString(out, i == 0 ? "{\"begin\":" : ",{\"begin\":");
+        AppendDec(out, functions->begins[i]);
+        AppendString(out, ",\"end\":");
+        AppendDec(out, functions->ends[i]);
+        AppendString(out, ",\"unwindData\":");
+        AppendDec(out, functions->unwindData[i]);
+
+        if (unwind)
+        {
+            const UnwindInfo *info = &functions->unwind[i];
+            AppendString(out, ",\"unwind\":{\"version\":");
+            AppendDec(out, info->version);
+            JSON_FIELD(out, info, flags);
+            JSON_FIELD(out, info, prologSize);
+            JSON_FIELD(out, info, frameRegister);
+            JSON_FIELD(out, info, frameOffset);
+            JSON_FIELD(out, info, stackSize);
+            JSON_FIELD(out, info, epilogCount);
+            JSON_FIELD(out, info, handler);
+            JSON_FIELD(out, info, chained);
+
+            if (image->cfh.Machine == 0xAA64)
+            {
+                JSON_FIELD(out, info, codeCount);
+            }
+            else
+            {
+                AppendString(out, ",\"codes\":[");
+                for (uint32_t c = 0; c < info->codeCount && info->firstCode + c < functions->codes.size(); ++c)
+                {
+                    const UnwindCode *code = &functions->codes[info->firstCode + c];
+                    AppendString(out, c == 0 ? "[" : ",[");
+                    AppendDec(out, code->codeOffset);
+                    AppendChar(out, ',');
+                    AppendDec(out, code->op);
+                    AppendChar(out, ',');
+                    AppendDec(out, code->info);
+                    AppendChar(out, ',');
+                    AppendDec(out, code->value);
+                    AppendChar(out, ']');
+                }
+                AppendChar(out, ']');
+            }
+            AppendChar(out, '}');
+        }
+        AppendChar(out, '}');
+    }
+    AppendString(out, "]}");
+}
+
+
+/* FormatJsonRich    Append ,"rich":{...}
+ */
+static void FormatJsonRich(OutBuf *out, const PeImage *image)
+{
+    const RichHeader *rich = &image->rich;
+
+    AppendString(out, ",\"rich\":{\"offset\":");
+    AppendDec(out, rich->offset);
+    JSON_FIELD(out, rich, key);
+    AppendString(out, rich->checksumValid ? ",\"checksumValid\":true" : ",\"checksumValid\":false");
+    AppendString(out, ",\"fingerprint\":\"");
+    AppendHex(out, rich->fingerprint, 16, '0');
+    AppendString(out, "\",\"entries\":[");
+    for (size_t i = 0; i < rich->entries.size(); ++i)
+    {
+        AppendString(out, i == 0 ? "{\"productId\":" : ",{\"productId\":");
+        AppendDec(out, rich->entries[i].productId);
+        JSON_FIELD(out, &rich->entries[i], build);
+        JSON_FIELD(out, &rich->entries[i], count);
+        AppendChar(out, '}');
+    }
+    AppendString(out, "]}");
+}
+
+
+/* FormatJsonDigest    Append a similarity digest as a hex string, or null
+ */
+static void FormatJsonDigest(OutBuf *out, const SimilarityDigest *digest)
+{
+    if (digest->valid)
+    {
+        AppendChar(out, '"');
+        AppendHexBytes(out, digest->bytes, sizeof(digest->bytes));
+        AppendChar(out, '"');
+    }
+    else
+    {
+        AppendString(out, "null");
+    }
+}
+
+
+/* FormatJsonSimilarity    Append ,"similarity":{...}; ranges too short or
+ *                         uniform to digest are null
+ */
+static void FormatJsonSimilarity(OutBuf *out, const PeImage *image)
+{
+    const SimilarityTable *similarity = &image->similarity;
+
+    AppendString(out, ",\"similarity\":{\"image\":");
+    FormatJsonDigest(out, &similarity->image);
+    AppendString(out, ",\"sections\":[");
+    for (size_t i = 0; i < similarity->sections.size(); ++i)
+    {
+        if (i > 0)
+        {
+            AppendChar(out, ',');
+        }
+        FormatJsonDigest(out, &similarity->sections[i]);
+    }
+    AppendString(out, "]}");
+}
+
+
+/* FormatJson    Append one NDJSON line describing an image
+ * Parameters    Buffer, file path, the parsed image
+ */
+static void FormatJson(OutBuf *out, const char *path, const PeImage *image)
+{
+    AppendString(out, "{\"path\":");
+    AppendJsonString(out, path, strlen(path));
+    AppendString(out, image->isArchive ? ",\"archive\":true" : ",\"archive\":false");
+    AppendString(out, image->isPE ? ",\"pe\":true" : ",\"pe\":false");
+    AppendString(out, image->isCOFF ? ",\"coff\":true" : ",\"coff\":false");
+    AppendString(out, image->isManaged ? ",\"managed\":true" : ",\"managed\":false");
+    AppendString(out, image->isPE32Plus ? ",\"pe32plus\":true" : ",\"pe32plus\":false");
+
+    if (!image->isPE && !image->isCOFF)
+    {
+        AppendString(out, "}\n");
+        return;
+    }
+
+    const CoffFileHeader *cfh = &image->cfh;
+    AppendString(out, ",\"CoffFileHeader\":{\"Machine\":");
+    AppendDec(out, cfh->Machine);
+    JSON_FIELD(out, cfh, NumberOfSections);
+    JSON_FIELD(out, cfh, TimeDateStamp);
+    JSON_FIELD(out, cfh, PointerToSymbolTable);
+    JSON_FIELD(out, cfh, NumberOfSymbols);
+    JSON_FIELD(out, cfh, SizeOfOptionalHeader);
+    JSON_FIELD(out, cfh, Characteristics);
+    AppendChar(out, '}');
+
+    if (image->isCOFF)
+    {
+        FormatJsonSections(out, image);
+        if (image->decoded & PARSE_SYMBOLS)
+        {
+            FormatJsonSymbols(out, image);
+        }
+        if (image->decoded & PARSE_ENTROPY)
+        {
+            FormatJsonEntropy(out, image);
+        }
+        AppendString(out, "}\n");
+        return;
+    }
+
+    const OptionalStdHeader *osh = &image->osh;
+    AppendString(out, ",\"OptionalStdHeader\":{\"Magic\":");
+    AppendDec(out, osh->Magic);
+    JSON_FIELD(out, osh, MajorLinkerVersion);
+    JSON_FIELD(out, osh, MinorLinkerVersion);
+    JSON_FIELD(out, osh, SizeOfCode);
+    JSON_FIELD(out, osh, SizeOfInitializedData);
+    JSON_FIELD(out, osh, SizeOfUninitializedData);
+    JSON_FIELD(out, osh, AddressOfEntryPoint);
+    JSON_FIELD(out, osh, BaseOfCode);
+    if (!image->isPE32Plus)
+    {
+        JSON_FIELD(out, osh, BaseOfData);
+    }
+    AppendChar(out, '}');
+
+    const OptionalWinHeader *owh = &image->owh;
+    AppendString(out, ",\"OptionalWinHeader\":{\"ImageBase\":");
+    AppendDec(out, owh->ImageBase);
+    JSON_FIELD(out, owh, SectionAlignment);
+    JSON_FIELD(out, owh, FileAlignment);
+    JSON_FIELD(out, owh, MajorOperatingSystemVersion);
+    JSON_FIELD(out, owh, MinorOperatingSystemVersion);
+    JSON_FIELD(out, owh, MajorImageVersion);
+    JSON_FIELD(out, owh, MinorImageVersion);
+    JSON_FIELD(out, owh, MajorSubsystemVersion);
+    JSON_FIELD(out, owh, MinorSubsystemVersion);
+    JSON_FIELD(out, owh, Win32VersionValue);
+    JSON_FIELD(out, owh, SizeOfImage);
+    JSON_FIELD(out, owh, SizeOfHeaders);
+    JSON_FIELD(out, owh, CheckSum);
+    JSON_FIELD(out, owh, Subsystem);
+    JSON_FIELD(out, owh, DllCharacteristics);
+    JSON_FIELD(out, owh, SizeOfStackReserve);
+    JSON_FIELD(out, owh, SizeOfStackCommit);
+    JSON_FIELD(out, owh, SizeOfHeapReserve);
+    JSON_FIELD(out, owh, SizeOfHeapCommit);
+    JSON_FIELD(out, owh, LoaderFlags);
+    JSON_FIELD(out, owh, NumberOfRvaAndSizes);
+    AppendChar(out, '}');
+
+    const OptionalDataDirs *odd = &image->odd;
+    AppendString(out, ",\"OptionalDataDirs\":{\"ExportTable\":[");
+    AppendDec(out, odd->ExportTable.VirtualAddress);
+    AppendChar(out, ',');
+    AppendDec(out, odd->ExportTable.Size);
+    AppendChar(out, ']');
+    JSON_DIR(out, odd, ImportTable);
+    JSON_DIR(out, odd, ResourceTable);
+    JSON_DIR(out, odd, ExceptionTable);
+    JSON_DIR(out, odd, CertificateTable);
+    JSON_DIR(out, odd, BaseRelocationTable);
+    JSON_DIR(out, odd, Debug);
+    JSON_DIR(out, odd, Architecture);
+    JSON_DIR(out, odd, GlobalPtr);
+    JSON_DIR(out, odd, TLSTable);
+    JSON_DIR(out, odd, LoadConfigTable);
+    JSON_DIR(out, odd, BoundImport);
+    JSON_DIR(out, odd, IAT);
+    JSON_DIR(out, odd, DelayImportDescriptor);
+    JSON_DIR(out, odd, CLRRuntimeHeader);
+    JSON_DIR(out, odd, Reserved);
+    AppendChar(out, '}');
+
+    FormatJsonSections(out, image);
+
+    if (image->decoded & PARSE_IMPORTS)
+    {
+        FormatJsonImports(out, image);
+    }
+    if (image->decoded & PARSE_EXPORTS)
+    {
+        FormatJsonExports(out, image);
+    }
+    if (image->decoded & PARSE_SYMBOLS)
+    {
+        FormatJsonSymbols(out, image);
+    }
+    if (image->decoded & PARSE_CHECKSUM)
+    {
+        AppendString(out, ",\"checksum\":{\"stored\":");
+        AppendDec(out, owh->CheckSum);
+        AppendString(out, ",\"computed\":");
+        AppendDec(out, image->computedCheckSum);
+        AppendString(out, owh->CheckSum == image->computedCheckSum ? ",\"valid\":true}" : ",\"valid\":false}");
+    }
+    if (image->decoded & PARSE_ENTROPY)
+    {
+        FormatJsonEntropy(out, image);
+    }
+    if (image->decoded & PARSE_VERSION)
+    {
+        FormatJsonVersionInfo(out, image);
+    }
+    if (image->decoded & (PARSE_RELOCS | PARSE_REBASE))
+    {
+        FormatJsonRelocations(out, image);
+    }
+    if (image->decoded & PARSE_CLR)
+    {
+        FormatJsonClr(out, image);
+    }
+    if (image->decoded & PARSE_DEBUG)
+    {
+        FormatJsonDebug(out, image);
+    }
+    if (image->decoded & PARSE_FUNCTIONS)
+    {
+        FormatJsonFunctions(out, image);
+    }
+    if (image->decoded & PARSE_RICH)
+    {
+        FormatJsonRich(out, image);
+    }
+    if (image->decoded & PARSE_SIMILARITY)
+    {
+        FormatJsonSimilarity(out, image);
+    }
+
+    AppendString(out, "}\n");
+}
+
+
+/* FormatRecord    Append one binary PeRecord followed by the path
+ * Parameters      Buffer, file path, PE_RECORD_* flags, the parsed image
+ *                 (NULL to leave the headers zero)
+ */
+static void FormatRecord(OutBuf *out, const char *path, uint16_t flags, const PeImage *image)
+{
+    size_t pathLength = strlen(path);
+    if (pathLength > 0xFFFF)
+    {
+        pathLength = 0xFFFF;
+    }
+
+    PeRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = PE_RECORD_MAGIC;
+    record.version = PE_RECORD_VERSION;
+    record.flags = flags;
+    record.recordSize = (uint32_t)((sizeof(record) + pathLength + 7) & ~(size_t)7);
+    record.pathLength = (uint16_t)pathLength;
+
+    if (image != NULL)
+    {
+        record.cfh = image->cfh;
+        record.osh = image->osh;
+        record.owh = image->owh;
+        record.odd = image->odd;
+    }
+
+    AppendBytes(out, &record, sizeof(record));
+    AppendBytes(out, path, pathLength);
+    AppendChar(out, '\0', record.recordSize - sizeof(record) - pathLength);
+}
+
+
+/* RecordFlags    PE_RECORD_* flags describing a parsed image
+ */
+static uint16_t RecordFlags(const PeImage *image)
+{
+    return (image->isArchive ? PE_RECORD_ARCHIVE : 0) |
+           (image->isPE ? PE_RECORD_PE : 0) |
+           (image->isCOFF ? PE_RECORD_COFF : 0) |
+           (image->isManaged ? PE_RECORD_MANAGED : 0) |
+           (image->isPE32Plus ? PE_RECORD_PE32PLUS : 0);
+}
+
+
+/* FormatImage    Append everything the chosen format prints for a file
+ * Parameters     Buffer, output options, file path, the parsed image
+ */
+void FormatImage(OutBuf *out, const OutputOptions *options, const char *path, const PeImage *image)
+{
+    switch (options->format)
+    {
+    case FORMAT_TEXT:
+        if (!options->quiet)
+        {
+            PrintAll(out, image);
+        }
+        PrintSummary(out, image);
+        break;
+    case FORMAT_NDJSON:
+        FormatJson(out, path, image);
+        break;
+    case FORMAT_BINARY:
+        FormatRecord(out, path, RecordFlags(image), image);
+        break;
+    }
+}
+
+
+/* FormatOpenError    Append the output for a file that could not be opened
+ * Parameters         Buffer, output options, file path
+ */
+void FormatOpenError(OutBuf *out, const OutputOptions *options, const char *path)
+{
+    switch (options->format)
+    {
+    case FORMAT_TEXT:
+        AppendString(out, "Error: Could not open \"");
+        AppendString(out, path);
+        AppendString(out, "\" for reading\n");
+        break;
+    case FORMAT_NDJSON:
+        AppendString(out, "{\"path\":");
+        AppendJsonString(out, path, strlen(path));
+        AppendString(out, ",\"error\":\"could not open for reading\"}\n");
+        break;
+    case FORMAT_BINARY:
+        FormatRecord(out, path, PE_RECORD_ERROR, NULL);
+        break;
+    }
+}
+
+
+/* FormatShortImport    Append everything the chosen format prints for a
+ *                      short import library member
+ * Parameters           Buffer, output options, member path, the import
+ */
+void FormatShortImport(OutBuf *out, const OutputOptions *options, const char *path, const ShortImport *import)
+{
+    static const char *const types[] = { "code", "data", "const", "3" };
+    static const char *const nameTypes[] = { "ordinal", "name", "no prefix", "undecorate", "export as", "5", "6", "7" };
+
+    switch (options->format)
+    {
+    case FORMAT_TEXT:
+        if (!options->quiet)
+        {
+            AppendString(out, "IMPORT OBJECT HEADER\n");
+            PRINT_HEX(out, import->Machine);
+            PrintMachineType(out, import->Machine);
+            PRINT_HEX(out, import->TimeDateStamp);
+            AppendString(out, "time date stamp: ");
+            AppendTimeStamp(out, import->TimeDateStamp);
+            AppendChar(out, '\n');
+            PRINT_HEX(out, import->SizeOfData);
+            AppendString(out, "size of data\n");
+            PRINT_HEX(out, import->OrdinalOrHint);
+            AppendString(out, import->NameType == 0 ? "ordinal\n" : "hint\n");
+            AppendString(out, "           type: ");
+            AppendString(out, types[import->Type]);
+            AppendString(out, "\n           name type: ");
+            AppendString(out, nameTypes[import->NameType]);
+            AppendChar(out, '\n');
+        }
+        AppendString(out, "Symbol: ");
+        AppendString(out, import->symbol);
+        AppendString(out, "\nDLL: ");
+        AppendString(out, import->dll);
+        AppendChar(out, '\n');
+        break;
+    case FORMAT_NDJSON:
+        AppendString(out, "{\"path\":");
+        AppendJsonString(out, path, strlen(path));
+        AppendString(out, ",\"import\":{\"Machine\":");
+        AppendDec(out, import->Machine);
+        JSON_FIELD(out, import, TimeDateStamp);
+        JSON_FIELD(out, import, SizeOfData);
+        JSON_FIELD(out, import, OrdinalOrHint);
+        AppendString(out, ",\"Type\":\"");
+        AppendString(out, types[import->Type]);
+        AppendString(out, "\",\"NameType\":\"");
+        AppendString(out, nameTypes[import->NameType]);
+        AppendString(out, "\",\"symbol\":");
+        AppendJsonString(out, import->symbol, strlen(import->symbol));
+        AppendString(out, ",\"dll\":");
+        AppendJsonString(out, import->dll, strlen(import->dll));
+        AppendString(out, "}}\n");
+        break;
+    case FORMAT_BINARY:
+    {
+        /* Only the machine and time stamp have a place in a PeRecord */
+        PeImage image = {};
+        image.cfh.Machine = import->Machine;
+        image.cfh.TimeDateStamp = import->TimeDateStamp;
+        FormatRecord(out, path, PE_RECORD_IMPORT, &image);
+        break;
+    }
+    }
+}
+
+
+/* FormatLinkerMember    Append the symbol counts of an archive's linker
+ *                       member; binary output has no record for them
+ * Parameters            Buffer, output options, member path, member, counts
+ */
+void FormatLinkerMember(OutBuf *out, const OutputOptions *options, const char *path,
+                        const ArMember *member, const ArLinkerMember *linker)
+{
+    switch (options->format)
+    {
+    case FORMAT_TEXT:
+        AppendString(out, member->kind == AR_FIRST_LINKER ? "FIRST LINKER MEMBER\n" : "SECOND LINKER MEMBER\n");
+        PRINT_HEX(out, linker->symbols);
+        AppendString(out, "number of symbols\n");
+        if (member->kind == AR_SECOND_LINKER)
+        {
+            PRINT_HEX(out, linker->members);
+            AppendString(out, "number of members\n");
+        }
+        break;
+    case FORMAT_NDJSON:
+        AppendString(out, "{\"path\":");
+        AppendJsonString(out, path, strlen(path));
+        AppendString(out, ",\"linker\":{\"symbols\":");
+        AppendDec(out, linker->symbols);
+        if (member->kind == AR_SECOND_LINKER)
+        {
+            AppendString(out, ",\"members\":");
+            AppendDec(out, linker->members);
+        }
+        AppendString(out, "}}\n");
+        break;
+    case FORMAT_BINARY:
+        break;
+    }
+}
+
+
+/* FormatDuplicateSymbol    Append a link check finding: a symbol defined
+ *                          in more than one object
+ * Parameters               Buffer, output options, symbol, first two
+ *                          defining paths, number of definitions
+ */
+void FormatDuplicateSymbol(OutBuf *out, const OutputOptions *options, const char *name,
+                           const char *first, const char *second, uint32_t definitions)
+{
+    if (options->format == FORMAT_NDJSON)
+    {
+        AppendString(out, "{\"duplicate\":");
+        AppendJsonString(out, name, strlen(name));
+        AppendString(out, ",\"definitions\":");
+        AppendDec(out, definitions);
+        AppendString(out, ",\"first\":");
+        AppendJsonString(out, first, strlen(first));
+        AppendString(out, ",\"second\":");
+        AppendJsonString(out, second, strlen(second));
+        AppendString(out, "}\n");
+        return;
+    }
+
+    AppendString(out, "Duplicate: ");
+    AppendString(out, name);
+    AppendString(out, " (");
+    AppendDec(out, definitions);
+    AppendString(out, " definitions)\n    ");
+    AppendString(out, first);
+    AppendString(out, "\n    ");
+    AppendString(out, second);
+    AppendChar(out, '\n');
+}
+
+
+/* FormatUndefinedSymbol    Append a link check finding: a symbol that is
+ *                          referenced but defined nowhere
+ * Parameters               Buffer, output options, symbol, first referencing path
+ */
+void FormatUndefinedSymbol(OutBuf *out, const OutputOptions *options, const char *name, const char *referencedBy)
+{
+    if (options->format == FORMAT_NDJSON)
+    {
+        AppendString(out, "{\"undefined\":");
+        AppendJsonString(out, name, strlen(name));
+        AppendString(out, ",\"referencedBy\":");
+        AppendJsonString(out, referencedBy, strlen(referencedBy));
+        AppendString(out, "}\n");
+        return;
+    }
+
+    AppendString(out, "Undefined: ");
+    AppendString(out, name);
+    AppendString(out, "\n    ");
+    AppendString(out, referencedBy);
+    AppendChar(out, '\n');
+}
+
+
+/* FormatRichCluster    Append one toolchain cluster found by
+ *                      --rich-clusters
+ * Parameters           Buffer, options, cluster number, its members' paths
+ *                      and Rich fingerprints, member count
+ */
+void FormatRichCluster(OutBuf *out, const OutputOptions *options, uint32_t cluster, const char *const *paths,
+                       const uint64_t *fingerprints, size_t count)
+{
+    if (options->format == FORMAT_NDJSON)
+    {
+        AppendString(out, "{\"cluster\":");
+        AppendDec(out, cluster);
+        AppendString(out, ",\"members\":[");
+        for (size_t i = 0; i < count; ++i)
+        {
+            AppendString(out, i == 0 ? "{\"path\":" : ",{\"path\":");
+            AppendJsonString(out, paths[i], strlen(paths[i]));
+            AppendString(out, ",\"fingerprint\":\"");
+            AppendHex(out, fingerprints[i], 16, '0');
+            AppendString(out, "\"}");
+        }
+        AppendString(out, "]}\n");
+        return;
+    }
+
+    AppendString(out, "Cluster ");
+    AppendDec(out, cluster);
+    AppendString(out, " (");
+    AppendDec(out, count);
+    AppendString(out, count == 1 ? " binary)\n" : " binaries)\n");
+    for (size_t i = 0; i < count; ++i)
+    {
+        AppendString(out, "    ");
+        AppendHex(out, fingerprints[i], 16, '0');
+        AppendChar(out, ' ');
+        AppendString(out, paths[i]);
+        AppendChar(out, '\n');
+    }
+}
+
+
+/* FormatSimilarMatch    Append one binary found by --similar
+ * Parameters            Buffer, options, the query's path, the path found,
+ *                       distance between the image digests (UINT32_MAX
+ *                       if the query has none), sections of the query
+ *                       with a similar section there, and with a digest
+ */
+void FormatSimilarMatch(OutBuf *out, const OutputOptions *options, const char *query, PeBuffer path,
+                        uint32_t distance, uint32_t sections, uint32_t querySections)
+{
+    if (options->format == FORMAT_NDJSON)
+    {
+        AppendString(out, "{\"query\":");
+        AppendJsonString(out, query, strlen(query));
+        AppendString(out, ",\"path\":");
+        AppendJsonString(out, (const char *)path.data, path.size);
+        AppendString(out, ",\"distance\":");
+        if (distance == UINT32_MAX)
+        {
+            AppendString(out, "null");
+        }
+        else
+        {
+            AppendDec(out, distance);
+        }
+        AppendString(out, ",\"sections\":");
+        AppendDec(out, sections);
+        AppendString(out, ",\"querySections\":");
+        AppendDec(out, querySections);
+        AppendString(out, "}\n");
+        return;
+    }
+
+    if (distance == UINT32_MAX)
+    {
+        AppendString(out, "         -");
+    }
+    else
+    {
+        AppendDec(out, distance, 10);
+    }
+    AppendDec(out, sections, 5);
+    AppendChar(out, '/');
+    AppendDec(out, querySections);
+    AppendChar(out, ' ');
+    AppendBytes(out, path.data, path.size);
+    AppendChar(out, '\n');
+}
+
+
+/* FormatFunctionAt    Append the function found by --function-at
+ * Parameters          Buffer, options, path, image decoded with
+ *                     PARSE_FUNCTIONS and PARSE_UNWIND, RVA looked up
+ */
+void FormatFunctionAt(OutBuf *out, const OutputOptions *options, const char *path, const PeImage *image, uint32_t rva)
+{
+    const FunctionTable *functions = &image->functions;
+    uint32_t index = FindFunction(functions, rva);
+    const UnwindInfo *info = index < functions->unwind.size() ? &functions->unwind[index] : NULL;
+
+    if (options->format == FORMAT_NDJSON)
+    {
+        AppendString(out, "{\"path\":");
+        AppendJsonString(out, path, strlen(path));
+        AppendString(out, ",\"rva\":");
+        AppendDec(out, rva);
+        if (info == NULL)
+        {
+            AppendString(out, ",\"function\":null}\n");
+            return;
+        }
+        AppendString(out, ",\"function\":{\"begin\":");
+        AppendDec(out, functions->begins[index]);
+        AppendString(out, ",\"end\":");
+        AppendDec(out, functions->ends[index]);
+        AppendString(out, ",\"unwindData\":");
+        AppendDec(out, functions->unwindData[index]);
+        JSON_FIELD(out, info, stackSize);
+        JSON_FIELD(out, info, handler);
+        JSON_FIELD(out, info, chained);
+        AppendString(out, "}}\n");
+        return;
+    }
+
+    AppendString(out, path);
+    AppendString(out, ": ");
+    AppendHex(out, rva, 8, '0');
+    if (info == NULL)
+    {
+        AppendString(out, " in no function\n");
+        return;
+    }
+    AppendString(out, " in ");
+    AppendHex(out, functions->begins[index], 8, '0');
+    AppendChar(out, '-');
+    AppendHex(out, functions->ends[index], 8, '0');
+    AppendString(out, " +");
+    AppendHex(out, rva - functions->begins[index]);
+    AppendString(out, ", unwind ");
+    AppendHex(out, functions->unwindData[index], 8, '0');
+    AppendString(out, ", stack ");
+    AppendHex(out, info->stackSize);
+    AppendString(out, ", handler ");
+    AppendHex(out, info->handler, 8, '0');
+    if (info->chained != 0)
+    {
+        AppendString(out, ", chained to ");
+        AppendHex(out, info->chained, 8, '0');
+    }
+    AppendChar(out, '\n');
+}
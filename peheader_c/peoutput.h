@@ -0,0 +1,128 @@
+#ifndef _PEOUTPUT
+#define _PEOUTPUT
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "peheader.h"
+
+#define OUTBUF_INITIAL_SIZE  0x10000   /* Starting capacity of an output buffer */
+#define OUTBUF_FLUSH_SIZE    0x100000  /* Batch workers write their buffer out past this */
+
+#define PE_RECORD_MAGIC      0x52484550  /* "PEHR" */
+#define PE_RECORD_VERSION    2
+
+/* PeRecord flags */
+#define PE_RECORD_ARCHIVE    0x0001
+#define PE_RECORD_PE         0x0002
+#define PE_RECORD_COFF       0x0004
+#define PE_RECORD_MANAGED    0x0008
+#define PE_RECORD_PE32PLUS   0x0010
+#define PE_RECORD_IMPORT     0x0020  /* Short import archive member; only Machine and TimeDateStamp are set */
+#define PE_RECORD_ERROR      0x8000  /* The file could not be read; only the path is valid */
+
+typedef enum
+{
+    FORMAT_TEXT,      // the classic human readable dump
+    FORMAT_NDJSON,    // one JSON object per line
+    FORMAT_BINARY     // one PeRecord per file
+} OutputFormat;
+
+typedef struct
+{
+    OutputFormat format;
+    bool quiet;       // text: summary only
+} OutputOptions;
+
+/* Growable byte buffer that every formatter writes through. Buffers are
+ * reused from file to file, so steady state formatting doesn't allocate.
+ */
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} OutBuf;
+
+/* Fixed layout binary record, written little endian with no padding
+ * between fields. The file's path follows the record (pathLength bytes,
+ * not NUL terminated) and recordSize covers both, rounded up to a
+ * multiple of 8 so the next record stays aligned.
+ */
+typedef struct
+{
+    uint32_t magic;                     // PE_RECORD_MAGIC
+    uint16_t version;                   // PE_RECORD_VERSION
+    uint16_t flags;                     // PE_RECORD_* bits
+    uint32_t recordSize;                // bytes from magic to the start of the next record
+    uint16_t pathLength;
+    uint16_t reserved;
+
+    CoffFileHeader cfh;                 // 20 bytes
+    OptionalStdHeader osh;              // 28 bytes
+    OptionalWinHeader owh;              // 88 bytes
+    OptionalDataDirs odd;               // 128 bytes
+} PeRecord;
+
+
+void InitOutBuf(OutBuf *out, size_t capacity);
+void FreeOutBuf(OutBuf *out);
+void GrowOutBuf(OutBuf *out, size_t extra);
+bool WriteOutBuf(OutBuf *out, int fd);
+
+void AppendHex(OutBuf *out, uint64_t value, int width = 0, char pad = ' ');
+void AppendDec(OutBuf *out, uint64_t value, int width = 0, char pad = ' ');
+void AppendHexBytes(OutBuf *out, const uint8_t *bytes, size_t count);
+void AppendJsonString(OutBuf *out, const char *s, size_t len);
+void AppendTimeStamp(OutBuf *out, uint32_t stamp);
+
+void FormatImage(OutBuf *out, const OutputOptions *options, const char *path, const PeImage *image);
+void FormatOpenError(OutBuf *out, const OutputOptions *options, const char *path);
+void FormatShortImport(OutBuf *out, const OutputOptions *options, const char *path, const ShortImport *import);
+void FormatLinkerMember(OutBuf *out, const OutputOptions *options, const char *path,
+                        const ArMember *member, const ArLinkerMember *linker);
+void FormatDuplicateSymbol(OutBuf *out, const OutputOptions *options, const char *name,
+                           const char *first, const char *second, uint32_t definitions);
+void FormatUndefinedSymbol(OutBuf *out, const OutputOptions *options, const char *name, const char *referencedBy);
+void FormatRichCluster(OutBuf *out, const OutputOptions *options, uint32_t cluster, const char *const *paths,
+                       const uint64_t *fingerprints, size_t count);
+void FormatSimilarMatch(OutBuf *out, const OutputOptions *options, const char *query, PeBuffer path,
+                        uint32_t distance, uint32_t sections, uint32_t querySections);
+void FormatFunctionAt(OutBuf *out, const OutputOptions *options, const char *path, const PeImage *image, uint32_t rva);
+
+
+/* AppendBytes    Copy raw bytes onto the end of a buffer
+ */
+inline void AppendBytes(OutBuf *out, const void *data, size_t len)
+{
+    if (out->cap - out->len < len)
+    {
+        GrowOutBuf(out, len);
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+
+/* AppendString    Copy a NUL terminated string onto the end of a buffer
+ */
+inline void AppendString(OutBuf *out, const char *s)
+{
+    AppendBytes(out, s, strlen(s));
+}
+
+
+/* AppendChar    Append one character, repeated count times
+ */
+inline void AppendChar(OutBuf *out, char c, size_t count = 1)
+{
+    if (out->cap - out->len < count)
+    {
+        GrowOutBuf(out, count);
+    }
+    memset(out->data + out->len, c, count);
+    out->len += count;
+}
+
+#endif // _PEOUTPUT
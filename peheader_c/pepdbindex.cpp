@@ -0,0 +1,222 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pepdbindex.cpp
+//  Author:     Mark Coppa
+//
+//  Symbol server index: maps the PDB identity (GUID and age) of every
+//  binary in a corpus to the binary's path, so a crash report naming a PDB
+//  can be matched to its binary without rescanning. The file is a header,
+//  an array of fixed size entries sorted by identity and the paths they
+//  point at; it is mapped and binary searched in place.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pepdbindex.h"
+#include "pedigest.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The PDB index file is read by mapping the structs; add byte swapping for big endian hosts"
+#endif
+
+static_assert(sizeof(PdbIndexEntry) == 32, "PdbIndexEntry must stay 32 bytes with no padding");
+
+
+/* CompareKey    Order entries by GUID bytes, then age
+ */
+static int CompareKey(const PdbIndexEntry *entry, const uint8_t guid[16], uint32_t age)
+{
+    int order = memcmp(entry->guid, guid, sizeof(entry->guid));
+    if (order != 0)
+    {
+        return order;
+    }
+    return entry->age < age ? -1 : entry->age > age ? 1 : 0;
+}
+
+
+/* Add           Record the PDB identity of one binary
+ * Parameters    GUID as stored in its RSDS record, age, path of the binary
+ */
+void PdbIndexBuilder::Add(const uint8_t guid[16], uint32_t age, const char *path)
+{
+    Pending pending;
+    memset(&pending.entry, 0, sizeof(pending.entry));
+    memcpy(pending.entry.guid, guid, sizeof(pending.entry.guid));
+    pending.entry.age = age;
+    pending.path = path;
+
+    Shard *shard = &shards[HashBytes(path, pending.path.size()) >> 58];
+    std::lock_guard<std::mutex> guard(shard->lock);
+    shard->entries.push_back(std::move(pending));
+}
+
+
+/* Write         Sort everything added and write the index, replacing any
+ *               file of that name only once it is complete
+ * Parameters    Index file name, where to return the number of entries
+ * Returns       false if the file could not be written
+ */
+bool PdbIndexBuilder::Write(const char *path, uint64_t *entries)
+{
+    std::vector<Pending *> all;
+    for (int s = 0; s < SHARD_COUNT; ++s)
+    {
+        for (size_t e = 0; e < shards[s].entries.size(); ++e)
+        {
+            all.push_back(&shards[s].entries[e]);
+        }
+    }
+
+    /* Paths break ties so the same corpus always writes the same file */
+    std::sort(all.begin(), all.end(), [](const Pending *a, const Pending *b) {
+        int order = CompareKey(&a->entry, b->entry.guid, b->entry.age);
+        return order != 0 ? order < 0 : a->path < b->path;
+    });
+
+    std::vector<PdbIndexEntry> table(all.size());
+    uint64_t offset = 0;
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        table[i] = all[i]->entry;
+        table[i].pathLength = (uint32_t)all[i]->path.size();
+        table[i].pathOffset = offset;
+        offset += all[i]->path.size();
+    }
+
+    std::string temp = std::string(path) + ".tmp";
+    FILE *out = fopen(temp.c_str(), "wb");
+    if (out == NULL)
+    {
+        return false;
+    }
+
+    PdbIndexHeader header = { PDB_INDEX_MAGIC, PDB_INDEX_VERSION, table.size(), offset, 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              (table.empty() || fwrite(table.data(), sizeof(PdbIndexEntry), table.size(), out) == table.size());
+
+    for (size_t i = 0; ok && i < all.size(); ++i)
+    {
+        ok = all[i]->path.empty() || fwrite(all[i]->path.data(), all[i]->path.size(), 1, out) == 1;
+    }
+
+    ok = fclose(out) == 0 && ok;
+
+#ifdef _WIN32
+    if (ok)
+    {
+        remove(path);
+    }
+#endif
+    if (!ok || rename(temp.c_str(), path) != 0)
+    {
+        remove(temp.c_str());
+        return false;
+    }
+
+    *entries = table.size();
+    return true;
+}
+
+
+PdbIndex::PdbIndex()
+    : loaded(false), entries(NULL), entryCount(0), paths(NULL), pathSize(0)
+{
+    memset(&file, 0, sizeof(file));
+}
+
+
+PdbIndex::~PdbIndex()
+{
+    if (loaded)
+    {
+        ClosePeFile(&file);
+    }
+}
+
+
+/* Open          Map an index written by PdbIndexBuilder
+ * Parameters    Index file name
+ * Returns       false if it can't be read or isn't a valid index
+ */
+bool PdbIndex::Open(const char *path)
+{
+    if (!OpenWholeFile(path, &file))
+    {
+        return false;
+    }
+
+    const PdbIndexHeader *header = (const PdbIndexHeader *)file.buffer.data;
+    size_t size = file.buffer.size;
+
+    bool valid = file.complete && size >= sizeof(PdbIndexHeader) &&
+                 header->magic == PDB_INDEX_MAGIC && header->version == PDB_INDEX_VERSION &&
+                 header->entryCount <= (size - sizeof(PdbIndexHeader)) / sizeof(PdbIndexEntry) &&
+                 header->pathSize == size - sizeof(PdbIndexHeader) - header->entryCount * sizeof(PdbIndexEntry);
+    if (!valid)
+    {
+        ClosePeFile(&file);
+        return false;
+    }
+
+    loaded = true;
+    entries = (const PdbIndexEntry *)(file.buffer.data + sizeof(PdbIndexHeader));
+    entryCount = header->entryCount;
+    paths = (const uint8_t *)(entries + entryCount);
+    pathSize = header->pathSize;
+    return true;
+}
+
+
+/* Find          Find the binaries built with a PDB
+ * Parameters    GUID as stored in the RSDS record, age, where to return
+ *               the first matching entry
+ * Returns       Number of matching entries, which follow each other
+ */
+uint64_t PdbIndex::Find(const uint8_t guid[16], uint32_t age, uint64_t *first) const
+{
+    uint64_t lo = 0;
+    uint64_t hi = entryCount;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (CompareKey(&entries[mid], guid, age) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    *first = lo;
+    uint64_t end = lo;
+    while (end < entryCount && CompareKey(&entries[end], guid, age) == 0)
+    {
+        ++end;
+    }
+    return end - lo;
+}
+
+
+/* Path       Path of the binary an entry describes
+ * Returns    Its bytes in the mapping (not NUL terminated), empty if the
+ *            entry points outside the path area
+ */
+PeBuffer PdbIndex::Path(uint64_t entry) const
+{
+    PeBuffer path = { NULL, 0 };
+    if (entry < entryCount && entries[entry].pathOffset <= pathSize &&
+        pathSize - entries[entry].pathOffset >= entries[entry].pathLength)
+    {
+        path.data = paths + entries[entry].pathOffset;
+        path.size = entries[entry].pathLength;
+    }
+    return path;
+}
@@ -0,0 +1,93 @@
+#ifndef _PEPDBINDEX
+#define _PEPDBINDEX
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pefile.h"
+
+#define PDB_INDEX_MAGIC      0x49504850  /* "PHPI" */
+#define PDB_INDEX_VERSION    1
+
+typedef struct
+{
+    uint32_t magic;             // PDB_INDEX_MAGIC
+    uint32_t version;           // PDB_INDEX_VERSION
+    uint64_t entryCount;
+    uint64_t pathSize;          // bytes in the path area, which follows the entries
+    uint64_t reserved;
+} PdbIndexHeader;
+
+/* One entry of the on-disk index, 32 bytes. Entries are sorted by GUID
+ * bytes, then age, then path.
+ */
+typedef struct
+{
+    uint8_t guid[16];           // as stored in the RSDS record
+    uint32_t age;
+    uint32_t pathLength;
+    uint64_t pathOffset;        // from the start of the path area
+} PdbIndexEntry;
+
+/* Collects the PDB identity of every binary in a batch scan. Shards have
+ * their own locks so batch workers can add binaries concurrently.
+ */
+class PdbIndexBuilder
+{
+public:
+    PdbIndexBuilder() {}
+
+    void Add(const uint8_t guid[16], uint32_t age, const char *path);
+    bool Write(const char *path, uint64_t *entries);
+
+    PdbIndexBuilder(const PdbIndexBuilder &) = delete;
+    PdbIndexBuilder &operator=(const PdbIndexBuilder &) = delete;
+
+private:
+    enum { SHARD_COUNT = 64 };
+
+    struct Pending
+    {
+        PdbIndexEntry entry;
+        std::string path;
+    };
+
+    struct Shard
+    {
+        std::mutex lock;
+        std::vector<Pending> entries;
+    };
+
+    Shard shards[SHARD_COUNT];
+};
+
+/* A written index, mapped read-only. A lookup is a binary search over the
+ * entries in place, so no part of the index is read up front.
+ */
+class PdbIndex
+{
+public:
+    PdbIndex();
+    ~PdbIndex();
+
+    bool Open(const char *path);
+    uint64_t Find(const uint8_t guid[16], uint32_t age, uint64_t *first) const;
+    PeBuffer Path(uint64_t entry) const;
+
+    PdbIndex(const PdbIndex &) = delete;
+    PdbIndex &operator=(const PdbIndex &) = delete;
+
+private:
+    PeFile file;
+    bool loaded;
+    const PdbIndexEntry *entries;
+    uint64_t entryCount;
+    const uint8_t *paths;
+    uint64_t pathSize;
+};
+
+#endif // _PEPDBINDEX
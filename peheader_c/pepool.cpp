@@ -0,0 +1,181 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pepool.cpp
+//  Author:     Mark Coppa
+//
+//  Work-stealing thread pool used by the batch scanner.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pepool.h"
+
+/* Index of the pool worker running on this thread, or -1 for outside threads */
+static thread_local int currentWorker = -1;
+static thread_local const ThreadPool *currentPool = NULL;
+
+
+/* DefaultThreads    Number of workers to use when the caller doesn't say
+ * Returns           One per hardware thread, at least one
+ */
+unsigned ThreadPool::DefaultThreads()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+
+ThreadPool::ThreadPool(unsigned threads)
+    : queues(threads == 0 ? DefaultThreads() : threads),
+      queued(0),
+      pending(0),
+      sleepers(0),
+      nextQueue(0),
+      stopping(false)
+{
+    for (unsigned i = 0; i < queues.size(); ++i)
+    {
+        workers.push_back(std::thread(&ThreadPool::WorkerMain, this, i));
+    }
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    Wait();
+
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i].join();
+    }
+}
+
+
+/* Submit        Queue a task. Tasks submitted from a worker go on that
+ *               worker's own deque; others are spread round robin.
+ * Parameters    The task to run
+ */
+void ThreadPool::Submit(PoolTask task)
+{
+    unsigned index;
+    if (currentPool == this)
+    {
+        index = (unsigned)currentWorker;
+    }
+    else
+    {
+        index = nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    }
+
+    pending.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> guard(queues[index].lock);
+        queues[index].tasks.push_back(std::move(task));
+    }
+    queued.fetch_add(1);
+
+    /* Pairs with the sleepers increment in WorkerMain; whichever side
+     * moves second sees the other and the wakeup can't be lost */
+    if (sleepers.load() > 0)
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        wake.notify_one();
+    }
+}
+
+
+/* Wait    Block until every submitted task, including tasks submitted by
+ *         other tasks, has finished
+ */
+void ThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> guard(sleepLock);
+    idle.wait(guard, [this] { return pending.load() == 0; });
+}
+
+
+/* PopLocal      Take the newest task from a worker's own deque
+ * Parameters    Worker index, task to fill
+ * Returns       true if a task was taken
+ */
+bool ThreadPool::PopLocal(unsigned index, PoolTask *task)
+{
+    WorkQueue &queue = queues[index];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty())
+    {
+        return false;
+    }
+
+    *task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+
+/* Steal         Take the oldest task from some other worker's deque
+ * Parameters    Index of the thief, task to fill
+ * Returns       true if a task was taken
+ */
+bool ThreadPool::Steal(unsigned index, PoolTask *task)
+{
+    size_t count = queues.size();
+    for (size_t i = 1; i < count; ++i)
+    {
+        WorkQueue &queue = queues[(index + i) % count];
+        std::unique_lock<std::mutex> guard(queue.lock, std::try_to_lock);
+        if (!guard.owns_lock() || queue.tasks.empty())
+        {
+            continue;
+        }
+
+        *task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    return false;
+}
+
+
+void ThreadPool::WorkerMain(unsigned index)
+{
+    currentWorker = (int)index;
+    currentPool = this;
+
+    PoolTask task;
+    for (;;)
+    {
+        if (PopLocal(index, &task) || Steal(index, &task))
+        {
+            queued.fetch_sub(1);
+            task(index);
+            task = nullptr;
+
+            if (pending.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> guard(sleepLock);
+                idle.notify_all();
+            }
+            continue;
+        }
+
+        /* A failed try_lock in Steal can miss work, so only sleep once
+         * nothing is queued anywhere */
+        std::unique_lock<std::mutex> guard(sleepLock);
+        sleepers.fetch_add(1);
+        wake.wait(guard, [this] { return stopping || queued.load() > 0; });
+        sleepers.fetch_sub(1);
+
+        if (stopping && queued.load() == 0)
+        {
+            return;
+        }
+    }
+}
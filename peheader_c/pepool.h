@@ -0,0 +1,62 @@
+#ifndef _PEPOOL
+#define _PEPOOL
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define POOL_MAX_THREADS  1024    /* Most workers the command line will ask for */
+
+/* A task receives the index of the worker running it, which callers use to
+ * pick per-thread state (output buffers, arenas) without locking.
+ */
+typedef std::function<void(unsigned worker)> PoolTask;
+
+/* Fixed size work-stealing thread pool. Each worker owns a deque: it pushes
+ * and pops its own tasks LIFO for locality, and idle workers steal the
+ * oldest task from the front of a victim's deque. Tasks may submit more
+ * tasks (a directory task submits its files and subdirectories).
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+
+    unsigned Size() const { return (unsigned)workers.size(); }
+
+    void Submit(PoolTask task);
+    void Wait();
+
+    static unsigned DefaultThreads();
+
+private:
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<PoolTask> tasks;
+    };
+
+    void WorkerMain(unsigned index);
+    bool PopLocal(unsigned index, PoolTask *task);
+    bool Steal(unsigned index, PoolTask *task);
+
+    std::vector<std::thread> workers;
+    std::vector<WorkQueue> queues;
+
+    std::atomic<size_t> queued;     // tasks sitting in some deque
+    std::atomic<size_t> pending;    // tasks submitted but not yet finished
+    std::atomic<unsigned> sleepers;
+    std::atomic<unsigned> nextQueue;
+    bool stopping;
+
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+};
+
+#endif // _PEPOOL
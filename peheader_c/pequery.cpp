@@ -0,0 +1,244 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pequery.cpp
+//  Author:     Mark Coppa
+//
+//  Filters over files: parse only the facts the conditions depend on and
+//  check them cheapest first, so most files are rejected after a few
+//  header reads.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pequery.h"
+#include "peexports.h"
+#include "pesymbols.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    const char *name;
+    uint16_t machine;
+} MachineName;
+
+static const MachineName machineNames[] =
+{
+    { "i386", 0x14c },
+    { "x86", 0x14c },
+    { "x64", 0x8664 },
+    { "amd64", 0x8664 },
+    { "arm", 0x1c4 },
+    { "arm64", 0xaa64 },
+    { "ia64", 0x200 },
+};
+
+
+/* InitFilter    Start with no conditions
+ */
+void InitFilter(PeFilter *filter)
+{
+    filter->managed = -1;
+    filter->pe32Plus = -1;
+    filter->machine = 0;
+    filter->importCount = 0;
+    filter->exportCount = 0;
+    filter->defineCount = 0;
+}
+
+
+/* AddFilterTerm    Add one condition
+ * Parameters       Filter, condition: managed, native, pe32, pe32+,
+ *                  machine=<name or hex value>, imports=<dll>,
+ *                  exports=<name> or defines=<symbol>
+ * Returns          FILTER_ADDED, FILTER_UNKNOWN if the condition isn't
+ *                  understood, or FILTER_TOO_MANY
+ */
+FilterTermResult AddFilterTerm(PeFilter *filter, const char *term)
+{
+    if (strcmp(term, "managed") == 0 || strcmp(term, "native") == 0)
+    {
+        filter->managed = term[0] == 'm';
+        return FILTER_ADDED;
+    }
+    if (strcmp(term, "pe32") == 0 || strcmp(term, "pe32+") == 0)
+    {
+        filter->pe32Plus = term[4] == '+';
+        return FILTER_ADDED;
+    }
+
+    if (strncmp(term, "machine=", 8) == 0)
+    {
+        const char *value = term + 8;
+        for (size_t i = 0; i < sizeof(machineNames) / sizeof(machineNames[0]); ++i)
+        {
+            if (strcmp(value, machineNames[i].name) == 0)
+            {
+                filter->machine = machineNames[i].machine;
+                return FILTER_ADDED;
+            }
+        }
+
+        char *end;
+        unsigned long machine = strtoul(value, &end, 16);
+        if (*value == '\0' || *end != '\0' || machine == 0 || machine > 0xFFFF)
+        {
+            return FILTER_UNKNOWN;
+        }
+        filter->machine = (uint16_t)machine;
+        return FILTER_ADDED;
+    }
+
+    if (strncmp(term, "imports=", 8) == 0 && term[8] != '\0')
+    {
+        if (filter->importCount == MAX_FILTER_IMPORTS)
+        {
+            return FILTER_TOO_MANY;
+        }
+        filter->importsFrom[filter->importCount++] = term + 8;
+        return FILTER_ADDED;
+    }
+    if (strncmp(term, "exports=", 8) == 0 && term[8] != '\0')
+    {
+        if (filter->exportCount == MAX_FILTER_EXPORTS)
+        {
+            return FILTER_TOO_MANY;
+        }
+        filter->exportsNamed[filter->exportCount++] = term + 8;
+        return FILTER_ADDED;
+    }
+    if (strncmp(term, "defines=", 8) == 0 && term[8] != '\0')
+    {
+        if (filter->defineCount == MAX_FILTER_DEFINES)
+        {
+            return FILTER_TOO_MANY;
+        }
+        filter->defines[filter->defineCount++] = term + 8;
+        return FILTER_ADDED;
+    }
+
+    return FILTER_UNKNOWN;
+}
+
+
+/* IsFilterSet    Check whether a filter has any condition
+ */
+bool IsFilterSet(const PeFilter *filter)
+{
+    return filter->managed >= 0 || filter->pe32Plus >= 0 || filter->machine != 0 || filter->importCount > 0 ||
+           filter->exportCount > 0 || filter->defineCount > 0;
+}
+
+
+/* FilterFacts    The FACT_* a parse needs for MatchesFilter
+ */
+uint32_t FilterFacts(const PeFilter *filter)
+{
+    uint32_t facts = FACT_KIND;
+
+    if (filter->machine != 0 || filter->defineCount > 0)
+    {
+        facts |= FACT_MACHINE;
+    }
+    if (filter->managed >= 0 || filter->pe32Plus >= 0)
+    {
+        facts |= FACT_MANAGED;
+    }
+    if (filter->importCount > 0 || filter->exportCount > 0)
+    {
+        facts |= FACT_SECTIONS;
+    }
+
+    return facts;
+}
+
+
+/* DefinesSymbol    Check whether a symbol table defines an external
+ *                  symbol, strongly or as a common block
+ */
+static bool DefinesSymbol(const SymbolTable *symbols, const char *name)
+{
+    uint32_t i = FindSymbol(symbols, name);
+
+    return i != NO_SYMBOL && symbols->storageClasses[i] == SYMBOL_CLASS_EXTERNAL &&
+           (symbols->sections[i] != SYMBOL_UNDEFINED || symbols->values[i] != 0);
+}
+
+
+/* MatchesFilter    Check a file against a filter
+ * Parameters       Image parsed with at least FilterFacts(filter), the
+ *                  buffer it was parsed from, filter
+ * Returns          true if every condition holds
+ */
+bool MatchesFilter(const PeImage *image, PeBuffer buffer, const PeFilter *filter)
+{
+    bool isImage = image->isPE && !image->isCOFF;
+
+    if (filter->machine != 0 && (!(image->isPE || image->isCOFF) || image->cfh.Machine != filter->machine))
+    {
+        return false;
+    }
+    if (filter->managed >= 0 && (!isImage || image->isManaged != (filter->managed != 0)))
+    {
+        return false;
+    }
+    if (filter->pe32Plus >= 0 && (!isImage || image->isPE32Plus != (filter->pe32Plus != 0)))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < filter->importCount; ++i)
+    {
+        if (!isImage || !ImportsModule(image, buffer, filter->importsFrom[i]))
+        {
+            return false;
+        }
+    }
+
+    /* An export table that was decoded anyway is searched in memory;
+     * otherwise the name pointer table is searched in the file */
+    for (uint32_t i = 0; i < filter->exportCount; ++i)
+    {
+        if (!isImage)
+        {
+            return false;
+        }
+        uint32_t found = (image->decoded & PARSE_EXPORTS) ? FindExport(image, filter->exportsNamed[i])
+                                                          : FindExport(image, buffer, filter->exportsNamed[i]);
+        if (found == NO_EXPORT)
+        {
+            return false;
+        }
+    }
+
+    if (filter->defineCount == 0)
+    {
+        return true;
+    }
+    if (!(image->isPE || image->isCOFF))
+    {
+        return false;
+    }
+
+    /* Symbols are decoded last, and only for files every other condition
+     * let through, unless the parse decoded them anyway */
+    PeImage scratch = PeImage();
+    const SymbolTable *symbols = &image->symbols;
+    if (!(image->decoded & PARSE_SYMBOLS))
+    {
+        scratch.cfh = image->cfh;
+        DecodeSymbols(buffer, &scratch, NULL);
+        symbols = &scratch.symbols;
+    }
+
+    for (uint32_t i = 0; i < filter->defineCount; ++i)
+    {
+        if (!DefinesSymbol(symbols, filter->defines[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef _PEQUERY
+#define _PEQUERY
+
+#include <stdint.h>
+
+#include "peheader.h"
+
+#define MAX_FILTER_IMPORTS 8
+#define MAX_FILTER_EXPORTS 8
+#define MAX_FILTER_DEFINES 8
+
+/* What AddFilterTerm made of a condition */
+typedef enum
+{
+    FILTER_ADDED,           // the condition was added
+    FILTER_UNKNOWN,         // not a condition
+    FILTER_TOO_MANY         // an imports=, exports= or defines= past its MAX_FILTER_* limit
+} FilterTermResult;
+
+/* Conditions a file has to meet, all of them. Conditions on the optional
+ * header, imports or exports only hold for PE images; machine and defines
+ * also match COFF objects. Strings are borrowed from the caller.
+ */
+typedef struct
+{
+    int managed;                                // 1 managed only, 0 native only, -1 either
+    int pe32Plus;                               // 1 PE32+ only, 0 PE32 only, -1 either
+    uint16_t machine;                           // COFF machine, 0 for any
+    uint32_t importCount;
+    const char *importsFrom[MAX_FILTER_IMPORTS];    // DLLs that must all be imported from
+    uint32_t exportCount;
+    const char *exportsNamed[MAX_FILTER_EXPORTS];   // names that must all be exported (case sensitive)
+    uint32_t defineCount;
+    const char *defines[MAX_FILTER_DEFINES];        // external symbols the symbol table must all define
+} PeFilter;
+
+void InitFilter(PeFilter *filter);
+FilterTermResult AddFilterTerm(PeFilter *filter, const char *term);
+bool IsFilterSet(const PeFilter *filter);
+uint32_t FilterFacts(const PeFilter *filter);
+bool MatchesFilter(const PeImage *image, PeBuffer buffer, const PeFilter *filter);
+
+#endif // _PEQUERY
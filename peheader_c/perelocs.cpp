@@ -0,0 +1,335 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       perelocs.cpp
+//  Author:     Mark Coppa
+//
+//  Base relocation decoder and rebase. The directory is a run of blocks,
+//  one per 4K page, each a page RVA followed by 16 bit entries holding a
+//  type in the top 4 bits and an offset into the page in the rest. Every
+//  entry of a block decodes the same way, so blocks are decoded 8 or 16
+//  entries at a time; the kernel is picked from the CPU at first use.
+//
+//  A rebase applies the relocations to a copy of the file, the way the
+//  loader would for a different base, so a memory capture taken at an
+//  ASLR base can be brought back to the preferred base (or both to any
+//  common base) before hashing.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "peheader.h"
+#include "pedigest.h"
+#include "pesimd.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+/* Decodes count entries of a block into out; returns true if any was
+ * REL_BASED_ABSOLUTE padding */
+typedef bool (*DecodeBlockFn)(const uint8_t *entries, uint32_t count, uint32_t page, BaseRelocation *out);
+
+
+/* DecodeBlockScalar    One entry at a time
+ */
+static bool DecodeBlockScalar(const uint8_t *entries, uint32_t count, uint32_t page, BaseRelocation *out)
+{
+    bool absolute = false;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t e = entries[i * 2] | (entries[i * 2 + 1] << 8);
+        out[i].rva = page + (e & 0xFFF);
+        out[i].type = e >> 12;
+        absolute = absolute || out[i].type == REL_BASED_ABSOLUTE;
+    }
+    return absolute;
+}
+
+
+#ifdef SIMD_X86
+
+/* DecodeBlockSse2    8 entries per step: widen to 32 bit lanes, split
+ *                    offset and type, and interleave them into
+ *                    (rva, type) pairs
+ */
+TARGET_SSE2
+static bool DecodeBlockSse2(const uint8_t *entries, uint32_t count, uint32_t page, BaseRelocation *out)
+{
+    const __m128i offsetMask = _mm_set1_epi32(0xFFF);
+    const __m128i base = _mm_set1_epi32((int)page);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i absolute = zero;
+    uint32_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i e = _mm_loadu_si128((const __m128i *)(entries + i * 2));
+        __m128i halves[2] = { _mm_unpacklo_epi16(e, zero), _mm_unpackhi_epi16(e, zero) };
+
+        for (int h = 0; h < 2; ++h)
+        {
+            __m128i rva = _mm_add_epi32(_mm_and_si128(halves[h], offsetMask), base);
+            __m128i type = _mm_srli_epi32(halves[h], 12);
+            absolute = _mm_or_si128(absolute, _mm_cmpeq_epi32(type, zero));
+
+            _mm_storeu_si128((__m128i *)(out + i + h * 4), _mm_unpacklo_epi32(rva, type));
+            _mm_storeu_si128((__m128i *)(out + i + h * 4 + 2), _mm_unpackhi_epi32(rva, type));
+        }
+    }
+
+    bool tail = DecodeBlockScalar(entries + i * 2, count - i, page, out + i);
+    return _mm_movemask_epi8(absolute) != 0 || tail;
+}
+
+
+/* DecodeBlockAvx2    DecodeBlockSse2 with 16 entries per step
+ */
+TARGET_AVX2
+static bool DecodeBlockAvx2(const uint8_t *entries, uint32_t count, uint32_t page, BaseRelocation *out)
+{
+    const __m256i offsetMask = _mm256_set1_epi32(0xFFF);
+    const __m256i base = _mm256_set1_epi32((int)page);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i absolute = zero;
+    uint32_t i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        for (int h = 0; h < 2; ++h)
+        {
+            __m128i e = _mm_loadu_si128((const __m128i *)(entries + (i + h * 8) * 2));
+            __m256i wide = _mm256_cvtepu16_epi32(e);
+            __m256i rva = _mm256_add_epi32(_mm256_and_si256(wide, offsetMask), base);
+            __m256i type = _mm256_srli_epi32(wide, 12);
+            absolute = _mm256_or_si256(absolute, _mm256_cmpeq_epi32(type, zero));
+
+            /* unpack works within 128 bit lanes; put the pairs back in order */
+            __m256i low = _mm256_unpacklo_epi32(rva, type);
+            __m256i high = _mm256_unpackhi_epi32(rva, type);
+            _mm256_storeu_si256((__m256i *)(out + i + h * 8), _mm256_permute2x128_si256(low, high, 0x20));
+            _mm256_storeu_si256((__m256i *)(out + i + h * 8 + 4), _mm256_permute2x128_si256(low, high, 0x31));
+        }
+    }
+
+    bool tail = DecodeBlockScalar(entries + i * 2, count - i, page, out + i);
+    return _mm256_movemask_epi8(absolute) != 0 || tail;
+}
+
+#endif // SIMD_X86
+
+
+typedef struct
+{
+    DecodeBlockFn decode;
+    const char *name;
+} RelocationKernel;
+
+/* PickKernel    Choose the widest kernel the CPU runs, once
+ */
+static const RelocationKernel &PickKernel()
+{
+    static const RelocationKernel kernel = []() {
+#ifdef SIMD_X86
+        if (CpuHasAvx2())
+        {
+            return RelocationKernel{ DecodeBlockAvx2, "avx2" };
+        }
+#ifdef SIMD_SSE2
+        return RelocationKernel{ DecodeBlockSse2, "sse2" };
+#endif
+#endif
+        return RelocationKernel{ DecodeBlockScalar, "scalar" };
+    }();
+    return kernel;
+}
+
+
+/* DecodeRelocations    Decode the base relocation directory into
+ *                      image->relocations
+ * Parameters           The buffer the image was parsed from, the image
+ * Returns              false if the image has no readable relocation
+ *                      directory
+ */
+bool DecodeRelocations(PeBuffer buffer, PeImage *image)
+{
+    RelocationTable *relocs = &image->relocations;
+    uint32_t rva = image->odd.BaseRelocationTable.VirtualAddress;
+    uint32_t size = image->odd.BaseRelocationTable.Size;
+    uint32_t offset;
+    uint32_t available;
+
+    if (rva == 0 || size == 0 || !RvaToOffset(image, rva, &offset, &available) || offset >= buffer.size)
+    {
+        return false;
+    }
+    if (available > buffer.size - offset)
+    {
+        available = (uint32_t)(buffer.size - offset);
+    }
+    if (size > available)
+    {
+        size = available;
+        relocs->truncated = true;
+    }
+
+    DecodeBlockFn decode = PickKernel().decode;
+    const uint8_t *p = buffer.data + offset;
+    relocs->entries.reserve(std::min<size_t>(size / 2, MAX_BASE_RELOCS));
+
+    for (uint32_t at = 0; size - at >= BASE_RELOC_BLOCK_HEADER_SIZE; )
+    {
+        uint32_t page = ReadDword(p + at);
+        uint32_t blockSize = ReadDword(p + at + 4);
+        if (blockSize < BASE_RELOC_BLOCK_HEADER_SIZE)
+        {
+            break;      // some linkers end the directory with an empty block
+        }
+
+        bool last = false;
+        if (blockSize > size - at)
+        {
+            blockSize = size - at;
+            relocs->truncated = true;
+            last = true;
+        }
+
+        uint32_t count = (blockSize - BASE_RELOC_BLOCK_HEADER_SIZE) / 2;
+        size_t first = relocs->entries.size();
+        if (count > MAX_BASE_RELOCS - first)
+        {
+            count = (uint32_t)(MAX_BASE_RELOCS - first);
+            relocs->truncated = true;
+            last = true;
+        }
+
+        relocs->entries.resize(first + count);
+        if (decode(p + at + BASE_RELOC_BLOCK_HEADER_SIZE, count, page, relocs->entries.data() + first))
+        {
+            /* Drop the padding that keeps blocks 4 byte aligned */
+            std::vector<BaseRelocation>::iterator end =
+                std::remove_if(relocs->entries.begin() + first, relocs->entries.end(),
+                               [](const BaseRelocation &r) { return r.type == REL_BASED_ABSOLUTE; });
+            relocs->entries.erase(end, relocs->entries.end());
+        }
+
+        ++relocs->blockCount;
+        if (last)
+        {
+            break;
+        }
+        at += blockSize;
+    }
+
+    return true;
+}
+
+
+/* RebaseImage    Apply decoded relocations to a copy of the file
+ * Parameters     Image decoded with PARSE_RELOCS, writable copy of the
+ *                file it was parsed from and its size, new image base,
+ *                where to count relocations that could not be applied
+ * Returns        Number of relocations applied
+ *
+ * The copy's ImageBase field is set to the new base as well, as the
+ * loader does for the mapped image. HIGHADJ and the architecture specific
+ * types are counted as unsupported.
+ */
+uint32_t RebaseImage(const PeImage *image, uint8_t *copy, size_t size, uint64_t newBase, uint32_t *unsupported)
+{
+    const std::vector<BaseRelocation> &entries = image->relocations.entries;
+    uint64_t delta = newBase - image->owh.ImageBase;
+    uint32_t applied = 0;
+    uint32_t skipped = 0;
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        uint32_t type = entries[i].type;
+        uint32_t width = type == REL_BASED_DIR64 ? 8 : type == REL_BASED_HIGHLOW ? 4 :
+                         type == REL_BASED_HIGH || type == REL_BASED_LOW ? 2 : 0;
+        uint32_t offset;
+        uint32_t available;
+
+        if (width == 0 || !RvaToOffset(image, entries[i].rva, &offset, &available) || available < width ||
+            offset > size || size - offset < width)
+        {
+            ++skipped;
+            continue;
+        }
+
+        uint8_t *p = copy + offset;
+        uint64_t value = 0;
+        for (uint32_t b = 0; b < width; ++b)
+        {
+            value |= (uint64_t)p[b] << (8 * b);
+        }
+
+        switch (type)
+        {
+        case REL_BASED_HIGH:
+            value = (((value << 16) + (uint32_t)delta) >> 16) & 0xFFFF;
+            break;
+        case REL_BASED_LOW:
+            value = (value + delta) & 0xFFFF;
+            break;
+        default:
+            value += delta;
+            break;
+        }
+
+        for (uint32_t b = 0; b < width; ++b)
+        {
+            p[b] = (uint8_t)(value >> (8 * b));
+        }
+        ++applied;
+    }
+
+    /* ImageBase sits 24 bytes into a PE32+ optional header, 28 into PE32 */
+    if (size >= PE_OFFSET_LOCATION + 4)
+    {
+        uint64_t field = (uint64_t)ReadDword(copy + PE_OFFSET_LOCATION) + 4 + COFF_FILE_HEADER_SIZE +
+                         (image->isPE32Plus ? 24 : 28);
+        uint32_t width = image->isPE32Plus ? 8 : 4;
+        if (field <= size && size - field >= width)
+        {
+            for (uint32_t b = 0; b < width; ++b)
+            {
+                copy[field + b] = (uint8_t)(newBase >> (8 * b));
+            }
+        }
+    }
+
+    if (unsupported != NULL)
+    {
+        *unsupported = skipped;
+    }
+    return applied;
+}
+
+
+/* DecodeRebase    Rebase a copy of the file and hash the result
+ * Parameters      The whole file, image (with its relocations decoded if
+ *                 it has any), new image base
+ * Returns         true once image->relocations holds the outcome
+ */
+bool DecodeRebase(PeBuffer buffer, PeImage *image, uint64_t newBase)
+{
+    RelocationTable *relocs = &image->relocations;
+    std::vector<uint8_t> copy(buffer.data, buffer.data + buffer.size);
+
+    relocs->rebasedTo = newBase;
+    relocs->rebasedCount = RebaseImage(image, copy.data(), copy.size(), newBase, &relocs->unsupported);
+
+    Md5Context md5;
+    Md5Init(&md5);
+    Md5Update(&md5, copy.data(), copy.size());
+    Md5Final(&md5, relocs->rebasedMd5);
+    return true;
+}
+
+
+/* RelocationKernelName    Name of the kernel in use, for reports
+ */
+const char *RelocationKernelName()
+{
+    return PickKernel().name;
+}
@@ -0,0 +1,48 @@
+#ifndef _PERELOCS
+#define _PERELOCS
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "pefile.h"
+
+#define BASE_RELOC_BLOCK_HEADER_SIZE 8
+#define MAX_BASE_RELOCS              0x1000000  /* Stop decoding after this many entries */
+
+/* IMAGE_REL_BASED_* types the rebase applies */
+#define REL_BASED_ABSOLUTE           0          /* padding, left out of the decoded table */
+#define REL_BASED_HIGH               1
+#define REL_BASED_LOW                2
+#define REL_BASED_HIGHLOW            3
+#define REL_BASED_DIR64              10
+
+typedef struct
+{
+    uint32_t rva;               // address of the field to fix up
+    uint32_t type;              // IMAGE_REL_BASED_*
+} BaseRelocation;
+
+/* The decoded base relocation directory, and the outcome of a rebase when
+ * one was asked for.
+ */
+typedef struct
+{
+    std::vector<BaseRelocation> entries;    // in file order
+    uint32_t blockCount;
+    bool truncated;             // a block ran past the directory or the file data
+    uint64_t rebasedTo;         // PARSE_REBASE: the new image base
+    uint32_t rebasedCount;      // relocations applied
+    uint32_t unsupported;       // relocations of types the rebase doesn't apply
+    uint8_t rebasedMd5[16];     // MD5 of the whole file after rebasing
+} RelocationTable;
+
+struct PeImage;
+
+bool DecodeRelocations(PeBuffer buffer, PeImage *image);
+uint32_t RebaseImage(const PeImage *image, uint8_t *copy, size_t size, uint64_t newBase, uint32_t *unsupported = NULL);
+bool DecodeRebase(PeBuffer buffer, PeImage *image, uint64_t newBase);
+const char *RelocationKernelName();
+
+#endif // _PERELOCS
@@ -0,0 +1,409 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       peresource.cpp
+//  Author:     Mark Coppa
+//
+//  Resource directory walker and VS_VERSIONINFO decoder. The tree has
+//  three levels (type, name, language); iterators read one directory at a
+//  time straight from the file and allocate nothing. Id entries are sorted
+//  within a directory, so a known type such as RT_VERSION is found by
+//  binary search without visiting the rest of the tree.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "peheader.h"
+
+#include <string.h>
+
+#define VERSION_BLOCK_HEADER_SIZE 6     /* wLength, wValueLength, wType */
+
+
+/* OpenResourceTree    Find the resource section's bytes
+ * Parameters          Parsed image, the buffer it was parsed from, tree to fill
+ * Returns             false if the image has no readable resource directory
+ *
+ * Directory offsets are relative to the root, so the tree runs from there
+ * to the end of the file-backed data around it.
+ */
+bool OpenResourceTree(const PeImage *image, PeBuffer buffer, PeBuffer *tree)
+{
+    uint32_t rva = image->odd.ResourceTable.VirtualAddress;
+    uint32_t offset;
+    uint32_t available;
+
+    if (rva == 0 || image->odd.ResourceTable.Size == 0 ||
+        !RvaToOffset(image, rva, &offset, &available) || offset >= buffer.size)
+    {
+        return false;
+    }
+    if (available > buffer.size - offset)
+    {
+        available = (uint32_t)(buffer.size - offset);
+    }
+
+    tree->data = buffer.data + offset;
+    tree->size = available;
+    return available >= RESOURCE_DIRECTORY_SIZE;
+}
+
+
+/* OpenResourceDirectory    Start walking a directory
+ * Parameters               Tree, offset of the directory (0 for the root),
+ *                          iterator to initialize
+ * Returns                  false if the directory header is outside the tree
+ */
+bool OpenResourceDirectory(PeBuffer tree, uint32_t offset, ResourceIterator *it)
+{
+    it->tree = tree;
+    it->offset = offset + RESOURCE_DIRECTORY_SIZE;
+    it->remaining = 0;
+
+    if (offset > tree.size || tree.size - offset < RESOURCE_DIRECTORY_SIZE)
+    {
+        return false;
+    }
+
+    const uint8_t *p = tree.data + offset;
+    uint32_t count = (uint32_t)ReadWord(p + 12) + ReadWord(p + 14);
+    size_t fits = (tree.size - it->offset) / RESOURCE_ENTRY_SIZE;
+
+    it->remaining = count < fits ? count : (uint32_t)fits;
+    return true;
+}
+
+
+/* DecodeEntry    Split the two words of a directory entry
+ */
+static void DecodeEntry(PeBuffer tree, const uint8_t *p, ResourceEntry *entry)
+{
+    uint32_t name = ReadDword(p);
+    uint32_t target = ReadDword(p + 4);
+
+    entry->id = 0;
+    entry->name.data = NULL;
+    entry->name.length = 0;
+    entry->offset = target & 0x7FFFFFFF;
+    entry->isDirectory = (target & 0x80000000) != 0;
+
+    if (!(name & 0x80000000))
+    {
+        entry->id = name;
+        return;
+    }
+
+    /* IMAGE_RESOURCE_DIR_STRING_U: a length, then that many UTF-16 units */
+    uint32_t at = name & 0x7FFFFFFF;
+    if (at < tree.size && tree.size - at >= 2)
+    {
+        uint32_t length = ReadWord(tree.data + at);
+        uint32_t fits = (uint32_t)((tree.size - at - 2) / 2);
+        entry->name.data = tree.data + at + 2;
+        entry->name.length = length < fits ? length : fits;
+    }
+}
+
+
+/* NextResourceEntry    Get the next entry of a directory
+ * Returns              false when the directory has no more entries
+ */
+bool NextResourceEntry(ResourceIterator *it, ResourceEntry *entry)
+{
+    if (it->remaining == 0)
+    {
+        return false;
+    }
+
+    DecodeEntry(it->tree, it->tree.data + it->offset, entry);
+    it->offset += RESOURCE_ENTRY_SIZE;
+    --it->remaining;
+    return true;
+}
+
+
+/* FindResourceEntry    Look up an id entry of a directory
+ * Parameters           Tree, offset of the directory, id, entry to fill
+ * Returns              false if the directory has no entry with that id
+ */
+bool FindResourceEntry(PeBuffer tree, uint32_t directory, uint32_t id, ResourceEntry *entry)
+{
+    ResourceIterator it;
+    if (!OpenResourceDirectory(tree, directory, &it))
+    {
+        return false;
+    }
+
+    /* Id entries follow the named ones, in ascending order */
+    const uint8_t *p = tree.data + directory;
+    uint32_t named = ReadWord(p + 12);
+    uint32_t lo = named < it.remaining ? named : it.remaining;
+    uint32_t hi = it.remaining;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t midId = ReadDword(tree.data + it.offset + mid * RESOURCE_ENTRY_SIZE);
+        if (midId == id)
+        {
+            DecodeEntry(tree, tree.data + it.offset + mid * RESOURCE_ENTRY_SIZE, entry);
+            return true;
+        }
+        if (midId < id)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return false;
+}
+
+
+/* ReadResourceData    Find the bytes of a leaf
+ * Parameters          Parsed image, its buffer, tree, leaf entry, data to
+ *                     fill, optional code page to fill
+ * Returns             false if the leaf is a directory or its data isn't
+ *                     in the file
+ */
+bool ReadResourceData(const PeImage *image, PeBuffer buffer, PeBuffer tree, const ResourceEntry *leaf,
+                      PeBuffer *data, uint32_t *codePage)
+{
+    if (leaf->isDirectory || leaf->offset > tree.size || tree.size - leaf->offset < RESOURCE_DATA_ENTRY_SIZE)
+    {
+        return false;
+    }
+
+    /* IMAGE_RESOURCE_DATA_ENTRY: the data is located by RVA, not by offset */
+    const uint8_t *p = tree.data + leaf->offset;
+    uint32_t rva = ReadDword(p);
+    uint32_t size = ReadDword(p + 4);
+
+    const uint8_t *bytes = RvaToPointer(image, buffer, rva, size);
+    if (bytes == NULL)
+    {
+        return false;
+    }
+
+    data->data = bytes;
+    data->size = size;
+    if (codePage != NULL)
+    {
+        *codePage = ReadDword(p + 8);
+    }
+    return true;
+}
+
+
+/* A VS_VERSIONINFO node: wLength covers the header, the key, the value
+ * and the children, each part aligned to 4 bytes from the resource start.
+ */
+typedef struct
+{
+    Utf16Span key;
+    PeBuffer value;
+    uint16_t type;              // 1 for text values, whose length counts UTF-16 units
+    size_t children;            // offset of the first child
+    size_t end;                 // offset one past the node
+} VersionBlock;
+
+
+/* AlignUp4    Round an offset up to the next multiple of 4
+ */
+static inline size_t AlignUp4(size_t offset)
+{
+    return (offset + 3) & ~(size_t)3;
+}
+
+
+/* ReadVersionBlock    Decode the node at an offset
+ * Parameters          Resource bytes, offset of the node, the end of its
+ *                     parent, node to fill
+ * Returns             false if the node's header or key is unreadable
+ */
+static bool ReadVersionBlock(PeBuffer data, size_t offset, size_t limit, VersionBlock *block)
+{
+    if (offset > limit || limit - offset < VERSION_BLOCK_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    const uint8_t *p = data.data + offset;
+    size_t length = ReadWord(p);
+    size_t valueLength = ReadWord(p + 2);
+    block->type = ReadWord(p + 4);
+
+    if (length < VERSION_BLOCK_HEADER_SIZE)
+    {
+        return false;
+    }
+    block->end = length < limit - offset ? offset + length : limit;
+
+    /* The key is NUL terminated */
+    size_t at = offset + VERSION_BLOCK_HEADER_SIZE;
+    block->key.data = data.data + at;
+    block->key.length = 0;
+    while (at + 2 <= block->end && ReadWord(data.data + at) != 0)
+    {
+        at += 2;
+        ++block->key.length;
+    }
+    if (at + 2 > block->end)
+    {
+        return false;
+    }
+
+    size_t value = AlignUp4(at + 2);
+    size_t valueSize = block->type == 1 ? valueLength * 2 : valueLength;
+    if (value > block->end)
+    {
+        value = block->end;
+    }
+    if (valueSize > block->end - value)
+    {
+        valueSize = block->end - value;
+    }
+
+    block->value.data = data.data + value;
+    block->value.size = valueSize;
+    block->children = AlignUp4(value + valueSize);
+    return true;
+}
+
+
+/* KeyIs    Compare a UTF-16 key with ASCII text
+ */
+static bool KeyIs(Utf16Span key, const char *ascii)
+{
+    size_t len = strlen(ascii);
+    if (key.length != len)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (ReadWord(key.data + i * 2) != (uint8_t)ascii[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/* TextSpan    A text value as a span, without its terminator
+ */
+static Utf16Span TextSpan(PeBuffer value)
+{
+    Utf16Span span = { value.data, (uint32_t)(value.size / 2) };
+    while (span.length > 0 && ReadWord(span.data + (span.length - 1) * 2) == 0)
+    {
+        --span.length;
+    }
+    return span;
+}
+
+
+/* ParseStringTable    Collect the String children of a StringTable
+ */
+static void ParseStringTable(PeBuffer data, const VersionBlock *table, VersionInfo *info)
+{
+    VersionBlock entry;
+    for (size_t at = table->children;
+         info->strings.size() < MAX_VERSION_STRINGS && ReadVersionBlock(data, at, table->end, &entry);
+         at = AlignUp4(entry.end))
+    {
+        VersionString s = { entry.key, TextSpan(entry.value) };
+        info->strings.push_back(s);
+    }
+}
+
+
+/* ParseVersionInfo    Decode a VS_VERSIONINFO resource in place
+ * Parameters          Bytes of the resource, info to fill; its spans point
+ *                     into those bytes
+ * Returns             false if the root node is unreadable
+ *
+ * Only the first string table is kept: nearly every file has one, and
+ * the rest are translations of the same strings.
+ */
+bool ParseVersionInfo(PeBuffer data, VersionInfo *info)
+{
+    VersionBlock root;
+    if (!ReadVersionBlock(data, 0, data.size, &root))
+    {
+        return false;
+    }
+
+    const uint8_t *fixed = root.value.data;
+    info->hasFixed = root.value.size >= VS_FIXEDFILEINFO_SIZE && ReadDword(fixed) == VS_FIXEDFILEINFO_SIGNATURE;
+    if (info->hasFixed)
+    {
+        info->FileVersionMS = ReadDword(fixed + 8);
+        info->FileVersionLS = ReadDword(fixed + 12);
+        info->ProductVersionMS = ReadDword(fixed + 16);
+        info->ProductVersionLS = ReadDword(fixed + 20);
+        info->FileFlagsMask = ReadDword(fixed + 24);
+        info->FileFlags = ReadDword(fixed + 28);
+        info->FileOS = ReadDword(fixed + 32);
+        info->FileType = ReadDword(fixed + 36);
+        info->FileSubtype = ReadDword(fixed + 40);
+    }
+
+    VersionBlock child;
+    for (size_t at = root.children; ReadVersionBlock(data, at, root.end, &child); at = AlignUp4(child.end))
+    {
+        VersionBlock table;
+        if (KeyIs(child.key, "StringFileInfo") && info->strings.empty() &&
+            ReadVersionBlock(data, child.children, child.end, &table))
+        {
+            info->language = table.key;
+            ParseStringTable(data, &table, info);
+        }
+    }
+
+    return true;
+}
+
+
+/* DecodeVersionInfo    Decode the image's RT_VERSION resource into
+ *                      image->version
+ * Parameters           The buffer the image was parsed from, the image
+ * Returns              false if the image has no readable version resource
+ *
+ * Goes straight from the root to the first name and language under
+ * RT_VERSION. The resource is copied into the image's arena as it is, so
+ * the image stays independent of the buffer; strings stay UTF-16.
+ */
+bool DecodeVersionInfo(PeBuffer buffer, PeImage *image)
+{
+    PeBuffer tree;
+    ResourceEntry type;
+    ResourceEntry name;
+    ResourceEntry language;
+    ResourceIterator it;
+    PeBuffer data;
+
+    if (!OpenResourceTree(image, buffer, &tree) ||
+        !FindResourceEntry(tree, 0, RT_VERSION, &type) || !type.isDirectory ||
+        !OpenResourceDirectory(tree, type.offset, &it) || !NextResourceEntry(&it, &name) || !name.isDirectory ||
+        !OpenResourceDirectory(tree, name.offset, &it) || !NextResourceEntry(&it, &language) ||
+        !ReadResourceData(image, buffer, tree, &language, &data))
+    {
+        return false;
+    }
+
+    /* wLength is 16 bits, so nothing past 64K belongs to the root node */
+    if (data.size > 0xFFFF)
+    {
+        data.size = 0xFFFF;
+    }
+
+    uint8_t *copy = (uint8_t *)image->arena.Alloc(data.size, 4);
+    memcpy(copy, data.data, data.size);
+    data.data = copy;
+
+    return ParseVersionInfo(data, &image->version);
+}
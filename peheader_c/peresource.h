@@ -0,0 +1,86 @@
+#ifndef _PERESOURCE
+#define _PERESOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "pefile.h"
+
+#define RESOURCE_DIRECTORY_SIZE   16
+#define RESOURCE_ENTRY_SIZE       8
+#define RESOURCE_DATA_ENTRY_SIZE  16
+#define RT_VERSION                16
+#define VS_FIXEDFILEINFO_SIZE     52
+#define VS_FIXEDFILEINFO_SIGNATURE 0xFEEF04BD
+#define MAX_VERSION_STRINGS       64        /* Stop collecting StringFileInfo entries after this many */
+
+/* UTF-16LE text left where it was found; length counts code units and
+ * there is no terminator. Converted only when it is printed.
+ */
+typedef struct
+{
+    const uint8_t *data;
+    uint32_t length;
+} Utf16Span;
+
+/* One entry of a resource directory: a type, name or language, leading
+ * either to the next level's directory or to a data entry.
+ */
+typedef struct
+{
+    uint32_t id;                // numeric id, when name.data is NULL
+    Utf16Span name;             // the entry's name, for named entries
+    uint32_t offset;            // of the subdirectory or data entry, from the start of the tree
+    bool isDirectory;
+} ResourceEntry;
+
+/* Walks the entries of one resource directory, named entries first. It
+ * holds no state beyond its position, so subdirectories are only read when
+ * the caller opens them.
+ */
+typedef struct
+{
+    PeBuffer tree;              // the resource section from the root directory on
+    uint32_t offset;            // of the next entry
+    uint32_t remaining;         // entries not yet returned
+} ResourceIterator;
+
+typedef struct
+{
+    Utf16Span key;
+    Utf16Span value;
+} VersionString;
+
+/* The fixed and string file info of an RT_VERSION resource. Spans point
+ * into a copy of the resource kept in the owning image's arena.
+ */
+typedef struct
+{
+    bool hasFixed;              // VS_FIXEDFILEINFO was present and signed
+    uint32_t FileVersionMS;
+    uint32_t FileVersionLS;
+    uint32_t ProductVersionMS;
+    uint32_t ProductVersionLS;
+    uint32_t FileFlagsMask;
+    uint32_t FileFlags;
+    uint32_t FileOS;
+    uint32_t FileType;
+    uint32_t FileSubtype;
+    Utf16Span language;         // key of the string table, e.g. "040904b0"
+    std::vector<VersionString> strings;
+} VersionInfo;
+
+struct PeImage;
+
+bool OpenResourceTree(const PeImage *image, PeBuffer buffer, PeBuffer *tree);
+bool OpenResourceDirectory(PeBuffer tree, uint32_t offset, ResourceIterator *it);
+bool NextResourceEntry(ResourceIterator *it, ResourceEntry *entry);
+bool FindResourceEntry(PeBuffer tree, uint32_t directory, uint32_t id, ResourceEntry *entry);
+bool ReadResourceData(const PeImage *image, PeBuffer buffer, PeBuffer tree, const ResourceEntry *leaf,
+                      PeBuffer *data, uint32_t *codePage = NULL);
+bool ParseVersionInfo(PeBuffer data, VersionInfo *info);
+bool DecodeVersionInfo(PeBuffer buffer, PeImage *image);
+
+#endif // _PERESOURCE
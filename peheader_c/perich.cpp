@@ -0,0 +1,305 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       perich.cpp
+//  Author:     Mark Coppa
+//
+//  Rich header decoder and toolchain clustering. Microsoft linkers leave
+//  a record of the tools that built each object in the DOS stub: a masked
+//  "DanS" marker, padding and (tool, count) pairs, all XORed with a key
+//  that follows the plain "Rich" marker at the end. The key is a checksum
+//  of the stub and the entries, so tampering shows.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "peheader.h"
+#include "pedigest.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <numeric>
+
+
+/* RotateLeft    32 bit rotate, as the linker's checksum uses
+ */
+static inline uint32_t RotateLeft(uint32_t value, uint32_t bits)
+{
+    bits &= 31;
+    return bits == 0 ? value : (value << bits) | (value >> (32 - bits));
+}
+
+
+/* Toolset    The sorted distinct tools (product << 16 | build) of a header
+ */
+static std::vector<uint32_t> Toolset(const RichHeader *rich)
+{
+    std::vector<uint32_t> tools(rich->entries.size());
+    for (size_t i = 0; i < rich->entries.size(); ++i)
+    {
+        tools[i] = (uint32_t)rich->entries[i].productId << 16 | rich->entries[i].build;
+    }
+    std::sort(tools.begin(), tools.end());
+    tools.erase(std::unique(tools.begin(), tools.end()), tools.end());
+    return tools;
+}
+
+
+/* DecodeRich    Find and unmask the Rich header into image->rich
+ * Parameters    The buffer the image was parsed from, the image
+ * Returns       false if the DOS stub holds no Rich header
+ */
+bool DecodeRich(PeBuffer buffer, PeImage *image)
+{
+    if (buffer.size < PE_OFFSET_LOCATION + 4)
+    {
+        return false;
+    }
+
+    /* The header sits in the stub, between the DOS header and the PE header */
+    size_t end = ReadDword(buffer.data + PE_OFFSET_LOCATION);
+    end = std::min(end, buffer.size) & ~(size_t)3;
+
+    size_t rich = 0;
+    for (size_t at = RICH_STUB_START; at + 8 <= end; at += 4)
+    {
+        if (ReadDword(buffer.data + at) == RICH_SIGNATURE)
+        {
+            rich = at;
+            break;
+        }
+    }
+    if (rich == 0)
+    {
+        return false;
+    }
+
+    uint32_t key = ReadDword(buffer.data + rich + 4);
+    size_t dans = 0;
+    for (size_t at = rich; at >= RICH_STUB_START + 4; )
+    {
+        at -= 4;
+        if ((ReadDword(buffer.data + at) ^ key) == DANS_SIGNATURE)
+        {
+            dans = at;
+            break;
+        }
+    }
+
+    /* "DanS" is followed by three masked zero dwords */
+    if (dans == 0 || rich - dans < 16)
+    {
+        return false;
+    }
+
+    RichHeader *header = &image->rich;
+    uint32_t checksum = (uint32_t)dans;
+    for (size_t i = 0; i < dans; ++i)
+    {
+        if (i < PE_OFFSET_LOCATION || i >= PE_OFFSET_LOCATION + 4)
+        {
+            checksum += RotateLeft(buffer.data[i], (uint32_t)i);
+        }
+    }
+
+    for (size_t at = dans + 16; at + 8 <= rich && header->entries.size() < MAX_RICH_ENTRIES; at += 8)
+    {
+        uint32_t tool = ReadDword(buffer.data + at) ^ key;
+        uint32_t count = ReadDword(buffer.data + at + 4) ^ key;
+
+        RichEntry entry = { (uint16_t)(tool >> 16), (uint16_t)tool, count };
+        header->entries.push_back(entry);
+        checksum += RotateLeft(tool, count);
+    }
+
+    std::vector<uint32_t> tools = Toolset(header);
+    header->present = true;
+    header->offset = (uint32_t)dans;
+    header->key = key;
+    header->checksumValid = checksum == key;
+    header->fingerprint = HashBytes(tools.data(), tools.size() * sizeof(tools[0]));
+    return true;
+}
+
+
+/* Add           File one binary under its toolchain
+ * Parameters    Its decoded Rich header, its path
+ */
+void RichClusterIndex::Add(const RichHeader *rich, const char *path)
+{
+    if (!rich->present)
+    {
+        return;
+    }
+
+    Shard *shard = &shards[rich->fingerprint >> 58];
+    std::lock_guard<std::mutex> guard(shard->lock);
+
+    Member member = { rich->fingerprint, path };
+    shard->members.push_back(std::move(member));
+    if (shard->toolchains.find(rich->fingerprint) == shard->toolchains.end())
+    {
+        shard->toolchains[rich->fingerprint] = Toolset(rich);
+    }
+}
+
+
+/* Similarity    Jaccard similarity of two sorted tool sets
+ */
+static double Similarity(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b)
+{
+    size_t shared = 0;
+    for (size_t i = 0, j = 0; i < a.size() && j < b.size(); )
+    {
+        if (a[i] == b[j])
+        {
+            ++shared;
+            ++i;
+            ++j;
+        }
+        else if (a[i] < b[j])
+        {
+            ++i;
+        }
+        else
+        {
+            ++j;
+        }
+    }
+
+    size_t either = a.size() + b.size() - shared;
+    return either == 0 ? 1.0 : (double)shared / either;
+}
+
+
+/* FindRoot    Union-find root with path halving
+ */
+static uint32_t FindRoot(std::vector<uint32_t> &parent, uint32_t i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+
+/* Report        Cluster everything added and hand each cluster to a
+ *               callback
+ * Parameters    Callback, its context
+ * Returns       Number of clusters
+ */
+uint32_t RichClusterIndex::Report(ClusterFn report, void *context)
+{
+    /* Every fingerprint lives in one shard, so groups don't repeat */
+    std::vector<uint64_t> fingerprints;
+    std::vector<const std::vector<uint32_t> *> toolsets;
+    for (int s = 0; s < SHARD_COUNT; ++s)
+    {
+        for (std::unordered_map<uint64_t, std::vector<uint32_t> >::const_iterator it = shards[s].toolchains.begin();
+             it != shards[s].toolchains.end(); ++it)
+        {
+            fingerprints.push_back(it->first);
+        }
+    }
+    std::sort(fingerprints.begin(), fingerprints.end());
+    for (size_t g = 0; g < fingerprints.size(); ++g)
+    {
+        toolsets.push_back(&shards[fingerprints[g] >> 58].toolchains[fingerprints[g]]);
+    }
+
+    /* File each group in one bucket per band of its MinHash signature */
+    const uint32_t bands = RICH_MINHASHES / RICH_BAND_ROWS;
+    std::vector<std::pair<uint64_t, uint32_t> > buckets;
+    buckets.reserve(fingerprints.size() * bands);
+    for (uint32_t g = 0; g < fingerprints.size(); ++g)
+    {
+        uint64_t signature[RICH_MINHASHES];
+        for (uint32_t h = 0; h < RICH_MINHASHES; ++h)
+        {
+            signature[h] = UINT64_MAX;
+            for (size_t t = 0; t < toolsets[g]->size(); ++t)
+            {
+                signature[h] = std::min(signature[h], HashBytes(&(*toolsets[g])[t], sizeof(uint32_t), h + 1));
+            }
+        }
+        for (uint32_t b = 0; b < bands; ++b)
+        {
+            buckets.push_back(std::make_pair(HashBytes(signature + b * RICH_BAND_ROWS,
+                                                       RICH_BAND_ROWS * sizeof(uint64_t), b), g));
+        }
+    }
+    std::sort(buckets.begin(), buckets.end());
+
+    /* Groups sharing a bucket are candidates; join the ones that are
+     * near-identical to the first group of the bucket */
+    std::vector<uint32_t> parent(fingerprints.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    for (size_t start = 0, next; start < buckets.size(); start = next)
+    {
+        for (next = start + 1; next < buckets.size() && buckets[next].first == buckets[start].first; ++next)
+        {
+            uint32_t a = buckets[start].second;
+            uint32_t b = buckets[next].second;
+            if (FindRoot(parent, a) != FindRoot(parent, b) &&
+                Similarity(*toolsets[a], *toolsets[b]) >= RICH_CLUSTER_SIMILARITY)
+            {
+                parent[FindRoot(parent, b)] = FindRoot(parent, a);
+            }
+        }
+    }
+
+    /* Collect members by cluster */
+    std::vector<const Member *> members;
+    for (int s = 0; s < SHARD_COUNT; ++s)
+    {
+        for (size_t m = 0; m < shards[s].members.size(); ++m)
+        {
+            members.push_back(&shards[s].members[m]);
+        }
+    }
+    std::sort(members.begin(), members.end(), [](const Member *a, const Member *b) {
+        return a->fingerprint != b->fingerprint ? a->fingerprint < b->fingerprint : a->path < b->path;
+    });
+
+    std::vector<uint32_t> clusterOf(members.size());
+    std::vector<uint32_t> sizes(fingerprints.size(), 0);
+    for (size_t m = 0; m < members.size(); ++m)
+    {
+        size_t g = std::lower_bound(fingerprints.begin(), fingerprints.end(), members[m]->fingerprint) -
+                   fingerprints.begin();
+        clusterOf[m] = FindRoot(parent, (uint32_t)g);
+        ++sizes[clusterOf[m]];
+    }
+
+    std::vector<uint32_t> order(members.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        uint32_t ca = clusterOf[a];
+        uint32_t cb = clusterOf[b];
+        return sizes[ca] != sizes[cb] ? sizes[ca] > sizes[cb] : ca < cb;
+    });
+
+    uint32_t clusters = 0;
+    std::vector<const char *> paths;
+    std::vector<uint64_t> prints;
+    for (size_t start = 0, next; start < order.size(); start = next)
+    {
+        paths.clear();
+        prints.clear();
+        for (next = start; next < order.size() && clusterOf[order[next]] == clusterOf[order[start]]; ++next)
+        {
+            paths.push_back(members[order[next]]->path.c_str());
+            prints.push_back(members[order[next]]->fingerprint);
+        }
+
+        ++clusters;
+        if (report != NULL)
+        {
+            report(context, clusters, paths.data(), prints.data(), paths.size());
+        }
+    }
+
+    return clusters;
+}
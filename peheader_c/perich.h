@@ -0,0 +1,91 @@
+#ifndef _PERICH
+#define _PERICH
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pefile.h"
+
+#define RICH_SIGNATURE          0x68636952  /* "Rich" */
+#define DANS_SIGNATURE          0x536E6144  /* "DanS" */
+#define RICH_STUB_START         0x40        /* The stub follows the DOS header */
+#define MAX_RICH_ENTRIES        0x100       /* Stop decoding after this many tool entries */
+
+#define RICH_MINHASHES          8           /* MinHash values per toolchain, taken in bands */
+#define RICH_BAND_ROWS          2
+#define RICH_CLUSTER_SIMILARITY 0.75        /* Jaccard similarity of two toolchains put in one cluster */
+
+typedef struct
+{
+    uint16_t productId;         // the tool: compiler, linker, assembler, import library, ...
+    uint16_t build;             // its build number
+    uint32_t count;             // objects it produced
+} RichEntry;
+
+/* The unmasked Rich header. The fingerprint hashes the set of tools
+ * (product and build) and ignores their counts, so rebuilding with the
+ * same toolchain keeps it.
+ */
+typedef struct
+{
+    bool present;
+    uint32_t offset;            // of the masked "DanS" in the file
+    uint32_t key;               // the XOR mask, which is also the checksum the linker computed
+    bool checksumValid;         // the key matches the checksum of the stub and entries
+    std::vector<RichEntry> entries;
+    uint64_t fingerprint;
+} RichHeader;
+
+struct PeImage;
+
+bool DecodeRich(PeBuffer buffer, PeImage *image);
+
+/* Groups binaries by toolchain across a batch scan. Binaries with the
+ * same fingerprint form one group; groups are joined when their tool sets
+ * are near-identical. Candidates are found by MinHash banding: each group
+ * is filed in a few sorted hash buckets and only groups sharing a bucket
+ * are compared, so clustering is a sort rather than a pairwise scan.
+ * Shards have their own locks so batch workers can add binaries
+ * concurrently.
+ */
+class RichClusterIndex
+{
+public:
+    RichClusterIndex() {}
+
+    void Add(const RichHeader *rich, const char *path);
+
+    /* Callback for Report: one cluster, largest first; its members are
+     * ordered by fingerprint, then path */
+    typedef void (*ClusterFn)(void *context, uint32_t cluster, const char *const *paths,
+                              const uint64_t *fingerprints, size_t count);
+    uint32_t Report(ClusterFn report, void *context);
+
+    RichClusterIndex(const RichClusterIndex &) = delete;
+    RichClusterIndex &operator=(const RichClusterIndex &) = delete;
+
+private:
+    enum { SHARD_COUNT = 64 };
+
+    struct Member
+    {
+        uint64_t fingerprint;
+        std::string path;
+    };
+
+    struct Shard
+    {
+        std::mutex lock;
+        std::vector<Member> members;
+        std::unordered_map<uint64_t, std::vector<uint32_t> > toolchains;   // fingerprint to sorted tools
+    };
+
+    Shard shards[SHARD_COUNT];
+};
+
+#endif // _PERICH
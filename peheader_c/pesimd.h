@@ -0,0 +1,75 @@
+#ifndef _PESIMD
+#define _PESIMD
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Shared pieces of the vector kernels: which instruction sets the build
+ * can target, per-function target attributes so one binary carries every
+ * kernel, and the CPU checks that pick one at run time.
+ */
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+/* SSE2 can be assumed by kernels compiled for these targets */
+#if defined(SIMD_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SIMD_SSE2 1
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE2
+#endif
+
+#ifdef SIMD_X86
+
+/* CpuHasAvx2    Check for AVX2 and OS support for the wide registers
+ */
+inline bool CpuHasAvx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // SIMD_X86
+
+
+/* LowestSetBit    Index of the lowest set bit of a non-zero mask
+ */
+inline unsigned LowestSetBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+#endif // _PESIMD
@@ -0,0 +1,323 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pesimilarity.cpp
+//  Author:     Mark Coppa
+//
+//  Similarity digests of images and their sections, for grouping builds
+//  of one product that exact hashes tell apart. The file is read once,
+//  and the triplets of each byte are hashed once for both the image and
+//  the section the byte belongs to.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pesimilarity.h"
+#include "peheader.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+/* Bytes counted into 32 bit tables before they are added into a state's
+ * counts; no counter can reach 2^32 within one chunk */
+#define SIMILARITY_CHUNK_SIZE 0x40000000
+
+
+/* Pearson permutation the triplets are hashed with */
+static const uint8_t pearson[256] =
+{
+    0x06, 0xE4, 0x45, 0x2A, 0xE8, 0xC1, 0xA3, 0x8F, 0x79, 0x1F, 0x3F, 0x5E, 0x4C, 0x49, 0xCE, 0xA8,
+    0xD8, 0x91, 0x8E, 0x9E, 0xD5, 0x31, 0x2D, 0x70, 0x30, 0xC8, 0x24, 0x02, 0x38, 0xC4, 0x86, 0xA6,
+    0x33, 0xAF, 0xCB, 0x73, 0x99, 0x0E, 0x60, 0x2C, 0xDB, 0x4F, 0xEC, 0x6E, 0xC0, 0x6D, 0xAD, 0x9A,
+    0x4E, 0x51, 0x3B, 0x16, 0x01, 0xD1, 0xE7, 0xF0, 0xB2, 0x04, 0x85, 0x57, 0x34, 0xC5, 0xCD, 0xCF,
+    0x4B, 0x5A, 0x68, 0x1B, 0x46, 0xDE, 0x9F, 0x74, 0xAE, 0x17, 0xD0, 0x21, 0x82, 0x58, 0x03, 0x9D,
+    0xC6, 0x76, 0x63, 0x4A, 0x84, 0xA5, 0x50, 0x1D, 0xBD, 0x1C, 0x2E, 0x19, 0xA2, 0x61, 0x96, 0x78,
+    0x11, 0x3C, 0x20, 0x59, 0xA4, 0x42, 0xD9, 0x7A, 0x2B, 0x22, 0xEF, 0x7B, 0x3D, 0x35, 0x39, 0x18,
+    0xF8, 0xC9, 0x37, 0xB1, 0x98, 0x4D, 0x5B, 0x62, 0x3A, 0x29, 0x8B, 0xB5, 0xE2, 0xD7, 0xE0, 0xB8,
+    0x8C, 0xFC, 0xE3, 0xA7, 0xDA, 0xB7, 0x36, 0x09, 0x67, 0x12, 0xE5, 0xE1, 0xD2, 0x87, 0x54, 0xAC,
+    0x27, 0xDD, 0x10, 0x94, 0xA9, 0x3E, 0x7F, 0x44, 0x0A, 0xBC, 0xFF, 0xEA, 0x65, 0x7C, 0x40, 0x23,
+    0xEE, 0xED, 0xB4, 0x0B, 0x5C, 0x80, 0xD4, 0x43, 0x64, 0xF7, 0xF4, 0xEB, 0x6A, 0xB3, 0x2F, 0x81,
+    0xAA, 0xFD, 0x0C, 0xB6, 0x5D, 0xBE, 0x32, 0xAB, 0x90, 0x9C, 0xF9, 0x25, 0xBF, 0xC3, 0x77, 0x5F,
+    0x07, 0x95, 0x7D, 0xE6, 0xDF, 0x13, 0xA0, 0x6C, 0xB9, 0xFE, 0x66, 0x55, 0x69, 0x28, 0x7E, 0xC2,
+    0x6B, 0x08, 0x89, 0x26, 0x88, 0xF6, 0x15, 0x9B, 0x72, 0xC7, 0xBA, 0xF5, 0xCA, 0x8A, 0xFA, 0x14,
+    0x1A, 0x0F, 0xBB, 0xF3, 0x83, 0x6F, 0xB0, 0x1E, 0xD3, 0x97, 0x56, 0x00, 0x47, 0xF1, 0xFB, 0xCC,
+    0x8D, 0x48, 0x92, 0xF2, 0x71, 0x41, 0xD6, 0x0D, 0xDC, 0x93, 0x05, 0x75, 0x53, 0xE9, 0xA1, 0x52,
+};
+
+/* Running state of one digest */
+typedef struct
+{
+    uint32_t buckets[SIMILARITY_BUCKETS];
+    uint8_t window[4];      // the previous bytes, most recent first
+    uint8_t checksum;
+    uint64_t length;
+} SimilarityState;
+
+
+/* Triplet    Pearson hash of a salt and three bytes, as a bucket
+ */
+static inline uint8_t Triplet(uint8_t salt, uint8_t a, uint8_t b, uint8_t c)
+{
+    return pearson[pearson[pearson[salt ^ a] ^ b] ^ c] & (SIMILARITY_BUCKETS - 1);
+}
+
+
+/* HashRange     Add bytes to a digest's state and, optionally, to a
+ *               section's state that has seen the same last four bytes
+ * Parameters    State, section state or NULL, bytes, their count
+ *
+ * Each of the six triplets counts into its own table, so the increments
+ * of one byte never wait on each other, and the tables are added to both
+ * states at the end: the triplets are hashed and counted once. Only the
+ * checksums run separately.
+ */
+static void HashRange(SimilarityState *state, SimilarityState *also, const uint8_t *data, size_t size)
+{
+    for (; size > SIMILARITY_CHUNK_SIZE; data += SIMILARITY_CHUNK_SIZE, size -= SIMILARITY_CHUNK_SIZE)
+    {
+        HashRange(state, also, data, SIMILARITY_CHUNK_SIZE);
+    }
+
+    uint8_t b1 = state->window[0];
+    uint8_t b2 = state->window[1];
+    uint8_t b3 = state->window[2];
+    uint8_t b4 = state->window[3];
+    uint8_t checksum = state->checksum;
+    uint8_t alsoChecksum = also != NULL ? also->checksum : 0;
+
+    /* The first four bytes only fill the window */
+    size_t i = 0;
+    for (; i < size && state->length + i < 4; ++i)
+    {
+        b4 = b3;
+        b3 = b2;
+        b2 = b1;
+        b1 = data[i];
+    }
+
+    bool counted = i < size;
+    uint32_t tables[6][SIMILARITY_BUCKETS];
+    if (counted)
+    {
+        memset(tables, 0, sizeof(tables));
+    }
+
+    for (; i < size; ++i)
+    {
+        uint8_t b0 = data[i];
+        uint8_t pair = pearson[pearson[b0] ^ b1];
+        checksum = pearson[pair ^ checksum];
+        alsoChecksum = pearson[pair ^ alsoChecksum];
+
+        ++tables[0][Triplet(2, b0, b1, b2)];
+        ++tables[1][Triplet(3, b0, b1, b3)];
+        ++tables[2][Triplet(5, b0, b2, b3)];
+        ++tables[3][Triplet(7, b0, b2, b4)];
+        ++tables[4][Triplet(11, b0, b1, b4)];
+        ++tables[5][Triplet(13, b0, b3, b4)];
+
+        b4 = b3;
+        b3 = b2;
+        b2 = b1;
+        b1 = b0;
+    }
+
+    if (counted)
+    {
+        for (uint32_t b = 0; b < SIMILARITY_BUCKETS; ++b)
+        {
+            uint32_t count = tables[0][b] + tables[1][b] + tables[2][b] + tables[3][b] + tables[4][b] + tables[5][b];
+            state->buckets[b] += count;
+            if (also != NULL)
+            {
+                also->buckets[b] += count;
+            }
+        }
+    }
+
+    state->window[0] = b1;
+    state->window[1] = b2;
+    state->window[2] = b3;
+    state->window[3] = b4;
+    state->checksum = checksum;
+    state->length += size;
+    if (also != NULL)
+    {
+        memcpy(also->window, state->window, sizeof(also->window));
+        also->checksum = alsoChecksum;
+        also->length += size;
+    }
+}
+
+
+/* LengthCode    Logarithmic code of a length, fine for short ranges and
+ *               coarse for long ones
+ */
+static uint8_t LengthCode(uint64_t length)
+{
+    double l = (double)length;
+    double code;
+    if (length <= 656)
+    {
+        code = log(l) / log(1.5);
+    }
+    else if (length <= 3199)
+    {
+        code = log(l) / log(1.3) - 8.72777;
+    }
+    else
+    {
+        code = log(l) / log(1.1) - 62.5472;
+    }
+    return (uint8_t)((uint64_t)code & 0xFF);
+}
+
+
+/* FinishDigest    Turn a state into its digest
+ */
+static void FinishDigest(const SimilarityState *state, SimilarityDigest *digest)
+{
+    memset(digest, 0, sizeof(*digest));
+    if (state->length < SIMILARITY_MIN_SIZE)
+    {
+        return;
+    }
+
+    uint32_t sorted[SIMILARITY_BUCKETS];
+    memcpy(sorted, state->buckets, sizeof(sorted));
+    std::nth_element(sorted, sorted + SIMILARITY_BUCKETS * 3 / 4 - 1, sorted + SIMILARITY_BUCKETS);
+    uint32_t q3 = sorted[SIMILARITY_BUCKETS * 3 / 4 - 1];
+    std::nth_element(sorted, sorted + SIMILARITY_BUCKETS / 2 - 1, sorted + SIMILARITY_BUCKETS * 3 / 4 - 1);
+    uint32_t q2 = sorted[SIMILARITY_BUCKETS / 2 - 1];
+    std::nth_element(sorted, sorted + SIMILARITY_BUCKETS / 4 - 1, sorted + SIMILARITY_BUCKETS / 2 - 1);
+    uint32_t q1 = sorted[SIMILARITY_BUCKETS / 4 - 1];
+
+    /* Too little variety: most buckets empty */
+    uint32_t filled = 0;
+    for (uint32_t b = 0; b < SIMILARITY_BUCKETS; ++b)
+    {
+        filled += state->buckets[b] != 0;
+    }
+    if (q3 == 0 || filled <= SIMILARITY_BUCKETS / 2)
+    {
+        return;
+    }
+
+    digest->valid = true;
+    digest->bytes[0] = state->checksum;
+    digest->bytes[1] = LengthCode(state->length);
+    digest->bytes[2] = (uint8_t)(((uint64_t)q1 * 100 / q3 & 0xF) << 4 | ((uint64_t)q2 * 100 / q3 & 0xF));
+
+    uint8_t *body = digest->bytes + 3;
+    for (uint32_t b = 0; b < SIMILARITY_BUCKETS; ++b)
+    {
+        uint32_t count = state->buckets[b];
+        uint8_t code = count <= q1 ? 0 : count <= q2 ? 1 : count <= q3 ? 2 : 3;
+        body[b / 4] |= code << (b % 4 * 2);
+    }
+}
+
+
+/* DecodeSimilarity    Digest the whole file and each section's raw data
+ * Parameters          The whole file, image with its section table parsed
+ * Returns             true once image->similarity is filled in
+ */
+bool DecodeSimilarity(PeBuffer buffer, PeImage *image)
+{
+    SimilarityTable *table = &image->similarity;
+    size_t count = image->sections.size();
+
+    SimilarityState imageState;
+    memset(&imageState, 0, sizeof(imageState));
+    std::vector<SimilarityState> sectionStates(count);
+    if (count > 0)
+    {
+        memset(sectionStates.data(), 0, count * sizeof(SimilarityState));
+    }
+
+    /* Sections in file order */
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (image->sections[i].SizeOfRawData > 0 && image->sections[i].PointerToRawData < buffer.size)
+        {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return image->sections[a].PointerToRawData < image->sections[b].PointerToRawData;
+    });
+
+    /* Walk the file once. A section's first bytes fill its own window;
+     * after that it sees the same triplets as the image. A section
+     * overlapping an earlier one is hashed on its own. */
+    uint64_t at = 0;
+    for (size_t k = 0; k < order.size(); ++k)
+    {
+        const SectionHeader *sh = &image->sections[order[k]];
+        SimilarityState *section = &sectionStates[order[k]];
+        uint64_t start = sh->PointerToRawData;
+        uint64_t end = std::min<uint64_t>(start + sh->SizeOfRawData, buffer.size);
+        if (start < at)
+        {
+            HashRange(section, NULL, buffer.data + start, (size_t)(end - start));
+            continue;
+        }
+
+        uint64_t head = std::min<uint64_t>(end - start, sizeof(section->window));
+        HashRange(&imageState, NULL, buffer.data + at, (size_t)(start - at + head));
+        HashRange(section, NULL, buffer.data + start, (size_t)head);
+        HashRange(&imageState, section, buffer.data + start + head, (size_t)(end - start - head));
+        at = end;
+    }
+    HashRange(&imageState, NULL, buffer.data + at, (size_t)(buffer.size - at));
+
+    FinishDigest(&imageState, &table->image);
+    table->sections.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        FinishDigest(&sectionStates[i], &table->sections[i]);
+    }
+    return true;
+}
+
+
+/* CircularDistance    Distance between two values on a ring
+ */
+static uint32_t CircularDistance(uint32_t a, uint32_t b, uint32_t ring)
+{
+    uint32_t d = a > b ? a - b : b - a;
+    return std::min(d, ring - d);
+}
+
+
+/* DigestDistance    How far apart two digests are: 0 for the same
+ *                   content, growing as it differs
+ * Parameters        Two valid digests
+ */
+uint32_t DigestDistance(const SimilarityDigest *a, const SimilarityDigest *b)
+{
+    uint32_t distance = a->bytes[0] != b->bytes[0];
+
+    uint32_t length = CircularDistance(a->bytes[1], b->bytes[1], 256);
+    distance += length <= 1 ? length : length * 12;
+
+    uint32_t q1 = CircularDistance(a->bytes[2] >> 4, b->bytes[2] >> 4, 16);
+    distance += q1 <= 1 ? q1 : (q1 - 1) * 12;
+    uint32_t q2 = CircularDistance(a->bytes[2] & 0xF, b->bytes[2] & 0xF, 16);
+    distance += q2 <= 1 ? q2 : (q2 - 1) * 12;
+
+    /* Codes at opposite ends of the range weigh double */
+    for (uint32_t i = 3; i < SIMILARITY_DIGEST_SIZE; ++i)
+    {
+        for (uint32_t shift = 0; shift < 8; shift += 2)
+        {
+            int ca = a->bytes[i] >> shift & 3;
+            int cb = b->bytes[i] >> shift & 3;
+            int d = ca > cb ? ca - cb : cb - ca;
+            distance += d == 3 ? 6 : d;
+        }
+    }
+    return distance;
+}
@@ -0,0 +1,43 @@
+#ifndef _PESIMILARITY
+#define _PESIMILARITY
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "pefile.h"
+
+#define SIMILARITY_BUCKETS       128     /* Triplet buckets; two bits of the digest body each */
+#define SIMILARITY_BODY_SIZE     (SIMILARITY_BUCKETS / 4)
+#define SIMILARITY_DIGEST_SIZE   (3 + SIMILARITY_BODY_SIZE)   /* checksum, length code, quartile ratios, body */
+#define SIMILARITY_MIN_SIZE      50      /* Shorter ranges get no digest */
+#define SIMILARITY_MAX_DISTANCE  40      /* Default distance up to which digests count as similar */
+#define SIMILARITY_DISTANCE_LIMIT (1 + 128 * 12 + 2 * 7 * 12 + SIMILARITY_BUCKETS * 6)  /* Most DigestDistance returns */
+
+/* A locality sensitive digest in the style of TLSH. Every byte and the
+ * four before it form six triplets, each counted into one of the buckets;
+ * the body codes each bucket by the quartile its count falls in, so
+ * similar content gives digests that differ in few places. The header
+ * holds a checksum, a code for the logarithm of the length and the ratios
+ * of the quartiles.
+ */
+typedef struct
+{
+    bool valid;                 // the range was long and varied enough to hash
+    uint8_t bytes[SIMILARITY_DIGEST_SIZE];
+} SimilarityDigest;
+
+/* Digests of the whole file and of each section's raw data */
+typedef struct
+{
+    SimilarityDigest image;
+    std::vector<SimilarityDigest> sections;     // parallel to PeImage::sections
+} SimilarityTable;
+
+struct PeImage;
+
+bool DecodeSimilarity(PeBuffer buffer, PeImage *image);
+uint32_t DigestDistance(const SimilarityDigest *a, const SimilarityDigest *b);
+
+#endif // _PESIMILARITY
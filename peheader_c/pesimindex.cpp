@@ -0,0 +1,368 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pesimindex.cpp
+//  Author:     Mark Coppa
+//
+//  Near-duplicate index: the similarity digests of every binary in a
+//  corpus, with locality sensitive keys to find them by. Each digest is
+//  filed under a few bands of its body, and similar digests almost always
+//  agree on at least one band, so a query only looks at the few records
+//  sharing a band with it. The file is a header, the records, the sorted
+//  keys and the paths; it is mapped and binary searched in place.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pesimindex.h"
+#include "pedigest.h"
+#include "peheader.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The similarity index file is read by mapping the structs; add byte swapping for big endian hosts"
+#endif
+
+static_assert(sizeof(SimilarityIndexRecord) == 64, "SimilarityIndexRecord must stay 64 bytes with no padding");
+
+
+/* BandKey    Key of one band of a digest
+ */
+static inline uint32_t BandKey(const uint8_t digest[SIMILARITY_DIGEST_SIZE], uint32_t band)
+{
+    const uint8_t *body = digest + 3;
+    return band << 16 | body[band] | body[(band + 1) % SIMILARITY_BODY_SIZE] << 8;
+}
+
+
+/* NewRecord    A record for a valid digest, path fields unset
+ */
+static SimilarityIndexRecord NewRecord(const SimilarityDigest *digest, uint8_t kind, const char *section)
+{
+    SimilarityIndexRecord record;
+    memset(&record, 0, sizeof(record));
+    memcpy(record.digest, digest->bytes, sizeof(record.digest));
+    record.kind = kind;
+    if (section != NULL)
+    {
+        memcpy(record.section, section, sizeof(record.section));
+    }
+    return record;
+}
+
+
+/* Add           Record the digests of one binary
+ * Parameters    The binary parsed with PARSE_SIMILARITY, its path
+ *
+ * Binaries too small or uniform to have an image digest are left out.
+ */
+void SimilarityIndexBuilder::Add(const PeImage *image, const char *path)
+{
+    const SimilarityTable *table = &image->similarity;
+    const std::vector<SectionHeader> &sections = image->sections;
+    if (!(image->decoded & PARSE_SIMILARITY) || !table->image.valid)
+    {
+        return;
+    }
+
+    Pending pending;
+    pending.records.push_back(NewRecord(&table->image, SIMILARITY_IMAGE, NULL));
+    for (size_t i = 0; i < table->sections.size() && i < sections.size(); ++i)
+    {
+        if (table->sections[i].valid)
+        {
+            pending.records.push_back(NewRecord(&table->sections[i], SIMILARITY_SECTION, sections[i].Name));
+        }
+    }
+    pending.path = path;
+
+    Shard *shard = &shards[HashBytes(path, pending.path.size()) >> 58];
+    std::lock_guard<std::mutex> guard(shard->lock);
+    shard->binaries.push_back(std::move(pending));
+}
+
+
+/* Write         Key everything added and write the index, replacing any
+ *               file of that name only once it is complete
+ * Parameters    Index file name, where to return the number of binaries
+ * Returns       false if the file could not be written
+ */
+bool SimilarityIndexBuilder::Write(const char *path, uint64_t *binaries)
+{
+    std::vector<Pending *> all;
+    for (int s = 0; s < SHARD_COUNT; ++s)
+    {
+        for (size_t b = 0; b < shards[s].binaries.size(); ++b)
+        {
+            all.push_back(&shards[s].binaries[b]);
+        }
+    }
+
+    /* Ordered by path so the same corpus always writes the same file */
+    std::sort(all.begin(), all.end(), [](const Pending *a, const Pending *b) {
+        return a->path < b->path;
+    });
+
+    std::vector<SimilarityIndexRecord> records;
+    uint64_t offset = 0;
+    for (size_t b = 0; b < all.size(); ++b)
+    {
+        uint32_t image = (uint32_t)records.size();
+        for (size_t r = 0; r < all[b]->records.size(); ++r)
+        {
+            SimilarityIndexRecord record = all[b]->records[r];
+            record.image = image;
+            record.pathLength = (uint32_t)all[b]->path.size();
+            record.pathOffset = offset;
+            records.push_back(record);
+        }
+        offset += all[b]->path.size();
+    }
+
+    std::vector<SimilarityIndexKey> keys;
+    keys.reserve(records.size() * SIMILARITY_BANDS);
+    for (uint32_t r = 0; r < records.size(); ++r)
+    {
+        for (uint32_t band = 0; band < SIMILARITY_BANDS; ++band)
+        {
+            SimilarityIndexKey key = { BandKey(records[r].digest, band), r };
+            keys.push_back(key);
+        }
+    }
+    std::sort(keys.begin(), keys.end(), [](const SimilarityIndexKey &a, const SimilarityIndexKey &b) {
+        return a.band != b.band ? a.band < b.band : a.record < b.record;
+    });
+
+    std::string temp = std::string(path) + ".tmp";
+    FILE *out = fopen(temp.c_str(), "wb");
+    if (out == NULL)
+    {
+        return false;
+    }
+
+    SimilarityIndexHeader header = { SIMILARITY_INDEX_MAGIC, SIMILARITY_INDEX_VERSION, records.size(), keys.size(),
+                                     offset, 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              (records.empty() || fwrite(records.data(), sizeof(SimilarityIndexRecord), records.size(), out) == records.size()) &&
+              (keys.empty() || fwrite(keys.data(), sizeof(SimilarityIndexKey), keys.size(), out) == keys.size());
+
+    for (size_t b = 0; ok && b < all.size(); ++b)
+    {
+        ok = all[b]->path.empty() || fwrite(all[b]->path.data(), all[b]->path.size(), 1, out) == 1;
+    }
+
+    ok = fclose(out) == 0 && ok;
+
+#ifdef _WIN32
+    if (ok)
+    {
+        remove(path);
+    }
+#endif
+    if (!ok || rename(temp.c_str(), path) != 0)
+    {
+        remove(temp.c_str());
+        return false;
+    }
+
+    *binaries = all.size();
+    return true;
+}
+
+
+SimilarityIndex::SimilarityIndex()
+    : loaded(false), records(NULL), recordCount(0), keys(NULL), keyCount(0), paths(NULL), pathSize(0)
+{
+    memset(&file, 0, sizeof(file));
+}
+
+
+SimilarityIndex::~SimilarityIndex()
+{
+    if (loaded)
+    {
+        ClosePeFile(&file);
+    }
+}
+
+
+/* Open          Map an index written by SimilarityIndexBuilder
+ * Parameters    Index file name
+ * Returns       false if it can't be read or isn't a valid index
+ */
+bool SimilarityIndex::Open(const char *path)
+{
+    if (!OpenWholeFile(path, &file))
+    {
+        return false;
+    }
+
+    const SimilarityIndexHeader *header = (const SimilarityIndexHeader *)file.buffer.data;
+    size_t size = file.buffer.size;
+    size_t tables = size - sizeof(SimilarityIndexHeader);
+
+    bool valid = file.complete && size >= sizeof(SimilarityIndexHeader) &&
+                 header->magic == SIMILARITY_INDEX_MAGIC && header->version == SIMILARITY_INDEX_VERSION &&
+                 header->recordCount < UINT32_MAX &&
+                 header->recordCount <= tables / sizeof(SimilarityIndexRecord) &&
+                 header->keyCount <= (tables - header->recordCount * sizeof(SimilarityIndexRecord)) / sizeof(SimilarityIndexKey) &&
+                 header->pathSize == tables - header->recordCount * sizeof(SimilarityIndexRecord) -
+                                     header->keyCount * sizeof(SimilarityIndexKey);
+    if (!valid)
+    {
+        ClosePeFile(&file);
+        return false;
+    }
+
+    loaded = true;
+    records = (const SimilarityIndexRecord *)(file.buffer.data + sizeof(SimilarityIndexHeader));
+    recordCount = header->recordCount;
+    keys = (const SimilarityIndexKey *)(records + recordCount);
+    keyCount = header->keyCount;
+    paths = (const uint8_t *)(keys + keyCount);
+    pathSize = header->pathSize;
+    return true;
+}
+
+
+/* FindBand      Find the keys of one band value
+ * Parameters    Band key, where to return the first matching key
+ * Returns       Number of matching keys, which follow each other
+ */
+uint64_t SimilarityIndex::FindBand(uint32_t band, uint64_t *first) const
+{
+    uint64_t lo = 0;
+    uint64_t hi = keyCount;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (keys[mid].band < band)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    *first = lo;
+    uint64_t end = lo;
+    while (end < keyCount && keys[end].band == band)
+    {
+        ++end;
+    }
+    return end - lo;
+}
+
+
+/* Find          Find the binaries similar to a query: those whose image
+ *               digest is near the query's, or with a section near one of
+ *               the query's sections
+ * Parameters    Digests of the query, greatest distance that counts as
+ *               similar, where to return the binaries, nearest first
+ */
+void SimilarityIndex::Find(const SimilarityTable *query, uint32_t maxDistance, std::vector<SimilarMatch> *matches) const
+{
+    /* Candidates by image record; lastSection keeps a query section from
+     * counting twice for one binary */
+    struct Candidate
+    {
+        SimilarMatch match;
+        size_t lastSection;
+    };
+    std::unordered_map<uint32_t, Candidate> found;
+
+    for (size_t q = 0; q <= query->sections.size(); ++q)
+    {
+        const SimilarityDigest *digest = q == 0 ? &query->image : &query->sections[q - 1];
+        uint8_t kind = q == 0 ? SIMILARITY_IMAGE : SIMILARITY_SECTION;
+        if (!digest->valid)
+        {
+            continue;
+        }
+
+        for (uint32_t band = 0; band < SIMILARITY_BANDS; ++band)
+        {
+            uint64_t first;
+            uint64_t count = FindBand(BandKey(digest->bytes, band), &first);
+            for (uint64_t k = first; k < first + count; ++k)
+            {
+                uint32_t r = keys[k].record;
+                if (r >= recordCount || records[r].kind != kind || records[r].image >= recordCount)
+                {
+                    continue;
+                }
+
+                uint32_t image = records[r].image;
+                std::unordered_map<uint32_t, Candidate>::iterator it = found.find(image);
+                if (it != found.end() && (q == 0 || it->second.lastSection == q))
+                {
+                    continue;
+                }
+
+                SimilarityDigest other;
+                other.valid = true;
+                memcpy(other.bytes, records[r].digest, sizeof(other.bytes));
+                if (DigestDistance(digest, &other) > maxDistance)
+                {
+                    continue;
+                }
+
+                if (it == found.end())
+                {
+                    Candidate candidate = { { image, UINT32_MAX, 0 }, 0 };
+                    it = found.insert(std::make_pair(image, candidate)).first;
+                }
+                if (q > 0)
+                {
+                    ++it->second.match.sections;
+                    it->second.lastSection = q;
+                }
+            }
+        }
+    }
+
+    matches->clear();
+    for (std::unordered_map<uint32_t, Candidate>::iterator it = found.begin(); it != found.end(); ++it)
+    {
+        SimilarMatch match = it->second.match;
+        if (query->image.valid)
+        {
+            SimilarityDigest other;
+            other.valid = true;
+            memcpy(other.bytes, records[match.image].digest, sizeof(other.bytes));
+            match.distance = DigestDistance(&query->image, &other);
+        }
+        matches->push_back(match);
+    }
+
+    std::sort(matches->begin(), matches->end(), [](const SimilarMatch &a, const SimilarMatch &b) {
+        if (a.distance != b.distance)
+        {
+            return a.distance < b.distance;
+        }
+        return a.sections != b.sections ? a.sections > b.sections : a.image < b.image;
+    });
+}
+
+
+/* Path       Path of the binary a record describes
+ * Returns    Its bytes in the mapping (not NUL terminated), empty if the
+ *            record points outside the path area
+ */
+PeBuffer SimilarityIndex::Path(uint32_t record) const
+{
+    PeBuffer path = { NULL, 0 };
+    if (record < recordCount && records[record].pathOffset <= pathSize &&
+        pathSize - records[record].pathOffset >= records[record].pathLength)
+    {
+        path.data = paths + records[record].pathOffset;
+        path.size = records[record].pathLength;
+    }
+    return path;
+}
@@ -0,0 +1,124 @@
+#ifndef _PESIMINDEX
+#define _PESIMINDEX
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pefile.h"
+#include "pesimilarity.h"
+
+#define SIMILARITY_INDEX_MAGIC    0x49534850  /* "PHSI" */
+#define SIMILARITY_INDEX_VERSION  1
+#define SIMILARITY_BANDS          32          /* Keys per digest: two body bytes (eight buckets) starting at each byte */
+
+#define SIMILARITY_IMAGE          0           /* SimilarityIndexRecord::kind */
+#define SIMILARITY_SECTION        1
+
+typedef struct
+{
+    uint32_t magic;             // SIMILARITY_INDEX_MAGIC
+    uint32_t version;           // SIMILARITY_INDEX_VERSION
+    uint64_t recordCount;
+    uint64_t keyCount;          // keys follow the records
+    uint64_t pathSize;          // bytes in the path area, which follows the keys
+    uint64_t reserved;
+} SimilarityIndexHeader;
+
+/* One digest of the on-disk index, 64 bytes. A binary's image record is
+ * followed by the records of its sections; binaries are ordered by path.
+ */
+typedef struct
+{
+    uint8_t digest[SIMILARITY_DIGEST_SIZE];
+    uint8_t kind;               // SIMILARITY_IMAGE or SIMILARITY_SECTION
+    char section[8];            // section name, zero for the image
+    uint32_t image;             // record of the binary's image digest
+    uint32_t pathLength;
+    uint32_t reserved;
+    uint64_t pathOffset;        // from the start of the path area
+} SimilarityIndexRecord;
+
+/* One band of one digest: band number << 16 | the body bytes of the band.
+ * Keys are sorted, so the records sharing a band are found by binary
+ * search and candidates never need a scan of the whole index.
+ */
+typedef struct
+{
+    uint32_t band;
+    uint32_t record;
+} SimilarityIndexKey;
+
+/* A binary found by SimilarityIndex::Find */
+typedef struct
+{
+    uint32_t image;             // its image record
+    uint32_t distance;          // between the image digests
+    uint32_t sections;          // sections of the query with a similar section in it
+} SimilarMatch;
+
+struct PeImage;
+
+/* Collects the digests of every binary in a batch scan. Shards have their
+ * own locks so batch workers can add binaries concurrently.
+ */
+class SimilarityIndexBuilder
+{
+public:
+    SimilarityIndexBuilder() {}
+
+    void Add(const PeImage *image, const char *path);
+    bool Write(const char *path, uint64_t *binaries);
+
+    SimilarityIndexBuilder(const SimilarityIndexBuilder &) = delete;
+    SimilarityIndexBuilder &operator=(const SimilarityIndexBuilder &) = delete;
+
+private:
+    enum { SHARD_COUNT = 64 };
+
+    struct Pending
+    {
+        std::vector<SimilarityIndexRecord> records;     // image first, path fields unset
+        std::string path;
+    };
+
+    struct Shard
+    {
+        std::mutex lock;
+        std::vector<Pending> binaries;
+    };
+
+    Shard shards[SHARD_COUNT];
+};
+
+/* A written index, mapped read-only and searched in place */
+class SimilarityIndex
+{
+public:
+    SimilarityIndex();
+    ~SimilarityIndex();
+
+    bool Open(const char *path);
+    void Find(const SimilarityTable *query, uint32_t maxDistance, std::vector<SimilarMatch> *matches) const;
+    PeBuffer Path(uint32_t record) const;
+
+    SimilarityIndex(const SimilarityIndex &) = delete;
+    SimilarityIndex &operator=(const SimilarityIndex &) = delete;
+
+private:
+    uint64_t FindBand(uint32_t band, uint64_t *first) const;
+
+    PeFile file;
+    bool loaded;
+    const SimilarityIndexRecord *records;
+    uint64_t recordCount;
+    const SimilarityIndexKey *keys;
+    uint64_t keyCount;
+    const uint8_t *paths;
+    uint64_t pathSize;
+};
+
+#endif // _PESIMINDEX
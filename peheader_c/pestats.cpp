@@ -0,0 +1,212 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pestats.cpp
+//  Author:     Mark Coppa
+//
+//  Run time statistics: where a scan spends its time and what it read.
+//  Every thread counts into a cache line of its own, claimed on first
+//  use, with no locks and no shared writes; totals are summed from all
+//  of them on demand. Stage timers read the cycle counter and are turned
+//  into seconds against the steady clock when reported.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pestats.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#else
+#include <unistd.h>
+#endif
+
+#define STDERR_FD 2
+
+bool statsEnabled = false;
+thread_local StatSlot *threadStats = NULL;
+
+/* One slot per thread, and one past the end they all share */
+static StatSlot slots[STATS_MAX_THREADS + 1];
+static std::atomic<unsigned> claimedSlots(0);
+
+/* Where the cycle counter and the clock were when stats were enabled */
+static uint64_t startTicks;
+static std::chrono::steady_clock::time_point startTime;
+
+static const char *const timerNames[TIMERS] = { "open", "decode", "format", "write", "close" };
+
+
+/* ClaimStatSlot    Give the calling thread its counters
+ * Returns          The slot, also left in threadStats
+ */
+StatSlot *ClaimStatSlot()
+{
+    unsigned index = claimedSlots.fetch_add(1, std::memory_order_relaxed);
+    threadStats = &slots[index < STATS_MAX_THREADS ? index : STATS_MAX_THREADS];
+    return threadStats;
+}
+
+
+/* EnableStats    Start counting. Call before the threads to be counted
+ *                start, since they read the flag unsynchronized.
+ */
+void EnableStats()
+{
+    slots[STATS_MAX_THREADS].shared = true;
+    startTicks = StatTicks();
+    startTime = std::chrono::steady_clock::now();
+    statsEnabled = true;
+}
+
+
+/* SnapshotStats    Sum every thread's counters. Threads keep counting
+ *                  meanwhile, so a snapshot taken during a scan is only
+ *                  consistent counter by counter.
+ * Parameters       Totals to fill
+ */
+void SnapshotStats(StatTotals *totals)
+{
+    *totals = StatTotals();
+
+    /* Calibrate the ticks against the clock over the whole run */
+    uint64_t ticks = StatTicks() - startTicks;
+    totals->elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    double secondsPerTick = ticks > 0 ? totals->elapsed / ticks : 0;
+
+    unsigned claimed = claimedSlots.load(std::memory_order_relaxed);
+    unsigned used = claimed < STATS_MAX_THREADS ? claimed : STATS_MAX_THREADS + 1;
+    for (unsigned s = 0; s < used; ++s)
+    {
+        const StatSlot &slot = slots[s];
+        for (int c = 0; c < STATS; ++c)
+        {
+            totals->counters[c] += slot.counters[c].load(std::memory_order_relaxed);
+        }
+        for (int t = 0; t < TIMERS; ++t)
+        {
+            totals->seconds[t] += slot.ticks[t].load(std::memory_order_relaxed) * secondsPerTick;
+            totals->calls[t] += slot.calls[t].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+
+/* Megabytes    For printing byte counts */
+static double Megabytes(uint64_t bytes)
+{
+    return bytes / 1e6;
+}
+
+
+/* FormatStatsReport    The --stats report: files by kind, I/O, and the
+ *                      thread time each stage took
+ * Parameters           Text to fill, its size, totals
+ */
+void FormatStatsReport(char *text, size_t size, const StatTotals *totals)
+{
+    const uint64_t *c = totals->counters;
+    double rate = totals->elapsed > 0 ? c[STAT_FILES] / totals->elapsed : 0;
+
+    int used = snprintf(text, size,
+        "Scanned %llu files in %.3f s (%.0f files/s): %llu PE (%llu managed), %llu COFF, %llu archives "
+        "(%llu members); %llu malformed, %llu unreadable\n"
+        "Read %.1f MB in %llu reads with %llu seeks; mapped %.1f MB in %llu files; wrote %.1f MB\n",
+        (unsigned long long)c[STAT_FILES], totals->elapsed, rate, (unsigned long long)c[STAT_PE],
+        (unsigned long long)c[STAT_MANAGED], (unsigned long long)c[STAT_COFF], (unsigned long long)c[STAT_ARCHIVES],
+        (unsigned long long)c[STAT_MEMBERS], (unsigned long long)c[STAT_MALFORMED],
+        (unsigned long long)c[STAT_FAILED], Megabytes(c[STAT_BYTES_READ]), (unsigned long long)c[STAT_READ_CALLS],
+        (unsigned long long)c[STAT_SEEKS], Megabytes(c[STAT_BYTES_MAPPED]), (unsigned long long)c[STAT_MAPS],
+        Megabytes(c[STAT_BYTES_WRITTEN]));
+
+    used = used < 0 ? 0 : used;
+    for (int t = 0; t < TIMERS && (size_t)used < size; ++t)
+    {
+        double mean = totals->calls[t] > 0 ? totals->seconds[t] / totals->calls[t] * 1e6 : 0;
+        int added = snprintf(text + used, size - used, "%s%s %.3f s (%llu, %.1f us each)%s",
+                             t == 0 ? "Thread time: " : "", timerNames[t], totals->seconds[t],
+                             (unsigned long long)totals->calls[t], mean, t + 1 < TIMERS ? "; " : "\n");
+        used += added < 0 ? 0 : added;
+    }
+}
+
+
+/* FormatStatsProgress    One line of running totals, no line break
+ * Parameters             Text to fill, its size, totals
+ */
+void FormatStatsProgress(char *text, size_t size, const StatTotals *totals)
+{
+    const uint64_t *c = totals->counters;
+    double rate = totals->elapsed > 0 ? c[STAT_FILES] / totals->elapsed : 0;
+
+    snprintf(text, size, "%llu files (%.0f/s): %llu PE, %llu managed, %llu COFF, %llu archives, %llu malformed; "
+             "%.1f MB read, %.1f MB mapped",
+             (unsigned long long)c[STAT_FILES], rate, (unsigned long long)c[STAT_PE],
+             (unsigned long long)c[STAT_MANAGED], (unsigned long long)c[STAT_COFF],
+             (unsigned long long)c[STAT_ARCHIVES], (unsigned long long)c[STAT_MALFORMED],
+             Megabytes(c[STAT_BYTES_READ]), Megabytes(c[STAT_BYTES_MAPPED]));
+}
+
+
+StatsProgress::StatsProgress() : stopping(false), terminal(isatty(STDERR_FD) != 0)
+{
+}
+
+
+StatsProgress::~StatsProgress()
+{
+    Stop();
+}
+
+
+/* Start    Begin printing; stats must already be enabled
+ */
+void StatsProgress::Start()
+{
+    stopping = false;
+    thread = std::thread(&StatsProgress::Run, this);
+}
+
+
+/* Stop    Stop printing, and end the last line if it was left open
+ */
+void StatsProgress::Stop()
+{
+    if (!thread.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+
+void StatsProgress::Run()
+{
+    char line[512];
+    bool printed = false;
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (!wake.wait_for(guard, std::chrono::milliseconds(STATS_PROGRESS_INTERVAL), [this] { return stopping; }))
+    {
+        StatTotals totals;
+        SnapshotStats(&totals);
+        FormatStatsProgress(line, sizeof(line), &totals);
+
+        /* Pad over the end of a longer previous line */
+        fprintf(stderr, terminal ? "\r%-100s" : "%s\n", line);
+        fflush(stderr);
+        printed = true;
+    }
+
+    if (printed && terminal)
+    {
+        fputc('\n', stderr);
+    }
+}
@@ -0,0 +1,185 @@
+#ifndef _PESTATS
+#define _PESTATS
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define STATS_TSC 1
+#elif defined(__aarch64__)
+#define STATS_TSC 1
+#endif
+
+#define STATS_MAX_THREADS       256     /* threads with counters of their own; later ones share one more */
+#define STATS_PROGRESS_INTERVAL 1000    /* milliseconds between live progress lines */
+
+/* Counters. Batch scans count files; the front end counts what they
+ * turned out to be; the readers count I/O; the parsers count bailouts. */
+typedef enum
+{
+    STAT_FILES,             // files a batch handed to its handler
+    STAT_FAILED,            // of those, files the handler could not read
+    STAT_ARCHIVES,
+    STAT_PE,                // PE images, managed or not
+    STAT_COFF,              // bare COFF objects, top level files only
+    STAT_MANAGED,           // PE images with a CLR header
+    STAT_MEMBERS,           // archive members dumped
+    STAT_MALFORMED,         // parses that gave up on headers running past the end of the file
+    STAT_READ_CALLS,        // read, pread and io_uring reads
+    STAT_BYTES_READ,
+    STAT_SEEKS,             // jumps of the header parser to another offset in the file
+    STAT_MAPS,              // files mapped instead of read
+    STAT_BYTES_MAPPED,
+    STAT_BYTES_WRITTEN,
+    STATS
+} StatCounter;
+
+/* Timed stages, per thread, so the total can exceed wall time */
+typedef enum
+{
+    TIMER_OPEN,             // open and map, or open and read the headers; io_uring opens are not timed
+    TIMER_DECODE,           // ParsePeImage and the decoders it runs
+    TIMER_FORMAT,
+    TIMER_WRITE,
+    TIMER_CLOSE,
+    TIMERS
+} StatTimer;
+
+/* One thread's counters. A thread only ever writes its own slot, so
+ * adding is a plain load and store; readers sum every slot while the
+ * writers run. The slot shared by threads past STATS_MAX_THREADS adds
+ * atomically instead. */
+struct alignas(64) StatSlot
+{
+    std::atomic<uint64_t> counters[STATS];
+    std::atomic<uint64_t> ticks[TIMERS];
+    std::atomic<uint64_t> calls[TIMERS];
+    bool shared;
+};
+
+/* Sums over every thread */
+typedef struct
+{
+    uint64_t counters[STATS];
+    double seconds[TIMERS];     // thread-seconds spent in each stage
+    uint64_t calls[TIMERS];
+    double elapsed;             // wall time since EnableStats
+} StatTotals;
+
+extern bool statsEnabled;
+extern thread_local StatSlot *threadStats;
+
+StatSlot *ClaimStatSlot();
+void EnableStats();
+void SnapshotStats(StatTotals *totals);
+void FormatStatsReport(char *text, size_t size, const StatTotals *totals);
+void FormatStatsProgress(char *text, size_t size, const StatTotals *totals);
+
+/* Prints a line of running totals to stderr every
+ * STATS_PROGRESS_INTERVAL from a thread of its own, overwriting the
+ * previous line when stderr is a terminal.
+ */
+class StatsProgress
+{
+public:
+    StatsProgress();
+    ~StatsProgress();
+
+    void Start();
+    void Stop();
+
+    StatsProgress(const StatsProgress &) = delete;
+    StatsProgress &operator=(const StatsProgress &) = delete;
+
+private:
+    void Run();
+
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping;
+    bool terminal;          // stderr is a terminal: lines end in \r, not \n
+};
+
+
+/* StatTicks    Read the cycle counter, or the steady clock in nanoseconds
+ *              where there isn't one that user code can read
+ */
+inline uint64_t StatTicks()
+{
+#if defined(STATS_TSC) && defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#elif defined(STATS_TSC)
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
+/* AddToSlot    Add to one of this thread's counters
+ */
+inline void AddToSlot(StatSlot *slot, std::atomic<uint64_t> *value, uint64_t amount)
+{
+    if (slot->shared)
+    {
+        value->fetch_add(amount, std::memory_order_relaxed);
+    }
+    else
+    {
+        value->store(value->load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+}
+
+
+/* CountStat    Add to a counter; nothing unless stats are enabled
+ */
+inline void CountStat(StatCounter counter, uint64_t amount = 1)
+{
+    if (statsEnabled)
+    {
+        StatSlot *slot = threadStats != NULL ? threadStats : ClaimStatSlot();
+        AddToSlot(slot, &slot->counters[counter], amount);
+    }
+}
+
+
+/* StatMark    Start timing a stage
+ * Returns     The tick count to pass to TimeStat, 0 if stats are off
+ */
+inline uint64_t StatMark()
+{
+    return statsEnabled ? StatTicks() : 0;
+}
+
+
+/* TimeStat    Charge the ticks since a mark to a stage and move the mark
+ *             to now, so consecutive stages can share one
+ */
+inline void TimeStat(StatTimer timer, uint64_t *mark)
+{
+    if (statsEnabled)
+    {
+        uint64_t now = StatTicks();
+        StatSlot *slot = threadStats != NULL ? threadStats : ClaimStatSlot();
+        AddToSlot(slot, &slot->ticks[timer], now - *mark);
+        AddToSlot(slot, &slot->calls[timer], 1);
+        *mark = now;
+    }
+}
+
+#endif // _PESTATS
@@ -0,0 +1,333 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pesymbols.cpp
+//  Author:     Mark Coppa
+//
+//  COFF symbol table decoder. Symbols, their auxiliary records and the
+//  string table are decoded into parallel arrays with a hash index by
+//  name, and a ledger collects external symbols across many objects to
+//  find duplicate and undefined ones.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "peheader.h"
+#include "pedigest.h"
+
+#include <algorithm>
+
+#define IMAGE_SCN_LNK_COMDAT 0x00001000
+
+
+/* SymbolName    Resolve the 8 byte name field of a symbol record
+ * Parameters    The record, the string table and its size, length to fill
+ * Returns       The name's bytes, else NULL if a long name is out of range
+ */
+static const char *SymbolName(const uint8_t *record, const char *strings, size_t stringsSize, size_t *len)
+{
+    /* A zero first word means the second is a string table offset */
+    if (record[0] == 0 && record[1] == 0 && record[2] == 0 && record[3] == 0)
+    {
+        uint32_t offset = ReadDword(record + 4);
+        if (strings == NULL || offset < 4 || offset >= stringsSize)
+        {
+            return NULL;
+        }
+
+        const char *name = strings + offset;
+        const char *nul = (const char *)memchr(name, '\0', stringsSize - offset);
+        if (nul == NULL)
+        {
+            return NULL;
+        }
+        *len = (size_t)(nul - name);
+        return name;
+    }
+
+    const char *name = (const char *)record;
+    const char *nul = (const char *)memchr(name, '\0', 8);
+    *len = nul != NULL ? (size_t)(nul - name) : 8;
+    return name;
+}
+
+
+/* BuildSymbolIndex    Hash every named symbol into an open addressing
+ *                     table; the first symbol with a given name wins
+ */
+static void BuildSymbolIndex(SymbolTable *symbols)
+{
+    size_t count = symbols->names.size();
+    size_t size = 16;
+    while (size < count * 2)
+    {
+        size *= 2;
+    }
+
+    symbols->hashIndex.assign(size, 0);
+    size_t mask = size - 1;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char *name = symbols->names[i];
+        if (name[0] == '\0')
+        {
+            continue;
+        }
+
+        size_t slot = (size_t)HashBytes(name, strlen(name)) & mask;
+        for (;;)
+        {
+            uint32_t entry = symbols->hashIndex[slot];
+            if (entry == 0)
+            {
+                symbols->hashIndex[slot] = (uint32_t)i + 1;
+                break;
+            }
+            if (strcmp(symbols->names[entry - 1], name) == 0)
+            {
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+}
+
+
+/* DecodeSymbols    Decode the COFF symbol and string tables into
+ *                  image->symbols
+ * Parameters       The buffer the image was parsed from, the image, and an
+ *                  optional interner for names
+ * Returns          false if the image has no readable symbol table
+ */
+bool DecodeSymbols(PeBuffer buffer, PeImage *image, StringInterner *interner)
+{
+    SymbolTable *symbols = &image->symbols;
+    size_t base = image->cfh.PointerToSymbolTable;
+    size_t count = image->cfh.NumberOfSymbols;
+
+    if (base == 0 || count == 0 || base >= buffer.size)
+    {
+        return false;
+    }
+
+    /* The string table follows the last record: a 32 bit size that counts
+     * itself, then the strings */
+    const char *strings = NULL;
+    size_t stringsSize = 0;
+    uint64_t stringsAt = base + (uint64_t)count * SYMBOL_RECORD_SIZE;
+    if (stringsAt + 4 <= buffer.size)
+    {
+        const uint8_t *p = buffer.data + stringsAt;
+        stringsSize = ReadDword(p);
+        if (stringsSize > buffer.size - stringsAt)
+        {
+            stringsSize = (size_t)(buffer.size - stringsAt);
+        }
+        strings = (const char *)p;
+    }
+
+    /* Keep whatever part of a truncated table is present */
+    count = std::min(count, (buffer.size - base) / SYMBOL_RECORD_SIZE);
+    count = std::min(count, (size_t)MAX_SYMBOLS);
+
+    symbols->comdat.assign(image->sections.size(), 0);
+    symbols->sourceFile = NULL;
+
+    const uint8_t *table = buffer.data + base;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint8_t *record = table + i * SYMBOL_RECORD_SIZE;
+        int16_t section = (int16_t)ReadWord(record + 12);
+        uint8_t storageClass = record[16];
+        uint8_t auxCount = record[17];
+
+        if (auxCount > count - i - 1)
+        {
+            auxCount = (uint8_t)(count - i - 1);
+        }
+
+        size_t len = 0;
+        const char *name = SymbolName(record, strings, stringsSize, &len);
+
+        symbols->names.push_back(name != NULL ? KeepName(name, len, interner, image) : "");
+        symbols->values.push_back(ReadDword(record + 8));
+        symbols->sections.push_back(section);
+        symbols->types.push_back(ReadWord(record + 14));
+        symbols->storageClasses.push_back(storageClass);
+        symbols->auxCounts.push_back(auxCount);
+        symbols->firstAux.push_back((uint32_t)(symbols->aux.size() / SYMBOL_RECORD_SIZE));
+        symbols->recordIndex.push_back((uint32_t)i);
+
+        const uint8_t *aux = record + SYMBOL_RECORD_SIZE;
+        symbols->aux.insert(symbols->aux.end(), aux, aux + auxCount * SYMBOL_RECORD_SIZE);
+
+        /* The .file record's auxiliary records hold the source name */
+        if (storageClass == SYMBOL_CLASS_FILE && auxCount > 0 && symbols->sourceFile == NULL)
+        {
+            const char *file = (const char *)aux;
+            const char *nul = (const char *)memchr(file, '\0', auxCount * SYMBOL_RECORD_SIZE);
+            size_t fileLen = nul != NULL ? (size_t)(nul - file) : auxCount * SYMBOL_RECORD_SIZE;
+            symbols->sourceFile = KeepName(file, fileLen, interner, image);
+        }
+
+        /* A section definition: static, value 0, naming its own section */
+        if (storageClass == SYMBOL_CLASS_STATIC && auxCount > 0 && section > 0 &&
+            (size_t)section <= image->sections.size() && symbols->values.back() == 0 &&
+            (image->sections[section - 1].Characteristics & IMAGE_SCN_LNK_COMDAT))
+        {
+            symbols->comdat[section - 1] = aux[14];
+        }
+
+        i += auxCount;
+    }
+
+    BuildSymbolIndex(symbols);
+    return true;
+}
+
+
+/* FindSymbol    Look a name up in a decoded symbol table
+ * Parameters    Table decoded with PARSE_SYMBOLS, symbol name
+ * Returns       Index of the first symbol with that name, else NO_SYMBOL
+ */
+uint32_t FindSymbol(const SymbolTable *symbols, const char *name)
+{
+    if (symbols->hashIndex.empty())
+    {
+        return NO_SYMBOL;
+    }
+
+    size_t mask = symbols->hashIndex.size() - 1;
+    size_t slot = (size_t)HashBytes(name, strlen(name)) & mask;
+
+    for (;;)
+    {
+        uint32_t entry = symbols->hashIndex[slot];
+        if (entry == 0)
+        {
+            return NO_SYMBOL;
+        }
+        if (strcmp(symbols->names[entry - 1], name) == 0)
+        {
+            return entry - 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+
+/* Add           Count the external definitions and references of one object
+ * Parameters    Image decoded with PARSE_SYMBOLS and the ledger's interner,
+ *               path to report it by
+ */
+void SymbolLedger::Add(const PeImage *image, const char *path)
+{
+    const SymbolTable *symbols = &image->symbols;
+
+    for (size_t i = 0; i < symbols->names.size(); ++i)
+    {
+        uint8_t storageClass = symbols->storageClasses[i];
+        const char *name = symbols->names[i];
+        if ((storageClass != SYMBOL_CLASS_EXTERNAL && storageClass != SYMBOL_CLASS_WEAK_EXTERNAL) || name[0] == '\0')
+        {
+            continue;
+        }
+
+        int16_t section = symbols->sections[i];
+        bool strong = false;
+        bool weak = false;
+
+        if (storageClass == SYMBOL_CLASS_WEAK_EXTERNAL)
+        {
+            weak = true;
+        }
+        else if (section > 0)
+        {
+            /* Only NODUPLICATES COMDATs clash; the linker picks one of the rest */
+            uint8_t selection = (size_t)section <= symbols->comdat.size() ? symbols->comdat[section - 1] : 0;
+            strong = selection == 0 || selection == COMDAT_NODUPLICATES;
+            weak = !strong;
+        }
+        else if (section == SYMBOL_ABSOLUTE)
+        {
+            strong = true;
+        }
+        else if (section == SYMBOL_UNDEFINED && symbols->values[i] != 0)
+        {
+            weak = true;    // common symbol: size in value, merged at link time
+        }
+
+        uint64_t h = (uint64_t)(uintptr_t)name * 0x9E3779B97F4A7C15ull;
+        Shard *shard = &shards[h >> 58];
+        std::lock_guard<std::mutex> guard(shard->lock);
+
+        /* Keep the lowest paths rather than the first seen, so reports
+         * don't depend on which worker got there first */
+        Entry &entry = shard->entries[name];
+        if (strong)
+        {
+            if (entry.definitions == 0 || entry.firstDefinition > path)
+            {
+                entry.secondDefinition.swap(entry.firstDefinition);
+                entry.firstDefinition = path;
+            }
+            else if (entry.definitions == 1 || entry.secondDefinition > path)
+            {
+                entry.secondDefinition = path;
+            }
+            ++entry.definitions;
+        }
+        else if (weak)
+        {
+            entry.weak = true;
+        }
+        else if (entry.firstReference.empty() || entry.firstReference > path)
+        {
+            entry.firstReference = path;
+        }
+    }
+}
+
+
+/* Report        Hand every duplicate and undefined symbol to the callbacks
+ * Parameters    Callbacks (either may be NULL) and their context
+ */
+void SymbolLedger::Report(DuplicateFn duplicate, UndefinedFn undefined, void *context)
+{
+    std::vector<std::pair<const char *, const Entry *> > found;
+
+    for (int s = 0; s < SHARD_COUNT; ++s)
+    {
+        std::lock_guard<std::mutex> guard(shards[s].lock);
+        for (std::unordered_map<const char *, Entry>::const_iterator it = shards[s].entries.begin();
+             it != shards[s].entries.end(); ++it)
+        {
+            const Entry &entry = it->second;
+            if (entry.definitions > 1 || (entry.definitions == 0 && !entry.weak && !entry.firstReference.empty()))
+            {
+                found.push_back(std::make_pair(it->first, &entry));
+            }
+        }
+    }
+
+    std::sort(found.begin(), found.end(),
+              [](const std::pair<const char *, const Entry *> &a, const std::pair<const char *, const Entry *> &b)
+              { return strcmp(a.first, b.first) < 0; });
+
+    for (size_t i = 0; i < found.size(); ++i)
+    {
+        const Entry *entry = found[i].second;
+        if (entry->definitions > 1)
+        {
+            if (duplicate != NULL)
+            {
+                duplicate(context, found[i].first, entry->firstDefinition.c_str(),
+                          entry->secondDefinition.c_str(), entry->definitions);
+            }
+        }
+        else if (undefined != NULL)
+        {
+            undefined(context, found[i].first, entry->firstReference.c_str());
+        }
+    }
+}
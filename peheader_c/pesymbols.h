@@ -0,0 +1,105 @@
+#ifndef _PESYMBOLS
+#define _PESYMBOLS
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pearena.h"
+#include "pefile.h"
+
+#define SYMBOL_RECORD_SIZE   18
+#define MAX_SYMBOLS          0x1000000  /* Stop decoding a symbol table after this many records */
+#define NO_SYMBOL            0xFFFFFFFF
+
+/* Special section numbers */
+#define SYMBOL_UNDEFINED     0
+#define SYMBOL_ABSOLUTE      -1
+#define SYMBOL_DEBUG         -2
+
+/* Storage classes used when checking links */
+#define SYMBOL_CLASS_EXTERNAL       2
+#define SYMBOL_CLASS_STATIC         3
+#define SYMBOL_CLASS_FILE           103
+#define SYMBOL_CLASS_WEAK_EXTERNAL  105
+
+/* COMDAT selection of a section definition; only NODUPLICATES makes a
+ * second definition an error */
+#define COMDAT_NODUPLICATES  1
+
+/* The decoded COFF symbol table, struct of arrays: entry i of each array
+ * describes symbol i. Auxiliary records are not entries of their own;
+ * firstAux indexes the raw 18 byte records in aux. Names refer either to
+ * the string interner passed to the decoder or to the owning image's arena.
+ */
+typedef struct
+{
+    std::vector<const char *> names;
+    std::vector<uint32_t> values;
+    std::vector<int16_t> sections;      // 1 based, or SYMBOL_UNDEFINED / _ABSOLUTE / _DEBUG
+    std::vector<uint16_t> types;
+    std::vector<uint8_t> storageClasses;
+    std::vector<uint8_t> auxCounts;
+    std::vector<uint32_t> firstAux;
+    std::vector<uint32_t> recordIndex; // position in the file's table, counting auxiliary records
+
+    std::vector<uint8_t> aux;           // auxiliary records, SYMBOL_RECORD_SIZE bytes each
+    std::vector<uint8_t> comdat;        // COMDAT selection per section (index section - 1), 0 if none
+    const char *sourceFile;             // from the .file record, NULL if there is none
+
+    std::vector<uint32_t> hashIndex;    // symbol + 1 per slot, 0 when empty; power of two size
+} SymbolTable;
+
+struct PeImage;
+
+/* Whole link checks across many objects: counts definitions and references
+ * of external symbols, keyed by name pointer, so every image added must
+ * have been decoded with the same StringInterner. Shards have their own
+ * locks so batch workers can add objects concurrently.
+ */
+class SymbolLedger
+{
+public:
+    SymbolLedger() {}
+
+    void Add(const PeImage *image, const char *path);
+
+    /* Callbacks for Report: every name defined more than once (the two
+     * lowest paths defining it) and every name referenced but never
+     * defined (the lowest path referring to it), each in name order.
+     */
+    typedef void (*DuplicateFn)(void *context, const char *name, const char *first, const char *second, uint32_t definitions);
+    typedef void (*UndefinedFn)(void *context, const char *name, const char *referencedBy);
+    void Report(DuplicateFn duplicate, UndefinedFn undefined, void *context);
+
+    SymbolLedger(const SymbolLedger &) = delete;
+    SymbolLedger &operator=(const SymbolLedger &) = delete;
+
+private:
+    enum { SHARD_COUNT = 64 };
+
+    struct Entry
+    {
+        uint32_t definitions;       // strong definitions
+        bool weak;                  // has a weak, common or COMDAT definition
+        std::string firstDefinition;    // lowest defining paths
+        std::string secondDefinition;
+        std::string firstReference;     // lowest referring path
+    };
+
+    struct Shard
+    {
+        std::mutex lock;
+        std::unordered_map<const char *, Entry> entries;
+    };
+
+    Shard shards[SHARD_COUNT];
+};
+
+bool DecodeSymbols(PeBuffer buffer, PeImage *image, StringInterner *interner);
+uint32_t FindSymbol(const SymbolTable *symbols, const char *name);
+
+#endif // _PESYMBOLS
@@ -0,0 +1,1027 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       pesynth.cpp
+//  Author:     Mark Coppa
+//
+//  Synthetic corpus for benchmarks. Every file is built from a seed with
+//  a fixed generator, so the same seed gives the same bytes on every
+//  machine and every run, and parser changes can be timed against an
+//  unchanging input. The files are well formed: images have import,
+//  export and CLR directories the decoders accept, objects have symbol
+//  and string tables, and archives have linker and long name members.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "pesynth.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#define SYNTH_FILE_ALIGNMENT      0x200
+#define SYNTH_SECTION_ALIGNMENT   0x1000
+#define SYNTH_STUB_END            0x80      /* e_lfanew of every image */
+
+/* Files of each kind in a corpus of scale 1 */
+static const uint32_t kindCounts[SYNTH_KINDS] = { 200, 200, 100, 200, 40 };
+
+static const char *const kindNames[SYNTH_KINDS] = { "pe32", "pe32plus", "managed", "coff", "archive" };
+
+static const char *const dllNames[] =
+{
+    "KERNEL32.dll", "USER32.dll", "ADVAPI32.dll", "ntdll.dll", "msvcrt.dll", "WS2_32.dll",
+    "ole32.dll", "SHELL32.dll", "GDI32.dll", "VERSION.dll", "bcrypt.dll", "CRYPT32.dll"
+};
+
+static const char *const verbs[] =
+{
+    "Get", "Set", "Create", "Open", "Close", "Read", "Write", "Query", "Enum", "Find", "Load", "Free"
+};
+
+static const char *const nouns[] =
+{
+    "File", "Process", "Thread", "Key", "Value", "Memory", "Handle", "Event", "Module", "Window",
+    "Token", "Buffer", "Device", "Service", "Section", "Object"
+};
+
+static const char *const suffixes[] = { "", "A", "W", "Ex", "ExW", "Internal" };
+
+static const char *const extraSections[] = { ".tls", ".gfids", ".00cfg", ".didat", ".idata", ".rodata", ".init" };
+
+static const char *const objectSections[] =
+{
+    ".text$mn", ".data", ".rdata", ".bss", ".xdata", ".pdata", ".text$x", ".CRT$XCU", ".rdata$r", ".debug$S"
+};
+
+
+/* SplitMix64; small, fast and identical everywhere */
+class SynthRng
+{
+public:
+    explicit SynthRng(uint64_t seed) : state(seed) {}
+
+    uint64_t Next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    /* Range    Uniform in [lo, hi] */
+    uint32_t Range(uint32_t lo, uint32_t hi) { return lo + (uint32_t)(Next() % ((uint64_t)hi - lo + 1)); }
+
+    bool Chance(uint32_t percent) { return Next() % 100 < percent; }
+
+    template <typename T, size_t N>
+    T Pick(T (&list)[N]) { return list[Next() % N]; }
+
+private:
+    uint64_t state;
+};
+
+
+/* Little endian stores into a byte vector that is already large enough */
+static void Put16(std::vector<uint8_t> *b, size_t at, uint32_t v)
+{
+    (*b)[at] = (uint8_t)v;
+    (*b)[at + 1] = (uint8_t)(v >> 8);
+}
+
+
+static void Put32(std::vector<uint8_t> *b, size_t at, uint32_t v)
+{
+    Put16(b, at, v & 0xFFFF);
+    Put16(b, at + 2, v >> 16);
+}
+
+
+static void Put64(std::vector<uint8_t> *b, size_t at, uint64_t v)
+{
+    Put32(b, at, (uint32_t)v);
+    Put32(b, at + 4, (uint32_t)(v >> 32));
+}
+
+
+/* Grow    Append zeros
+ * Returns Offset of the first one
+ */
+static size_t Grow(std::vector<uint8_t> *b, size_t count)
+{
+    size_t at = b->size();
+    b->resize(at + count, 0);
+    return at;
+}
+
+
+static size_t AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+
+/* AppendName    Append a NUL terminated string
+ * Returns       Its offset
+ */
+static size_t AppendName(std::vector<uint8_t> *b, const std::string &s)
+{
+    size_t at = Grow(b, s.size() + 1);
+    memcpy(b->data() + at, s.data(), s.size());
+    return at;
+}
+
+
+/* FillRandom    Append bytes that look like code or data: runs of
+ *               repeated bytes mixed with noise, so entropy varies
+ */
+static void FillRandom(SynthRng *rng, std::vector<uint8_t> *b, size_t count)
+{
+    size_t at = Grow(b, count);
+    for (size_t i = 0; i < count; )
+    {
+        size_t run = rng->Range(1, 64);
+        bool noise = rng->Chance(60);
+        uint8_t fill = (uint8_t)rng->Next();
+        for (size_t j = 0; j < run && i < count; ++j, ++i)
+        {
+            (*b)[at + i] = noise ? (uint8_t)rng->Next() : fill;
+        }
+    }
+}
+
+
+/* FunctionName    A plausible API name; serial makes it unique */
+static std::string FunctionName(SynthRng *rng, uint32_t serial)
+{
+    std::string name = rng->Pick(verbs);
+    name += rng->Pick(nouns);
+    if (serial > 0)
+    {
+        char number[16];
+        snprintf(number, sizeof(number), "%u", serial);
+        name += number;
+    }
+    name += rng->Pick(suffixes);
+    return name;
+}
+
+
+/* A section of a synthetic image, before layout */
+typedef struct
+{
+    std::string name;
+    uint32_t characteristics;
+    std::vector<uint8_t> data;
+    uint32_t rva;
+} ImageSection;
+
+
+/* BuildImports    Import descriptors, lookup and address tables, hint/name
+ *                 entries and DLL names, appended to a section at rva base
+ * Returns         RVA of the descriptors; iatRva and iatSize are set
+ */
+static uint32_t BuildImports(SynthRng *rng, std::vector<uint8_t> *b, uint32_t base, bool plus,
+                             const std::vector<std::string> &dlls, uint32_t maxFunctions,
+                             uint32_t *iatRva, uint32_t *iatSize)
+{
+    size_t thunkSize = plus ? 8 : 4;
+    size_t descriptors = Grow(b, (dlls.size() + 1) * 20);
+
+    std::vector<size_t> lookups(dlls.size());
+    std::vector<size_t> counts(dlls.size());
+    for (size_t d = 0; d < dlls.size(); ++d)
+    {
+        counts[d] = rng->Range(1, maxFunctions);
+        lookups[d] = Grow(b, (counts[d] + 1) * thunkSize);
+    }
+
+    /* The address tables sit together, as linkers place them */
+    size_t iat = Grow(b, 0);
+    std::vector<size_t> addresses(dlls.size());
+    for (size_t d = 0; d < dlls.size(); ++d)
+    {
+        addresses[d] = Grow(b, (counts[d] + 1) * thunkSize);
+    }
+    *iatRva = base + (uint32_t)iat;
+    *iatSize = (uint32_t)(b->size() - iat);
+
+    for (size_t d = 0; d < dlls.size(); ++d)
+    {
+        for (size_t f = 0; f < counts[d]; ++f)
+        {
+            uint64_t thunk;
+            if (rng->Chance(8))
+            {
+                thunk = (plus ? 1ull << 63 : 1ull << 31) | rng->Range(1, 400);
+            }
+            else
+            {
+                if (b->size() & 1)
+                {
+                    Grow(b, 1);
+                }
+                size_t hint = Grow(b, 2);
+                Put16(b, hint, rng->Range(0, 2000));
+                AppendName(b, FunctionName(rng, rng->Chance(30) ? (uint32_t)f + 1 : 0));
+                thunk = base + hint;
+            }
+
+            size_t slot = f * thunkSize;
+            if (plus)
+            {
+                Put64(b, lookups[d] + slot, thunk);
+                Put64(b, addresses[d] + slot, thunk);
+            }
+            else
+            {
+                Put32(b, lookups[d] + slot, (uint32_t)thunk);
+                Put32(b, addresses[d] + slot, (uint32_t)thunk);
+            }
+        }
+
+        size_t name = AppendName(b, dlls[d]);
+        size_t descriptor = descriptors + d * 20;
+        Put32(b, descriptor, base + (uint32_t)lookups[d]);        // OriginalFirstThunk
+        Put32(b, descriptor + 12, base + (uint32_t)name);         // Name
+        Put32(b, descriptor + 16, base + (uint32_t)addresses[d]); // FirstThunk
+    }
+
+    return base + (uint32_t)descriptors;
+}
+
+
+/* BuildExports    An export directory with sorted names and an ordinal
+ *                 table, appended to a section at rva base
+ * Returns         RVA of the directory; size is set
+ */
+static uint32_t BuildExports(SynthRng *rng, std::vector<uint8_t> *b, uint32_t base, const std::string &dll,
+                             uint32_t textRva, uint32_t textSize, uint32_t *size)
+{
+    uint32_t functions = rng->Range(1, 300);
+    std::vector<std::string> names;
+    for (uint32_t i = 0; i < functions; ++i)
+    {
+        if (!rng->Chance(10))
+        {
+            names.push_back(FunctionName(rng, i + 1));
+        }
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+
+    size_t start = b->size();
+    size_t directory = Grow(b, 40);
+    size_t addresses = Grow(b, functions * 4);
+    size_t namePointers = Grow(b, names.size() * 4);
+    size_t ordinals = Grow(b, names.size() * 2);
+
+    for (uint32_t i = 0; i < functions; ++i)
+    {
+        Put32(b, addresses + i * 4, textRva + rng->Range(0, textSize - 1));
+    }
+    for (size_t n = 0; n < names.size(); ++n)
+    {
+        size_t name = AppendName(b, names[n]);
+        Put32(b, namePointers + n * 4, base + (uint32_t)name);
+        Put16(b, ordinals + n * 2, rng->Range(0, functions - 1));
+    }
+    size_t dllName = AppendName(b, dll);
+
+    Put32(b, directory + 4, (uint32_t)rng->Next());                 // TimeDateStamp
+    Put32(b, directory + 12, base + (uint32_t)dllName);            // Name
+    Put32(b, directory + 16, 1);                                    // Base
+    Put32(b, directory + 20, functions);
+    Put32(b, directory + 24, (uint32_t)names.size());
+    Put32(b, directory + 28, base + (uint32_t)addresses);
+    Put32(b, directory + 32, base + (uint32_t)namePointers);
+    Put32(b, directory + 36, base + (uint32_t)ordinals);
+
+    *size = (uint32_t)(b->size() - start);
+    return base + (uint32_t)directory;
+}
+
+
+/* A metadata stream under construction: its name and padded contents */
+typedef std::pair<std::string, std::vector<uint8_t> > ClrStream;
+
+
+static void AppendStream(std::vector<ClrStream> *streams, const char *name, const std::vector<uint8_t> &data)
+{
+    streams->push_back(ClrStream(name, data));
+    streams->back().second.resize(AlignUp(data.size(), 4), 0);
+}
+
+
+/* BuildClr    A COR20 header and a metadata root with Module, Assembly and
+ *             AssemblyRef tables, appended to a section at rva base
+ * Returns     RVA of the COR20 header
+ */
+static uint32_t BuildClr(SynthRng *rng, std::vector<uint8_t> *b, uint32_t base)
+{
+    static const char *const references[] =
+    {
+        "System.Runtime", "System.Console", "System.Collections", "System.Linq", "System.Net.Http",
+        "System.Text.Json", "System.Memory", "Microsoft.Extensions.Logging", "Newtonsoft.Json"
+    };
+
+    /* #Strings: the assembly, its module and its references */
+    std::vector<uint8_t> strings(1, 0);
+    char assembly[32];
+    snprintf(assembly, sizeof(assembly), "Synthetic.App%u", rng->Range(1, 9999));
+    uint32_t assemblyName = (uint32_t)AppendName(&strings, assembly);
+    uint32_t moduleName = (uint32_t)AppendName(&strings, std::string(assembly) + ".dll");
+
+    uint32_t referenceCount = rng->Range(1, 9);
+    std::vector<uint32_t> referenceNames;
+    for (uint32_t r = 0; r < referenceCount; ++r)
+    {
+        referenceNames.push_back((uint32_t)AppendName(&strings, references[r]));
+    }
+
+    /* #Blob: one public key token; #GUID: the module version id */
+    std::vector<uint8_t> blob(1, 0);
+    blob.push_back(8);
+    for (int i = 0; i < 8; ++i)
+    {
+        blob.push_back((uint8_t)rng->Next());
+    }
+    std::vector<uint8_t> guid(16);
+    for (int i = 0; i < 16; ++i)
+    {
+        guid[i] = (uint8_t)rng->Next();
+    }
+    std::vector<uint8_t> userStrings(1, 0);
+
+    /* #~: every heap is small, so every index is two bytes */
+    std::vector<uint8_t> tables;
+    Grow(&tables, 24);
+    tables[4] = 2;                                  // MajorVersion
+    tables[7] = 1;                                  // Reserved
+    uint64_t valid = 1ull << 0x00 | 1ull << 0x20 | 1ull << 0x23;
+    Put64(&tables, 8, valid);
+    Put32(&tables, Grow(&tables, 4), 1);            // Module rows
+    Put32(&tables, Grow(&tables, 4), 1);            // Assembly rows
+    Put32(&tables, Grow(&tables, 4), referenceCount);
+
+    size_t module = Grow(&tables, 10);
+    Put16(&tables, module + 2, moduleName);
+    Put16(&tables, module + 4, 1);                  // Mvid
+
+    size_t row = Grow(&tables, 22);
+    Put32(&tables, row, 0x8004);                    // HashAlgId: SHA1
+    Put16(&tables, row + 4, rng->Range(1, 9));
+    Put16(&tables, row + 18, assemblyName);
+
+    for (uint32_t r = 0; r < referenceCount; ++r)
+    {
+        size_t ref = Grow(&tables, 20);
+        Put16(&tables, ref, rng->Range(4, 9));
+        Put16(&tables, ref + 12, 1);                // PublicKeyOrToken
+        Put16(&tables, ref + 14, referenceNames[r]);
+    }
+
+    std::vector<ClrStream> streams;
+    AppendStream(&streams, "#~", tables);
+    AppendStream(&streams, "#Strings", strings);
+    AppendStream(&streams, "#US", userStrings);
+    AppendStream(&streams, "#GUID", guid);
+    AppendStream(&streams, "#Blob", blob);
+
+    /* The root: signature, version string, then a header per stream */
+    std::vector<uint8_t> root;
+    Grow(&root, 16);
+    Put32(&root, 0, 0x424A5342);                    // "BSJB"
+    Put16(&root, 4, 1);
+    Put16(&root, 6, 1);
+    const char version[] = "v4.0.30319";
+    Put32(&root, 12, AlignUp(sizeof(version), 4));
+    size_t at = Grow(&root, AlignUp(sizeof(version), 4));
+    memcpy(root.data() + at, version, sizeof(version));
+    Put16(&root, Grow(&root, 4) + 2, (uint32_t)streams.size());
+
+    std::vector<size_t> headers;
+    for (size_t s = 0; s < streams.size(); ++s)
+    {
+        headers.push_back(Grow(&root, 8));
+        AppendName(&root, streams[s].first);
+        root.resize(AlignUp(root.size(), 4), 0);
+    }
+    for (size_t s = 0; s < streams.size(); ++s)
+    {
+        Put32(&root, headers[s], (uint32_t)root.size());
+        Put32(&root, headers[s] + 4, (uint32_t)streams[s].second.size());
+        root.insert(root.end(), streams[s].second.begin(), streams[s].second.end());
+    }
+
+    b->resize(AlignUp(b->size(), 4), 0);
+    size_t cor20 = Grow(b, 72);
+    size_t metadata = Grow(b, root.size());
+    memcpy(b->data() + metadata, root.data(), root.size());
+
+    Put32(b, cor20, 72);                            // cb
+    Put16(b, cor20 + 4, 2);                         // MajorRuntimeVersion
+    Put16(b, cor20 + 6, 5);
+    Put32(b, cor20 + 8, base + (uint32_t)metadata);
+    Put32(b, cor20 + 12, (uint32_t)root.size());
+    Put32(b, cor20 + 16, 1);                        // COMIMAGE_FLAGS_ILONLY
+    return base + (uint32_t)cor20;
+}
+
+
+/* SynthesizeImage    A PE32 or PE32+ image, native or managed
+ */
+static void SynthesizeImage(SynthRng *rng, SynthKind kind, std::vector<uint8_t> *out)
+{
+    bool plus = kind == SYNTH_PE32PLUS;
+    bool managed = kind == SYNTH_MANAGED;
+    bool dll = !managed && rng->Chance(35);
+    size_t optionalSize = plus ? 240 : 224;
+
+    /* Sections: code, read-only data holding the directories, data, and a
+     * few of the odd ones real binaries carry */
+    std::vector<ImageSection> sections(3);
+    sections[0].name = ".text";
+    sections[0].characteristics = 0x60000020;
+    sections[1].name = ".rdata";
+    sections[1].characteristics = 0x40000040;
+    sections[2].name = ".data";
+    sections[2].characteristics = 0xC0000040;
+    uint32_t extras = managed ? rng->Range(0, 1) : rng->Range(0, 7);
+    for (uint32_t i = 0; i < extras; ++i)
+    {
+        ImageSection extra;
+        extra.name = extraSections[i];
+        extra.characteristics = 0x40000040;
+        sections.push_back(extra);
+    }
+
+    FillRandom(rng, &sections[0].data, rng->Range(0x200, managed ? 0x4000 : 0x20000));
+    sections[0].rva = SYNTH_SECTION_ALIGNMENT;
+    sections[1].rva = sections[0].rva + (uint32_t)AlignUp(sections[0].data.size(), SYNTH_SECTION_ALIGNMENT);
+
+    /* Directories, all in .rdata */
+    std::vector<uint8_t> *rdata = &sections[1].data;
+    uint32_t base = sections[1].rva;
+    FillRandom(rng, rdata, rng->Range(0x10, 0x400));
+
+    std::vector<std::string> dlls;
+    if (managed)
+    {
+        dlls.push_back("mscoree.dll");
+    }
+    else
+    {
+        uint32_t count = rng->Range(1, 8);
+        std::vector<const char *> pool(dllNames, dllNames + sizeof(dllNames) / sizeof(dllNames[0]));
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            size_t pick = rng->Next() % pool.size();
+            dlls.push_back(pool[pick]);
+            pool.erase(pool.begin() + pick);
+        }
+    }
+
+    rdata->resize(AlignUp(rdata->size(), 8), 0);
+    uint32_t iatRva;
+    uint32_t iatSize;
+    uint32_t importRva = BuildImports(rng, rdata, base, plus, dlls, managed ? 1 : 60, &iatRva, &iatSize);
+    uint32_t importSize = (uint32_t)(dlls.size() + 1) * 20;
+
+    uint32_t exportRva = 0;
+    uint32_t exportSize = 0;
+    if (dll)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "synth%u.dll", rng->Range(1, 99999));
+        rdata->resize(AlignUp(rdata->size(), 4), 0);
+        exportRva = BuildExports(rng, rdata, base, name, sections[0].rva, (uint32_t)sections[0].data.size(),
+                                 &exportSize);
+    }
+
+    uint32_t clrRva = managed ? BuildClr(rng, rdata, base) : 0;
+    FillRandom(rng, rdata, rng->Range(0x10, 0x800));
+
+    FillRandom(rng, &sections[2].data, rng->Range(0x200, 0x4000));
+    for (size_t i = 3; i < sections.size(); ++i)
+    {
+        FillRandom(rng, &sections[i].data, rng->Range(0x200, 0x2000));
+    }
+    for (size_t i = 2; i < sections.size(); ++i)
+    {
+        sections[i].rva = sections[i - 1].rva + (uint32_t)AlignUp(sections[i - 1].data.size(), SYNTH_SECTION_ALIGNMENT);
+    }
+
+    /* Headers */
+    size_t table = SYNTH_STUB_END + 4 + 20 + optionalSize;
+    size_t headersSize = AlignUp(table + sections.size() * 40, SYNTH_FILE_ALIGNMENT);
+    std::vector<uint8_t> &b = *out;
+    b.assign(headersSize, 0);
+
+    b[0] = 'M';
+    b[1] = 'Z';
+    Put32(&b, 0x3C, SYNTH_STUB_END);
+    const char stub[] = "This program cannot be run in DOS mode.\r\r\n$";
+    memcpy(b.data() + 0x4E, stub, sizeof(stub) - 1);
+
+    size_t coff = SYNTH_STUB_END + 4;
+    memcpy(b.data() + SYNTH_STUB_END, "PE\0\0", 4);
+    Put16(&b, coff, plus ? 0x8664 : 0x14C);
+    Put16(&b, coff + 2, (uint32_t)sections.size());
+    Put32(&b, coff + 4, (uint32_t)rng->Next());
+    Put16(&b, coff + 16, (uint32_t)optionalSize);
+    Put16(&b, coff + 18, (plus ? 0x0022 : 0x0102) | (dll ? 0x2000 : 0));
+
+    const ImageSection &last = sections.back();
+    uint32_t sizeOfImage = last.rva + (uint32_t)AlignUp(last.data.size(), SYNTH_SECTION_ALIGNMENT);
+    size_t opt = coff + 20;
+    Put16(&b, opt, plus ? 0x20B : 0x10B);
+    b[opt + 2] = 14;                                            // linker version
+    b[opt + 3] = (uint8_t)rng->Range(0, 40);
+    size_t initialized = 0;
+    for (size_t i = 1; i < sections.size(); ++i)
+    {
+        initialized += AlignUp(sections[i].data.size(), SYNTH_FILE_ALIGNMENT);
+    }
+    Put32(&b, opt + 4, (uint32_t)AlignUp(sections[0].data.size(), SYNTH_FILE_ALIGNMENT));
+    Put32(&b, opt + 8, (uint32_t)initialized);
+    Put32(&b, opt + 16, sections[0].rva + rng->Range(0, (uint32_t)sections[0].data.size() - 1));
+    Put32(&b, opt + 20, sections[0].rva);
+    size_t windows;
+    if (plus)
+    {
+        Put64(&b, opt + 24, dll ? 0x180000000ull : 0x140000000ull);
+        windows = opt + 32;
+    }
+    else
+    {
+        Put32(&b, opt + 24, sections[1].rva);                   // BaseOfData
+        Put32(&b, opt + 28, dll ? 0x10000000 : 0x400000);
+        windows = opt + 32;
+    }
+    Put32(&b, windows, SYNTH_SECTION_ALIGNMENT);
+    Put32(&b, windows + 4, SYNTH_FILE_ALIGNMENT);
+    Put16(&b, windows + 8, 6);                                  // OS version
+    Put16(&b, windows + 16, 6);                                 // subsystem version
+    Put32(&b, windows + 24, sizeOfImage);
+    Put32(&b, windows + 28, (uint32_t)headersSize);
+    Put16(&b, windows + 36, managed || rng->Chance(30) ? 3 : 2);  // console or GUI
+    Put16(&b, windows + 38, 0x8160);                            // DllCharacteristics
+    size_t sizes = windows + 40;
+    size_t sizeWidth = plus ? 8 : 4;
+    Put32(&b, sizes, 0x100000);
+    Put32(&b, sizes + sizeWidth, 0x1000);
+    Put32(&b, sizes + 2 * sizeWidth, 0x100000);
+    Put32(&b, sizes + 3 * sizeWidth, 0x1000);
+    size_t directories = sizes + 4 * sizeWidth + 8;
+    Put32(&b, directories - 4, 16);                             // NumberOfRvaAndSizes
+    Put32(&b, directories + 0 * 8, exportRva);
+    Put32(&b, directories + 0 * 8 + 4, exportSize);
+    Put32(&b, directories + 1 * 8, importRva);
+    Put32(&b, directories + 1 * 8 + 4, importSize);
+    Put32(&b, directories + 12 * 8, iatRva);
+    Put32(&b, directories + 12 * 8 + 4, iatSize);
+    if (managed)
+    {
+        Put32(&b, directories + 14 * 8, clrRva);
+        Put32(&b, directories + 14 * 8 + 4, 72);
+    }
+
+    /* Section table and raw data */
+    size_t raw = headersSize;
+    for (size_t i = 0; i < sections.size(); ++i)
+    {
+        size_t header = table + i * 40;
+        size_t rawSize = AlignUp(sections[i].data.size(), SYNTH_FILE_ALIGNMENT);
+        memcpy(b.data() + header, sections[i].name.data(), std::min<size_t>(sections[i].name.size(), 8));
+        Put32(&b, header + 8, (uint32_t)sections[i].data.size());
+        Put32(&b, header + 12, sections[i].rva);
+        Put32(&b, header + 16, (uint32_t)rawSize);
+        Put32(&b, header + 20, (uint32_t)raw);
+        Put32(&b, header + 36, sections[i].characteristics);
+        raw += rawSize;
+    }
+    for (size_t i = 0; i < sections.size(); ++i)
+    {
+        size_t at = Grow(&b, AlignUp(sections[i].data.size(), SYNTH_FILE_ALIGNMENT));
+        memcpy(b.data() + at, sections[i].data.data(), sections[i].data.size());
+    }
+}
+
+
+/* A symbol of a synthetic object */
+typedef struct
+{
+    std::string name;
+    uint32_t value;
+    int16_t section;
+    uint8_t storageClass;
+} ObjectSymbol;
+
+
+/* SynthesizeObject    A COFF object with sections, a symbol table and a
+ *                     string table
+ * Parameters          Generator, output, where to return the names of the
+ *                     external symbols it defines (NULL if not wanted)
+ */
+static void SynthesizeObject(SynthRng *rng, std::vector<uint8_t> *out, std::vector<std::string> *defined,
+                             uint32_t maxSection)
+{
+    uint32_t sectionCount = rng->Range(1, 10);
+    std::vector<uint8_t> &b = *out;
+    b.assign(20 + sectionCount * 40, 0);
+    Put16(&b, 0, rng->Chance(75) ? 0x8664 : 0x14C);
+    Put16(&b, 2, sectionCount);
+    Put32(&b, 4, (uint32_t)rng->Next());
+
+    std::vector<uint32_t> sizes(sectionCount);
+    for (uint32_t i = 0; i < sectionCount; ++i)
+    {
+        const char *name = objectSections[i % (sizeof(objectSections) / sizeof(objectSections[0]))];
+        size_t header = 20 + i * 40;
+        memcpy(b.data() + header, name, std::min<size_t>(strlen(name), 8));
+
+        sizes[i] = rng->Range(0x10, maxSection);
+        Put32(&b, header + 16, sizes[i]);
+        Put32(&b, header + 20, (uint32_t)b.size());
+        Put32(&b, header + 36, i == 0 ? 0x60500020 : 0x40300040);
+        FillRandom(rng, &b, sizes[i]);
+    }
+
+    /* Symbols: the source file, one per section, then externals */
+    std::vector<ObjectSymbol> symbols;
+    uint32_t externals = rng->Range(1, 80);
+    for (uint32_t i = 0; i < externals; ++i)
+    {
+        ObjectSymbol symbol;
+        symbol.name = std::string(rng->Chance(50) ? "?" : "") + FunctionName(rng, i + 1);
+        if (rng->Chance(60))
+        {
+            symbol.section = (int16_t)rng->Range(1, sectionCount);
+            symbol.value = rng->Range(0, sizes[symbol.section - 1] - 1);
+            if (defined != NULL)
+            {
+                defined->push_back(symbol.name);
+            }
+        }
+        else
+        {
+            symbol.section = 0;
+            symbol.value = 0;
+        }
+        symbol.storageClass = 2;                    // IMAGE_SYM_CLASS_EXTERNAL
+        symbols.push_back(symbol);
+    }
+
+    uint32_t records = 2 + sectionCount * 2 + externals;
+    size_t table = Grow(&b, records * 18);
+    Put32(&b, 8, (uint32_t)table);
+    Put32(&b, 12, records);
+
+    std::vector<uint8_t> strings(4, 0);
+    size_t record = table;
+
+    memcpy(b.data() + record, ".file", 5);
+    Put16(&b, record + 12, 0xFFFE);                 // IMAGE_SYM_DEBUG
+    b[record + 16] = 103;                           // IMAGE_SYM_CLASS_FILE
+    b[record + 17] = 1;
+    memcpy(b.data() + record + 18, "synthetic.c", 11);
+    record += 36;
+
+    for (uint32_t i = 0; i < sectionCount; ++i)
+    {
+        const char *name = objectSections[i % (sizeof(objectSections) / sizeof(objectSections[0]))];
+        memcpy(b.data() + record, name, std::min<size_t>(strlen(name), 8));
+        Put16(&b, record + 12, i + 1);
+        b[record + 16] = 3;                         // IMAGE_SYM_CLASS_STATIC
+        b[record + 17] = 1;
+        Put32(&b, record + 18, sizes[i]);           // section definition: Length
+        Put16(&b, record + 30, i + 1);              // Number
+        record += 36;
+    }
+
+    for (size_t i = 0; i < symbols.size(); ++i)
+    {
+        const ObjectSymbol &symbol = symbols[i];
+        if (symbol.name.size() <= 8)
+        {
+            memcpy(b.data() + record, symbol.name.data(), symbol.name.size());
+        }
+        else
+        {
+            Put32(&b, record + 4, (uint32_t)AppendName(&strings, symbol.name));
+        }
+        Put32(&b, record + 8, symbol.value);
+        Put16(&b, record + 12, (uint16_t)symbol.section);
+        Put16(&b, record + 14, 0x20);               // function
+        b[record + 16] = symbol.storageClass;
+        record += 18;
+    }
+
+    Put32(&strings, 0, (uint32_t)strings.size());
+    b.insert(b.end(), strings.begin(), strings.end());
+}
+
+
+/* An archive member before layout */
+typedef struct
+{
+    std::string name;
+    std::vector<uint8_t> data;
+    std::vector<std::string> symbols;       // external symbols it defines, for the linker members
+} ArchiveMember;
+
+
+/* ShortImport    A short import library member for one function
+ */
+static void ShortImport(SynthRng *rng, const std::string &dll, const std::string &symbol, ArchiveMember *member)
+{
+    std::vector<uint8_t> &b = member->data;
+    b.assign(20, 0);
+    Put16(&b, 2, 0xFFFF);
+    Put16(&b, 6, 0x8664);
+    Put32(&b, 8, (uint32_t)rng->Next());
+    AppendName(&b, symbol);
+    AppendName(&b, dll);
+    Put32(&b, 12, (uint32_t)b.size() - 20);
+    Put16(&b, 16, rng->Range(0, 2000));
+    Put16(&b, 18, 1 << 2);                          // code, IMPORT_OBJECT_NAME
+
+    member->name = dll;
+    member->symbols.push_back("__imp_" + symbol);
+    member->symbols.push_back(symbol);
+}
+
+
+/* PutField    Write a space padded ar header field
+ */
+static void PutField(std::vector<uint8_t> *b, size_t at, size_t width, const std::string &value)
+{
+    memset(b->data() + at, ' ', width);
+    memcpy(b->data() + at, value.data(), std::min(width, value.size()));
+}
+
+
+/* AppendMember    Append a member header and its data, padded to an even
+ *                 offset
+ */
+static void AppendMember(std::vector<uint8_t> *b, const std::string &name, const std::vector<uint8_t> &data)
+{
+    size_t header = Grow(b, 60);
+    char size[16];
+    snprintf(size, sizeof(size), "%u", (unsigned)data.size());
+    PutField(b, header, 16, name);
+    PutField(b, header + 16, 12, "0");
+    PutField(b, header + 28, 6, "");
+    PutField(b, header + 34, 6, "");
+    PutField(b, header + 40, 8, "0");
+    PutField(b, header + 48, 10, size);
+    (*b)[header + 58] = '`';
+    (*b)[header + 59] = '\n';
+    b->insert(b->end(), data.begin(), data.end());
+    if (b->size() & 1)
+    {
+        b->push_back('\n');
+    }
+}
+
+
+/* SynthesizeArchive    A static library of objects, or an import library
+ *                      of short import members and a few objects, with
+ *                      both linker members and a long names member
+ */
+static void SynthesizeArchive(SynthRng *rng, std::vector<uint8_t> *out)
+{
+    std::vector<ArchiveMember> members;
+    bool importLibrary = rng->Chance(40);
+    if (importLibrary)
+    {
+        std::string dll = rng->Pick(dllNames);
+        uint32_t functions = rng->Range(10, 200);
+        for (uint32_t i = 0; i < functions; ++i)
+        {
+            ArchiveMember member;
+            ShortImport(rng, dll, FunctionName(rng, i + 1), &member);
+            members.push_back(member);
+        }
+    }
+
+    uint32_t objects = importLibrary ? rng->Range(1, 3) : rng->Range(4, 40);
+    for (uint32_t i = 0; i < objects; ++i)
+    {
+        ArchiveMember member;
+        char name[64];
+        snprintf(name, sizeof(name), rng->Chance(50) ? "obj%u.obj" : "src/synthetic_module_%u.obj", i);
+        member.name = name;
+        SynthesizeObject(rng, &member.data, &member.symbols, 0x800);
+        members.push_back(member);
+    }
+
+    /* Long names, then header names */
+    std::vector<uint8_t> longNames;
+    std::vector<std::string> headerNames;
+    for (size_t m = 0; m < members.size(); ++m)
+    {
+        if (members[m].name.size() < 16)
+        {
+            headerNames.push_back(members[m].name + "/");
+        }
+        else
+        {
+            headerNames.push_back("/" + std::to_string(longNames.size()));
+            AppendName(&longNames, members[m].name);
+        }
+    }
+
+    /* Symbols in member order, and sorted for the second linker member */
+    std::vector<std::pair<std::string, uint32_t> > symbols;
+    for (size_t m = 0; m < members.size(); ++m)
+    {
+        for (size_t s = 0; s < members[m].symbols.size(); ++s)
+        {
+            symbols.push_back(std::make_pair(members[m].symbols[s], (uint32_t)m));
+        }
+    }
+    std::vector<std::pair<std::string, uint32_t> > sorted = symbols;
+    std::sort(sorted.begin(), sorted.end());
+
+    size_t namesSize = 0;
+    for (size_t s = 0; s < symbols.size(); ++s)
+    {
+        namesSize += symbols[s].first.size() + 1;
+    }
+    size_t firstSize = 4 + symbols.size() * 4 + namesSize;
+    size_t secondSize = 4 + members.size() * 4 + 4 + symbols.size() * 2 + namesSize;
+
+    /* Member offsets follow from the sizes alone */
+    size_t offset = 8;
+    offset += 60 + AlignUp(firstSize, 2);
+    offset += 60 + AlignUp(secondSize, 2);
+    if (!longNames.empty())
+    {
+        offset += 60 + AlignUp(longNames.size(), 2);
+    }
+    std::vector<uint32_t> offsets;
+    for (size_t m = 0; m < members.size(); ++m)
+    {
+        offsets.push_back((uint32_t)offset);
+        offset += 60 + AlignUp(members[m].data.size(), 2);
+    }
+
+    std::vector<uint8_t> first;
+    Grow(&first, 4 + symbols.size() * 4);
+    first[0] = (uint8_t)(symbols.size() >> 24);
+    first[1] = (uint8_t)(symbols.size() >> 16);
+    first[2] = (uint8_t)(symbols.size() >> 8);
+    first[3] = (uint8_t)symbols.size();
+    for (size_t s = 0; s < symbols.size(); ++s)
+    {
+        uint32_t at = offsets[symbols[s].second];
+        first[4 + s * 4] = (uint8_t)(at >> 24);
+        first[5 + s * 4] = (uint8_t)(at >> 16);
+        first[6 + s * 4] = (uint8_t)(at >> 8);
+        first[7 + s * 4] = (uint8_t)at;
+    }
+    for (size_t s = 0; s < symbols.size(); ++s)
+    {
+        AppendName(&first, symbols[s].first);
+    }
+
+    std::vector<uint8_t> second;
+    Put32(&second, Grow(&second, 4), (uint32_t)members.size());
+    for (size_t m = 0; m < members.size(); ++m)
+    {
+        Put32(&second, Grow(&second, 4), offsets[m]);
+    }
+    Put32(&second, Grow(&second, 4), (uint32_t)sorted.size());
+    for (size_t s = 0; s < sorted.size(); ++s)
+    {
+        Put16(&second, Grow(&second, 2), sorted[s].second + 1);
+    }
+    for (size_t s = 0; s < sorted.size(); ++s)
+    {
+        AppendName(&second, sorted[s].first);
+    }
+
+    std::vector<uint8_t> &b = *out;
+    b.assign((const uint8_t *)"!<arch>\n", (const uint8_t *)"!<arch>\n" + 8);
+    AppendMember(&b, "/", first);
+    AppendMember(&b, "/", second);
+    if (!longNames.empty())
+    {
+        AppendMember(&b, "//", longNames);
+    }
+    for (size_t m = 0; m < members.size(); ++m)
+    {
+        AppendMember(&b, headerNames[m], members[m].data);
+    }
+}
+
+
+/* SynthKindName    Short name of a kind, as used in paths and reports
+ */
+const char *SynthKindName(SynthKind kind)
+{
+    return kind < SYNTH_KINDS ? kindNames[kind] : "unknown";
+}
+
+
+/* SynthesizeFile    Build one file in memory
+ * Parameters        Kind, seed of the file, bytes to fill
+ */
+void SynthesizeFile(SynthKind kind, uint64_t seed, std::vector<uint8_t> *bytes)
+{
+    SynthRng rng(seed);
+    switch (kind)
+    {
+    case SYNTH_PE32:
+    case SYNTH_PE32PLUS:
+    case SYNTH_MANAGED:
+        SynthesizeImage(&rng, kind, bytes);
+        break;
+    case SYNTH_COFF:
+        SynthesizeObject(&rng, bytes, NULL, 0x4000);
+        break;
+    case SYNTH_ARCHIVE:
+        SynthesizeArchive(&rng, bytes);
+        break;
+    default:
+        bytes->clear();
+        break;
+    }
+}
+
+
+/* MakeDirectory    Create a directory if it isn't there
+ */
+static bool MakeDirectory(const std::string &path)
+{
+#ifdef _WIN32
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+
+/* GenerateCorpus    Write a corpus under a directory, one subdirectory
+ *                   per kind, replacing files of the same names
+ * Parameters        Directory, seed and scale, files to fill in the order
+ *                   they were written
+ * Returns           false if a file could not be written
+ */
+bool GenerateCorpus(const char *dir, const SynthOptions *options, std::vector<SynthFile> *files)
+{
+    static const char *const extensions[SYNTH_KINDS] = { "exe", "exe", "dll", "obj", "lib" };
+
+    if (!MakeDirectory(dir))
+    {
+        return false;
+    }
+
+    std::vector<uint8_t> bytes;
+    for (int k = 0; k < SYNTH_KINDS; ++k)
+    {
+        SynthKind kind = (SynthKind)k;
+        std::string subdirectory = std::string(dir) + "/" + kindNames[k];
+        if (!MakeDirectory(subdirectory))
+        {
+            return false;
+        }
+
+        uint32_t count = kindCounts[k] * (options->scale > 0 ? options->scale : 1);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            /* Each file has its own stream, so adding kinds or files
+             * leaves the others unchanged */
+            SynthRng mix(options->seed ^ ((uint64_t)k << 32 | i));
+            SynthesizeFile(kind, mix.Next(), &bytes);
+
+            char name[32];
+            snprintf(name, sizeof(name), "/%s-%05u.%s", kindNames[k], i, extensions[k]);
+            SynthFile file = { subdirectory + name, kind, bytes.size() };
+
+            FILE *out = fopen(file.path.c_str(), "wb");
+            if (out == NULL)
+            {
+                return false;
+            }
+            bool ok = fwrite(bytes.data(), 1, bytes.size(), out) == bytes.size();
+            ok = fclose(out) == 0 && ok;
+            if (!ok)
+            {
+                return false;
+            }
+            files->push_back(file);
+        }
+    }
+    return true;
+}
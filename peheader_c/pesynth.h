@@ -0,0 +1,40 @@
+#ifndef _PESYNTH
+#define _PESYNTH
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#define SYNTH_VERSION   1       /* Bumped whenever the same seed starts producing different files */
+
+typedef enum
+{
+    SYNTH_PE32,             // native PE32 executables and DLLs
+    SYNTH_PE32PLUS,         // native PE32+ executables and DLLs
+    SYNTH_MANAGED,          // PE32 images with CLR metadata
+    SYNTH_COFF,             // bare COFF objects with symbol tables
+    SYNTH_ARCHIVE,          // ar archives: static libraries and import libraries
+    SYNTH_KINDS
+} SynthKind;
+
+typedef struct
+{
+    uint64_t seed;
+    uint32_t scale;         // multiplies the number of files of every kind
+} SynthOptions;
+
+/* One generated file */
+typedef struct
+{
+    std::string path;
+    SynthKind kind;
+    uint64_t size;
+} SynthFile;
+
+const char *SynthKindName(SynthKind kind);
+void SynthesizeFile(SynthKind kind, uint64_t seed, std::vector<uint8_t> *bytes);
+bool GenerateCorpus(const char *dir, const SynthOptions *options, std::vector<SynthFile> *files);
+
+#endif // _PESYNTH
@@ -0,0 +1,1549 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     petest - Regression tests for the peheader command line
+//  File:       petest.cpp
+//  Author:     Mark Coppa
+//
+//  Writes a small set of fixtures, some from the deterministic generator
+//  (pesynth.cpp) and one image built here with a debug directory, an
+//  exception table and base relocations, then runs peheader over them
+//  and checks what it prints: NDJSON against a stored expectation, every
+//  NDJSON line through a strict JSON parser, and the answers of the
+//  --where filters, the scan cache, carving, rebasing, the PDB and
+//  similarity indexes and --function-at.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define popen _popen
+#define pclose _pclose
+#else
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pedigest.h"
+#include "pesynth.h"
+
+#define TEST_DEFAULT_DIR        "check-fixtures"
+#define TEST_SEED               0x5045544553543031ull   /* "PETEST01" */
+#define TEST_FILES_PER_KIND     2
+
+/* The hand built image */
+#define HAND_IMAGE_BASE         0x180000000ull
+#define HAND_REBASE_TO          0x7FF612340000ull
+#define HAND_POINTERS           4                       /* relocated pointers at the start of .rdata */
+#define HAND_PDB_AGE            3
+#define HAND_PDB_PATH           "C:\\build\\petest.pdb"
+
+static const uint8_t handGuid[16] =
+{
+    0x78, 0x56, 0x34, 0x12, 0xBC, 0x9A, 0xF0, 0xDE, 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF
+};
+
+/* What every test gets */
+typedef struct
+{
+    std::string peheader;               // command that runs peheader
+    std::string dir;                    // where the fixtures are
+    std::vector<std::string> files;     // every fixture, in a fixed order
+    std::string list;                   // @listfile naming them
+    std::string handmade;               // the hand built image
+} Fixtures;
+
+
+//////////////////////////////////////////////////////////////////////////////
+//  A strict JSON parser, just enough to check the NDJSON and read fields
+//  back out of it. Strings must be valid UTF-8 and are decoded to UTF-8.
+//////////////////////////////////////////////////////////////////////////////
+
+typedef enum
+{
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+} JsonType;
+
+struct JsonValue
+{
+    JsonType type;
+    bool boolean;
+    std::string text;                   // strings decoded; numbers as written
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue> > members;
+
+    JsonValue() : type(JSON_NULL), boolean(false) {}
+
+    /* Get    Member of an object by name, NULL if there is none */
+    const JsonValue *Get(const char *name) const
+    {
+        for (size_t i = 0; i < members.size(); ++i)
+        {
+            if (members[i].first == name)
+            {
+                return &members[i].second;
+            }
+        }
+        return NULL;
+    }
+
+    uint64_t Number() const { return type == JSON_NUMBER ? strtoull(text.c_str(), NULL, 10) : 0; }
+};
+
+class JsonParser
+{
+public:
+    JsonParser(const std::string &text) : p(text.data()), end(text.data() + text.size()) {}
+
+    bool Parse(JsonValue *value, std::string *error)
+    {
+        bool ok = Value(value, 0);
+        Space();
+        if (ok && p != end)
+        {
+            ok = Fail("trailing characters");
+        }
+        if (!ok && error != NULL)
+        {
+            *error = message;
+        }
+        return ok;
+    }
+
+private:
+    enum { MAX_DEPTH = 64 };
+
+    bool Fail(const char *what)
+    {
+        if (message.empty())
+        {
+            message = what;
+        }
+        return false;
+    }
+
+    void Space()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        {
+            ++p;
+        }
+    }
+
+    bool Literal(const char *word)
+    {
+        size_t len = strlen(word);
+        if ((size_t)(end - p) < len || memcmp(p, word, len) != 0)
+        {
+            return Fail("bad literal");
+        }
+        p += len;
+        return true;
+    }
+
+    bool Value(JsonValue *value, int depth)
+    {
+        Space();
+        if (p == end)
+        {
+            return Fail("unexpected end");
+        }
+        if (depth > MAX_DEPTH)
+        {
+            return Fail("nested too deeply");
+        }
+
+        switch (*p)
+        {
+        case '{':
+            return Object(value, depth);
+        case '[':
+            return Array(value, depth);
+        case '"':
+            value->type = JSON_STRING;
+            return String(&value->text);
+        case 't':
+            value->type = JSON_BOOL;
+            value->boolean = true;
+            return Literal("true");
+        case 'f':
+            value->type = JSON_BOOL;
+            return Literal("false");
+        case 'n':
+            value->type = JSON_NULL;
+            return Literal("null");
+        default:
+            value->type = JSON_NUMBER;
+            return Number(&value->text);
+        }
+    }
+
+    bool Object(JsonValue *value, int depth)
+    {
+        value->type = JSON_OBJECT;
+        ++p;
+        Space();
+        if (p < end && *p == '}')
+        {
+            ++p;
+            return true;
+        }
+        for (;;)
+        {
+            std::pair<std::string, JsonValue> member;
+            Space();
+            if (p == end || *p != '"' || !String(&member.first))
+            {
+                return Fail("expected a member name");
+            }
+            Space();
+            if (p == end || *p++ != ':')
+            {
+                return Fail("expected ':'");
+            }
+            if (!Value(&member.second, depth + 1))
+            {
+                return false;
+            }
+            value->members.push_back(member);
+            Space();
+            if (p == end)
+            {
+                return Fail("unterminated object");
+            }
+            if (*p == '}')
+            {
+                ++p;
+                return true;
+            }
+            if (*p++ != ',')
+            {
+                return Fail("expected ',' or '}'");
+            }
+        }
+    }
+
+    bool Array(JsonValue *value, int depth)
+    {
+        value->type = JSON_ARRAY;
+        ++p;
+        Space();
+        if (p < end && *p == ']')
+        {
+            ++p;
+            return true;
+        }
+        for (;;)
+        {
+            value->items.push_back(JsonValue());
+            if (!Value(&value->items.back(), depth + 1))
+            {
+                return false;
+            }
+            Space();
+            if (p == end)
+            {
+                return Fail("unterminated array");
+            }
+            if (*p == ']')
+            {
+                ++p;
+                return true;
+            }
+            if (*p++ != ',')
+            {
+                return Fail("expected ',' or ']'");
+            }
+        }
+    }
+
+    bool Number(std::string *text)
+    {
+        const char *start = p;
+        if (p < end && *p == '-')
+        {
+            ++p;
+        }
+        if (p < end && *p == '0')
+        {
+            ++p;
+        }
+        else if (p < end && *p >= '1' && *p <= '9')
+        {
+            while (p < end && *p >= '0' && *p <= '9')
+            {
+                ++p;
+            }
+        }
+        else
+        {
+            return Fail("bad number");
+        }
+        if (p < end && *p == '.')
+        {
+            ++p;
+            if (p == end || *p < '0' || *p > '9')
+            {
+                return Fail("bad fraction");
+            }
+            while (p < end && *p >= '0' && *p <= '9')
+            {
+                ++p;
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            ++p;
+            if (p < end && (*p == '+' || *p == '-'))
+            {
+                ++p;
+            }
+            if (p == end || *p < '0' || *p > '9')
+            {
+                return Fail("bad exponent");
+            }
+            while (p < end && *p >= '0' && *p <= '9')
+            {
+                ++p;
+            }
+        }
+        text->assign(start, p);
+        return true;
+    }
+
+    static void PutUtf8(std::string *out, uint32_t c)
+    {
+        if (c < 0x80)
+        {
+            *out += (char)c;
+        }
+        else if (c < 0x800)
+        {
+            *out += (char)(0xC0 | (c >> 6));
+            *out += (char)(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            *out += (char)(0xE0 | (c >> 12));
+            *out += (char)(0x80 | ((c >> 6) & 0x3F));
+            *out += (char)(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            *out += (char)(0xF0 | (c >> 18));
+            *out += (char)(0x80 | ((c >> 12) & 0x3F));
+            *out += (char)(0x80 | ((c >> 6) & 0x3F));
+            *out += (char)(0x80 | (c & 0x3F));
+        }
+    }
+
+    bool Hex4(uint32_t *value)
+    {
+        *value = 0;
+        for (int i = 0; i < 4; ++i, ++p)
+        {
+            if (p == end)
+            {
+                return Fail("short \\u escape");
+            }
+            char c = *p;
+            uint32_t digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                             c >= 'A' && c <= 'F' ? c - 'A' + 10 : 16;
+            if (digit == 16)
+            {
+                return Fail("bad \\u escape");
+            }
+            *value = *value << 4 | digit;
+        }
+        return true;
+    }
+
+    /* Utf8    One raw multibyte character, checked the way RFC 3629 has it */
+    bool Utf8(std::string *out)
+    {
+        uint8_t lead = (uint8_t)*p;
+        size_t count = lead >= 0xC2 && lead <= 0xDF ? 1 : lead >= 0xE0 && lead <= 0xEF ? 2 :
+                       lead >= 0xF0 && lead <= 0xF4 ? 3 : 0;
+        if (count == 0 || (size_t)(end - p) <= count)
+        {
+            return Fail("invalid UTF-8");
+        }
+
+        uint32_t c = lead & (0x3F >> count);
+        for (size_t i = 1; i <= count; ++i)
+        {
+            uint8_t next = (uint8_t)p[i];
+            if ((next & 0xC0) != 0x80)
+            {
+                return Fail("invalid UTF-8");
+            }
+            c = c << 6 | (next & 0x3F);
+        }
+        if ((count == 2 && (c < 0x800 || (c >= 0xD800 && c <= 0xDFFF))) || (count == 3 && (c < 0x10000 || c > 0x10FFFF)))
+        {
+            return Fail("invalid UTF-8");
+        }
+
+        out->append(p, count + 1);
+        p += count + 1;
+        return true;
+    }
+
+    bool String(std::string *out)
+    {
+        ++p;
+        for (;;)
+        {
+            if (p == end)
+            {
+                return Fail("unterminated string");
+            }
+            uint8_t c = (uint8_t)*p;
+            if (c == '"')
+            {
+                ++p;
+                return true;
+            }
+            if (c < 0x20)
+            {
+                return Fail("control character in string");
+            }
+            if (c >= 0x80)
+            {
+                if (!Utf8(out))
+                {
+                    return false;
+                }
+                continue;
+            }
+            ++p;
+            if (c != '\\')
+            {
+                *out += (char)c;
+                continue;
+            }
+
+            if (p == end)
+            {
+                return Fail("unterminated escape");
+            }
+            char escape = *p++;
+            switch (escape)
+            {
+            case '"': *out += '"'; break;
+            case '\\': *out += '\\'; break;
+            case '/': *out += '/'; break;
+            case 'b': *out += '\b'; break;
+            case 'f': *out += '\f'; break;
+            case 'n': *out += '\n'; break;
+            case 'r': *out += '\r'; break;
+            case 't': *out += '\t'; break;
+            case 'u':
+            {
+                uint32_t unit;
+                if (!Hex4(&unit))
+                {
+                    return false;
+                }
+                if (unit >= 0xDC00 && unit <= 0xDFFF)
+                {
+                    return Fail("lone low surrogate");
+                }
+                if (unit >= 0xD800 && unit <= 0xDBFF)
+                {
+                    uint32_t low;
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                    {
+                        return Fail("lone high surrogate");
+                    }
+                    p += 2;
+                    if (!Hex4(&low) || low < 0xDC00 || low > 0xDFFF)
+                    {
+                        return Fail("lone high surrogate");
+                    }
+                    unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                }
+                PutUtf8(out, unit);
+                break;
+            }
+            default:
+                return Fail("bad escape");
+            }
+        }
+    }
+
+    const char *p;
+    const char *end;
+    std::string message;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+//  Test plumbing
+//////////////////////////////////////////////////////////////////////////////
+
+static const char *currentTest = "";
+static unsigned failures = 0;
+static unsigned testFailures = 0;
+
+
+/* Expect    Count a failed check and say what it was
+ * Parameters    Whether the check held, printf style description
+ * Returns       The check
+ */
+static bool Expect(bool ok, const char *format, ...)
+{
+    if (!ok)
+    {
+        va_list args;
+        va_start(args, format);
+        fprintf(stderr, "FAIL %s: ", currentTest);
+        vfprintf(stderr, format, args);
+        fputc('\n', stderr);
+        va_end(args);
+        ++testFailures;
+    }
+    return ok;
+}
+
+
+/* Quote    A path as one shell word */
+static std::string Quote(const std::string &path)
+{
+    std::string quoted = "'";
+    for (size_t i = 0; i < path.size(); ++i)
+    {
+        quoted += path[i] == '\'' ? std::string("'\\''") : std::string(1, path[i]);
+    }
+    return quoted + "'";
+}
+
+
+/* Run           Run peheader and collect what it prints
+ * Parameters    Fixtures, arguments (already quoted), output to fill,
+ *               whether stderr goes to the output too
+ * Returns       Exit status, -1 if it could not be run
+ */
+static int Run(const Fixtures *fixtures, const std::string &args, std::string *output, bool withErrors = false)
+{
+    std::string command = fixtures->peheader + " " + args + (withErrors ? " 2>&1" : " 2>/dev/null");
+    FILE *pipe = popen(command.c_str(), "r");
+    output->clear();
+    if (pipe == NULL)
+    {
+        return -1;
+    }
+
+    char chunk[4096];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), pipe)) > 0)
+    {
+        output->append(chunk, got);
+    }
+
+    int status = pclose(pipe);
+#ifdef _WIN32
+    return status;
+#else
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
+
+
+/* SplitLines    The lines of some output, without their line breaks */
+static std::vector<std::string> SplitLines(const std::string &text)
+{
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while (start < text.size())
+    {
+        size_t next = text.find('\n', start);
+        if (next == std::string::npos)
+        {
+            next = text.size();
+        }
+        lines.push_back(text.substr(start, next - start));
+        start = next + 1;
+    }
+    return lines;
+}
+
+
+/* ParseLines    Parse every line of NDJSON output
+ * Parameters    Output, values to fill, what produced it for messages
+ * Returns       false (after reporting each) if any line isn't JSON
+ */
+static bool ParseLines(const std::string &output, std::vector<JsonValue> *values, const char *what)
+{
+    std::vector<std::string> lines = SplitLines(output);
+    bool ok = true;
+    values->clear();
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        JsonValue value;
+        std::string error;
+        if (!JsonParser(lines[i]).Parse(&value, &error))
+        {
+            ok = Expect(false, "%s: line %zu is not JSON (%s): %.200s", what, i + 1, error.c_str(), lines[i].c_str());
+            continue;
+        }
+        values->push_back(value);
+    }
+    return ok;
+}
+
+
+static bool WriteFile(const std::string &path, const std::vector<uint8_t> &bytes)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == NULL)
+    {
+        return false;
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    return fclose(f) == 0 && ok;
+}
+
+
+static bool ReadFile(const std::string &path, std::string *text)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    text->clear();
+    if (f == NULL)
+    {
+        return false;
+    }
+    char chunk[4096];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    {
+        text->append(chunk, got);
+    }
+    fclose(f);
+    return true;
+}
+
+
+static bool MakeDirectory(const std::string &path)
+{
+#ifdef _WIN32
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+//  Fixtures
+//////////////////////////////////////////////////////////////////////////////
+
+static void Put16(std::vector<uint8_t> *b, size_t at, uint32_t v)
+{
+    (*b)[at] = (uint8_t)v;
+    (*b)[at + 1] = (uint8_t)(v >> 8);
+}
+
+static void Put32(std::vector<uint8_t> *b, size_t at, uint32_t v)
+{
+    Put16(b, at, v & 0xFFFF);
+    Put16(b, at + 2, v >> 16);
+}
+
+static void Put64(std::vector<uint8_t> *b, size_t at, uint64_t v)
+{
+    Put32(b, at, (uint32_t)v);
+    Put32(b, at + 4, (uint32_t)(v >> 32));
+}
+
+
+/* Where things are in the hand built image: three sections of 0x200
+ * file bytes each, one page apart in memory */
+#define HAND_PE               0x80
+#define HAND_OPTIONAL         (HAND_PE + 4 + 20)
+#define HAND_DIRECTORIES      (HAND_OPTIONAL + 112)
+#define HAND_SECTIONS         (HAND_OPTIONAL + 240)
+#define HAND_TEXT_RAW         0x200
+#define HAND_RDATA_RAW        0x400
+#define HAND_RELOC_RAW        0x600
+#define HAND_DEBUG_RVA        0x2040
+#define HAND_CODEVIEW_RVA     0x2080
+#define HAND_UNWIND_RVA       0x2100
+#define HAND_PDATA_RVA        0x2180
+
+/* Functions of the exception table: begin, end, unwind data */
+static const uint32_t handFunctions[][3] =
+{
+    { 0x1000, 0x1040, HAND_UNWIND_RVA },
+    { 0x1050, 0x10A0, HAND_UNWIND_RVA + 8 },
+};
+
+
+/* BuildHandImage    A PE32+ DLL with what the generator doesn't make: a
+ *                   CodeView debug record, an exception table with
+ *                   unwind data, and DIR64 relocations of pointers in
+ *                   .rdata
+ */
+static void BuildHandImage(std::vector<uint8_t> *out)
+{
+    std::vector<uint8_t> &b = *out;
+    b.assign(0x800, 0);
+
+    b[0] = 'M';
+    b[1] = 'Z';
+    Put32(&b, 0x3C, HAND_PE);
+    memcpy(b.data() + HAND_PE, "PE\0\0", 4);
+    Put16(&b, HAND_PE + 4, 0x8664);
+    Put16(&b, HAND_PE + 6, 3);
+    Put32(&b, HAND_PE + 8, 0x5F000000);
+    Put16(&b, HAND_PE + 20, 240);
+    Put16(&b, HAND_PE + 22, 0x2022);
+
+    size_t opt = HAND_OPTIONAL;
+    Put16(&b, opt, 0x20B);
+    b[opt + 2] = 14;
+    Put32(&b, opt + 4, 0x200);
+    Put32(&b, opt + 8, 0x400);
+    Put32(&b, opt + 16, 0x1000);
+    Put32(&b, opt + 20, 0x1000);
+    Put64(&b, opt + 24, HAND_IMAGE_BASE);
+    Put32(&b, opt + 32, 0x1000);
+    Put32(&b, opt + 36, 0x200);
+    Put16(&b, opt + 40, 6);
+    Put16(&b, opt + 48, 6);
+    Put32(&b, opt + 56, 0x4000);                    // SizeOfImage
+    Put32(&b, opt + 60, 0x200);                     // SizeOfHeaders
+    Put16(&b, opt + 68, 3);
+    Put16(&b, opt + 70, 0x0160);
+    Put32(&b, opt + 108, 16);                       // NumberOfRvaAndSizes
+    Put32(&b, HAND_DIRECTORIES + 3 * 8, HAND_PDATA_RVA);
+    Put32(&b, HAND_DIRECTORIES + 3 * 8 + 4, sizeof(handFunctions) / sizeof(handFunctions[0]) * 12);
+    Put32(&b, HAND_DIRECTORIES + 5 * 8, 0x3000);
+    Put32(&b, HAND_DIRECTORIES + 5 * 8 + 4, 8 + HAND_POINTERS * 2);
+    Put32(&b, HAND_DIRECTORIES + 6 * 8, HAND_DEBUG_RVA);
+    Put32(&b, HAND_DIRECTORIES + 6 * 8 + 4, 28);
+
+    static const char *const names[3] = { ".text", ".rdata", ".reloc" };
+    static const uint32_t characteristics[3] = { 0x60000020, 0x40000040, 0x42000040 };
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        size_t header = HAND_SECTIONS + i * 40;
+        memcpy(b.data() + header, names[i], strlen(names[i]));
+        Put32(&b, header + 8, 0x200);
+        Put32(&b, header + 12, 0x1000 * (i + 1));
+        Put32(&b, header + 16, 0x200);
+        Put32(&b, header + 20, HAND_TEXT_RAW + i * 0x200);
+        Put32(&b, header + 36, characteristics[i]);
+    }
+
+    memset(b.data() + HAND_TEXT_RAW, 0xCC, 0x200);
+
+    /* .rdata: pointers into .text, then the directories */
+    size_t rdata = HAND_RDATA_RAW;
+    for (uint32_t i = 0; i < HAND_POINTERS; ++i)
+    {
+        Put64(&b, rdata + i * 8, HAND_IMAGE_BASE + 0x1000 + i * 0x10);
+    }
+
+    const size_t pdbPathSize = sizeof(HAND_PDB_PATH);
+    size_t debug = rdata + (HAND_DEBUG_RVA - 0x2000);
+    Put32(&b, debug + 4, 0x5F000000);
+    Put32(&b, debug + 12, 2);                       // IMAGE_DEBUG_TYPE_CODEVIEW
+    Put32(&b, debug + 16, (uint32_t)(24 + pdbPathSize));
+    Put32(&b, debug + 20, HAND_CODEVIEW_RVA);
+    Put32(&b, debug + 24, (uint32_t)(rdata + (HAND_CODEVIEW_RVA - 0x2000)));
+
+    size_t codeView = rdata + (HAND_CODEVIEW_RVA - 0x2000);
+    memcpy(b.data() + codeView, "RSDS", 4);
+    memcpy(b.data() + codeView + 4, handGuid, sizeof(handGuid));
+    Put32(&b, codeView + 20, HAND_PDB_AGE);
+    memcpy(b.data() + codeView + 24, HAND_PDB_PATH, pdbPathSize);
+
+    /* Unwind data: sub rsp, 40 after four bytes of prolog; push rbx after one */
+    static const uint8_t unwind[16] =
+    {
+        0x01, 0x04, 0x01, 0x00, 0x04, 0x42, 0x00, 0x00,
+        0x01, 0x01, 0x01, 0x00, 0x01, 0x30, 0x00, 0x00
+    };
+    memcpy(b.data() + rdata + (HAND_UNWIND_RVA - 0x2000), unwind, sizeof(unwind));
+    for (size_t i = 0; i < sizeof(handFunctions) / sizeof(handFunctions[0]); ++i)
+    {
+        size_t entry = rdata + (HAND_PDATA_RVA - 0x2000) + i * 12;
+        Put32(&b, entry, handFunctions[i][0]);
+        Put32(&b, entry + 4, handFunctions[i][1]);
+        Put32(&b, entry + 8, handFunctions[i][2]);
+    }
+
+    /* .reloc: one block with a DIR64 entry per pointer */
+    Put32(&b, HAND_RELOC_RAW, 0x2000);
+    Put32(&b, HAND_RELOC_RAW + 4, 8 + HAND_POINTERS * 2);
+    for (uint32_t i = 0; i < HAND_POINTERS; ++i)
+    {
+        Put16(&b, HAND_RELOC_RAW + 8 + i * 2, 0xA000 | (i * 8));
+    }
+}
+
+
+/* WriteFixtures    Write every fixture and the list file naming them
+ * Returns          false if one could not be written
+ */
+static bool WriteFixtures(Fixtures *fixtures)
+{
+    static const char *const extensions[SYNTH_KINDS] = { "exe", "exe", "dll", "obj", "lib" };
+
+    if (!MakeDirectory(fixtures->dir))
+    {
+        return false;
+    }
+
+    std::vector<uint8_t> bytes;
+    for (int k = 0; k < SYNTH_KINDS; ++k)
+    {
+        for (uint32_t n = 0; n < TEST_FILES_PER_KIND; ++n)
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "/%s-%u.%s", SynthKindName((SynthKind)k), n, extensions[k]);
+            std::string path = fixtures->dir + name;
+            SynthesizeFile((SynthKind)k, TEST_SEED + k * 0x100 + n, &bytes);
+            if (!WriteFile(path, bytes))
+            {
+                return false;
+            }
+            fixtures->files.push_back(path);
+        }
+    }
+
+    fixtures->handmade = fixtures->dir + "/handmade.dll";
+    BuildHandImage(&bytes);
+    if (!WriteFile(fixtures->handmade, bytes))
+    {
+        return false;
+    }
+    fixtures->files.push_back(fixtures->handmade);
+
+    std::string list;
+    for (size_t i = 0; i < fixtures->files.size(); ++i)
+    {
+        list += fixtures->files[i] + "\n";
+    }
+    fixtures->list = fixtures->dir + "/fixtures.lst";
+    return WriteFile(fixtures->list, std::vector<uint8_t>(list.begin(), list.end()));
+}
+
+
+/* Dump          Run peheader over every fixture in order and parse its
+ *               NDJSON
+ * Parameters    Fixtures, options, values to fill
+ */
+static bool Dump(const Fixtures *fixtures, const std::string &options, std::vector<JsonValue> *values)
+{
+    std::string output;
+    int status = Run(fixtures, "-f ndjson --ordered " + options + " @" + Quote(fixtures->list), &output);
+    Expect(status == 0, "peheader %s exited with %d", options.c_str(), status);
+    return ParseLines(output, values, options.c_str());
+}
+
+
+/* Paths    The paths of the NDJSON records of whole files, in order */
+static std::vector<std::string> Paths(const std::vector<JsonValue> &values)
+{
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        const JsonValue *path = values[i].Get("path");
+        if (path != NULL && values[i].Get("pe") != NULL)
+        {
+            paths.push_back(path->text);
+        }
+    }
+    return paths;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+//  Tests
+//////////////////////////////////////////////////////////////////////////////
+
+static const char goldenOptions[] = "-j 4 -i -e -r --clr --debug --unwind --version-info --rich --similarity";
+static const char *expectedPath = NULL;
+static bool updateExpected = false;
+
+
+/* TestGolden    NDJSON of every decoder over the fixtures, byte for byte
+ *               against the stored expectation
+ */
+static void TestGolden(const Fixtures *fixtures)
+{
+    std::string output;
+    int status = Run(fixtures, std::string("-f ndjson --ordered ") + goldenOptions + " @" + Quote(fixtures->list), &output);
+    Expect(status == 0, "exited with %d", status);
+
+    /* Paths are stored relative to the fixture directory */
+    std::string prefix = "\"" + fixtures->dir + "/";
+    for (size_t at = output.find(prefix); at != std::string::npos; at = output.find(prefix, at + 1))
+    {
+        output.erase(at + 1, prefix.size() - 1);
+    }
+
+    if (updateExpected)
+    {
+        Expect(WriteFile(expectedPath, std::vector<uint8_t>(output.begin(), output.end())), "could not write %s",
+               expectedPath);
+        return;
+    }
+
+    std::string expected;
+    if (!Expect(ReadFile(expectedPath, &expected), "could not read %s", expectedPath))
+    {
+        return;
+    }
+
+    std::vector<std::string> got = SplitLines(output);
+    std::vector<std::string> want = SplitLines(expected);
+    for (size_t i = 0; i < got.size() || i < want.size(); ++i)
+    {
+        const char *g = i < got.size() ? got[i].c_str() : "(none)";
+        const char *w = i < want.size() ? want[i].c_str() : "(none)";
+        if (!Expect(strcmp(g, w) == 0, "line %zu differs\n  want %.300s\n  got  %.300s", i + 1, w, g))
+        {
+            break;
+        }
+    }
+}
+
+
+/* TestJsonLines    Every line is JSON whatever is decoded and whichever
+ *                  way the files are read, and no option loses a record
+ */
+static void TestJsonLines(const Fixtures *fixtures)
+{
+    static const char *const runs[] =
+    {
+        "", "-s", "--entropy", "--verify-checksum", "--io pread", "--io map", "-j 1 --unwind --clr -i -e -s -r"
+    };
+    std::vector<JsonValue> values;
+    size_t records = 0;
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); ++i)
+    {
+        Dump(fixtures, runs[i], &values);
+        if (i == 0)
+        {
+            records = values.size();
+        }
+        Expect(values.size() == records && records > fixtures->files.size(), "\"%s\": %zu records, %zu without options",
+               runs[i], values.size(), records);
+    }
+}
+
+
+/* ExportNames, DefinedSymbols, ImportedDlls    What a record says it
+ *                                              exports, defines and imports
+ */
+static void ExportNames(const JsonValue &record, std::vector<std::string> *names)
+{
+    const JsonValue *exports = record.Get("exports");
+    const JsonValue *functions = exports != NULL ? exports->Get("functions") : NULL;
+    for (size_t i = 0; functions != NULL && i < functions->items.size(); ++i)
+    {
+        const JsonValue *name = functions->items[i].Get("name");
+        if (name != NULL && name->type == JSON_STRING)
+        {
+            names->push_back(name->text);
+        }
+    }
+}
+
+static void DefinedSymbols(const JsonValue &record, std::vector<std::string> *names)
+{
+    const JsonValue *symbols = record.Get("symbols");
+    for (size_t i = 0; symbols != NULL && i < symbols->items.size(); ++i)
+    {
+        const JsonValue &symbol = symbols->items[i];
+        const JsonValue *klass = symbol.Get("class");
+        const JsonValue *section = symbol.Get("section");
+        if (klass != NULL && klass->Number() == 2 && section != NULL && section->text != "0" &&
+            section->text[0] != '-')
+        {
+            names->push_back(symbol.Get("name")->text);
+        }
+    }
+}
+
+static void ImportedDlls(const JsonValue &record, std::vector<std::string> *names)
+{
+    const JsonValue *imports = record.Get("imports");
+    for (size_t i = 0; imports != NULL && i < imports->items.size(); ++i)
+    {
+        names->push_back(imports->items[i].Get("dll")->text);
+    }
+}
+
+
+static bool Contains(const std::vector<std::string> &names, const std::string &name)
+{
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        if (names[i] == name)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/* CheckFilter    A --where condition selects exactly the records a
+ *                function of the full dump says it should
+ */
+static void CheckFilter(const Fixtures *fixtures, const std::vector<JsonValue> &all, const std::string &term,
+                        void (*collect)(const JsonValue &, std::vector<std::string> *), const std::string &name)
+{
+    std::vector<std::string> expected;
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        std::vector<std::string> names;
+        collect(all[i], &names);
+        if (Contains(names, name) && all[i].Get("pe") != NULL)
+        {
+            expected.push_back(all[i].Get("path")->text);
+        }
+    }
+
+    std::vector<JsonValue> filtered;
+    Dump(fixtures, "-i -e -s --where " + Quote(term), &filtered);
+    std::vector<std::string> got = Paths(filtered);
+    Expect(!expected.empty(), "%s: no fixture qualifies", term.c_str());
+    Expect(got == expected, "%s: %zu files selected, %zu expected", term.c_str(), got.size(), expected.size());
+}
+
+
+/* TestEscaping    Names and paths that are not UTF-8 still make JSON, with
+ *                 each bad byte written as U+FFFD, fresh and from the cache
+ */
+static void TestEscaping(const Fixtures *fixtures)
+{
+    /* A section name mixing a good two byte character, a bad lead byte,
+     * a control character and a byte that is never UTF-8 */
+    static const char name[8] = { '.', '\xC3', '\xA9', '\xC0', '\x01', 't', '\xFF', 'x' };
+    static const char decoded[] = ".\xC3\xA9\xEF\xBF\xBD\x01t\xEF\xBF\xBDx";
+    std::vector<uint8_t> bytes;
+    BuildHandImage(&bytes);
+    memcpy(bytes.data() + HAND_SECTIONS, name, sizeof(name));
+
+    std::string path = fixtures->dir + "/high-\xFE\xFF.dll";
+    std::string shown = fixtures->dir + "/high-\xEF\xBF\xBD\xEF\xBF\xBD.dll";
+    std::string cache = fixtures->dir + "/escaping.cache";
+    WriteFile(path, bytes);
+    remove(cache.c_str());
+
+    for (int run = 0; run < 3; ++run)
+    {
+        std::string output;
+        std::vector<JsonValue> values;
+        std::string args = run == 0 ? "-f ndjson " : "--cache " + Quote(cache) + " -f ndjson ";
+        Run(fixtures, args + Quote(path), &output);
+        ParseLines(output, &values, run == 0 ? "high bytes" : "high bytes through the cache");
+        const JsonValue *sections = values.empty() ? NULL : values[0].Get("sections");
+        if (!Expect(sections != NULL && !sections->items.empty(), "run %d: no sections", run))
+        {
+            continue;
+        }
+        Expect(values[0].Get("path")->text == shown, "run %d: path read back as %s", run,
+               values[0].Get("path")->text.c_str());
+        Expect(sections->items[0].Get("Name")->text == decoded, "run %d: section name read back as %s", run,
+               sections->items[0].Get("Name")->text.c_str());
+    }
+
+    /* Fixtures with bytes overwritten at random put arbitrary bytes in
+     * every name the decoders find */
+    uint64_t state = TEST_SEED;
+    std::string list;
+    for (uint32_t n = 0; n < 200; ++n)
+    {
+        std::string source = fixtures->files[n % fixtures->files.size()];
+        std::string text;
+        ReadFile(source, &text);
+        bytes.assign(text.begin(), text.end());
+        for (int flips = 0; flips < 64; ++flips)
+        {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            bytes[(state >> 33) % bytes.size()] = (uint8_t)(state >> 17);
+        }
+
+        char mutated[64];
+        snprintf(mutated, sizeof(mutated), "/mutated-%03u.bin", n);
+        WriteFile(fixtures->dir + mutated, bytes);
+        list += fixtures->dir + mutated + "\n";
+    }
+    std::string listPath = fixtures->dir + "/mutated.lst";
+    WriteFile(listPath, std::vector<uint8_t>(list.begin(), list.end()));
+
+    remove(cache.c_str());
+    std::string fresh;
+    std::string cached;
+    std::vector<JsonValue> values;
+    std::string args = std::string("-f ndjson --ordered ") + goldenOptions + " -s @" + Quote(listPath);
+    Run(fixtures, args, &fresh);
+    ParseLines(fresh, &values, "mutated");
+    Expect(values.size() >= 200, "%zu records for 200 mutated files", values.size());
+    Run(fixtures, "--cache " + Quote(cache) + " " + args, &cached);
+    Run(fixtures, "--cache " + Quote(cache) + " " + args, &cached);
+    Expect(cached == fresh, "mutated files served from the cache printed something else");
+}
+
+
+/* TestFilters    imports=, exports=, defines=, machine= and managed
+ *                against the full dump
+ */
+static void TestFilters(const Fixtures *fixtures)
+{
+    std::vector<JsonValue> all;
+    Dump(fixtures, "-i -e -s", &all);
+
+    std::string exported;
+    std::string defined;
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        std::vector<std::string> names;
+        ExportNames(all[i], &names);
+        if (exported.empty() && !names.empty())
+        {
+            exported = names.back();
+        }
+        names.clear();
+        DefinedSymbols(all[i], &names);
+        if (defined.empty() && !names.empty())
+        {
+            defined = names[0];
+        }
+    }
+    Expect(!exported.empty() && !defined.empty(), "the fixtures export or define nothing");
+    CheckFilter(fixtures, all, "exports=" + exported, ExportNames, exported);
+    CheckFilter(fixtures, all, "defines=" + defined, DefinedSymbols, defined);
+    CheckFilter(fixtures, all, "imports=kernel32.dll", ImportedDlls, "KERNEL32.dll");
+
+    std::vector<std::string> managed;
+    std::vector<std::string> x64;
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        const JsonValue &record = all[i];
+        const JsonValue *cfh = record.Get("CoffFileHeader");
+        if (record.Get("managed") != NULL && record.Get("managed")->boolean)
+        {
+            managed.push_back(record.Get("path")->text);
+        }
+        if (cfh != NULL && cfh->Get("Machine")->Number() == 0x8664 &&
+            (record.Get("pe")->boolean || record.Get("coff")->boolean))
+        {
+            x64.push_back(record.Get("path")->text);
+        }
+    }
+
+    std::vector<JsonValue> filtered;
+    Dump(fixtures, "--where managed", &filtered);
+    Expect(!managed.empty() && Paths(filtered) == managed, "managed: %zu selected, %zu expected", Paths(filtered).size(),
+           managed.size());
+    Dump(fixtures, "--where machine=x64", &filtered);
+    Expect(!x64.empty() && Paths(filtered) == x64, "machine=x64: %zu selected, %zu expected", Paths(filtered).size(),
+           x64.size());
+
+    /* One condition past a limit names the limit, not "unknown condition" */
+    std::string args;
+    for (int i = 0; i <= 8; ++i)
+    {
+        args += " --where exports=f" + std::to_string(i);
+    }
+    std::string output;
+    int status = Run(fixtures, args + " " + Quote(fixtures->handmade), &output, true);
+    Expect(status == 1 && output.find("at most 8 exports= conditions") != std::string::npos,
+           "a ninth exports= printed %.100s", output.c_str());
+}
+
+
+/* TestCache    A cached rescan prints what a fresh scan does, and a
+ *              changed file is not served from the cache
+ */
+static void TestCache(const Fixtures *fixtures)
+{
+    std::string cache = fixtures->dir + "/scan.cache";
+    std::string args = "-f ndjson --ordered -i -e @" + Quote(fixtures->list);
+    std::string fresh;
+    std::string first;
+    std::string second;
+
+    remove(cache.c_str());
+    Run(fixtures, args, &fresh);
+    Expect(Run(fixtures, "--cache " + Quote(cache) + " " + args, &first) == 0, "first cached run failed");
+    Expect(Run(fixtures, "--cache " + Quote(cache) + " " + args, &second) == 0, "second cached run failed");
+    Expect(first == fresh, "the run that filled the cache printed something else");
+    Expect(second == fresh, "the run served from the cache printed something else");
+
+    /* Rewrite one fixture as another kind; its record has to change */
+    std::string victim = fixtures->dir + "/cache-victim.exe";
+    std::vector<uint8_t> bytes;
+    SynthesizeFile(SYNTH_PE32, TEST_SEED, &bytes);
+    WriteFile(victim, bytes);
+    Run(fixtures, "--cache " + Quote(cache) + " -f ndjson " + Quote(victim), &first);
+    SynthesizeFile(SYNTH_PE32PLUS, TEST_SEED, &bytes);
+    WriteFile(victim, bytes);
+    Run(fixtures, "-f ndjson " + Quote(victim), &fresh);
+    Run(fixtures, "--cache " + Quote(cache) + " --cache-verify -f ndjson " + Quote(victim), &second);
+    Expect(first != fresh && second == fresh, "a rewritten file was served from the cache");
+}
+
+
+/* TestCarve    Images embedded in a blob are found at their offsets */
+static void TestCarve(const Fixtures *fixtures)
+{
+    std::vector<uint8_t> blob(777, 0x5A);
+    std::vector<uint8_t> image;
+    size_t offsets[2];
+
+    SynthesizeFile(SYNTH_PE32, TEST_SEED + 7, &image);
+    offsets[0] = blob.size();
+    blob.insert(blob.end(), image.begin(), image.end());
+    blob.resize(blob.size() + 0x1234, 0xA5);
+    SynthesizeFile(SYNTH_PE32PLUS, TEST_SEED + 8, &image);
+    offsets[1] = blob.size();
+    blob.insert(blob.end(), image.begin(), image.end());
+
+    std::string path = fixtures->dir + "/carve.bin";
+    WriteFile(path, blob);
+
+    std::string output;
+    std::vector<JsonValue> values;
+    Expect(Run(fixtures, "--carve -f ndjson " + Quote(path), &output) == 0, "carving failed");
+    ParseLines(output, &values, "--carve");
+    std::vector<std::string> paths = Paths(values);
+    for (size_t i = 0; i < 2; ++i)
+    {
+        char expected[64];
+        snprintf(expected, sizeof(expected), "@0x%zx", offsets[i]);
+        Expect(i < paths.size() && paths[i] == path + expected, "image %zu not found at %s", i, expected);
+    }
+    Expect(paths.size() == 2, "%zu images carved, 2 embedded", paths.size());
+}
+
+
+/* TestRebase    The rebased MD5 matches a copy relocated here */
+static void TestRebase(const Fixtures *fixtures)
+{
+    std::vector<uint8_t> bytes;
+    BuildHandImage(&bytes);
+    uint64_t delta = HAND_REBASE_TO - HAND_IMAGE_BASE;
+    for (uint32_t i = 0; i < HAND_POINTERS; ++i)
+    {
+        Put64(&bytes, HAND_RDATA_RAW + i * 8, HAND_IMAGE_BASE + 0x1000 + i * 0x10 + delta);
+    }
+    Put64(&bytes, HAND_OPTIONAL + 24, HAND_REBASE_TO);
+
+    uint8_t digest[16];
+    Md5Context md5;
+    Md5Init(&md5);
+    Md5Update(&md5, bytes.data(), bytes.size());
+    Md5Final(&md5, digest);
+    char expected[33];
+    for (int i = 0; i < 16; ++i)
+    {
+        snprintf(expected + 2 * i, 3, "%02x", digest[i]);
+    }
+
+    char args[64];
+    snprintf(args, sizeof(args), "--rebase 0x%llx -f ndjson ", (unsigned long long)HAND_REBASE_TO);
+    std::string output;
+    std::vector<JsonValue> values;
+    Run(fixtures, args + Quote(fixtures->handmade), &output);
+    ParseLines(output, &values, "--rebase");
+    const JsonValue *rebase = values.empty() ? NULL : values[0].Get("rebase");
+    if (!Expect(rebase != NULL, "no rebase record"))
+    {
+        return;
+    }
+    Expect(rebase->Get("applied")->Number() == HAND_POINTERS, "%llu relocations applied, %d expected",
+           (unsigned long long)rebase->Get("applied")->Number(), HAND_POINTERS);
+    Expect(rebase->Get("md5")->text == expected, "md5 %s, expected %s", rebase->Get("md5")->text.c_str(), expected);
+}
+
+
+/* TestPdbIndex    The hand built image is found by its PDB's key, and an
+ *                 unknown key finds nothing
+ */
+static void TestPdbIndex(const Fixtures *fixtures)
+{
+    std::string index = fixtures->dir + "/pdb.index";
+    std::string output;
+    std::vector<JsonValue> values;
+
+    Run(fixtures, "-f ndjson --debug " + Quote(fixtures->handmade), &output);
+    ParseLines(output, &values, "--debug");
+    const JsonValue *debug = values.empty() ? NULL : values[0].Get("debug");
+    const JsonValue *pdb = debug != NULL ? debug->Get("pdb") : NULL;
+    if (!Expect(pdb != NULL, "no CodeView record decoded"))
+    {
+        return;
+    }
+    Expect(pdb->Get("path")->text == HAND_PDB_PATH, "pdb path %s", pdb->Get("path")->text.c_str());
+    Expect(pdb->Get("guid")->text == "{12345678-9ABC-DEF0-0123-456789ABCDEF}", "guid %s",
+           pdb->Get("guid")->text.c_str());
+    std::string key = pdb->Get("key")->text;
+    Expect(key == "123456789ABCDEF00123456789ABCDEF3", "key %s", key.c_str());
+
+    Expect(Run(fixtures, "--pdb-index " + Quote(index) + " @" + Quote(fixtures->list), &output) == 0,
+           "indexing failed");
+    Expect(Run(fixtures, "--pdb-lookup " + Quote(index) + " " + key, &output) == 0 &&
+           output == fixtures->handmade + "\n", "lookup printed \"%s\"", output.c_str());
+    Expect(Run(fixtures, "--pdb-lookup " + Quote(index) + " 000000000000000000000000000000001", &output) == 1 &&
+           output.empty(), "an unknown key found \"%s\"", output.c_str());
+
+    /* An index bigger than the header window, read from a pipe so it
+     * can't be mapped */
+    std::string list;
+    std::string dots;
+    for (int i = 0; i < 300; ++i, dots += "./")
+    {
+        list += fixtures->dir + "/" + dots + "handmade.dll\n";
+    }
+    std::string listPath = fixtures->dir + "/pdb-many.lst";
+    WriteFile(listPath, std::vector<uint8_t>(list.begin(), list.end()));
+    Run(fixtures, "--pdb-index " + Quote(index) + " @" + Quote(listPath), &output);
+
+    std::string text;
+    ReadFile(index, &text);
+    Fixtures piped = *fixtures;
+    piped.peheader = "cat " + Quote(index) + " | " + fixtures->peheader;
+    Expect(text.size() > 0x10000 && Run(&piped, "--pdb-lookup /dev/stdin " + key, &output) == 0 &&
+           SplitLines(output).size() == 300, "a %zu byte index read from a pipe found %zu files", text.size(),
+           SplitLines(output).size());
+}
+
+
+/* TestSimilarity    Every image is its own nearest neighbour */
+static void TestSimilarity(const Fixtures *fixtures)
+{
+    std::string index = fixtures->dir + "/similar.index";
+    std::string output;
+    std::vector<JsonValue> values;
+
+    Expect(Run(fixtures, "--similar-index " + Quote(index) + " @" + Quote(fixtures->list), &output) == 0,
+           "indexing failed");
+    for (size_t i = 0; i < fixtures->files.size(); ++i)
+    {
+        const std::string &file = fixtures->files[i];
+        if (file.find("archive") != std::string::npos)
+        {
+            continue;
+        }
+        Run(fixtures, "--similar " + Quote(index) + " -f ndjson " + Quote(file), &output);
+        ParseLines(output, &values, "--similar");
+        Expect(!values.empty() && values[0].Get("path")->text == file && values[0].Get("distance")->text == "0",
+               "%s is not its own nearest match", file.c_str());
+    }
+
+    /* An index bigger than the header window, read from a pipe so it
+     * can't be mapped */
+    std::string list;
+    std::string dots;
+    for (int copy = 0; copy < 8; ++copy, dots += "./")
+    {
+        for (size_t i = 0; i < fixtures->files.size(); ++i)
+        {
+            list += fixtures->dir + "/" + dots + fixtures->files[i].substr(fixtures->dir.size() + 1) + "\n";
+        }
+    }
+    std::string listPath = fixtures->dir + "/similar-many.lst";
+    WriteFile(listPath, std::vector<uint8_t>(list.begin(), list.end()));
+    Run(fixtures, "--similar-index " + Quote(index) + " @" + Quote(listPath), &output);
+
+    std::string text;
+    ReadFile(index, &text);
+    Fixtures piped = *fixtures;
+    piped.peheader = "cat " + Quote(index) + " | " + fixtures->peheader;
+    Run(&piped, "--similar /dev/stdin -f ndjson " + Quote(fixtures->handmade), &output);
+    ParseLines(output, &values, "--similar from a pipe");
+    Expect(text.size() > 0x10000 && values.size() == 8, "a %zu byte index read from a pipe found %zu matches",
+           text.size(), values.size());
+}
+
+
+/* TestFunctionAt    Addresses map to the functions of the exception
+ *                   table, and the gaps to none
+ */
+static void TestFunctionAt(const Fixtures *fixtures)
+{
+    for (size_t i = 0; i < sizeof(handFunctions) / sizeof(handFunctions[0]); ++i)
+    {
+        uint32_t probes[2] = { handFunctions[i][0], handFunctions[i][1] - 1 };
+        for (int p = 0; p < 2; ++p)
+        {
+            char args[64];
+            snprintf(args, sizeof(args), "--function-at 0x%x -f ndjson ", probes[p]);
+            std::string output;
+            std::vector<JsonValue> values;
+            int status = Run(fixtures, args + Quote(fixtures->handmade), &output);
+            ParseLines(output, &values, "--function-at");
+            const JsonValue *function = values.empty() ? NULL : values[0].Get("function");
+            Expect(status == 0 && function != NULL && function->type == JSON_OBJECT &&
+                   function->Get("begin")->Number() == handFunctions[i][0] &&
+                   function->Get("end")->Number() == handFunctions[i][1], "0x%x is not in function %zu", probes[p], i);
+        }
+    }
+
+    std::string output;
+    int status = Run(fixtures, "--function-at 0x1040 " + Quote(fixtures->handmade), &output);
+    Expect(status == 1 && output.find("in no function") != std::string::npos, "0x1040 found in a function");
+}
+
+
+/* TestTruncatedArchive    An archive cut inside a member is reported as
+ *                         truncated, not as members that failed
+ */
+static void TestTruncatedArchive(const Fixtures *fixtures)
+{
+    std::string text;
+    ReadFile(fixtures->dir + "/archive-0.lib", &text);
+    std::vector<uint8_t> bytes(text.begin(), text.end() - 50);
+    std::string path = fixtures->dir + "/truncated.lib";
+    WriteFile(path, bytes);
+
+    static const char *const runs[] = { "", "-j 1", "-f ndjson --ordered" };
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); ++i)
+    {
+        std::string output;
+        int status = Run(fixtures, std::string(runs[i]) + " " + Quote(path), &output, true);
+        Expect(status == 0, "\"%s\": exit %d", runs[i], status);
+        Expect(output.find("archive truncated after ") != std::string::npos, "\"%s\": truncation not reported", runs[i]);
+        Expect(output.find("could not be read") == std::string::npos, "\"%s\": truncation counted as a failed member",
+               runs[i]);
+    }
+}
+
+
+/* TestBadArguments    Option values that aren't numbers, or numbers out
+ *                     of range, are usage errors and decode nothing
+ */
+static void TestBadArguments(const Fixtures *fixtures)
+{
+    static const char *const arguments[] =
+    {
+        "--rebase junk", "--rebase 0", "--rebase -0x10000", "--rebase 0x12345", "--rebase 0x1000000000000000000",
+        "--entropy --entropy-sample 4k", "--entropy --entropy-sample 0", "--entropy --entropy-sample -1",
+        "--max-distance x --similar /dev/null", "--max-distance 100000 --similar /dev/null",
+        "-j abc", "-j 0", "-j -1", "-j 100000",
+    };
+    for (size_t i = 0; i < sizeof(arguments) / sizeof(arguments[0]); ++i)
+    {
+        std::string output;
+        int status = Run(fixtures, std::string(arguments[i]) + " " + Quote(fixtures->handmade), &output, true);
+        Expect(status == 1 && output.compare(0, 7, "Error: ") == 0, "%s: exit %d, printed %.100s", arguments[i], status,
+               output.c_str());
+    }
+}
+
+
+typedef struct
+{
+    const char *name;
+    void (*run)(const Fixtures *fixtures);
+} Test;
+
+static const Test tests[] =
+{
+    { "golden", TestGolden },
+    { "json-lines", TestJsonLines },
+    { "escaping", TestEscaping },
+    { "filters", TestFilters },
+    { "cache", TestCache },
+    { "carve", TestCarve },
+    { "rebase", TestRebase },
+    { "pdb-index", TestPdbIndex },
+    { "similarity", TestSimilarity },
+    { "function-at", TestFunctionAt },
+    { "truncated-archive", TestTruncatedArchive },
+    { "bad-arguments", TestBadArguments },
+};
+
+
+static void Usage()
+{
+    printf("Usage: petest <peheader> <expected.ndjson> [options]\n"
+           "    [--dir <dir>] where to write the fixtures (default: " TEST_DEFAULT_DIR ")\n"
+           "    [--update] rewrite the expected NDJSON from this build instead of comparing\n"
+           "    [--only <test>] run one test\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    Fixtures fixtures;
+    const char *only = NULL;
+    fixtures.dir = TEST_DEFAULT_DIR;
+
+    if (argc < 3)
+    {
+        Usage();
+        return 1;
+    }
+    fixtures.peheader = Quote(argv[1]);
+    expectedPath = argv[2];
+
+    for (int i = 3; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--dir") == 0 && i + 1 < argc)
+        {
+            fixtures.dir = argv[++i];
+        }
+        else if (strcmp(arg, "--update") == 0)
+        {
+            updateExpected = true;
+        }
+        else if (strcmp(arg, "--only") == 0 && i + 1 < argc)
+        {
+            only = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "Error: unknown option \"%s\"\n", arg);
+            Usage();
+            return 1;
+        }
+    }
+
+    if (!WriteFixtures(&fixtures))
+    {
+        fprintf(stderr, "Error: could not write the fixtures under \"%s\"\n", fixtures.dir.c_str());
+        return 1;
+    }
+
+    unsigned run = 0;
+    for (size_t t = 0; t < sizeof(tests) / sizeof(tests[0]); ++t)
+    {
+        if (only != NULL && strcmp(only, tests[t].name) != 0)
+        {
+            continue;
+        }
+        currentTest = tests[t].name;
+        testFailures = 0;
+        tests[t].run(&fixtures);
+        printf("%-18s %s\n", tests[t].name, testFailures == 0 ? "ok" : "FAILED");
+        failures += testFailures > 0;
+        ++run;
+    }
+
+    printf("%u of %u tests passed\n", run - failures, run);
+    return failures == 0 && run > 0 ? 0 : 1;
+}
@@ -0,0 +1,378 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Module:     libpeheader - Parses PE/COFF and archive files
+//  File:       peunwind.cpp
+//  Author:     Mark Coppa
+//
+//  Exception table (.pdata) and unwind decoder for x64 and ARM64 images.
+//  The table holds one RUNTIME_FUNCTION per non-leaf function: its range
+//  and where its unwind data is. Decoded into sorted arrays of begins and
+//  ends, it maps any code address to its function with a binary search,
+//  which is what symbolizing and unwinding sampled addresses needs.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "peheader.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <numeric>
+
+#define MACHINE_AMD64   0x8664
+#define MACHINE_ARM64   0xAA64
+
+
+/* UnwindSlots    Slots an x64 unwind code takes, its own included
+ */
+static uint32_t UnwindSlots(uint8_t op, uint8_t info)
+{
+    switch (op)
+    {
+    case UWOP_ALLOC_LARGE:
+        return info == 0 ? 2 : 3;
+    case UWOP_SAVE_NONVOL:
+    case UWOP_EPILOG:
+    case UWOP_SAVE_XMM128:
+        return 2;
+    case UWOP_SAVE_NONVOL_FAR:
+    case UWOP_SPARE:
+    case UWOP_SAVE_XMM128_FAR:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+
+/* DecodeUnwindX64    Decode an UNWIND_INFO and its codes
+ * Parameters         Image, buffer, RVA of the UNWIND_INFO, table to add
+ *                    the codes to, info to fill
+ * Returns            false if the UNWIND_INFO isn't in the buffer
+ */
+static bool DecodeUnwindX64(const PeImage *image, PeBuffer buffer, uint32_t rva, FunctionTable *table, UnwindInfo *info)
+{
+    const uint8_t *header = RvaToPointer(image, buffer, rva, 4);
+    if (header == NULL)
+    {
+        return false;
+    }
+
+    info->version = header[0] & 0x7;
+    info->flags = header[0] >> 3;
+    info->prologSize = header[1];
+    info->frameRegister = header[3] & 0xF;
+    info->frameOffset = (header[3] >> 4) * 16;
+
+    /* The codes are padded to an even count before what follows them */
+    uint32_t slots = header[2];
+    uint32_t padded = (slots + 1) & ~1u;
+    uint32_t trailer = (info->flags & UNW_FLAG_CHAININFO) ? RUNTIME_FUNCTION_SIZE_X64 :
+                       (info->flags & (UNW_FLAG_EHANDLER | UNW_FLAG_UHANDLER)) ? 4 : 0;
+    const uint8_t *codes = RvaToPointer(image, buffer, rva + 4, padded * 2 + trailer);
+    if (codes == NULL)
+    {
+        codes = RvaToPointer(image, buffer, rva + 4, slots * 2);
+        trailer = 0;
+        if (codes == NULL)
+        {
+            return false;
+        }
+    }
+
+    info->firstCode = (uint32_t)table->codes.size();
+    for (uint32_t i = 0; i < slots; )
+    {
+        UnwindCode code;
+        code.codeOffset = codes[i * 2];
+        code.op = codes[i * 2 + 1] & 0xF;
+        code.info = codes[i * 2 + 1] >> 4;
+        code.value = 0;
+
+        uint32_t used = UnwindSlots(code.op, code.info);
+        if (i + used > slots)
+        {
+            break;
+        }
+
+        const uint8_t *operand = codes + (i + 1) * 2;
+        switch (code.op)
+        {
+        case UWOP_PUSH_NONVOL:
+            info->stackSize += 8;
+            break;
+        case UWOP_ALLOC_LARGE:
+            code.value = code.info == 0 ? ReadWord(operand) * 8u : ReadDword(operand);
+            info->stackSize += code.value;
+            break;
+        case UWOP_ALLOC_SMALL:
+            code.value = code.info * 8u + 8;
+            info->stackSize += code.value;
+            break;
+        case UWOP_SAVE_NONVOL:
+            code.value = ReadWord(operand) * 8u;
+            break;
+        case UWOP_SAVE_NONVOL_FAR:
+        case UWOP_SAVE_XMM128_FAR:
+            code.value = ReadDword(operand);
+            break;
+        case UWOP_SAVE_XMM128:
+            code.value = ReadWord(operand) * 16u;
+            break;
+        case UWOP_PUSH_MACHFRAME:
+            info->stackSize += code.info ? 48 : 40;
+            break;
+        }
+
+        table->codes.push_back(code);
+        ++info->codeCount;
+        i += used;
+    }
+
+    if (trailer == RUNTIME_FUNCTION_SIZE_X64)
+    {
+        info->chained = ReadDword(codes + padded * 2);
+    }
+    else if (trailer == 4)
+    {
+        info->handler = ReadDword(codes + padded * 2);
+    }
+    return true;
+}
+
+
+/* Arm64FunctionEnd    Work out where an ARM64 function ends, decoding its
+ *                     unwind summary on the way when asked to
+ * Parameters          Image, buffer, begin RVA, UnwindData as stored, info
+ *                     to fill (NULL to skip)
+ * Returns             End RVA, or begin if the length can't be read
+ */
+static uint32_t Arm64FunctionEnd(const PeImage *image, PeBuffer buffer, uint32_t begin, uint32_t unwindData, UnwindInfo *info)
+{
+    uint32_t flag = unwindData & 3;
+    if (flag == ARM64_UNWIND_PACKED || flag == ARM64_UNWIND_PACKED_FRAGMENT)
+    {
+        if (info != NULL)
+        {
+            info->flags = (uint8_t)flag;
+            info->frameRegister = (unwindData >> 21) & 3;
+            info->stackSize = ((unwindData >> 23) & 0x1FF) * 16;
+        }
+        return begin + ((unwindData >> 2) & 0x7FF) * 4;
+    }
+    if (flag != ARM64_UNWIND_XDATA)
+    {
+        return begin;
+    }
+
+    const uint8_t *xdata = RvaToPointer(image, buffer, unwindData, 4);
+    if (xdata == NULL)
+    {
+        return begin;
+    }
+
+    uint32_t header = ReadDword(xdata);
+    if (info != NULL)
+    {
+        bool exception = (header >> 20) & 1;
+        bool singleEpilog = (header >> 21) & 1;
+        uint32_t epilogs = (header >> 22) & 0x1F;
+        uint32_t words = (header >> 27) & 0x1F;
+        uint32_t size = 4;
+
+        /* Both counts zero means they didn't fit and a second word has them */
+        if (epilogs == 0 && words == 0)
+        {
+            const uint8_t *extended = RvaToPointer(image, buffer, unwindData, 8);
+            if (extended != NULL)
+            {
+                epilogs = ReadWord(extended + 4);
+                words = extended[6];
+                size = 8;
+            }
+        }
+
+        info->version = (header >> 18) & 3;
+        info->flags = (uint8_t)(exception | singleEpilog << 1);
+        info->epilogCount = epilogs;
+        info->codeCount = words;
+
+        /* The handler follows the epilog scopes and the unwind codes */
+        if (exception)
+        {
+            size += (singleEpilog ? 0 : epilogs * 4) + words * 4;
+            const uint8_t *handler = RvaToPointer(image, buffer, unwindData + size, 4);
+            if (handler != NULL)
+            {
+                info->handler = ReadDword(handler);
+            }
+        }
+    }
+    return begin + (header & 0x3FFFF) * 4;
+}
+
+
+/* DecodeFunctions    Decode the exception table into image->functions
+ * Parameters         The buffer the image was parsed from, the image, and
+ *                    whether to decode each function's unwind data too
+ * Returns            false if the image isn't x64 or ARM64 or has no
+ *                    readable exception table
+ */
+bool DecodeFunctions(PeBuffer buffer, PeImage *image, bool unwind)
+{
+    bool arm64 = image->cfh.Machine == MACHINE_ARM64;
+    if (image->cfh.Machine != MACHINE_AMD64 && !arm64)
+    {
+        return false;
+    }
+
+    FunctionTable *table = &image->functions;
+    uint32_t rva = image->odd.ExceptionTable.VirtualAddress;
+    uint32_t size = image->odd.ExceptionTable.Size;
+    uint32_t offset;
+    uint32_t available;
+
+    if (rva == 0 || size == 0 || !RvaToOffset(image, rva, &offset, &available) || offset >= buffer.size)
+    {
+        return false;
+    }
+    if (available > buffer.size - offset)
+    {
+        available = (uint32_t)(buffer.size - offset);
+    }
+    if (size > available)
+    {
+        size = available;
+        table->truncated = true;
+    }
+
+    uint32_t entrySize = arm64 ? RUNTIME_FUNCTION_SIZE_ARM64 : RUNTIME_FUNCTION_SIZE_X64;
+    uint32_t count = size / entrySize;
+    if (count > MAX_RUNTIME_FUNCTIONS)
+    {
+        count = MAX_RUNTIME_FUNCTIONS;
+        table->truncated = true;
+    }
+
+    table->begins.resize(count);
+    table->ends.resize(count);
+    table->unwindData.resize(count);
+    if (unwind)
+    {
+        table->unwind.assign(count, UnwindInfo());
+    }
+
+    const uint8_t *p = buffer.data + offset;
+    for (uint32_t i = 0; i < count; ++i, p += entrySize)
+    {
+        uint32_t begin = ReadDword(p);
+        UnwindInfo *info = unwind ? &table->unwind[i] : NULL;
+
+        table->begins[i] = begin;
+        if (arm64)
+        {
+            table->unwindData[i] = ReadDword(p + 4);
+            table->ends[i] = Arm64FunctionEnd(image, buffer, begin, table->unwindData[i], info);
+            continue;
+        }
+
+        table->ends[i] = ReadDword(p + 4);
+        table->unwindData[i] = ReadDword(p + 8);
+        if (info == NULL)
+        {
+            continue;
+        }
+
+        /* Some linkers point an entry at another entry rather than at
+         * unwind data, with the low bit set */
+        if (table->unwindData[i] & 1)
+        {
+            const uint8_t *target = RvaToPointer(image, buffer, table->unwindData[i] & ~1u, 4);
+            info->chained = target != NULL ? ReadDword(target) : 0;
+        }
+        else
+        {
+            DecodeUnwindX64(image, buffer, table->unwindData[i], table, info);
+        }
+    }
+
+    /* The loader binary searches the table as stored, so linkers sort it;
+     * put a table that isn't back in order rather than trust it */
+    bool sorted = true;
+    for (uint32_t i = 1; i < count && sorted; ++i)
+    {
+        sorted = table->begins[i - 1] <= table->begins[i];
+    }
+
+    if (!sorted)
+    {
+        std::vector<uint32_t> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+                         [table](uint32_t a, uint32_t b) { return table->begins[a] < table->begins[b]; });
+
+        FunctionTable old;
+        old.begins.swap(table->begins);
+        old.ends.swap(table->ends);
+        old.unwindData.swap(table->unwindData);
+        old.unwind.swap(table->unwind);
+
+        table->begins.resize(count);
+        table->ends.resize(count);
+        table->unwindData.resize(count);
+        table->unwind.resize(old.unwind.size());
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            table->begins[i] = old.begins[order[i]];
+            table->ends[i] = old.ends[order[i]];
+            table->unwindData[i] = old.unwindData[order[i]];
+            if (unwind)
+            {
+                table->unwind[i] = old.unwind[order[i]];
+            }
+        }
+        table->resorted = true;
+    }
+
+    return true;
+}
+
+
+/* FindFunction    Find the function containing an address
+ * Parameters      Decoded table, RVA
+ * Returns         Index of the function, NO_FUNCTION if the address is in
+ *                 none (leaf functions have no entry)
+ */
+uint32_t FindFunction(const FunctionTable *functions, uint32_t rva)
+{
+    std::vector<uint32_t>::const_iterator after =
+        std::upper_bound(functions->begins.begin(), functions->begins.end(), rva);
+    if (after == functions->begins.begin())
+    {
+        return NO_FUNCTION;
+    }
+
+    uint32_t index = (uint32_t)(after - functions->begins.begin()) - 1;
+    return rva < functions->ends[index] ? index : NO_FUNCTION;
+}
+
+
+/* UnwindOpName    Name of an x64 UWOP_*, NULL if unknown
+ * Parameters      Operation, UNWIND_INFO version (6 and 7 changed meaning
+ *                 in version 2)
+ */
+const char *UnwindOpName(uint8_t op, uint8_t version)
+{
+    static const char *names[] = { "PUSH_NONVOL", "ALLOC_LARGE", "ALLOC_SMALL", "SET_FPREG", "SAVE_NONVOL",
+                                   "SAVE_NONVOL_FAR", "EPILOG", "SPARE", "SAVE_XMM128", "SAVE_XMM128_FAR",
+                                   "PUSH_MACHFRAME" };
+    if (version < 2 && op == UWOP_EPILOG)
+    {
+        return "SAVE_XMM";
+    }
+    if (version < 2 && op == UWOP_SPARE)
+    {
+        return "SAVE_XMM_FAR";
+    }
+    return op < sizeof(names) / sizeof(names[0]) ? names[op] : NULL;
+}
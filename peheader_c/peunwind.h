@@ -0,0 +1,88 @@
+#ifndef _PEUNWIND
+#define _PEUNWIND
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "pefile.h"
+
+#define RUNTIME_FUNCTION_SIZE_X64    12      /* BeginAddress, EndAddress, UnwindData */
+#define RUNTIME_FUNCTION_SIZE_ARM64  8       /* BeginAddress, UnwindData */
+#define MAX_RUNTIME_FUNCTIONS        0x1000000   /* Stop decoding the exception table after this many */
+#define NO_FUNCTION                  0xFFFFFFFF
+
+/* UNWIND_INFO flags (x64) */
+#define UNW_FLAG_EHANDLER            0x1
+#define UNW_FLAG_UHANDLER            0x2
+#define UNW_FLAG_CHAININFO           0x4
+
+/* UNWIND_CODE operations (x64) */
+#define UWOP_PUSH_NONVOL             0
+#define UWOP_ALLOC_LARGE             1
+#define UWOP_ALLOC_SMALL             2
+#define UWOP_SET_FPREG               3
+#define UWOP_SAVE_NONVOL             4
+#define UWOP_SAVE_NONVOL_FAR         5
+#define UWOP_EPILOG                  6       /* version 2; SAVE_XMM in version 1 */
+#define UWOP_SPARE                   7       /* SAVE_XMM_FAR in version 1 */
+#define UWOP_SAVE_XMM128             8
+#define UWOP_SAVE_XMM128_FAR         9
+#define UWOP_PUSH_MACHFRAME          10
+
+/* ARM64 .pdata: the low two bits of UnwindData */
+#define ARM64_UNWIND_XDATA           0       /* UnwindData is the RVA of an .xdata record */
+#define ARM64_UNWIND_PACKED          1       /* the unwind is packed into UnwindData */
+#define ARM64_UNWIND_PACKED_FRAGMENT 2
+
+typedef struct
+{
+    uint8_t codeOffset;         // prolog offset of the end of the instruction
+    uint8_t op;                 // UWOP_*
+    uint8_t info;               // OpInfo: a register, or the size of ALLOC_SMALL
+    uint32_t value;             // ALLOC_*: bytes; SAVE_*: stack offset; else 0
+} UnwindCode;
+
+/* What the unwinder needs of one function. For x64 this is the decoded
+ * UNWIND_INFO; for ARM64 it is the packed fields or the .xdata header.
+ */
+typedef struct
+{
+    uint8_t version;
+    uint8_t flags;              // x64: UNW_FLAG_*; ARM64: the packed Flag, or X | E << 1 of .xdata
+    uint8_t prologSize;         // x64 bytes
+    uint8_t frameRegister;      // x64: 0 for none; ARM64 packed: CR
+    uint32_t frameOffset;       // x64: scaled by 16
+    uint32_t stackSize;         // bytes the prolog allocates, pushes included
+    uint32_t firstCode;         // index into FunctionTable.codes (x64)
+    uint32_t codeCount;         // x64: decoded codes; ARM64 .xdata: unwind code words
+    uint32_t epilogCount;       // ARM64 .xdata
+    uint32_t handler;           // RVA of the exception handler, 0 if none
+    uint32_t chained;           // begin RVA of the function whose unwind continues this one, 0 if none
+} UnwindInfo;
+
+/* The decoded exception table, struct of arrays sorted by begin address:
+ * entry i of each array describes function i. Ranges are RVAs, end
+ * exclusive. unwind (and, for x64, codes) are filled only with
+ * PARSE_UNWIND.
+ */
+typedef struct
+{
+    std::vector<uint32_t> begins;
+    std::vector<uint32_t> ends;
+    std::vector<uint32_t> unwindData;   // UNWIND_INFO RVA (x64), or ARM64 UnwindData as stored
+    bool truncated;             // the table ran past the directory or the file data
+    bool resorted;              // the table was not stored in order
+
+    std::vector<UnwindInfo> unwind;
+    std::vector<UnwindCode> codes;
+} FunctionTable;
+
+struct PeImage;
+
+bool DecodeFunctions(PeBuffer buffer, PeImage *image, bool unwind);
+uint32_t FindFunction(const FunctionTable *functions, uint32_t rva);
+const char *UnwindOpName(uint8_t op, uint8_t version);
+
+#endif // _PEUNWIND